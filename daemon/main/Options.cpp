@@ -157,8 +157,11 @@ static const char* OPTION_PARCHECK				= "ParCheck";
 static const char* OPTION_PARREPAIR				= "ParRepair";
 static const char* OPTION_PARSCAN				= "ParScan";
 static const char* OPTION_PARQUICK				= "ParQuick";
+static const char* OPTION_PARPRECHECK			= "ParPreCheck";
 static const char* OPTION_PARRENAME				= "ParRename";
 static const char* OPTION_PARBUFFER				= "ParBuffer";
+static const char* OPTION_PARTILESIZE			= "ParTileSize";
+static const char* OPTION_PARMMAPLIMIT			= "ParMmapLimit";
 static const char* OPTION_PARTHREADS			= "ParThreads";
 static const char* OPTION_HEALTHCHECK			= "HealthCheck";
 static const char* OPTION_SCANSCRIPT			= "ScanScript";
@@ -178,16 +181,22 @@ static const char* OPTION_DISKSPACE				= "DiskSpace";
 static const char* OPTION_DUMPCORE				= "DumpCore";
 static const char* OPTION_PARPAUSEQUEUE			= "ParPauseQueue";
 static const char* OPTION_SCRIPTPAUSEQUEUE		= "ScriptPauseQueue";
+static const char* OPTION_POSTCPUSLOTS			= "PostCpuSlots";
+static const char* OPTION_POSTDISKSLOTS			= "PostDiskSlots";
+static const char* OPTION_MOVETHREADS			= "MoveThreads";
 static const char* OPTION_NZBCLEANUPDISK		= "NzbCleanupDisk";
 static const char* OPTION_DELETECLEANUPDISK		= "DeleteCleanupDisk";
 static const char* OPTION_PARTIMELIMIT			= "ParTimeLimit";
 static const char* OPTION_KEEPHISTORY			= "KeepHistory";
 static const char* OPTION_ACCURATERATE			= "AccurateRate";
 static const char* OPTION_UNPACK				= "Unpack";
+static const char* OPTION_DIRECTUNPACK			= "DirectUnpack";
+static const char* OPTION_UNPACKSTORED			= "UnpackStored";
 static const char* OPTION_UNPACKCLEANUPDISK		= "UnpackCleanupDisk";
 static const char* OPTION_UNRARCMD				= "UnrarCmd";
 static const char* OPTION_SEVENZIPCMD			= "SevenZipCmd";
 static const char* OPTION_UNPACKPASSFILE		= "UnpackPassFile";
+static const char* OPTION_UNPACKPASSTHREADS	= "UnpackPassThreads";
 static const char* OPTION_UNPACKPAUSEQUEUE		= "UnpackPauseQueue";
 static const char* OPTION_SCRIPTORDER			= "ScriptOrder";
 static const char* OPTION_POSTSCRIPT			= "PostScript";
@@ -199,6 +208,7 @@ static const char* OPTION_TIMECORRECTION		= "TimeCorrection";
 static const char* OPTION_PROPAGATIONDELAY		= "PropagationDelay";
 static const char* OPTION_ARTICLECACHE			= "ArticleCache";
 static const char* OPTION_EVENTINTERVAL			= "EventInterval";
+static const char* OPTION_COMPLETETHREADS		= "CompleteThreads";
 
 // obsolete options
 static const char* OPTION_POSTLOGKIND			= "PostLogKind";
@@ -231,6 +241,7 @@ static const char* QUEUE_SCRIPT_SIGNATURE = "QUEUE";
 static const char* SCHEDULER_SCRIPT_SIGNATURE = "SCHEDULER";
 static const char* END_SCRIPT_SIGNATURE = " SCRIPT";
 static const char* QUEUE_EVENTS_SIGNATURE = "### QUEUE EVENTS:";
+static const char* QUEUE_MODE_SIGNATURE = "### QUEUE MODE:";
 
 #ifndef WIN32
 const char* PossibleConfigLocations[] =
@@ -431,6 +442,7 @@ Options::Script::Script(const char* szName, const char* szLocation)
 	m_bQueueScript = false;
 	m_bSchedulerScript = false;
 	m_szQueueEvents = NULL;
+	m_bQueuePersistent = false;
 }
 
 Options::Script::~Script()
@@ -569,8 +581,11 @@ Options::Options()
 	m_bParRepair			= false;
 	m_eParScan				= psLimited;
 	m_bParQuick				= true;
+	m_bParPreCheck			= false;
 	m_bParRename			= false;
 	m_iParBuffer			= 0;
+	m_iParTileSize			= 0;
+	m_iParMmapLimit			= 0;
 	m_iParThreads			= 0;
 	m_eHealthCheck			= hcNone;
 	m_szScriptOrder			= NULL;
@@ -597,6 +612,9 @@ Options::Options()
 	m_bDumpCore				= false;
 	m_bParPauseQueue		= false;
 	m_bScriptPauseQueue		= false;
+	m_iPostCpuSlots			= 0;
+	m_iPostDiskSlots		= 0;
+	m_iMoveThreads			= 0;
 	m_bNzbCleanupDisk		= false;
 	m_bDeleteCleanupDisk	= false;
 	m_iParTimeLimit			= 0;
@@ -605,10 +623,13 @@ Options::Options()
 	m_EMatchMode			= mmID;
 	m_tResumeTime			= 0;
 	m_bUnpack				= false;
+	m_bDirectUnpack			= false;
+	m_bUnpackStored			= false;
 	m_bUnpackCleanupDisk	= false;
 	m_szUnrarCmd			= NULL;
 	m_szSevenZipCmd			= NULL;
 	m_szUnpackPassFile		= NULL;
+	m_iUnpackPassThreads	= 0;
 	m_bUnpackPauseQueue		= false;
 	m_szExtCleanupDisk		= NULL;
 	m_szParIgnoreExt		= NULL;
@@ -619,6 +640,7 @@ Options::Options()
 	m_iPropagationDelay		= 0;
 	m_iArticleCache			= 0;
 	m_iEventInterval		= 0;
+	m_iCompleteThreads		= 0;
 }
 
 Options::~Options()
@@ -865,8 +887,11 @@ void Options::InitDefault()
 	SetOption(OPTION_PARREPAIR, "yes");
 	SetOption(OPTION_PARSCAN, "limited");
 	SetOption(OPTION_PARQUICK, "yes");
+	SetOption(OPTION_PARPRECHECK, "no");
 	SetOption(OPTION_PARRENAME, "yes");
 	SetOption(OPTION_PARBUFFER, "16");
+	SetOption(OPTION_PARTILESIZE, "64");
+	SetOption(OPTION_PARMMAPLIMIT, "0");
 	SetOption(OPTION_PARTHREADS, "1");
 	SetOption(OPTION_HEALTHCHECK, "none");
 	SetOption(OPTION_SCRIPTORDER, "");
@@ -889,12 +914,17 @@ void Options::InitDefault()
 	SetOption(OPTION_DUMPCORE, "no");
 	SetOption(OPTION_PARPAUSEQUEUE, "no");
 	SetOption(OPTION_SCRIPTPAUSEQUEUE, "no");
+	SetOption(OPTION_POSTCPUSLOTS, "1");
+	SetOption(OPTION_POSTDISKSLOTS, "1");
+	SetOption(OPTION_MOVETHREADS, "2");
 	SetOption(OPTION_NZBCLEANUPDISK, "no");
 	SetOption(OPTION_DELETECLEANUPDISK, "no");
 	SetOption(OPTION_PARTIMELIMIT, "0");
 	SetOption(OPTION_KEEPHISTORY, "7");
 	SetOption(OPTION_ACCURATERATE, "no");
 	SetOption(OPTION_UNPACK, "no");
+	SetOption(OPTION_DIRECTUNPACK, "no");
+	SetOption(OPTION_UNPACKSTORED, "yes");
 	SetOption(OPTION_UNPACKCLEANUPDISK, "no");
 #ifdef WIN32
 	SetOption(OPTION_UNRARCMD, "unrar.exe");
@@ -904,6 +934,7 @@ void Options::InitDefault()
 	SetOption(OPTION_SEVENZIPCMD, "7z");
 #endif
 	SetOption(OPTION_UNPACKPASSFILE, "");
+	SetOption(OPTION_UNPACKPASSTHREADS, "4");
 	SetOption(OPTION_UNPACKPAUSEQUEUE, "no");
 	SetOption(OPTION_EXTCLEANUPDISK, "");
 	SetOption(OPTION_PARIGNOREEXT, "");
@@ -913,6 +944,7 @@ void Options::InitDefault()
 	SetOption(OPTION_PROPAGATIONDELAY, "0");
 	SetOption(OPTION_ARTICLECACHE, "0");
 	SetOption(OPTION_EVENTINTERVAL, "0");
+	SetOption(OPTION_COMPLETETHREADS, "2");
 }
 
 void Options::InitOptFile()
@@ -1120,7 +1152,11 @@ void Options::InitOptions()
 	m_iPropagationDelay		= ParseIntValue(OPTION_PROPAGATIONDELAY, 10) * 60;
 	m_iArticleCache			= ParseIntValue(OPTION_ARTICLECACHE, 10);
 	m_iEventInterval		= ParseIntValue(OPTION_EVENTINTERVAL, 10);
+	m_iCompleteThreads		= ParseIntValue(OPTION_COMPLETETHREADS, 10);
+	m_iUnpackPassThreads	= ParseIntValue(OPTION_UNPACKPASSTHREADS, 10);
 	m_iParBuffer			= ParseIntValue(OPTION_PARBUFFER, 10);
+	m_iParTileSize			= ParseIntValue(OPTION_PARTILESIZE, 10);
+	m_iParMmapLimit			= ParseIntValue(OPTION_PARMMAPLIMIT, 10);
 	m_iParThreads			= ParseIntValue(OPTION_PARTHREADS, 10);
 
 	CheckDir(&m_szNzbDir, OPTION_NZBDIR, szMainDir, m_iNzbDirInterval == 0, true);
@@ -1133,6 +1169,7 @@ void Options::InitOptions()
 	m_bDupeCheck			= (bool)ParseEnumValue(OPTION_DUPECHECK, BoolCount, BoolNames, BoolValues);
 	m_bParRepair			= (bool)ParseEnumValue(OPTION_PARREPAIR, BoolCount, BoolNames, BoolValues);
 	m_bParQuick				= (bool)ParseEnumValue(OPTION_PARQUICK, BoolCount, BoolNames, BoolValues);
+	m_bParPreCheck			= (bool)ParseEnumValue(OPTION_PARPRECHECK, BoolCount, BoolNames, BoolValues);
 	m_bParRename			= (bool)ParseEnumValue(OPTION_PARRENAME, BoolCount, BoolNames, BoolValues);
 	m_bReloadQueue			= (bool)ParseEnumValue(OPTION_RELOADQUEUE, BoolCount, BoolNames, BoolValues);
 	m_bCursesNZBName		= (bool)ParseEnumValue(OPTION_CURSESNZBNAME, BoolCount, BoolNames, BoolValues);
@@ -1145,11 +1182,16 @@ void Options::InitOptions()
 	m_bDumpCore				= (bool)ParseEnumValue(OPTION_DUMPCORE, BoolCount, BoolNames, BoolValues);
 	m_bParPauseQueue		= (bool)ParseEnumValue(OPTION_PARPAUSEQUEUE, BoolCount, BoolNames, BoolValues);
 	m_bScriptPauseQueue		= (bool)ParseEnumValue(OPTION_SCRIPTPAUSEQUEUE, BoolCount, BoolNames, BoolValues);
+	m_iPostCpuSlots			= ParseIntValue(OPTION_POSTCPUSLOTS, 10);
+	m_iPostDiskSlots		= ParseIntValue(OPTION_POSTDISKSLOTS, 10);
+	m_iMoveThreads			= ParseIntValue(OPTION_MOVETHREADS, 10);
 	m_bNzbCleanupDisk		= (bool)ParseEnumValue(OPTION_NZBCLEANUPDISK, BoolCount, BoolNames, BoolValues);
 	m_bDeleteCleanupDisk	= (bool)ParseEnumValue(OPTION_DELETECLEANUPDISK, BoolCount, BoolNames, BoolValues);
 	m_bAccurateRate			= (bool)ParseEnumValue(OPTION_ACCURATERATE, BoolCount, BoolNames, BoolValues);
 	m_bSecureControl		= (bool)ParseEnumValue(OPTION_SECURECONTROL, BoolCount, BoolNames, BoolValues);
 	m_bUnpack				= (bool)ParseEnumValue(OPTION_UNPACK, BoolCount, BoolNames, BoolValues);
+	m_bDirectUnpack			= (bool)ParseEnumValue(OPTION_DIRECTUNPACK, BoolCount, BoolNames, BoolValues);
+	m_bUnpackStored			= (bool)ParseEnumValue(OPTION_UNPACKSTORED, BoolCount, BoolNames, BoolValues);
 	m_bUnpackCleanupDisk	= (bool)ParseEnumValue(OPTION_UNPACKCLEANUPDISK, BoolCount, BoolNames, BoolValues);
 	m_bUnpackPauseQueue		= (bool)ParseEnumValue(OPTION_UNPACKPAUSEQUEUE, BoolCount, BoolNames, BoolValues);
 	m_bUrlForce				= (bool)ParseEnumValue(OPTION_URLFORCE, BoolCount, BoolNames, BoolValues);
@@ -3220,6 +3262,7 @@ bool Options::LoadConfigTemplates(ConfigTemplates* pConfigTemplates)
 
 	const int iBeginSignatureLen = strlen(BEGIN_SCRIPT_SIGNATURE);
 	const int iQueueEventsSignatureLen = strlen(QUEUE_EVENTS_SIGNATURE);
+	const int iQueueModeSignatureLen = strlen(QUEUE_MODE_SIGNATURE);
 
 	for (Scripts::iterator it = scriptList.begin(); it != scriptList.end(); it++)
 	{
@@ -3254,7 +3297,8 @@ bool Options::LoadConfigTemplates(ConfigTemplates* pConfigTemplates)
 				continue;
 			}
 
-			bool bSkip = !strncmp(buf, QUEUE_EVENTS_SIGNATURE, iQueueEventsSignatureLen);
+			bool bSkip = !strncmp(buf, QUEUE_EVENTS_SIGNATURE, iQueueEventsSignatureLen) ||
+				!strncmp(buf, QUEUE_MODE_SIGNATURE, iQueueModeSignatureLen);
 
 			if (bInConfig && !bSkip)
 			{
@@ -3332,6 +3376,7 @@ void Options::LoadScriptDir(Scripts* pScripts, const char* szDirectory, bool bIs
 
 	const int iBeginSignatureLen = strlen(BEGIN_SCRIPT_SIGNATURE);
 	const int iQueueEventsSignatureLen = strlen(QUEUE_EVENTS_SIGNATURE);
+	const int iQueueModeSignatureLen = strlen(QUEUE_MODE_SIGNATURE);
 
 	DirBrowser dir(szDirectory);
 	while (const char* szFilename = dir.Next())
@@ -3388,15 +3433,25 @@ void Options::LoadScriptDir(Scripts* pScripts, const char* szDirectory, bool bIs
 								szScriptName[1024-1] = '\0';
 
 								char* szQueueEvents = NULL;
+								bool bQueuePersistent = false;
 								if (bQueueScript)
 								{
+									// the script header ends with the second signature line
 									while (char* szLine = tok.Next())
 									{
-										if (!strncmp(szLine, QUEUE_EVENTS_SIGNATURE, iQueueEventsSignatureLen))
+										if (!strncmp(szLine, BEGIN_SCRIPT_SIGNATURE, iBeginSignatureLen) &&
+											strstr(szLine, END_SCRIPT_SIGNATURE))
 										{
-											szQueueEvents = szLine + iQueueEventsSignatureLen;
 											break;
 										}
+										else if (!strncmp(szLine, QUEUE_EVENTS_SIGNATURE, iQueueEventsSignatureLen))
+										{
+											szQueueEvents = szLine + iQueueEventsSignatureLen;
+										}
+										else if (!strncmp(szLine, QUEUE_MODE_SIGNATURE, iQueueModeSignatureLen))
+										{
+											bQueuePersistent = strstr(szLine + iQueueModeSignatureLen, "PERSISTENT");
+										}
 									}
 								}
 
@@ -3406,6 +3461,7 @@ void Options::LoadScriptDir(Scripts* pScripts, const char* szDirectory, bool bIs
 								pScript->SetQueueScript(bQueueScript);
 								pScript->SetSchedulerScript(bSchedulerScript);
 								pScript->SetQueueEvents(szQueueEvents);
+								pScript->SetQueuePersistent(bQueuePersistent);
 								pScripts->push_back(pScript);
 								break;
 							}
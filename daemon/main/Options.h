@@ -185,6 +185,7 @@ public:
 		bool			m_bQueueScript;
 		bool			m_bSchedulerScript;
 		char*			m_szQueueEvents;
+		bool			m_bQueuePersistent;
 
 	public:
 						Script(const char* szName, const char* szLocation);
@@ -203,6 +204,8 @@ public:
 		void			SetSchedulerScript(bool bSchedulerScript) { m_bSchedulerScript = bSchedulerScript; }
 		void			SetQueueEvents(const char* szQueueEvents);
 		const char*		GetQueueEvents() { return m_szQueueEvents; }
+		bool			GetQueuePersistent() { return m_bQueuePersistent; }
+		void			SetQueuePersistent(bool bQueuePersistent) { m_bQueuePersistent = bQueuePersistent; }
 	};
 
 	typedef std::list<Script*>  ScriptsBase;
@@ -302,8 +305,11 @@ private:
 	bool				m_bParRepair;
 	EParScan			m_eParScan;
 	bool				m_bParQuick;
+	bool				m_bParPreCheck;
 	bool				m_bParRename;
 	int					m_iParBuffer;
+	int					m_iParTileSize;
+	int					m_iParMmapLimit;
 	int					m_iParThreads;
 	EHealthCheck		m_eHealthCheck;
 	char*				m_szPostScript;
@@ -327,16 +333,22 @@ private:
 	bool				m_bDumpCore;
 	bool				m_bParPauseQueue;
 	bool				m_bScriptPauseQueue;
+	int					m_iPostCpuSlots;
+	int					m_iPostDiskSlots;
+	int					m_iMoveThreads;
 	bool				m_bNzbCleanupDisk;
 	bool				m_bDeleteCleanupDisk;
 	int					m_iParTimeLimit;
 	int					m_iKeepHistory;
 	bool				m_bAccurateRate;
 	bool				m_bUnpack;
+	bool				m_bDirectUnpack;
+	bool				m_bUnpackStored;
 	bool				m_bUnpackCleanupDisk;
 	char*				m_szUnrarCmd;
 	char*				m_szSevenZipCmd;
 	char*				m_szUnpackPassFile;
+	int					m_iUnpackPassThreads;
 	bool				m_bUnpackPauseQueue;
 	char*				m_szExtCleanupDisk;
 	char*				m_szParIgnoreExt;
@@ -346,6 +358,7 @@ private:
 	int					m_iPropagationDelay;
 	int					m_iArticleCache;
 	int					m_iEventInterval;
+	int					m_iCompleteThreads;
 
 	// Parsed command-line parameters
 	bool				m_bServerMode;
@@ -492,8 +505,11 @@ public:
 	bool				GetParRepair() { return m_bParRepair; }
 	EParScan			GetParScan() { return m_eParScan; }
 	bool				GetParQuick() { return m_bParQuick; }
+	bool				GetParPreCheck() { return m_bParPreCheck; }
 	bool				GetParRename() { return m_bParRename; }
 	int					GetParBuffer() { return m_iParBuffer; }
+	int					GetParTileSize() { return m_iParTileSize; }
+	int					GetParMmapLimit() { return m_iParMmapLimit; }
 	int					GetParThreads() { return m_iParThreads; }
 	EHealthCheck		GetHealthCheck() { return m_eHealthCheck; }
 	const char*			GetScriptOrder() { return m_szScriptOrder; }
@@ -516,16 +532,22 @@ public:
 	bool				GetDumpCore() { return m_bDumpCore; }
 	bool				GetParPauseQueue() { return m_bParPauseQueue; }
 	bool				GetScriptPauseQueue() { return m_bScriptPauseQueue; }
+	int					GetPostCpuSlots() { return m_iPostCpuSlots; }
+	int					GetPostDiskSlots() { return m_iPostDiskSlots; }
+	int					GetMoveThreads() { return m_iMoveThreads; }
 	bool				GetNzbCleanupDisk() { return m_bNzbCleanupDisk; }
 	bool				GetDeleteCleanupDisk() { return m_bDeleteCleanupDisk; }
 	int					GetParTimeLimit() { return m_iParTimeLimit; }
 	int					GetKeepHistory() { return m_iKeepHistory; }
 	bool				GetAccurateRate() { return m_bAccurateRate; }
 	bool				GetUnpack() { return m_bUnpack; }
+	bool				GetDirectUnpack() { return m_bDirectUnpack; }
+	bool				GetUnpackStored() { return m_bUnpackStored; }
 	bool				GetUnpackCleanupDisk() { return m_bUnpackCleanupDisk; }
 	const char*			GetUnrarCmd() { return m_szUnrarCmd; }
 	const char*			GetSevenZipCmd() { return m_szSevenZipCmd; }
 	const char*			GetUnpackPassFile() { return m_szUnpackPassFile; }
+	int					GetUnpackPassThreads() { return m_iUnpackPassThreads; }
 	bool				GetUnpackPauseQueue() { return m_bUnpackPauseQueue; }
 	const char*			GetExtCleanupDisk() { return m_szExtCleanupDisk; }
 	const char*			GetParIgnoreExt() { return m_szParIgnoreExt; }
@@ -535,6 +557,7 @@ public:
 	int					GetPropagationDelay() { return m_iPropagationDelay; }
 	int					GetArticleCache() { return m_iArticleCache; }
 	int					GetEventInterval() { return m_iEventInterval; }
+	int					GetCompleteThreads() { return m_iCompleteThreads; }
 
 	Categories*			GetCategories() { return &m_Categories; }
 	Category*			FindCategory(const char* szName, bool bSearchAliases) { return m_Categories.FindCategory(szName, bSearchAliases); }
@@ -702,6 +702,7 @@ void Cleanup()
 		delete g_pOptions;
 		g_pOptions = NULL;
 	}
+	ScriptController::ClearEnvCache();
 	debug("Options deleted");
 
 	debug("Deleting ServerPool");
@@ -108,7 +108,7 @@ public:
 	const char*			GetInfoName() { return m_szInfoName; }
 	const char*			GetConnectionName() { return m_szConnectionName; }
 	void				SetConnection(NNTPConnection* pConnection) { m_pConnection = pConnection; }
-	void				CompleteFileParts() { m_ArticleWriter.CompleteFileParts(); }
+	Decoder::EFormat	GetFormat() { return m_eFormat; }
 	int					GetDownloadedSize() { return m_iDownloadedSize; }
 
 	void				LogDebugInfo();
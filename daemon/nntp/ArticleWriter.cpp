@@ -44,6 +44,11 @@
 #include <errno.h>
 #include <algorithm>
 
+#ifndef DISABLE_PARCHECK
+#include "par2cmdline.h"
+#include "md5.h"
+#endif
+
 #include "nzbget.h"
 #include "ArticleWriter.h"
 #include "DiskState.h"
@@ -64,10 +69,18 @@ ArticleWriter::ArticleWriter()
 	m_szOutputFilename = NULL;
 	m_szResultFilename = NULL;
 	m_szInfoName = NULL;
+	m_pFileInfo = NULL;
+	m_pArticleInfo = NULL;
 	m_eFormat = Decoder::efUnknown;
 	m_pArticleData = NULL;
 	m_bDuplicate = false;
 	m_bFlushing = false;
+#ifndef DISABLE_PARCHECK
+	m_pHash16kContext = NULL;
+	m_iHash16kSize = 0;
+	m_iHash16kFill = 0;
+	m_pHashData = NULL;
+#endif
 }
 
 ArticleWriter::~ArticleWriter()
@@ -88,6 +101,11 @@ ArticleWriter::~ArticleWriter()
 	{
 		g_pArticleCache->UnlockFlush();
 	}
+
+#ifndef DISABLE_PARCHECK
+	delete (MD5Context*)m_pHash16kContext;
+	free(m_pHashData);
+#endif
 }
 
 void ArticleWriter::SetInfoName(const char* szInfoName)
@@ -121,6 +139,10 @@ bool ArticleWriter::Start(Decoder::EFormat eFormat, const char* szFilename, long
 	m_iArticleSize = iArticleSize ? iArticleSize : m_pArticleInfo->GetSize();
 	m_iArticlePtr = 0;
 
+#ifndef DISABLE_PARCHECK
+	StartHash16k(iFileSize);
+#endif
+
 	// prepare file for writing
 	if (m_eFormat == Decoder::efYenc)
 	{
@@ -183,6 +205,16 @@ bool ArticleWriter::Start(Decoder::EFormat eFormat, const char* szFilename, long
 		}
 	}
 
+#ifndef DISABLE_PARCHECK
+	// without article cache the decoded data is kept for the par-hasher
+	free(m_pHashData);
+	m_pHashData = NULL;
+	if (!m_pArticleData && m_eFormat == Decoder::efYenc && InitParHasher())
+	{
+		m_pHashData = (char*)malloc(m_iArticleSize);
+	}
+#endif
+
 	if (!m_pArticleData)
 	{
 		bool bDirectWrite = g_pOptions->GetDirectWrite() && m_eFormat == Decoder::efYenc;
@@ -213,6 +245,28 @@ bool ArticleWriter::Write(char* szBufffer, int iLen)
 		m_iArticlePtr += iLen;
 	}
 
+#ifndef DISABLE_PARCHECK
+	if (m_pHash16kContext && m_iHash16kFill < m_iHash16kSize)
+	{
+		int iHashLen = std::min(iLen, m_iHash16kSize - m_iHash16kFill);
+		((MD5Context*)m_pHash16kContext)->Update(szBufffer, iHashLen);
+		m_iHash16kFill += iHashLen;
+	}
+
+	if (m_pHashData)
+	{
+		if (m_iArticlePtr > m_iArticleSize)
+		{
+			free(m_pHashData);
+			m_pHashData = NULL;
+		}
+		else
+		{
+			memcpy(m_pHashData + m_iArticlePtr - iLen, szBufffer, iLen);
+		}
+	}
+#endif
+
 	if (g_pOptions->GetDecode() && m_pArticleData)
 	{
 		if (m_iArticlePtr > m_iArticleSize)
@@ -237,6 +291,10 @@ void ArticleWriter::Finish(bool bSuccess)
 		m_pOutFile = NULL;
 	}
 
+#ifndef DISABLE_PARCHECK
+	FinishHash16k(bSuccess);
+#endif
+
 	if (!bSuccess)
 	{
 		remove(m_szTempFilename);
@@ -260,6 +318,16 @@ void ArticleWriter::Finish(bool bSuccess)
 
 		remove(m_szTempFilename);
 
+#ifndef DISABLE_PARCHECK
+		// the decoded data is hashed before the article cache may flush it
+		if (m_eFormat == Decoder::efYenc && InitParHasher())
+		{
+			AdvanceParHasher(false, m_pArticleData ? m_pArticleData : m_pHashData);
+		}
+		free(m_pHashData);
+		m_pHashData = NULL;
+#endif
+
 		if (m_pArticleData)
 		{
 			if (m_iArticleSize != m_iArticlePtr)
@@ -371,6 +439,12 @@ void ArticleWriter::CompleteFileParts()
 	bool bDirectWrite = g_pOptions->GetDirectWrite() && m_pFileInfo->GetOutputInitialized();
 	char szErrBuf[256];
 
+	if (bDirectWrite && !m_szOutputFilename)
+	{
+		// the writer was not used for downloading, the file is completed in a separate thread
+		m_szOutputFilename = strdup(m_pFileInfo->GetOutputFilename());
+	}
+
 	char szNZBName[1024];
 	char szNZBDestDir[1024];
 	// the locking is needed for accessing the members of NZBInfo
@@ -465,6 +539,20 @@ void ArticleWriter::CompleteFileParts()
 		m_bFlushing = true;
 	}
 
+#ifndef DISABLE_PARCHECK
+	if (g_pOptions->GetDecode())
+	{
+		if (!m_pFileInfo->GetParHasher())
+		{
+			FindParBlockSize();
+		}
+		if (InitParHasher())
+		{
+			AdvanceParHasher(bCached);
+		}
+	}
+#endif
+
 	static const int BUFFER_SIZE = 1024 * 64;
 	char* buffer = NULL;
 	bool bFirstArticle = true;
@@ -598,6 +686,13 @@ void ArticleWriter::CompleteFileParts()
 		}
 	}
 
+#ifndef DISABLE_PARCHECK
+	if (g_pOptions->GetDecode() && Util::FileExists(ofn))
+	{
+		FinishParHasher(ofn);
+	}
+#endif
+
 	if (m_pFileInfo->GetMissedArticles() == 0 && m_pFileInfo->GetFailedArticles() == 0)
 	{
 		m_pFileInfo->GetNZBInfo()->PrintMessage(Message::mkInfo, "Successfully downloaded %s", szInfoFilename);
@@ -636,14 +731,23 @@ void ArticleWriter::CompleteFileParts()
 
 	// the locking is needed for accessing the members of NZBInfo
 	DownloadQueue::Lock();
-	m_pFileInfo->GetNZBInfo()->GetCompletedFiles()->push_back(new CompletedFile(
-		m_pFileInfo->GetID(), Util::BaseFileName(ofn), eFileStatus, lCrc));
+	CompletedFile* pCompletedFile = new CompletedFile(m_pFileInfo->GetID(), Util::BaseFileName(ofn), eFileStatus, lCrc);
+	pCompletedFile->SetHash16k(m_pFileInfo->GetHash16k());
+	m_pFileInfo->GetNZBInfo()->GetCompletedFiles()->push_back(pCompletedFile);
 	if (strcmp(m_pFileInfo->GetNZBInfo()->GetDestDir(), szNZBDestDir))
 	{
 		// destination directory was changed during completion, need to move the file
 		MoveCompletedFiles(m_pFileInfo->GetNZBInfo(), szNZBDestDir);
 	}
 	DownloadQueue::Unlock();
+
+#ifndef DISABLE_PARCHECK
+	if (m_pFileInfo->GetParFile() && g_pOptions->GetDecode())
+	{
+		// make the block size known for files being downloaded
+		FindParBlockSize();
+	}
+#endif
 }
 
 void ArticleWriter::FlushCache()
@@ -674,6 +778,10 @@ void ArticleWriter::FlushCache()
 	}
 	g_pArticleCache->UnlockContent();
 
+#ifndef DISABLE_PARCHECK
+	ParHasher* pHasher = InitParHasher();
+#endif
+
 	for (FileInfo::Articles::iterator it = cachedArticles.begin(); it != cachedArticles.end(); it++)
 	{
 		if (m_pFileInfo->GetDeleted())
@@ -719,6 +827,18 @@ void ArticleWriter::FlushCache()
 			bNeedBufFile = false;
 		}
 
+#ifndef DISABLE_PARCHECK
+		if (pHasher)
+		{
+			if (bDirectWrite)
+			{
+				// previously flushed articles may be read back by the hasher
+				fflush(outfile);
+			}
+			AdvanceParHasher(true);
+		}
+#endif
+
 		if (bDirectWrite)
 		{
 			fseek(outfile, pa->GetSegmentOffset(), SEEK_SET);
@@ -759,6 +879,220 @@ void ArticleWriter::FlushCache()
 	detail("Saved %i articles (%.2f MB) from cache into disk for %s", iFlushedArticles, (float)(iFlushedSize / 1024.0 / 1024.0), m_szInfoName);
 }
 
+#ifndef DISABLE_PARCHECK
+ParHasher* ArticleWriter::InitParHasher()
+{
+	if (m_pFileInfo->GetParHasher())
+	{
+		return m_pFileInfo->GetParHasher();
+	}
+
+	if (!g_pOptions->GetDecode() || g_pOptions->GetParCheck() == Options::pcManual ||
+		!g_pOptions->GetSaveQueue() || !g_pOptions->GetServerMode() ||
+		m_pFileInfo->GetParFile() || m_pFileInfo->GetNZBInfo()->GetParBlockSize() == 0)
+	{
+		return NULL;
+	}
+
+	DownloadQueue::Lock();
+	ParHasher* pHasher = m_pFileInfo->GetParHasher();
+	if (!pHasher)
+	{
+		pHasher = new ParHasher(m_pFileInfo->GetNZBInfo()->GetParBlockSize());
+		m_pFileInfo->SetParHasher(pHasher);
+	}
+	DownloadQueue::Unlock();
+
+	return pHasher;
+}
+
+/*
+ * Feeds the par-hasher with consecutive downloaded articles starting at its current position.
+ * The article being finished is hashed from its decoded data (pArticleData) if given.
+ * Other articles still held in the article cache are hashed only if the caller holds the
+ * flush lock, otherwise the data is read back from disk where it is still in the system cache.
+ */
+void ArticleWriter::AdvanceParHasher(bool bCacheLocked, const char* pArticleData)
+{
+	ParHasher* pHasher = m_pFileInfo->GetParHasher();
+	if (!pHasher)
+	{
+		return;
+	}
+
+	bool bDirectWrite = g_pOptions->GetDirectWrite() && m_pFileInfo->GetOutputInitialized();
+	char szOutputFilename[1024];
+	szOutputFilename[0] = '\0';
+	if (bDirectWrite)
+	{
+		m_pFileInfo->LockOutputFile();
+		if (m_pFileInfo->GetOutputFilename())
+		{
+			strncpy(szOutputFilename, m_pFileInfo->GetOutputFilename(), 1024);
+			szOutputFilename[1024-1] = '\0';
+		}
+		m_pFileInfo->UnlockOutputFile();
+	}
+
+	pHasher->Lock();
+
+	FileInfo::Articles* pArticles = m_pFileInfo->GetArticles();
+	int iIndex = pHasher->GetNextArticle();
+	for (; iIndex < (int)pArticles->size(); iIndex++)
+	{
+		ArticleInfo* pa = pArticles->at(iIndex);
+		bool bCurrent = pa == m_pArticleInfo && pArticleData;
+		if ((pa->GetStatus() != ArticleInfo::aiFinished && pa != m_pArticleInfo) ||
+			(bCurrent ? m_iArticleOffset : pa->GetSegmentOffset()) != pHasher->GetOffset())
+		{
+			break;
+		}
+
+		if (bCurrent)
+		{
+			pHasher->Append(pArticleData, m_iArticlePtr);
+		}
+		else if (pa->GetSegmentContent())
+		{
+			if (!bCacheLocked)
+			{
+				break;
+			}
+			pHasher->Append(pa->GetSegmentContent(), pa->GetSegmentSize());
+		}
+		else if (!pHasher->AppendFile(bDirectWrite ? szOutputFilename : pa->GetResultFilename(),
+			bDirectWrite ? pa->GetSegmentOffset() : 0, pa->GetSegmentSize()))
+		{
+			break;
+		}
+	}
+
+	pHasher->SetNextArticle(iIndex);
+	pHasher->Unlock();
+}
+
+/*
+ * Hashes the rest of completed file (failed articles and articles which
+ * couldn't be hashed during download) and saves the block checksums.
+ */
+void ArticleWriter::FinishParHasher(const char* szFilename)
+{
+	ParHasher* pHasher = m_pFileInfo->GetParHasher();
+	if (!pHasher)
+	{
+		return;
+	}
+
+	pHasher->Lock();
+
+	long long lFileSize = Util::FileSize(szFilename);
+	if (pHasher->GetOffset() <= lFileSize &&
+		pHasher->AppendFile(szFilename, pHasher->GetOffset(), lFileSize - pHasher->GetOffset()))
+	{
+		ParHashes parHashes;
+		pHasher->GetHashes(&parHashes);
+		parHashes.SetModified(Util::FileModificationTime(szFilename));
+		g_pDiskState->SaveParHashes(m_pFileInfo->GetID(), &parHashes);
+	}
+
+	pHasher->Unlock();
+}
+
+/*
+ * The par2 block size is taken from the main packet of an already downloaded par2-file of the nzb.
+ */
+void ArticleWriter::FindParBlockSize()
+{
+	std::deque<char*> parFiles;
+
+	DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = m_pFileInfo->GetNZBInfo();
+	if (pNZBInfo->GetParBlockSize() == 0)
+	{
+		for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
+		{
+			CompletedFile* pCompletedFile = *it;
+
+			char szLoFileName[1024];
+			strncpy(szLoFileName, pCompletedFile->GetFileName(), 1024);
+			szLoFileName[1024-1] = '\0';
+			for (char* p = szLoFileName; *p; p++) *p = tolower(*p); // convert string to lowercase
+
+			if (pCompletedFile->GetStatus() == CompletedFile::cfSuccess && strstr(szLoFileName, ".par2"))
+			{
+				char szFullFilename[1024];
+				snprintf(szFullFilename, 1024, "%s%c%s", pNZBInfo->GetDestDir(), (int)PATH_SEPARATOR, pCompletedFile->GetFileName());
+				szFullFilename[1024-1] = '\0';
+				parFiles.push_back(strdup(szFullFilename));
+			}
+		}
+	}
+	DownloadQueue::Unlock();
+
+	long long lBlockSize = 0;
+	for (std::deque<char*>::iterator it = parFiles.begin(); it != parFiles.end(); it++)
+	{
+		char* szParFilename = *it;
+		if (lBlockSize == 0)
+		{
+			lBlockSize = ParHasher::ReadBlockSize(szParFilename);
+		}
+		free(szParFilename);
+	}
+
+	if (lBlockSize > 0)
+	{
+		DownloadQueue::Lock();
+		if (pNZBInfo->GetParBlockSize() == 0)
+		{
+			pNZBInfo->SetParBlockSize(lBlockSize);
+		}
+		DownloadQueue::Unlock();
+	}
+}
+
+/*
+ * The MD5 of the first 16 KB of the file is computed while the first article is decoded.
+ * Par-renamer uses it to match obfuscated files against par2 file descriptions.
+ * If the first article is shorter than 16 KB the hash isn't computed.
+ */
+void ArticleWriter::StartHash16k(long long iFileSize)
+{
+	delete (MD5Context*)m_pHash16kContext;
+	m_pHash16kContext = NULL;
+
+	if (m_eFormat == Decoder::efYenc && m_iArticleOffset == 0 && iFileSize > 0 &&
+		g_pOptions->GetDecode() && !m_pFileInfo->GetHash16k())
+	{
+		m_pHash16kContext = new MD5Context();
+		m_iHash16kSize = (int)std::min(iFileSize, 16384LL);
+		m_iHash16kFill = 0;
+	}
+}
+
+void ArticleWriter::FinishHash16k(bool bSuccess)
+{
+	if (!m_pHash16kContext)
+	{
+		return;
+	}
+
+	if (bSuccess && m_iHash16kFill == m_iHash16kSize)
+	{
+		MD5Hash hash16k;
+		((MD5Context*)m_pHash16kContext)->Final(hash16k);
+
+		// the locking is needed for accessing the members of FileInfo
+		DownloadQueue::Lock();
+		m_pFileInfo->SetHash16k(hash16k.hash);
+		DownloadQueue::Unlock();
+	}
+
+	delete (MD5Context*)m_pHash16kContext;
+	m_pHash16kContext = NULL;
+}
+#endif
+
 bool ArticleWriter::MoveCompletedFiles(NZBInfo* pNZBInfo, const char* szOldDestDir)
 {
 	if (pNZBInfo->GetCompletedFiles()->empty())
@@ -1026,3 +1360,185 @@ bool ArticleCache::CheckFlush(bool bFlushEverything)
 
 	return false;
 }
+
+
+#ifndef DISABLE_PARCHECK
+ParHasher::ParHasher(long long lBlockSize)
+{
+	m_lBlockSize = lBlockSize;
+	m_lOffset = 0;
+	m_lBlockFill = 0;
+	m_lBlockCrc = ~0;
+	m_pFileContext = new MD5Context();
+	m_pBlockContext = new MD5Context();
+	memset(m_Hash16k, 0, sizeof(m_Hash16k));
+	m_iNextArticle = 0;
+}
+
+ParHasher::~ParHasher()
+{
+	delete (MD5Context*)m_pFileContext;
+	delete (MD5Context*)m_pBlockContext;
+}
+
+void ParHasher::Append(const char* pBuffer, int iSize)
+{
+	MD5Context* pFileContext = (MD5Context*)m_pFileContext;
+	MD5Context* pBlockContext = (MD5Context*)m_pBlockContext;
+
+	while (iSize > 0)
+	{
+		int iLen = (int)std::min((long long)iSize, m_lBlockSize - m_lBlockFill);
+		if (m_lOffset < 16384 && m_lOffset + iLen > 16384)
+		{
+			iLen = (int)(16384 - m_lOffset);
+		}
+
+		// file and block hashes are computed from the same data in one go
+		MD5Context* contexts[2] = { pFileContext, pBlockContext };
+		const void* buffers[2] = { pBuffer, pBuffer };
+		MD5Context::UpdateMulti(contexts, buffers, 2, iLen);
+
+		m_lBlockCrc = CRCUpdateBlock((u32)m_lBlockCrc, iLen, pBuffer);
+		m_lBlockFill += iLen;
+		m_lOffset += iLen;
+		pBuffer += iLen;
+		iSize -= iLen;
+
+		// the 16k hash is a snapshot of the file hash after the first 16384 bytes
+		if (m_lOffset == 16384)
+		{
+			MD5Context context16k = *pFileContext;
+			MD5Hash hash16k;
+			context16k.Final(hash16k);
+			memcpy(m_Hash16k, hash16k.hash, sizeof(m_Hash16k));
+		}
+
+		if (m_lBlockFill == m_lBlockSize)
+		{
+			FinishBlock();
+		}
+	}
+}
+
+void ParHasher::FinishBlock()
+{
+	MD5Context* pBlockContext = (MD5Context*)m_pBlockContext;
+
+	// the last block of a file is padded with zeros to the full block size
+	if (m_lBlockFill < m_lBlockSize)
+	{
+		pBlockContext->Update((size_t)(m_lBlockSize - m_lBlockFill));
+		m_lBlockCrc = CRCUpdateBlock((u32)m_lBlockCrc, (size_t)(m_lBlockSize - m_lBlockFill));
+	}
+
+	MD5Hash blockHash;
+	pBlockContext->Final(blockHash);
+
+	ParHashes::BlockHash block;
+	block.m_lCrc = (u32)(m_lBlockCrc ^ ~0);
+	memcpy(block.m_Md5, blockHash.hash, sizeof(block.m_Md5));
+	m_BlockHashes.push_back(block);
+
+	pBlockContext->Reset();
+	m_lBlockCrc = ~0;
+	m_lBlockFill = 0;
+}
+
+bool ParHasher::AppendFile(const char* szFilename, long long lFilePos, long long lSize)
+{
+	FILE* pFile = fopen(szFilename, FOPEN_RB);
+	if (!pFile)
+	{
+		return false;
+	}
+
+	if (fseek(pFile, lFilePos, SEEK_SET))
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	static const int BUFFER_SIZE = 1024 * 64;
+	char* buffer = (char*)malloc(BUFFER_SIZE);
+
+	while (lSize > 0)
+	{
+		int iCnt = (int)fread(buffer, 1, (int)std::min((long long)BUFFER_SIZE, lSize), pFile);
+		if (iCnt <= 0)
+		{
+			break;
+		}
+		Append(buffer, iCnt);
+		lSize -= iCnt;
+	}
+
+	free(buffer);
+	fclose(pFile);
+
+	return lSize == 0;
+}
+
+void ParHasher::GetHashes(ParHashes* pParHashes)
+{
+	if (m_lBlockFill > 0)
+	{
+		FinishBlock();
+	}
+
+	MD5Hash hashFull;
+	((MD5Context*)m_pFileContext)->Final(hashFull);
+
+	pParHashes->SetBlockSize(m_lBlockSize);
+	pParHashes->SetFileSize(m_lOffset);
+	memcpy(pParHashes->GetHashFull(), hashFull.hash, 16);
+	// for files smaller than 16k both hashes are the same
+	memcpy(pParHashes->GetHash16k(), m_lOffset < 16384 ? hashFull.hash : m_Hash16k, 16);
+	pParHashes->GetBlockHashes()->swap(m_BlockHashes);
+}
+
+/*
+ * Reads the block size from the main packet of a par2-file.
+ * Returns 0 if the file couldn't be read or doesn't have a main packet.
+ */
+long long ParHasher::ReadBlockSize(const char* szParFilename)
+{
+	FILE* pFile = fopen(szParFilename, FOPEN_RB);
+	if (!pFile)
+	{
+		return 0;
+	}
+
+	long long lBlockSize = 0;
+	PACKET_HEADER header;
+	// the main packet is one of the first packets, no need to go through the whole file
+	for (int i = 0; i < 1000 && fread(&header, 1, sizeof(header), pFile) == sizeof(header); i++)
+	{
+		if (memcmp(&header.magic, &packet_magic, sizeof(packet_magic)) ||
+			header.length < sizeof(header))
+		{
+			break;
+		}
+
+		if (!memcmp(&header.type, &mainpacket_type, sizeof(mainpacket_type)))
+		{
+			leu64 blocksize;
+			if (fread(&blocksize, 1, sizeof(blocksize), pFile) == sizeof(blocksize))
+			{
+				lBlockSize = (long long)(u64)blocksize;
+			}
+			break;
+		}
+
+		if (fseek(pFile, (long long)(u64)header.length - sizeof(header), SEEK_CUR))
+		{
+			break;
+		}
+	}
+
+	fclose(pFile);
+
+	// par2 requires the block size to be a multiple of 4
+	return lBlockSize > 0 && lBlockSize % 4 == 0 ? lBlockSize : 0;
+}
+#endif
@@ -46,12 +46,27 @@ private:
 	bool				m_bFlushing;
 	bool				m_bDuplicate;
 	char*				m_szInfoName;
+#ifndef DISABLE_PARCHECK
+	// declared as void* to prevent the including of libpar2-headers into this header-file
+	void*				m_pHash16kContext;
+	int					m_iHash16kSize;
+	int					m_iHash16kFill;
+	char*				m_pHashData;
+#endif
 
 	bool				PrepareFile(char* szLine);
 	bool				CreateOutputFile(long long iSize);
 	void				BuildOutputFilename();
 	bool				IsFileCached();
 	void				SetWriteBuffer(FILE* pOutFile, int iRecSize);
+#ifndef DISABLE_PARCHECK
+	ParHasher*			InitParHasher();
+	void				AdvanceParHasher(bool bCacheLocked, const char* pArticleData = NULL);
+	void				FinishParHasher(const char* szFilename);
+	void				FindParBlockSize();
+	void				StartHash16k(long long iFileSize);
+	void				FinishHash16k(bool bSuccess);
+#endif
 
 protected:
 	virtual void		SetLastUpdateTimeNow() {}
@@ -62,6 +77,7 @@ public:
 	void				SetInfoName(const char* szInfoName);
 	void				SetFileInfo(FileInfo* pFileInfo) { m_pFileInfo = pFileInfo; }
 	void				SetArticleInfo(ArticleInfo* pArticleInfo) { m_pArticleInfo = pArticleInfo; }
+	void				SetFormat(Decoder::EFormat eFormat) { m_eFormat = eFormat; }
 	void				Prepare();
 	bool				Start(Decoder::EFormat eFormat, const char* szFilename, long long iFileSize, long long iArticleOffset, int iArticleSize);
 	bool				Write(char* szBufffer, int iLen);
@@ -72,6 +88,43 @@ public:
 	void				FlushCache();
 };
 
+#ifndef DISABLE_PARCHECK
+/*
+ * Computes par2-block checksums (MD5 and CRC32) of a file in offset order
+ * while the file is being assembled from downloaded articles.
+ */
+class ParHasher
+{
+private:
+	Mutex				m_mutexHasher;
+	long long			m_lBlockSize;
+	long long			m_lOffset;
+	long long			m_lBlockFill;
+	unsigned long		m_lBlockCrc;
+	// declared as void* to prevent the including of libpar2-headers into this header-file
+	void*				m_pFileContext;
+	void*				m_pBlockContext;
+	unsigned char		m_Hash16k[16];
+	ParHashes::BlockHashes	m_BlockHashes;
+	int					m_iNextArticle;
+
+	void				FinishBlock();
+
+public:
+						ParHasher(long long lBlockSize);
+						~ParHasher();
+	void				Lock() { m_mutexHasher.Lock(); }
+	void				Unlock() { m_mutexHasher.Unlock(); }
+	long long			GetOffset() { return m_lOffset; }
+	int					GetNextArticle() { return m_iNextArticle; }
+	void				SetNextArticle(int iNextArticle) { m_iNextArticle = iNextArticle; }
+	void				Append(const char* pBuffer, int iSize);
+	bool				AppendFile(const char* szFilename, long long lFilePos, long long lSize);
+	void				GetHashes(ParHashes* pParHashes);
+	static long long	ReadBlockSize(const char* szParFilename);
+};
+#endif
+
 class ArticleCache : public Thread
 {
 private:
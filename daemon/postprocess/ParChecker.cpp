@@ -37,11 +37,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
+#include <fcntl.h>
 #ifndef WIN32
 #include <unistd.h>
+#include <sys/time.h>
 #endif
 #include <vector>
+#include <deque>
 #include <algorithm>
 
 #include "par2cmdline.h"
@@ -75,27 +79,159 @@ const char* Par2CmdLineErrStr[] = { "OK",
 #define SYNC_SLEEP_INTERVAL 100
 #endif
 
+// Number of input blocks processed at once during repair (with option ParTileSize)
+#define REPAIR_INPUT_BATCH 16
+
+// Number of batches of input blocks read ahead during repair
+#define REPAIR_PREFETCH_DEPTH 3
+
+// Minimum number of missing blocks to solve the recovery matrix in several threads
+#define MATRIX_PARALLEL_MIN_BLOCKS 128
+
+// Minimum number of matrix rows processed by a thread at once
+#define MATRIX_MIN_CHUNK 8
+
+// Buffer size for reading parts of partially downloaded files during quick verification
+#define RANGE_CRC_BUFFER_SIZE (1024 * 1024)
+
+// Signature of the file with saved repair progress
+#define REPAIR_STATE_SIGNATURE "nzbget-parstate1"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 class RepairThread;
+class ReadThread;
+class ScanThread;
+class MatrixThread;
+class RangeCrcThread;
 
-class Repairer : public Par2Repairer
+/*
+ * Range of output blocks of the current batch assigned to one repair thread.
+ * The owning thread takes blocks from the front, other threads which have
+ * finished their own ranges take (steal) blocks from the back.
+ */
+class RepairRange
 {
 private:
-	typedef vector<Thread*> Threads;
+#ifdef HAVE_SPINLOCK
+	SpinLock		m_lock;
+#else
+	Mutex			m_lock;
+#endif
+	u32				m_inputindex;
+	u32				m_inputcount;
+	size_t			m_blocklength;
+	u32				m_begin;
+	u32				m_end;
+
+public:
+					RepairRange() { m_begin = m_end = 0; }
+	void			Assign(u32 inputindex, u32 inputcount, size_t blocklength, u32 begin, u32 end);
+	bool			Take(bool bSteal, u32 &inputindex, u32 &inputcount, size_t &blocklength, u32 &outputindex);
+	u32				Clear();
+};
+
+/*
+ * Progress of a repair saved in QueueDir: the solved recovery matrix, the blocks
+ * it was solved for, the target files with the damaged files they replace and
+ * the offset within the blocks up to which the target files were written.
+ * File names are relative to the directory of the par-set, which changes when
+ * the files are moved from InterDir to DestDir.
+ */
+class RepairState
+{
+public:
+	struct FileEntry
+	{
+		string			m_TargetFilename;
+		long long		m_lTargetSize;
+		string			m_RenamedFilename;
+		long long		m_lRenamedSize;
+		time_t			m_tRenamedTime;
+		bool			m_bResumed;
+	};
+
+	typedef vector<FileEntry> Files;
+
+	string				m_Filename;
+	string				m_Path;
+	u64					m_lOffset;
+	MD5Hash				m_SetID;
+	u64					m_lBlockSize;
+	vector<u8>			m_Present;
+	vector<u16>			m_Exponents;
+	Files				m_Files;
+	u32					m_iRows;
+	u32					m_iCols;
+	vector<Galois16>	m_Matrix;
+
+private:
+	bool				Write(FILE* pFile, const void* pData, size_t iSize);
+	bool				WriteString(FILE* pFile, const string& str);
+	bool				Read(FILE* pFile, void* pData, size_t iSize);
+	bool				ReadString(FILE* pFile, string& str);
+
+public:
+						RepairState(const char* szFilename, const string& path) :
+							m_Filename(szFilename), m_Path(path), m_lOffset(0) {}
+	bool				Save();
+	bool				Load();
+	bool				SaveOffset(u64 lOffset);
+	void				Discard();
+	FileEntry*			FindFile(const string& filename);
+};
+
+static bool IsRepairPart(const string& filename)
+{
+	size_t iExtLen = strlen(REPAIR_PART_EXT);
+	return filename.size() > iExtLen && !filename.compare(filename.size() - iExtLen, iExtLen, REPAIR_PART_EXT);
+}
+
+class Repairer : public Par2Repairer, public RSParallel
+{
+private:
+	typedef vector<RepairThread*> Threads;
+	typedef vector<RepairRange*> Ranges;
+	typedef vector<ScanThread*> ScanThreads;
+	typedef vector<MatrixThread*> MatrixThreads;
 
 	CommandLine		commandLine;
 	ParChecker*		m_pOwner;
 	Threads			m_Threads;
+	Ranges			m_Ranges;
 	bool			m_bParallel;
-
-#ifdef HAVE_SPINLOCK
-	SpinLock		progresslock;
-#else
-	Mutex			progresslock;
-#endif
+	AtomicCounter	m_PendingBlocks;
+	Semaphore		m_semBlocksDone;
+	ReadThread*		m_pReadThread;
+	vector<ScanJob*>*	m_pScanJobs;
+	AtomicCounter	m_NextScanJob;
+	Mutex			m_MatrixMutex;
+	MatrixThreads	m_MatrixThreads;
+	Semaphore		m_semMatrixDone;
+	RSRowJob*		m_pMatrixJob;
+	int				m_iMatrixThreads;
+	u32				m_iMatrixRows;
+	u32				m_iMatrixChunk;
+	u32				m_iMatrixNextRow;
+	u32				m_iMatrixDoneRows;
+	RepairState*	m_pRepairState;
+	bool			m_bStateSaved;
+	bool			m_bKeepState;
+	u64				m_lResumeOffset;
+	bool			m_bMatrixRestored;
 
 	virtual void	BeginRepair();
 	virtual void	EndRepair();
-	void			RepairBlock(u32 inputindex, u32 outputindex, size_t blocklength);
+	void			ProcessRanges(int iOwnRange);
+	void			BlocksDone(long lCount);
+	void			ProcessScanJobs();
+	void			ProcessMatrixRows();
+	bool			BuildStateFilename(char* szFilename, int iBufLen);
+	bool			SameRepairPlan();
+	void			SaveRepairState();
+	void			KeepRepairState();
 
 protected:
 	virtual void	sig_filename(std::string filename) { m_pOwner->signal_filename(filename); }
@@ -104,81 +240,743 @@ protected:
 
 	virtual bool	ScanDataFile(DiskFile *diskfile, Par2RepairerSourceFile* &sourcefile,
 		MatchType &matchtype, MD5Hash &hashfull, MD5Hash &hash16k, u32 &count);
-	virtual bool	RepairData(u32 inputindex, size_t blocklength);
+	virtual void	ScanDataFiles(vector<ScanJob*> &jobs);
+	virtual bool	RepairData(u32 inputindex, u32 inputcount, size_t blocklength);
+	virtual bool	BeginReadInputBlocks(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount,
+						void *buffer, u64 &totalwritten);
+	virtual bool	EndReadInputBlocks();
+	virtual bool	ComputeRSmatrix();
+	virtual bool	FindPacketIndex(const string &filename, PacketIndex &index)
+						{ return m_pOwner->m_pPacketCache && m_pOwner->m_pPacketCache->Find(filename.c_str(), &index); }
+	virtual void	StorePacketIndex(const string &filename, const PacketIndex &index)
+						{ if (m_pOwner->m_pPacketCache) m_pOwner->m_pPacketCache->Add(filename.c_str(), (void*)&index); }
+	virtual bool	CreateTargetFile(DiskFile *targetfile, string filename, u64 filesize);
+	virtual bool	SolveRSmatrix();
+	virtual u64		ResumeRepair();
+	virtual void	ChunkCompleted(u64 blockoffset);
+	virtual bool	DeleteIncompleteTargetFiles();
 
 public:
-					Repairer(ParChecker* pOwner) { m_pOwner = pOwner; }
+					Repairer(ParChecker* pOwner);
+					~Repairer();
 	Result			PreProcess(const char *szParFilename);
 	Result			Process(bool dorepair);
+	virtual void	Run(RSRowJob &job, u32 rows);
+	void			LoadRepairState();
+	void			FinishRepairState();
 
 	friend class ParChecker;
 	friend class RepairThread;
+	friend class ReadThread;
+	friend class ScanThread;
+	friend class MatrixThread;
 };
 
 class RepairThread : public Thread
 {
 private:
 	Repairer*		m_pOwner;
-	u32				m_inputindex;
-	u32				m_outputindex;
-	size_t			m_blocklength;
-	volatile bool	m_bWorking;
+	int				m_iRange;
+	Semaphore		m_semJob;
+
+protected:
+	virtual void	Run();
+
+public:
+					RepairThread(Repairer* pOwner, int iRange) { m_pOwner = pOwner; m_iRange = iRange; }
+	virtual void	Stop() { Thread::Stop(); m_semJob.Post(); }
+	void			NewJob() { m_semJob.Post(); }
+};
+
+/*
+ * Reads the next batches of input blocks while the current batch is processed.
+ * The batches are read in the order they were requested.
+ */
+class ReadThread : public Thread
+{
+private:
+	struct ReadJob
+	{
+		u64			blockoffset;
+		size_t		blocklength;
+		u32			inputindex;
+		u32			inputcount;
+		void*		buffer;
+		u64*		totalwritten;
+	};
+
+	typedef deque<ReadJob>		Jobs;
+	typedef deque<bool>		Results;
+
+	Repairer*		m_pOwner;
+	Jobs			m_Jobs;
+	Results			m_Results;
+	Mutex			m_JobsMutex;
+	Semaphore		m_semJobs;
+	Semaphore		m_semResults;
 
 protected:
 	virtual void	Run();
 
-public:
-					RepairThread(Repairer* pOwner) { this->m_pOwner = pOwner; m_bWorking = false; }
-	void			RepairBlock(u32 inputindex, u32 outputindex, size_t blocklength);
-	bool			IsWorking() { return m_bWorking; }
-};
+public:
+					ReadThread(Repairer* pOwner) { m_pOwner = pOwner; }
+	virtual void	Stop() { Thread::Stop(); m_semJobs.Post(); }
+	void			BeginRead(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount,
+						void *buffer, u64 *totalwritten);
+	bool			EndRead();
+};
+
+/*
+ * Scans data files during verification, several threads take the files
+ * from the shared job list.
+ */
+class ScanThread : public Thread
+{
+private:
+	Repairer*		m_pOwner;
+
+protected:
+	virtual void	Run() { m_pOwner->ProcessScanJobs(); }
+
+public:
+					ScanThread(Repairer* pOwner) { m_pOwner = pOwner; }
+};
+
+/*
+ * Eliminates rows of the recovery matrix while it is solved.
+ */
+class MatrixThread : public Thread
+{
+private:
+	Repairer*		m_pOwner;
+	Semaphore		m_semJob;
+
+protected:
+	virtual void	Run();
+
+public:
+					MatrixThread(Repairer* pOwner) { m_pOwner = pOwner; }
+	virtual void	Stop() { Thread::Stop(); m_semJob.Post(); }
+	void			NewJob() { m_semJob.Post(); }
+};
+
+/*
+ * Verifies ranges of presumably valid blocks of a partially downloaded file.
+ */
+class RangeCrcVerifier
+{
+private:
+	struct Range
+	{
+		long long		m_lStart;
+		long long		m_lEnd;
+		long long		m_lPadding;		// to extend the last block to block size
+		unsigned long	m_lParCrc;
+	};
+
+	typedef std::vector<Range> Ranges;
+
+	int				m_iFile;
+	ParChecker::SegmentList*	m_pSegments;
+	Ranges			m_Ranges;
+	AtomicCounter	m_NextRange;
+	volatile bool	m_bFailed;
+
+	bool			SmartCalcFileRangeCrc(long long lStart, long long lEnd, unsigned char* pBuffer,
+						unsigned long* pDownloadCrc);
+	bool			DumbCalcFileRangeCrc(long long lStart, long long lEnd, unsigned char* pBuffer,
+						unsigned long* pDownloadCrc);
+
+public:
+					RangeCrcVerifier(int iFile, ParChecker::SegmentList* pSegments);
+	void			AddRange(long long lStart, long long lEnd, long long lPadding, unsigned long lParCrc);
+	bool			Verify(int iThreads);
+	void			ProcessRanges();
+};
+
+class RangeCrcThread : public Thread
+{
+private:
+	RangeCrcVerifier*	m_pOwner;
+
+protected:
+	virtual void	Run() { m_pOwner->ProcessRanges(); }
+
+public:
+					RangeCrcThread(RangeCrcVerifier* pOwner) { m_pOwner = pOwner; }
+};
+
+bool RepairState::Write(FILE* pFile, const void* pData, size_t iSize)
+{
+	return iSize == 0 || fwrite(pData, 1, iSize, pFile) == iSize;
+}
+
+bool RepairState::WriteString(FILE* pFile, const string& str)
+{
+	u32 iLen = (u32)str.size();
+	return Write(pFile, &iLen, sizeof(iLen)) && Write(pFile, str.data(), iLen);
+}
+
+bool RepairState::Read(FILE* pFile, void* pData, size_t iSize)
+{
+	return iSize == 0 || fread(pData, 1, iSize, pFile) == iSize;
+}
+
+bool RepairState::ReadString(FILE* pFile, string& str)
+{
+	u32 iLen = 0;
+	if (!Read(pFile, &iLen, sizeof(iLen)) || iLen > 1024 * 64)
+	{
+		return false;
+	}
+	str.resize(iLen);
+	return iLen == 0 || Read(pFile, &str[0], iLen);
+}
+
+/*
+ * The offset follows the signature, it is the only field updated after each chunk.
+ */
+bool RepairState::Save()
+{
+	string tempname = m_Filename + ".new";
+	FILE* pFile = fopen(tempname.c_str(), FOPEN_WB);
+	if (!pFile)
+	{
+		return false;
+	}
+
+	u32 iPresentCount = (u32)m_Present.size();
+	u32 iExponentCount = (u32)m_Exponents.size();
+	u32 iFileCount = (u32)m_Files.size();
+
+	bool bOK = Write(pFile, REPAIR_STATE_SIGNATURE, 16) &&
+		Write(pFile, &m_lOffset, sizeof(m_lOffset)) &&
+		Write(pFile, &m_SetID, sizeof(m_SetID)) &&
+		Write(pFile, &m_lBlockSize, sizeof(m_lBlockSize)) &&
+		Write(pFile, &iPresentCount, sizeof(iPresentCount)) &&
+		Write(pFile, iPresentCount ? &m_Present[0] : NULL, iPresentCount) &&
+		Write(pFile, &iExponentCount, sizeof(iExponentCount)) &&
+		Write(pFile, iExponentCount ? &m_Exponents[0] : NULL, iExponentCount * sizeof(u16)) &&
+		Write(pFile, &iFileCount, sizeof(iFileCount));
+
+	for (Files::iterator it = m_Files.begin(); bOK && it != m_Files.end(); it++)
+	{
+		bOK = WriteString(pFile, it->m_TargetFilename) &&
+			Write(pFile, &it->m_lTargetSize, sizeof(it->m_lTargetSize)) &&
+			WriteString(pFile, it->m_RenamedFilename) &&
+			Write(pFile, &it->m_lRenamedSize, sizeof(it->m_lRenamedSize)) &&
+			Write(pFile, &it->m_tRenamedTime, sizeof(it->m_tRenamedTime));
+	}
+
+	bOK = bOK && Write(pFile, &m_iRows, sizeof(m_iRows)) &&
+		Write(pFile, &m_iCols, sizeof(m_iCols)) &&
+		Write(pFile, m_Matrix.empty() ? NULL : &m_Matrix[0], m_Matrix.size() * sizeof(Galois16));
+
+	bOK = !fclose(pFile) && bOK;
+
+	remove(m_Filename.c_str());
+	if (!bOK || rename(tempname.c_str(), m_Filename.c_str()))
+	{
+		remove(tempname.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool RepairState::Load()
+{
+	FILE* pFile = fopen(m_Filename.c_str(), FOPEN_RB);
+	if (!pFile)
+	{
+		return false;
+	}
+
+	char szSignature[16];
+	u32 iPresentCount = 0;
+	u32 iExponentCount = 0;
+	u32 iFileCount = 0;
+
+	bool bOK = Read(pFile, szSignature, 16) && !memcmp(szSignature, REPAIR_STATE_SIGNATURE, 16) &&
+		Read(pFile, &m_lOffset, sizeof(m_lOffset)) &&
+		Read(pFile, &m_SetID, sizeof(m_SetID)) &&
+		Read(pFile, &m_lBlockSize, sizeof(m_lBlockSize)) &&
+		Read(pFile, &iPresentCount, sizeof(iPresentCount)) && iPresentCount <= 32768;
+
+	if (bOK)
+	{
+		m_Present.resize(iPresentCount);
+		bOK = Read(pFile, iPresentCount ? &m_Present[0] : NULL, iPresentCount) &&
+			Read(pFile, &iExponentCount, sizeof(iExponentCount)) && iExponentCount <= iPresentCount;
+	}
+
+	if (bOK)
+	{
+		m_Exponents.resize(iExponentCount);
+		bOK = Read(pFile, iExponentCount ? &m_Exponents[0] : NULL, iExponentCount * sizeof(u16)) &&
+			Read(pFile, &iFileCount, sizeof(iFileCount)) && iFileCount <= iPresentCount;
+	}
+
+	for (u32 i = 0; bOK && i < iFileCount; i++)
+	{
+		FileEntry entry;
+		entry.m_bResumed = false;
+		bOK = ReadString(pFile, entry.m_TargetFilename) &&
+			Read(pFile, &entry.m_lTargetSize, sizeof(entry.m_lTargetSize)) &&
+			ReadString(pFile, entry.m_RenamedFilename) &&
+			Read(pFile, &entry.m_lRenamedSize, sizeof(entry.m_lRenamedSize)) &&
+			Read(pFile, &entry.m_tRenamedTime, sizeof(entry.m_tRenamedTime));
+		m_Files.push_back(entry);
+	}
+
+	bOK = bOK && Read(pFile, &m_iRows, sizeof(m_iRows)) && Read(pFile, &m_iCols, sizeof(m_iCols)) &&
+		m_iRows == iExponentCount && m_iCols == iPresentCount;
+
+	if (bOK)
+	{
+		m_Matrix.resize((size_t)m_iRows * m_iCols);
+		bOK = Read(pFile, m_Matrix.empty() ? NULL : &m_Matrix[0], m_Matrix.size() * sizeof(Galois16));
+	}
+
+	fclose(pFile);
+
+	return bOK;
+}
+
+bool RepairState::SaveOffset(u64 lOffset)
+{
+	FILE* pFile = fopen(m_Filename.c_str(), FOPEN_RBP);
+	if (!pFile)
+	{
+		return false;
+	}
+
+	bool bOK = !fseek(pFile, 16, SEEK_SET) && Write(pFile, &lOffset, sizeof(lOffset));
+	bOK = !fclose(pFile) && bOK;
+
+	if (bOK)
+	{
+		m_lOffset = lOffset;
+	}
+
+	return bOK;
+}
+
+void RepairState::Discard()
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		string partname = m_Path + it->m_TargetFilename + REPAIR_PART_EXT;
+		remove(partname.c_str());
+	}
+
+	remove(m_Filename.c_str());
+}
+
+RepairState::FileEntry* RepairState::FindFile(const string& filename)
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		if (m_Path + it->m_TargetFilename == filename)
+		{
+			return &*it;
+		}
+	}
+	return NULL;
+}
+
+Repairer::Repairer(ParChecker* pOwner)
+{
+	m_pOwner = pOwner;
+	m_pReadThread = NULL;
+	m_pScanJobs = NULL;
+	m_pMatrixJob = NULL;
+	m_iMatrixThreads = 1;
+	m_iMatrixRows = 0;
+	m_iMatrixChunk = 0;
+	m_iMatrixNextRow = 0;
+	m_iMatrixDoneRows = 0;
+	m_pRepairState = NULL;
+	m_bStateSaved = false;
+	m_bKeepState = false;
+	m_lResumeOffset = 0;
+	m_bMatrixRestored = false;
+	prefetchdepth = REPAIR_PREFETCH_DEPTH;
+
+	DiskFile::SetMmapLimit((u64)g_pOptions->GetParMmapLimit() * 1024 * 1024);
+
+	if (g_pOptions->GetParTileSize() > 0)
+	{
+		inputbatchsize = REPAIR_INPUT_BATCH;
+		tilesize = g_pOptions->GetParTileSize() * 1024;
+	}
+}
+
+Result Repairer::PreProcess(const char *szParFilename)
+{
+	char szMemParam[20];
+	snprintf(szMemParam, 20, "-m%i", m_pOwner->GetParBuffer());
+	szMemParam[20-1] = '\0';
+
+	if (g_pOptions->GetParScan() == Options::psFull)
+	{
+		char szWildcardParam[1024];
+		strncpy(szWildcardParam, szParFilename, 1024);
+		szWildcardParam[1024-1] = '\0';
+		char* szBasename = Util::BaseFileName(szWildcardParam);
+		if (szBasename != szWildcardParam && strlen(szBasename) > 0)
+		{
+			szBasename[0] = '*';
+			szBasename[1] = '\0';
+		}
+
+		const char* argv[] = { "par2", "r", "-v", "-v", szMemParam, szParFilename, szWildcardParam };
+		if (!commandLine.Parse(7, (char**)argv))
+		{
+			return eInvalidCommandLineArguments;
+		}
+	}
+	else
+	{
+		const char* argv[] = { "par2", "r", "-v", "-v", szMemParam, szParFilename };
+		if (!commandLine.Parse(6, (char**)argv))
+		{
+			return eInvalidCommandLineArguments;
+		}
+	}
+
+	return Par2Repairer::PreProcess(commandLine);
+}
+
+Repairer::~Repairer()
+{
+	delete m_pRepairState;
+}
+
+Result Repairer::Process(bool dorepair)
+{
+	return Par2Repairer::Process(commandLine, dorepair);
+}
+
+bool Repairer::BuildStateFilename(char* szFilename, int iBufLen)
+{
+	if (m_pOwner->m_iNZBID == 0)
+	{
+		return false;
+	}
+
+	snprintf(szFilename, iBufLen, "%sn%i-%s%s", g_pOptions->GetQueueDir(), m_pOwner->m_iNZBID,
+		setid.print().c_str(), REPAIR_STATE_EXT);
+	szFilename[iBufLen-1] = '\0';
+	return true;
+}
+
+/*
+ * Checks if the repair of the par-set was interrupted before and if the saved
+ * progress can be used. The damaged files are then moved back to their names
+ * so that the verification finds the same blocks as before the interruption.
+ */
+void Repairer::LoadRepairState()
+{
+	char szFilename[1024];
+	if (!BuildStateFilename(szFilename, 1024) || !Util::FileExists(szFilename))
+	{
+		return;
+	}
+
+	RepairState* pState = new RepairState(szFilename, searchpath);
+	bool bOK = pState->Load() && pState->m_SetID == setid && pState->m_lBlockSize == blocksize;
+
+	for (RepairState::Files::iterator it = pState->m_Files.begin(); bOK && it != pState->m_Files.end(); it++)
+	{
+		RepairState::FileEntry& entry = *it;
+		string filename = searchpath + entry.m_TargetFilename;
+		string partname = filename + REPAIR_PART_EXT;
+		string renamedname = searchpath + entry.m_RenamedFilename;
+		bool bRestored = Util::FileExists(partname.c_str());
+		const char* szPartFilename = bRestored ? partname.c_str() : filename.c_str();
+		const char* szDamagedFilename = bRestored ? filename.c_str() : renamedname.c_str();
+
+		bOK = Util::FileSize(szPartFilename) == entry.m_lTargetSize &&
+			(entry.m_RenamedFilename.empty() ||
+			 (Util::FileSize(szDamagedFilename) == entry.m_lRenamedSize &&
+			  Util::FileModificationTime(szDamagedFilename) == entry.m_tRenamedTime));
+	}
+
+	if (!bOK)
+	{
+		m_pOwner->PrintMessage(Message::mkWarning, "Discarding saved repair progress for %s", m_pOwner->m_szInfoName);
+		pState->Discard();
+		delete pState;
+		return;
+	}
+
+	for (RepairState::Files::iterator it = pState->m_Files.begin(); it != pState->m_Files.end(); it++)
+	{
+		RepairState::FileEntry& entry = *it;
+		string filename = searchpath + entry.m_TargetFilename;
+		string partname = filename + REPAIR_PART_EXT;
+		if (!Util::FileExists(partname.c_str()))
+		{
+			rename(filename.c_str(), partname.c_str());
+			if (!entry.m_RenamedFilename.empty())
+			{
+				string renamedname = searchpath + entry.m_RenamedFilename;
+				rename(renamedname.c_str(), filename.c_str());
+			}
+		}
+	}
+
+	m_pOwner->PrintMessage(Message::mkInfo, "Found saved repair progress for %s", m_pOwner->m_szInfoName);
+	m_pRepairState = pState;
+}
+
+/*
+ * Deletes the saved progress at the end of the par-check unless the repair
+ * was interrupted and can be continued later.
+ */
+void Repairer::FinishRepairState()
+{
+	if (m_pRepairState && !m_bKeepState)
+	{
+		m_pRepairState->Discard();
+		delete m_pRepairState;
+		m_pRepairState = NULL;
+		m_bStateSaved = false;
+	}
+}
+
+/*
+ * Partially repaired files are reused if the repair is continued.
+ */
+bool Repairer::CreateTargetFile(DiskFile *targetfile, string filename, u64 filesize)
+{
+	RepairState::FileEntry* pEntry = m_pRepairState ? m_pRepairState->FindFile(filename) : NULL;
+	string partname = filename + REPAIR_PART_EXT;
+	if (pEntry && pEntry->m_lTargetSize == (long long)filesize &&
+		!rename(partname.c_str(), filename.c_str()) && targetfile->OpenWrite(filename, filesize))
+	{
+		pEntry->m_bResumed = true;
+		return true;
+	}
+
+	return Par2Repairer::CreateTargetFile(targetfile, filename, filesize);
+}
+
+bool Repairer::SameRepairPlan()
+{
+	if (m_pRepairState->m_Present.size() != sourceblocks.size() ||
+		m_pRepairState->m_Exponents.size() != missingblockcount ||
+		m_pRepairState->m_Files.size() != verifylist.size())
+	{
+		return false;
+	}
+
+	for (u32 i = 0; i < sourceblocks.size(); i++)
+	{
+		if ((m_pRepairState->m_Present[i] != 0) != sourceblocks[i].IsSet())
+		{
+			return false;
+		}
+	}
+
+	map<u32, RecoveryPacket*>::iterator rp = recoverypacketmap.begin();
+	for (u32 i = 0; i < missingblockcount; i++, rp++)
+	{
+		if (m_pRepairState->m_Exponents[i] != rp->first)
+		{
+			return false;
+		}
+	}
+
+	for (RepairState::Files::iterator it = m_pRepairState->m_Files.begin(); it != m_pRepairState->m_Files.end(); it++)
+	{
+		if (!it->m_bResumed)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Uses the matrix saved by an interrupted repair of the same blocks,
+ * otherwise solves the matrix and saves it together with the files being repaired.
+ */
+bool Repairer::SolveRSmatrix()
+{
+	if (m_pRepairState && SameRepairPlan() &&
+		rs.SetMatrix(&m_pRepairState->m_Matrix[0], m_pRepairState->m_iRows, m_pRepairState->m_iCols))
+	{
+		m_lResumeOffset = m_pRepairState->m_lOffset;
+		m_bStateSaved = true;
+		m_bMatrixRestored = true;
+		return true;
+	}
+
+	m_lResumeOffset = 0;
+
+	if (!Par2Repairer::SolveRSmatrix())
+	{
+		return false;
+	}
+
+	SaveRepairState();
+	return true;
+}
+
+void Repairer::SaveRepairState()
+{
+	char szFilename[1024];
+	if (!BuildStateFilename(szFilename, 1024))
+	{
+		return;
+	}
+
+	RepairState* pState = new RepairState(szFilename, searchpath);
+	pState->m_SetID = setid;
+	pState->m_lBlockSize = blocksize;
+
+	for (vector<DataBlock>::iterator it = sourceblocks.begin(); it != sourceblocks.end(); it++)
+	{
+		pState->m_Present.push_back(it->IsSet() ? 1 : 0);
+	}
+
+	map<u32, RecoveryPacket*>::iterator rp = recoverypacketmap.begin();
+	for (u32 i = 0; i < missingblockcount; i++, rp++)
+	{
+		pState->m_Exponents.push_back((u16)rp->first);
+	}
+
+	for (vector<Par2RepairerSourceFile*>::iterator it = verifylist.begin(); it != verifylist.end(); it++)
+	{
+		string filename = (*it)->TargetFileName();
+		map<string, string>::iterator renamed = renamedfiles.find(filename);
+		string renamedname = renamed != renamedfiles.end() ? renamed->second : "";
+
+		if (filename.compare(0, searchpath.size(), searchpath) ||
+			(!renamedname.empty() && renamedname.compare(0, searchpath.size(), searchpath)))
+		{
+			// files outside of the directory of the par-set are not supported
+			delete pState;
+			return;
+		}
+
+		RepairState::FileEntry entry;
+		entry.m_TargetFilename = filename.substr(searchpath.size());
+		entry.m_lTargetSize = (long long)(*it)->GetDescriptionPacket()->FileSize();
+		entry.m_RenamedFilename = renamedname.empty() ? "" : renamedname.substr(searchpath.size());
+		entry.m_lRenamedSize = renamedname.empty() ? 0 : Util::FileSize(renamedname.c_str());
+		entry.m_tRenamedTime = renamedname.empty() ? 0 : Util::FileModificationTime(renamedname.c_str());
+		entry.m_bResumed = false;
+		pState->m_Files.push_back(entry);
+	}
+
+	const Galois16* pMatrix = rs.GetMatrix(pState->m_iRows, pState->m_iCols);
+	pState->m_Matrix.assign(pMatrix, pMatrix + (size_t)pState->m_iRows * pState->m_iCols);
+
+	if (m_pRepairState)
+	{
+		m_pRepairState->Discard();
+		delete m_pRepairState;
+	}
+	m_pRepairState = pState;
+
+	m_bStateSaved = pState->Save();
+	if (!m_bStateSaved)
+	{
+		m_pOwner->PrintMessage(Message::mkWarning, "Could not save repair progress for %s into %s", m_pOwner->m_szInfoName, szFilename);
+	}
+}
+
+u64 Repairer::ResumeRepair()
+{
+	if (m_lResumeOffset > 0)
+	{
+		m_pOwner->PrintMessage(Message::mkInfo, "Continuing repair of %s at %i%%",
+			m_pOwner->m_szInfoName, (int)(m_lResumeOffset * 100 / blocksize));
+	}
+	return m_lResumeOffset;
+}
+
+/*
+ * The repaired data is written to disk before the progress is recorded,
+ * after an interruption the repair continues from the last recorded offset.
+ */
+void Repairer::ChunkCompleted(u64 blockoffset)
+{
+	if (!m_bStateSaved || blockoffset >= blocksize)
+	{
+		return;
+	}
+
+	for (vector<Par2RepairerSourceFile*>::iterator it = verifylist.begin(); it != verifylist.end(); it++)
+	{
+		DiskFile* pTargetFile = (*it)->GetTargetFile();
+		if (pTargetFile && pTargetFile->IsOpen() && !pTargetFile->Flush())
+		{
+			return;
+		}
+	}
+
+	m_pRepairState->SaveOffset(blockoffset);
+}
 
-Result Repairer::PreProcess(const char *szParFilename)
+bool Repairer::DeleteIncompleteTargetFiles()
 {
-	char szMemParam[20];
-	snprintf(szMemParam, 20, "-m%i", g_pOptions->GetParBuffer());
-	szMemParam[20-1] = '\0';
+	if (m_bStateSaved && m_pOwner->m_bInterrupted)
+	{
+		KeepRepairState();
+		return true;
+	}
 
-	if (g_pOptions->GetParScan() == Options::psFull)
+	return Par2Repairer::DeleteIncompleteTargetFiles();
+}
+
+/*
+ * Moves the partially repaired files aside and the damaged files back to their
+ * names, the repair continues when the par-check is started again.
+ */
+void Repairer::KeepRepairState()
+{
+	for (vector<Par2RepairerSourceFile*>::iterator it = verifylist.begin(); it != verifylist.end(); it++)
 	{
-		char szWildcardParam[1024];
-		strncpy(szWildcardParam, szParFilename, 1024);
-		szWildcardParam[1024-1] = '\0';
-		char* szBasename = Util::BaseFileName(szWildcardParam);
-		if (szBasename != szWildcardParam && strlen(szBasename) > 0)
+		Par2RepairerSourceFile* sourcefile = *it;
+		DiskFile* pTargetFile = sourcefile->GetTargetFile();
+		if (pTargetFile && pTargetFile->IsOpen())
 		{
-			szBasename[0] = '*';
-			szBasename[1] = '\0';
+			pTargetFile->Close();
 		}
 
-		const char* argv[] = { "par2", "r", "-v", "-v", szMemParam, szParFilename, szWildcardParam };
-		if (!commandLine.Parse(7, (char**)argv))
-		{
-			return eInvalidCommandLineArguments;
-		}
-	}
-	else
-	{
-		const char* argv[] = { "par2", "r", "-v", "-v", szMemParam, szParFilename };
-		if (!commandLine.Parse(6, (char**)argv))
+		string filename = sourcefile->TargetFileName();
+		string partname = filename + REPAIR_PART_EXT;
+		rename(filename.c_str(), partname.c_str());
+
+		map<string, string>::iterator renamed = renamedfiles.find(filename);
+		if (renamed != renamedfiles.end())
 		{
-			return eInvalidCommandLineArguments;
+			rename(renamed->second.c_str(), filename.c_str());
 		}
 	}
 
-	return Par2Repairer::PreProcess(commandLine);
-}
-
-Result Repairer::Process(bool dorepair)
-{
-	return Par2Repairer::Process(commandLine, dorepair);
+	m_bKeepState = true;
+	m_pOwner->PrintMessage(Message::mkInfo, "Saved repair progress for %s", m_pOwner->m_szInfoName);
 }
 
 
 bool Repairer::ScanDataFile(DiskFile *diskfile, Par2RepairerSourceFile* &sourcefile,
 	MatchType &matchtype, MD5Hash &hashfull, MD5Hash &hash16k, u32 &count)
 {
-	if (m_pOwner->GetParQuick() && sourcefile)
+	if (IsRepairPart(diskfile->FileName()))
+	{
+		// partially repaired files are used only to continue their repair
+		matchtype = eNoMatch;
+		count = 0;
+		return true;
+	}
+
+	if (sourcefile)
 	{
 		string path;
 		string name;
@@ -187,14 +985,25 @@ bool Repairer::ScanDataFile(DiskFile *diskfile, Par2RepairerSourceFile* &sourcef
 		sig_filename(name);
 
 		int iAvailableBlocks = sourcefile->BlockCount();
-		ParChecker::EFileStatus eFileStatus = m_pOwner->VerifyDataFile(diskfile, sourcefile, &iAvailableBlocks);
+
+		// block checksums computed during download are as good as a full verification
+		ParChecker::EFileStatus eFileStatus = m_pOwner->VerifyDataFileHashes(diskfile, sourcefile, &iAvailableBlocks);
+		bool bQuick = eFileStatus == ParChecker::fsUnknown && m_pOwner->GetParQuick();
+		if (bQuick)
+		{
+			eFileStatus = m_pOwner->VerifyDataFile(diskfile, sourcefile, &iAvailableBlocks);
+		}
+
 		if (eFileStatus != ParChecker::fsUnknown)
 		{
 			sig_done(name, iAvailableBlocks, sourcefile->BlockCount());
 			sig_progress(1000.0);
 			matchtype = eFileStatus == ParChecker::fsSuccess ? eFullMatch :
 				eFileStatus == ParChecker::fsPartial ? ePartialMatch : eNoMatch;
-			m_pOwner->SetParFull(false);
+			if (bQuick)
+			{
+				m_pOwner->SetParFull(false);
+			}
 			return true;
 		}
 	}
@@ -202,10 +1011,199 @@ bool Repairer::ScanDataFile(DiskFile *diskfile, Par2RepairerSourceFile* &sourcef
 	return Par2Repairer::ScanDataFile(diskfile, sourcefile, matchtype, hashfull, hash16k, count);
 }
 
+/*
+ * Scans the files which can't be verified quickly in several threads.
+ * The found blocks are assigned to the files later, in the usual
+ * order, when libpar2 processes each file in ScanDataFile.
+ */
+void Repairer::ScanDataFiles(vector<ScanJob*> &jobs)
+{
+	vector<ScanJob*> scanJobs;
+	for (vector<ScanJob*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+	{
+		ScanJob* pScanJob = *it;
+		if (!m_pOwner->IsQuickVerifiable(pScanJob->filename.c_str(), pScanJob->sourcefile) &&
+			!IsRepairPart(pScanJob->filename))
+		{
+			scanJobs.push_back(pScanJob);
+		}
+	}
+
+	int iMaxThreads = m_pOwner->GetMaxThreads();
+	int iThreads = iMaxThreads > (int)scanJobs.size() ? (int)scanJobs.size() : iMaxThreads;
+	if (iThreads < 2 || cancelled)
+	{
+		// the files are scanned one by one as usual
+		return;
+	}
+
+	m_pOwner->PrintMessage(Message::mkInfo, "Using %i thread(s) to scan %i file(s) for %s",
+		iThreads, (int)scanJobs.size(), m_pOwner->m_szNZBName);
+
+	m_pScanJobs = &scanJobs;
+	m_NextScanJob.Add(-m_NextScanJob.Get()); // reset to zero
+
+	// the calling thread scans files too
+	ScanThreads threads;
+	for (int i = 1; i < iThreads; i++)
+	{
+		ScanThread* pScanThread = new ScanThread(this);
+		threads.push_back(pScanThread);
+		pScanThread->Start();
+	}
+
+	ProcessScanJobs();
+
+	for (ScanThreads::iterator it = threads.begin(); it != threads.end(); it++)
+	{
+		ScanThread* pScanThread = *it;
+		while (pScanThread->IsRunning())
+		{
+			usleep(SYNC_SLEEP_INTERVAL);
+		}
+		delete pScanThread;
+	}
+
+	m_pScanJobs = NULL;
+}
+
+void Repairer::ProcessScanJobs()
+{
+	while (!cancelled)
+	{
+		long lIndex = m_NextScanJob.Add(1) - 1;
+		if (lIndex >= (long)m_pScanJobs->size())
+		{
+			break;
+		}
+		RunScanJob((*m_pScanJobs)[lIndex]);
+	}
+}
+
+/*
+ * Solves the recovery matrix using several threads if many blocks are missing
+ * and reports the time spent for solving.
+ */
+bool Repairer::ComputeRSmatrix()
+{
+	int iMaxThreads = m_pOwner->GetMaxThreads();
+	int iThreads = missingblockcount >= MATRIX_PARALLEL_MIN_BLOCKS && iMaxThreads > 1 ? iMaxThreads : 1;
+
+	// the calling thread processes rows too
+	for (int i = 1; i < iThreads; i++)
+	{
+		MatrixThread* pMatrixThread = new MatrixThread(this);
+		m_MatrixThreads.push_back(pMatrixThread);
+		pMatrixThread->Start();
+	}
+	m_iMatrixThreads = iThreads;
+	rsparallel = iThreads > 1 ? this : NULL;
+
+#ifdef WIN32
+	DWORD iStartTicks = GetTickCount();
+#else
+	timeval tStart;
+	gettimeofday(&tStart, NULL);
+#endif
+
+	bool bOK = Par2Repairer::ComputeRSmatrix();
+
+#ifdef WIN32
+	int iMSec = (int)(GetTickCount() - iStartTicks);
+#else
+	timeval tEnd;
+	gettimeofday(&tEnd, NULL);
+	int iMSec = (int)((tEnd.tv_sec - tStart.tv_sec) * 1000 + (tEnd.tv_usec - tStart.tv_usec) / 1000);
+#endif
+
+	rsparallel = NULL;
+	for (MatrixThreads::iterator it = m_MatrixThreads.begin(); it != m_MatrixThreads.end(); it++)
+	{
+		(*it)->Stop();
+	}
+	for (MatrixThreads::iterator it = m_MatrixThreads.begin(); it != m_MatrixThreads.end(); it++)
+	{
+		MatrixThread* pMatrixThread = *it;
+		while (pMatrixThread->IsRunning())
+		{
+			usleep(SYNC_SLEEP_INTERVAL);
+		}
+		delete pMatrixThread;
+	}
+	m_MatrixThreads.clear();
+
+	if (bOK && missingblockcount > 0 && !m_bMatrixRestored)
+	{
+		m_pOwner->PrintMessage(Message::mkInfo, "Solved recovery matrix for %i block(s) in %i.%03i sec using %i thread(s) for %s",
+			(int)missingblockcount, iMSec / 1000, iMSec % 1000, iThreads, m_pOwner->m_szNZBName);
+	}
+
+	return bOK;
+}
+
+/*
+ * Called by libpar2 for each pivot row of the recovery matrix. The rows are
+ * split into chunks which are taken by the matrix threads and the calling thread.
+ */
+void Repairer::Run(RSRowJob &job, u32 rows)
+{
+	if (rows == 0)
+	{
+		return;
+	}
+
+	u32 iChunk = rows / (m_iMatrixThreads * 4);
+
+	m_MatrixMutex.Lock();
+	m_pMatrixJob = &job;
+	m_iMatrixRows = rows;
+	m_iMatrixChunk = iChunk > MATRIX_MIN_CHUNK ? iChunk : MATRIX_MIN_CHUNK;
+	m_iMatrixNextRow = 0;
+	m_iMatrixDoneRows = 0;
+	m_MatrixMutex.Unlock();
+
+	for (MatrixThreads::iterator it = m_MatrixThreads.begin(); it != m_MatrixThreads.end(); it++)
+	{
+		(*it)->NewJob();
+	}
+
+	ProcessMatrixRows();
+
+	// Wait until other threads complete rows they have taken
+	m_semMatrixDone.Wait();
+}
+
+void Repairer::ProcessMatrixRows()
+{
+	while (true)
+	{
+		m_MatrixMutex.Lock();
+		if (m_iMatrixNextRow >= m_iMatrixRows)
+		{
+			m_MatrixMutex.Unlock();
+			break;
+		}
+		RSRowJob* pJob = m_pMatrixJob;
+		u32 iFirst = m_iMatrixNextRow;
+		u32 iLast = iFirst + m_iMatrixChunk < m_iMatrixRows ? iFirst + m_iMatrixChunk : m_iMatrixRows;
+		m_iMatrixNextRow = iLast;
+		m_MatrixMutex.Unlock();
+
+		pJob->ProcessRows(iFirst, iLast);
+
+		m_MatrixMutex.Lock();
+		m_iMatrixDoneRows += iLast - iFirst;
+		if (m_iMatrixDoneRows == m_iMatrixRows)
+		{
+			m_semMatrixDone.Post();
+		}
+		m_MatrixMutex.Unlock();
+	}
+}
+
 void Repairer::BeginRepair()
 {
-	int iMaxThreads = g_pOptions->GetParThreads() > 0 ? g_pOptions->GetParThreads() : Util::NumberOfCpuCores();
-	iMaxThreads = iMaxThreads > 0 ? iMaxThreads : 1;
+	int iMaxThreads = m_pOwner->GetMaxThreads();
 
 	int iThreads = iMaxThreads > (int)missingblockcount ? (int)missingblockcount : iMaxThreads;
 
@@ -214,13 +1212,21 @@ void Repairer::BeginRepair()
 
 	m_bParallel = iThreads > 1;
 
+	m_pReadThread = new ReadThread(this);
+	m_pReadThread->Start();
+
 	if (m_bParallel)
 	{
 		for (int i = 0; i < iThreads; i++)
 		{
-			RepairThread* pRepairThread = new RepairThread(this);
+			m_Ranges.push_back(new RepairRange());
+		}
+
+		// the first range is processed by the thread calling RepairData
+		for (int i = 1; i < iThreads; i++)
+		{
+			RepairThread* pRepairThread = new RepairThread(this, i);
 			m_Threads.push_back(pRepairThread);
-			pRepairThread->SetAutoDestroy(true);
 			pRepairThread->Start();
 		}
 
@@ -232,121 +1238,267 @@ void Repairer::BeginRepair()
 
 void Repairer::EndRepair()
 {
+	if (m_pReadThread)
+	{
+		m_pReadThread->Stop();
+		while (m_pReadThread->IsRunning())
+		{
+			usleep(SYNC_SLEEP_INTERVAL);
+		}
+		delete m_pReadThread;
+		m_pReadThread = NULL;
+	}
+
 	if (m_bParallel)
 	{
 		for (Threads::iterator it = m_Threads.begin(); it != m_Threads.end(); it++)
 		{
-			RepairThread* pRepairThread = (RepairThread*)*it;
+			RepairThread* pRepairThread = *it;
 			pRepairThread->Stop();
 		}
 
+		for (Threads::iterator it = m_Threads.begin(); it != m_Threads.end(); it++)
+		{
+			RepairThread* pRepairThread = *it;
+			while (pRepairThread->IsRunning())
+			{
+				usleep(SYNC_SLEEP_INTERVAL);
+			}
+			delete pRepairThread;
+		}
+		m_Threads.clear();
+
+		for (Ranges::iterator it = m_Ranges.begin(); it != m_Ranges.end(); it++)
+		{
+			delete *it;
+		}
+		m_Ranges.clear();
+
 #ifdef WIN32
 		timeEndPeriod(1);
 #endif
 	}
 }
 
-bool Repairer::RepairData(u32 inputindex, size_t blocklength)
+/*
+ * Splits the output blocks into one range per thread, wakes up the threads
+ * and waits until all output blocks are processed.
+ */
+bool Repairer::RepairData(u32 inputindex, u32 inputcount, size_t blocklength)
 {
 	if (!m_bParallel)
 	{
 		return false;
 	}
 
-	for (u32 outputindex = 0; outputindex < missingblockcount; )
+	u32 iRangeCount = (u32)m_Ranges.size();
+	// the calling thread holds one extra block until it has finished its own part
+	m_PendingBlocks.Add(missingblockcount + 1);
+	for (u32 i = 0; i < iRangeCount; i++)
 	{
-		bool bJobAdded = false;
-		for (Threads::iterator it = m_Threads.begin(); it != m_Threads.end(); it++)
-		{
-			RepairThread* pRepairThread = (RepairThread*)*it;
-			if (!pRepairThread->IsWorking())
-			{
-				pRepairThread->RepairBlock(inputindex, outputindex, blocklength);
-				outputindex++;
-				bJobAdded = true;
-				break;
-			}
-		}
+		m_Ranges[i]->Assign(inputindex, inputcount, blocklength,
+			(u32)((u64)missingblockcount * i / iRangeCount), (u32)((u64)missingblockcount * (i + 1) / iRangeCount));
+	}
+	for (Threads::iterator it = m_Threads.begin(); it != m_Threads.end(); it++)
+	{
+		(*it)->NewJob();
+	}
+
+	ProcessRanges(0);
 
-		if (cancelled)
+	if (cancelled)
+	{
+		for (Ranges::iterator it = m_Ranges.begin(); it != m_Ranges.end(); it++)
 		{
-			break;
+			BlocksDone((*it)->Clear());
 		}
+	}
+
+	// Wait until other threads complete blocks they have taken
+	BlocksDone(1);
+	m_semBlocksDone.Wait();
+
+	if (noiselevel > CommandLine::nlQuiet)
+	{
+		// Update a progress indicator
+		u32 oldfraction = (u32)(1000 * progress / totaldata);
+		progress += (u64)blocklength * inputcount * missingblockcount;
+		u32 newfraction = (u32)(1000 * progress / totaldata);
 
-		if (!bJobAdded)
+		if (oldfraction != newfraction)
 		{
-			usleep(SYNC_SLEEP_INTERVAL);
+			sig_progress(newfraction);
 		}
 	}
 
-	// Wait until all m_Threads complete their jobs
-	bool bWorking = true;
-	while (bWorking)
+	return true;
+}
+
+/*
+ * Processes the blocks of own range and then helps other threads
+ * by taking blocks from the end of their ranges.
+ */
+void Repairer::ProcessRanges(int iOwnRange)
+{
+	u32 inputindex, inputcount, outputindex;
+	size_t blocklength;
+
+	int iRangeCount = (int)m_Ranges.size();
+	for (int i = 0; i < iRangeCount && !cancelled; i++)
 	{
-		bWorking = false;
-		for (Threads::iterator it = m_Threads.begin(); it != m_Threads.end(); it++)
+		RepairRange* pRange = m_Ranges[(iOwnRange + i) % iRangeCount];
+		while (!cancelled && pRange->Take(i > 0, inputindex, inputcount, blocklength, outputindex))
 		{
-			RepairThread* pRepairThread = (RepairThread*)*it;
-			if (pRepairThread->IsWorking())
-			{
-				bWorking = true;
-				usleep(SYNC_SLEEP_INTERVAL);
-				break;
-			}
+			RepairBlocks(inputindex, inputcount, blocklength, outputindex, 1);
+			BlocksDone(1);
 		}
 	}
+}
+
+/*
+ * Wakes up the thread waiting in RepairData when the last pending block is done.
+ */
+void Repairer::BlocksDone(long lCount)
+{
+	if (m_PendingBlocks.Add(-lCount) == 0)
+	{
+		m_semBlocksDone.Post();
+	}
+}
 
+bool Repairer::BeginReadInputBlocks(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount,
+	void *buffer, u64 &totalwritten)
+{
+	m_pReadThread->BeginRead(blockoffset, blocklength, inputindex, inputcount, buffer, &totalwritten);
 	return true;
 }
 
-void Repairer::RepairBlock(u32 inputindex, u32 outputindex, size_t blocklength)
+bool Repairer::EndReadInputBlocks()
 {
-	// Select the appropriate part of the output buffer
-	void *outbuf = &((u8*)outputbuffer)[chunksize * outputindex];
+	return m_pReadThread->EndRead();
+}
 
-	// Process the data
-	rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf);
+void RepairRange::Assign(u32 inputindex, u32 inputcount, size_t blocklength, u32 begin, u32 end)
+{
+	m_lock.Lock();
+	m_inputindex = inputindex;
+	m_inputcount = inputcount;
+	m_blocklength = blocklength;
+	m_begin = begin;
+	m_end = end;
+	m_lock.Unlock();
+}
 
-	if (noiselevel > CommandLine::nlQuiet)
+bool RepairRange::Take(bool bSteal, u32 &inputindex, u32 &inputcount, size_t &blocklength, u32 &outputindex)
+{
+	m_lock.Lock();
+	bool bTaken = m_begin < m_end;
+	if (bTaken)
 	{
-		// Update a progress indicator
-		progresslock.Lock();
-		u32 oldfraction = (u32)(1000 * progress / totaldata);
-		progress += blocklength;
-		u32 newfraction = (u32)(1000 * progress / totaldata);
-		progresslock.Unlock();
+		inputindex = m_inputindex;
+		inputcount = m_inputcount;
+		blocklength = m_blocklength;
+		outputindex = bSteal ? --m_end : m_begin++;
+	}
+	m_lock.Unlock();
+	return bTaken;
+}
 
-		if (oldfraction != newfraction)
+/*
+ * Removes all remaining blocks from the range, returns the number of removed blocks.
+ */
+u32 RepairRange::Clear()
+{
+	m_lock.Lock();
+	u32 iCount = m_end - m_begin;
+	m_begin = m_end;
+	m_lock.Unlock();
+	return iCount;
+}
+
+void ReadThread::Run()
+{
+	while (true)
+	{
+		m_semJobs.Wait();
+		if (IsStopped())
 		{
-			sig_progress(newfraction);
+			break;
 		}
+
+		m_JobsMutex.Lock();
+		ReadJob job = m_Jobs.front();
+		m_Jobs.pop_front();
+		m_JobsMutex.Unlock();
+
+		bool bResult = m_pOwner->ReadInputBlocks(job.blockoffset, job.blocklength, job.inputindex, job.inputcount,
+			job.buffer, *job.totalwritten);
+
+		m_JobsMutex.Lock();
+		m_Results.push_back(bResult);
+		m_JobsMutex.Unlock();
+		m_semResults.Post();
 	}
 }
 
+void ReadThread::BeginRead(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount,
+	void *buffer, u64 *totalwritten)
+{
+	ReadJob job;
+	job.blockoffset = blockoffset;
+	job.blocklength = blocklength;
+	job.inputindex = inputindex;
+	job.inputcount = inputcount;
+	job.buffer = buffer;
+	job.totalwritten = totalwritten;
+
+	m_JobsMutex.Lock();
+	m_Jobs.push_back(job);
+	m_JobsMutex.Unlock();
+	m_semJobs.Post();
+}
+
+/*
+ * Waits until the oldest requested batch is read.
+ */
+bool ReadThread::EndRead()
+{
+	m_semResults.Wait();
+
+	m_JobsMutex.Lock();
+	bool bResult = m_Results.front();
+	m_Results.pop_front();
+	m_JobsMutex.Unlock();
+
+	return bResult;
+}
+
 void RepairThread::Run()
 {
-	while (!IsStopped())
+	while (true)
 	{
-		if (m_bWorking)
+		m_semJob.Wait();
+		if (IsStopped())
 		{
-			m_pOwner->RepairBlock(m_inputindex, m_outputindex, m_blocklength);
-			m_bWorking = false;
+			break;
 		}
-		else
+		m_pOwner->ProcessRanges(m_iRange);
+	}
+}
+
+void MatrixThread::Run()
+{
+	while (true)
+	{
+		m_semJob.Wait();
+		if (IsStopped())
 		{
-			usleep(SYNC_SLEEP_INTERVAL);
+			break;
 		}
+		m_pOwner->ProcessMatrixRows();
 	}
 }
 
-void RepairThread::RepairBlock(u32 inputindex, u32 outputindex, size_t blocklength)
-{
-	m_inputindex = inputindex;
-	m_outputindex = outputindex;
-	m_blocklength = blocklength;
-	m_bWorking = true;
-}
-
 
 class MissingFilesComparator
 {
@@ -417,6 +1569,11 @@ ParChecker::ParChecker()
 	m_bParQuick = false;
 	m_bForceRepair = false;
 	m_bParFull = false;
+	m_pReportedParSet = NULL;
+	m_iMaxParSets = 1;
+	m_pPacketCache = NULL;
+	m_iNZBID = 0;
+	m_bInterrupted = false;
 }
 
 ParChecker::~ParChecker()
@@ -486,6 +1643,137 @@ void ParChecker::Run()
 	Completed();
 }
 
+/*
+ * Checks one par-set of the nzb on behalf of the main par-checker, which
+ * runs several such checkers at once. The callbacks are passed to the
+ * main checker.
+ */
+class ParSetChecker : public ParChecker
+{
+private:
+	ParChecker*		m_pOwner;
+	char*			m_szSetParFilename;
+	EStatus			m_eSetStatus;
+
+protected:
+	virtual bool	RequestMorePars(const char* szParFilename, int iBlockNeeded, int* pBlockFound)
+						{ return m_pOwner->RequestMorePars(szParFilename, iBlockNeeded, pBlockFound); }
+	virtual void	UpdateProgress() { m_pOwner->UpdateParSetProgress(this); }
+	virtual void	PrintMessage(Message::EKind eKind, const char* szFormat, ...);
+	virtual void	RegisterParredFile(const char* szFilename);
+	virtual bool	IsParredFile(const char* szFilename);
+	virtual EFileStatus	FindFileCrc(const char* szFilename, unsigned long* lCrc, SegmentList* pSegments)
+						{ return m_pOwner->FindFileCrc(szFilename, lCrc, pSegments); }
+	virtual bool	FindFileHashes(const char* szFilename, ParHashes* pParHashes)
+						{ return m_pOwner->FindFileHashes(szFilename, pParHashes); }
+	virtual int		GetMaxThreads();
+	virtual int		GetParBuffer();
+
+public:
+					ParSetChecker(ParChecker* pOwner, const char* szParFilename);
+	virtual			~ParSetChecker();
+	virtual void	Run();
+	EStatus			GetSetStatus() { return m_eSetStatus; }
+};
+
+ParSetChecker::ParSetChecker(ParChecker* pOwner, const char* szParFilename)
+{
+	m_pOwner = pOwner;
+	m_szSetParFilename = strdup(szParFilename);
+	m_eSetStatus = psFailed;
+	SetDestDir(pOwner->m_szDestDir);
+	SetNZBName(pOwner->m_szNZBName);
+	SetParQuick(pOwner->GetParQuick());
+	SetForceRepair(pOwner->GetForceRepair());
+	SetParFull(true);
+	SetPacketCache(pOwner->m_pPacketCache);
+	SetNZBID(pOwner->m_iNZBID);
+}
+
+ParSetChecker::~ParSetChecker()
+{
+	free(m_szSetParFilename);
+}
+
+void ParSetChecker::Run()
+{
+	m_eSetStatus = RunParCheck(m_szSetParFilename);
+
+	if (g_pOptions->GetBrokenLog())
+	{
+		m_pOwner->m_mutexParSets.Lock();
+		WriteBrokenLog(m_eSetStatus);
+		m_pOwner->m_mutexParSets.Unlock();
+	}
+
+	m_pOwner->m_mutexParSets.Lock();
+	m_pOwner->m_FinishedParSets.push_back(this);
+	m_pOwner->m_mutexParSets.Unlock();
+	m_pOwner->m_semParSetDone.Post();
+}
+
+void ParSetChecker::PrintMessage(Message::EKind eKind, const char* szFormat, ...)
+{
+	char szText[1024];
+	va_list args;
+	va_start(args, szFormat);
+	vsnprintf(szText, 1024, szFormat, args);
+	va_end(args);
+	szText[1024-1] = '\0';
+
+	m_pOwner->PrintMessage(eKind, "%s", szText);
+}
+
+void ParSetChecker::RegisterParredFile(const char* szFilename)
+{
+	m_pOwner->m_mutexParSets.Lock();
+	m_pOwner->RegisterParredFile(szFilename);
+	m_pOwner->m_mutexParSets.Unlock();
+}
+
+bool ParSetChecker::IsParredFile(const char* szFilename)
+{
+	m_pOwner->m_mutexParSets.Lock();
+	bool bParred = m_pOwner->IsParredFile(szFilename);
+	m_pOwner->m_mutexParSets.Unlock();
+	return bParred;
+}
+
+/*
+ * The thread budget of the main checker is shared by all par-sets being
+ * checked at the moment.
+ */
+int ParSetChecker::GetMaxThreads()
+{
+	m_pOwner->m_mutexParSets.Lock();
+	int iRunningSets = (int)m_pOwner->m_RunningParSets.size();
+	m_pOwner->m_mutexParSets.Unlock();
+
+	int iMaxThreads = m_pOwner->GetMaxThreads() / (iRunningSets > 0 ? iRunningSets : 1);
+	return iMaxThreads > 0 ? iMaxThreads : 1;
+}
+
+/*
+ * The memory limit is divided between all par-sets which may run at the same
+ * time, so that the sets started first don't take the whole buffer.
+ */
+int ParSetChecker::GetParBuffer()
+{
+	int iParBuffer = m_pOwner->GetParBuffer() / m_pOwner->m_iMaxParSets;
+	return iParBuffer > 0 ? iParBuffer : 1;
+}
+
+int ParChecker::GetMaxThreads()
+{
+	int iMaxThreads = g_pOptions->GetParThreads() > 0 ? g_pOptions->GetParThreads() : Util::NumberOfCpuCores();
+	return iMaxThreads > 0 ? iMaxThreads : 1;
+}
+
+int ParChecker::GetParBuffer()
+{
+	return g_pOptions->GetParBuffer();
+}
+
 ParChecker::EStatus ParChecker::RunParCheckAll()
 {
 	ParCoordinator::ParFileList fileList;
@@ -499,6 +1787,18 @@ ParChecker::EStatus ParChecker::RunParCheckAll()
 	m_bCancelled = false;
 	m_bParFull = true;
 
+	int iMaxSets = GetMaxThreads();
+	if (fileList.size() > 1 && iMaxSets > 1)
+	{
+		eAllStatus = RunParSets(&fileList, iMaxSets);
+
+		for (ParCoordinator::ParFileList::iterator it = fileList.begin(); it != fileList.end(); it++)
+		{
+			free(*it);
+		}
+		return eAllStatus;
+	}
+
 	for (ParCoordinator::ParFileList::iterator it = fileList.begin(); it != fileList.end(); it++)
 	{
 		char* szParFilename = *it;
@@ -510,17 +1810,8 @@ ParChecker::EStatus ParChecker::RunParCheckAll()
 			snprintf(szFullParFilename, 1024, "%s%c%s", m_szDestDir, (int)PATH_SEPARATOR, szParFilename);
 			szFullParFilename[1024-1] = '\0';
 
-			char szInfoName[1024];
-			int iBaseLen = 0;
-			ParCoordinator::ParseParFilename(szParFilename, &iBaseLen, NULL);
-			int maxlen = iBaseLen < 1024 ? iBaseLen : 1024 - 1;
-			strncpy(szInfoName, szParFilename, maxlen);
-			szInfoName[maxlen] = '\0';
-			
 			char szParInfoName[1024];
-			snprintf(szParInfoName, 1024, "%s%c%s", m_szNZBName, (int)PATH_SEPARATOR, szInfoName);
-			szParInfoName[1024-1] = '\0';
-
+			BuildParInfoName(szParFilename, szParInfoName, 1024);
 			SetInfoName(szParInfoName);
 
 			EStatus eStatus = RunParCheck(szFullParFilename);
@@ -543,6 +1834,126 @@ ParChecker::EStatus ParChecker::RunParCheckAll()
 	return eAllStatus;
 }
 
+void ParChecker::BuildParInfoName(const char* szParFilename, char* szParInfoName, int iBufLen)
+{
+	char szInfoName[1024];
+	int iBaseLen = 0;
+	ParCoordinator::ParseParFilename(szParFilename, &iBaseLen, NULL);
+	int maxlen = iBaseLen < 1024 ? iBaseLen : 1024 - 1;
+	strncpy(szInfoName, szParFilename, maxlen);
+	szInfoName[maxlen] = '\0';
+
+	snprintf(szParInfoName, iBufLen, "%s%c%s", m_szNZBName, (int)PATH_SEPARATOR, szInfoName);
+	szParInfoName[iBufLen-1] = '\0';
+}
+
+/*
+ * Checks independent par-sets of the nzb at the same time, up to iMaxSets
+ * sets at once. The status of all sets is accumulated in the same way
+ * as when the sets are checked one after another.
+ */
+ParChecker::EStatus ParChecker::RunParSets(FileList* pFileList, int iMaxSets)
+{
+	EStatus eAllStatus = psRepairNotNeeded;
+	ParSets parSets;
+	FileList::iterator itNext = pFileList->begin();
+
+	m_eStage = ptLoadingPars;
+	m_pReportedParSet = NULL;
+	m_iMaxParSets = iMaxSets < (int)pFileList->size() ? iMaxSets : (int)pFileList->size();
+	SetInfoName(m_szNZBName);
+
+	while (true)
+	{
+		m_mutexParSets.Lock();
+		while ((int)m_RunningParSets.size() < iMaxSets && itNext != pFileList->end() && !IsStopped() && !m_bCancelled)
+		{
+			const char* szParFilename = *itNext++;
+			debug("Found par: %s", szParFilename);
+
+			char szFullParFilename[1024];
+			snprintf(szFullParFilename, 1024, "%s%c%s", m_szDestDir, (int)PATH_SEPARATOR, szParFilename);
+			szFullParFilename[1024-1] = '\0';
+
+			char szParInfoName[1024];
+			BuildParInfoName(szParFilename, szParInfoName, 1024);
+
+			ParSetChecker* pParSet = new ParSetChecker(this, szFullParFilename);
+			pParSet->SetInfoName(szParInfoName);
+			m_RunningParSets.push_back(pParSet);
+			parSets.push_back(pParSet);
+			pParSet->Start();
+		}
+		m_mutexParSets.Unlock();
+
+		if (parSets.empty())
+		{
+			break;
+		}
+
+		m_semParSetDone.Wait();
+
+		m_mutexParSets.Lock();
+		ParSetChecker* pParSet = (ParSetChecker*)m_FinishedParSets.front();
+		m_FinishedParSets.pop_front();
+		m_mutexParSets.Unlock();
+
+		// the thread has posted the semaphore but may not have exited yet
+		while (pParSet->IsRunning())
+		{
+			usleep(SYNC_SLEEP_INTERVAL);
+		}
+
+		// accumulate total status, the worst status has priority
+		if (eAllStatus > pParSet->GetSetStatus())
+		{
+			eAllStatus = pParSet->GetSetStatus();
+		}
+		if (!pParSet->GetParFull())
+		{
+			m_bParFull = false;
+		}
+
+		m_mutexParSets.Lock();
+		m_RunningParSets.erase(std::find(m_RunningParSets.begin(), m_RunningParSets.end(), pParSet));
+		if (m_pReportedParSet == pParSet)
+		{
+			m_pReportedParSet = NULL;
+		}
+		m_mutexParSets.Unlock();
+
+		parSets.erase(std::find(parSets.begin(), parSets.end(), pParSet));
+		delete pParSet;
+	}
+
+	return eAllStatus;
+}
+
+/*
+ * The progress of parallel par-sets is reported through the main checker.
+ * It follows one set until that set is finished, or another set reaches
+ * a further stage; the stage of the main checker never goes back.
+ */
+void ParChecker::UpdateParSetProgress(ParChecker* pParSet)
+{
+	m_mutexParSets.Lock();
+	if (!m_pReportedParSet || m_pReportedParSet == pParSet || pParSet->m_eStage > m_pReportedParSet->m_eStage)
+	{
+		m_pReportedParSet = pParSet;
+		if (pParSet->m_eStage > m_eStage)
+		{
+			m_eStage = pParSet->m_eStage;
+		}
+		strncpy(m_szProgressLabel, pParSet->m_szProgressLabel, 1024);
+		m_szProgressLabel[1024-1] = '\0';
+		m_iFileProgress = pParSet->m_iFileProgress;
+		m_iStageProgress = pParSet->m_iStageProgress;
+	}
+	m_mutexParSets.Unlock();
+
+	UpdateProgress();
+}
+
 ParChecker::EStatus ParChecker::RunParCheck(const char* szParFilename)
 {
 	Cleanup();
@@ -573,6 +1984,7 @@ ParChecker::EStatus ParChecker::RunParCheck(const char* szParFilename)
 	
 	m_eStage = ptVerifyingSources;
 	Repairer* pRepairer = (Repairer*)m_pRepairer;
+	pRepairer->LoadRepairState();
 	res = pRepairer->Process(false);
     debug("ParChecker: Process-result=%i", res);
 
@@ -676,7 +2088,9 @@ ParChecker::EStatus ParChecker::RunParCheck(const char* szParFilename)
 		}
 		PrintMessage(Message::mkError, "Repair failed for %s: %s", m_szInfoName, m_szErrMsg ? m_szErrMsg : "");
 	}
-	
+
+	pRepairer->FinishRepairState();
+
 	Cleanup();
 	return eStatus;
 }
@@ -750,7 +2164,7 @@ bool ParChecker::LoadMainParBak()
 		}
 
 		int iBlockFound = 0;
-		bool requested = RequestMorePars(1, &iBlockFound);
+		bool requested = RequestMorePars(m_szParFilename, 1, &iBlockFound);
 		if (requested)
 		{
 			strncpy(m_szProgressLabel, "Awaiting additional par-files", 1024);
@@ -812,7 +2226,7 @@ int ParChecker::ProcessMorePars()
 		if (!hasMorePars)
 		{
 			int iBlockFound = 0;
-			bool requested = RequestMorePars(missingblockcount, &iBlockFound);
+			bool requested = RequestMorePars(m_szParFilename, missingblockcount, &iBlockFound);
 			if (requested)
 			{
 				strncpy(m_szProgressLabel, "Awaiting additional par-files", 1024);
@@ -897,6 +2311,14 @@ void ParChecker::AddParFile(const char * szParFilename)
 	m_QueuedParFiles.push_back(strdup(szParFilename));
 	m_bQueuedParFilesChanged = true;
 	m_mutexQueuedParFiles.Unlock();
+
+	// par-sets checked in parallel ignore the packets of other sets
+	m_mutexParSets.Lock();
+	for (ParSets::iterator it = m_RunningParSets.begin(); it != m_RunningParSets.end(); it++)
+	{
+		(*it)->AddParFile(szParFilename);
+	}
+	m_mutexParSets.Unlock();
 }
 
 void ParChecker::QueueChanged()
@@ -904,6 +2326,13 @@ void ParChecker::QueueChanged()
 	m_mutexQueuedParFiles.Lock();
 	m_bQueuedParFilesChanged = true;
 	m_mutexQueuedParFiles.Unlock();
+
+	m_mutexParSets.Lock();
+	for (ParSets::iterator it = m_RunningParSets.begin(); it != m_RunningParSets.end(); it++)
+	{
+		(*it)->QueueChanged();
+	}
+	m_mutexParSets.Unlock();
 }
 
 bool ParChecker::AddSplittedFragments()
@@ -1227,13 +2656,54 @@ void ParChecker::CheckEmptyFiles()
 	}
 }
 
+void ParChecker::Stop()
+{
+	Thread::Stop();
+
+	m_mutexParSets.Lock();
+	for (ParSets::iterator it = m_RunningParSets.begin(); it != m_RunningParSets.end(); it++)
+	{
+		(*it)->Stop();
+	}
+	m_mutexParSets.Unlock();
+}
+
 void ParChecker::Cancel()
 {
-	((Repairer*)m_pRepairer)->cancelled = true;
+	if (m_pRepairer)
+	{
+		((Repairer*)m_pRepairer)->cancelled = true;
+	}
 	m_bCancelled = true;
+
+	m_mutexParSets.Lock();
+	for (ParSets::iterator it = m_RunningParSets.begin(); it != m_RunningParSets.end(); it++)
+	{
+		(*it)->Cancel();
+	}
+	m_mutexParSets.Unlock();
+
 	QueueChanged();
 }
 
+/*
+ * Cancels the repair keeping its progress, the repair continues from
+ * the last completed chunk when the par-check is started again.
+ */
+void ParChecker::Interrupt()
+{
+	m_bInterrupted = true;
+
+	m_mutexParSets.Lock();
+	for (ParSets::iterator it = m_RunningParSets.begin(); it != m_RunningParSets.end(); it++)
+	{
+		(*it)->m_bInterrupted = true;
+	}
+	m_mutexParSets.Unlock();
+
+	Cancel();
+}
+
 void ParChecker::WriteBrokenLog(EStatus eStatus)
 {
 	char szBrokenLogName[1024];
@@ -1370,64 +2840,186 @@ ParChecker::EFileStatus ParChecker::VerifyDataFile(void* pDiskfile, void* pSourc
 	std::string filename = pSourceFile->GetTargetFile()->FileName();
 	const char* szFilename = filename.c_str();
 
-	if (Util::FileSize(szFilename) == 0 && pSourceFile->BlockCount() > 0)
+	if (Util::FileSize(szFilename) == 0 && pSourceFile->BlockCount() > 0)
+	{
+		*pAvailableBlocks = 0;
+		return fsFailure;
+	}
+
+	// find file status and CRC computed during download
+	unsigned long lDownloadCrc;
+	SegmentList segments;
+	EFileStatus	eFileStatus = FindFileCrc(Util::BaseFileName(szFilename), &lDownloadCrc, &segments);
+	ValidBlocks validBlocks;
+
+	if (eFileStatus == fsFailure || eFileStatus == fsUnknown)
+	{
+		return eFileStatus;
+	}
+	else if ((eFileStatus == fsSuccess && !VerifySuccessDataFile(pDiskfile, pSourcefile, lDownloadCrc)) ||
+		(eFileStatus == fsPartial && !VerifyPartialDataFile(pDiskfile, pSourcefile, &segments, &validBlocks)))
+	{
+		PrintMessage(Message::mkWarning, "Quick verification failed for %s file %s, performing full verification instead",
+			eFileStatus == fsSuccess ? "good" : "damaged", Util::BaseFileName(szFilename));
+		return fsUnknown; // let libpar2 do the full verification of the file
+	}
+
+	// attach verification blocks to the file
+	*pAvailableBlocks = 0;
+	u64 blocksize = ((Repairer*)m_pRepairer)->mainpacket->BlockSize();
+	std::deque<const VerificationHashEntry*> undoList;
+	for (unsigned int i = 0; i < packet->BlockCount(); i++)
+	{
+		if (eFileStatus == fsSuccess || validBlocks.at(i))
+		{
+			const FILEVERIFICATIONENTRY* entry = packet->VerificationEntry(i);
+			u32 blockCrc = entry->crc;
+
+			// Look for a match
+			const VerificationHashEntry* pHashEntry = ((Repairer*)m_pRepairer)->verificationhashtable.Lookup(blockCrc);
+			if (!pHashEntry || pHashEntry->SourceFile() != pSourceFile || pHashEntry->IsSet())
+			{
+				// no match found, revert back the changes made by "pHashEntry->SetBlock"
+				for (std::deque<const VerificationHashEntry*>::iterator it = undoList.begin(); it != undoList.end(); it++)
+				{
+					const VerificationHashEntry* pUndoEntry = *it;
+					pUndoEntry->SetBlock(NULL, 0);
+				}
+				return fsUnknown;
+			}
+
+			undoList.push_back(pHashEntry);
+			pHashEntry->SetBlock(pDiskFile, i*blocksize);
+			(*pAvailableBlocks)++;
+		}
+	}
+
+	PrintMessage(Message::mkDetail, "Quickly verified %s file %s",
+		eFileStatus == fsSuccess ? "good" : "damaged", Util::BaseFileName(szFilename));
+
+	return eFileStatus;
+}
+
+/*
+ * Checks if the file will likely be verified by VerifyDataFileHashes or VerifyDataFile
+ * without a full scan; such files are not scanned in advance.
+ */
+bool ParChecker::IsQuickVerifiable(const char* szFilename, void* pSourcefile)
+{
+	if (!pSourcefile)
+	{
+		return false;
+	}
+
+	if (m_bParQuick && m_eStage != ptVerifyingSources)
+	{
+		return true;
+	}
+
+	if (m_eStage != ptVerifyingSources)
+	{
+		return false;
+	}
+
+	ParHashes parHashes;
+	if (FindFileHashes(Util::BaseFileName(szFilename), &parHashes) &&
+		parHashes.GetModified() == Util::FileModificationTime(szFilename))
+	{
+		return true;
+	}
+
+	unsigned long lDownloadCrc;
+	SegmentList segments;
+	return m_bParQuick && FindFileCrc(Util::BaseFileName(szFilename), &lDownloadCrc, &segments) != fsUnknown;
+}
+
+/*
+ * Verifies the file using par2-block checksums computed during download.
+ * The file isn't read from disk at all. The checksums are used only if the file
+ * wasn't changed after download (same size and modification time).
+ */
+ParChecker::EFileStatus ParChecker::VerifyDataFileHashes(void* pDiskfile, void* pSourcefile, int* pAvailableBlocks)
+{
+	if (m_eStage != ptVerifyingSources)
+	{
+		return fsUnknown;
+	}
+
+	DiskFile* pDiskFile = (DiskFile*)pDiskfile;
+	Par2RepairerSourceFile* pSourceFile = (Par2RepairerSourceFile*)pSourcefile;
+	if (!pSourceFile->GetTargetExists() || pSourceFile->GetTargetFile() != pDiskFile)
+	{
+		return fsUnknown;
+	}
+
+	VerificationPacket* packet = pSourceFile->GetVerificationPacket();
+	if (!packet)
+	{
+		return fsUnknown;
+	}
+
+	std::string filename = pDiskFile->FileName();
+	const char* szFilename = filename.c_str();
+	u64 blocksize = ((Repairer*)m_pRepairer)->mainpacket->BlockSize();
+
+	ParHashes parHashes;
+	if (!FindFileHashes(Util::BaseFileName(szFilename), &parHashes) ||
+		parHashes.GetBlockSize() != (long long)blocksize ||
+		parHashes.GetFileSize() != (long long)pDiskFile->FileSize() ||
+		parHashes.GetFileSize() != (long long)pSourceFile->GetDescriptionPacket()->FileSize() ||
+		parHashes.GetModified() != Util::FileModificationTime(szFilename))
 	{
-		*pAvailableBlocks = 0;
-		return fsFailure;
+		return fsUnknown;
 	}
 
-	// find file status and CRC computed during download
-	unsigned long lDownloadCrc;
-	SegmentList segments;
-	EFileStatus	eFileStatus = FindFileCrc(Util::BaseFileName(szFilename), &lDownloadCrc, &segments);
-	ValidBlocks validBlocks;
+	ParHashes::BlockHashes* pBlockHashes = parHashes.GetBlockHashes();
+	if (pBlockHashes->size() != packet->BlockCount())
+	{
+		return fsUnknown;
+	}
 
-	if (eFileStatus == fsFailure || eFileStatus == fsUnknown)
+	ValidBlocks validBlocks(packet->BlockCount(), false);
+	u32 iValidBlocks = 0;
+	for (u32 i = 0; i < packet->BlockCount(); i++)
 	{
-		return eFileStatus;
+		const FILEVERIFICATIONENTRY* entry = packet->VerificationEntry(i);
+		ParHashes::BlockHash& blockHash = pBlockHashes->at(i);
+		if (blockHash.m_lCrc == entry->crc && !memcmp(blockHash.m_Md5, entry->hash.hash, sizeof(blockHash.m_Md5)))
+		{
+			validBlocks[i] = true;
+			iValidBlocks++;
+		}
 	}
-	else if ((eFileStatus == fsSuccess && !VerifySuccessDataFile(pDiskfile, pSourcefile, lDownloadCrc)) ||
-		(eFileStatus == fsPartial && !VerifyPartialDataFile(pDiskfile, pSourcefile, &segments, &validBlocks)))
+
+	if (iValidBlocks == 0)
 	{
-		PrintMessage(Message::mkWarning, "Quick verification failed for %s file %s, performing full verification instead",
-			eFileStatus == fsSuccess ? "good" : "damaged", Util::BaseFileName(szFilename));
-		return fsUnknown; // let libpar2 do the full verification of the file
+		// probably a different file, let libpar2 scan it
+		return fsUnknown;
 	}
 
+	bool bComplete = iValidBlocks == packet->BlockCount() &&
+		!memcmp(parHashes.GetHashFull(), pSourceFile->GetDescriptionPacket()->HashFull().hash, 16) &&
+		!memcmp(parHashes.GetHash16k(), pSourceFile->GetDescriptionPacket()->Hash16k().hash, 16);
+
 	// attach verification blocks to the file
 	*pAvailableBlocks = 0;
-	u64 blocksize = ((Repairer*)m_pRepairer)->mainpacket->BlockSize();
-	std::deque<const VerificationHashEntry*> undoList;
-	for (unsigned int i = 0; i < packet->BlockCount(); i++)
+	for (u32 i = 0; i < packet->BlockCount(); i++)
 	{
-		if (eFileStatus == fsSuccess || validBlocks.at(i))
+		if (validBlocks.at(i))
 		{
-			const FILEVERIFICATIONENTRY* entry = packet->VerificationEntry(i);
-			u32 blockCrc = entry->crc;
-
-			// Look for a match
-			const VerificationHashEntry* pHashEntry = ((Repairer*)m_pRepairer)->verificationhashtable.Lookup(blockCrc);
-			if (!pHashEntry || pHashEntry->SourceFile() != pSourceFile || pHashEntry->IsSet())
+			DataBlock* pDataBlock = &*(pSourceFile->SourceBlocks() + i);
+			if (!pDataBlock->IsSet())
 			{
-				// no match found, revert back the changes made by "pHashEntry->SetBlock"
-				for (std::deque<const VerificationHashEntry*>::iterator it = undoList.begin(); it != undoList.end(); it++)
-				{
-					const VerificationHashEntry* pUndoEntry = *it;
-					pUndoEntry->SetBlock(NULL, 0);
-				}
-				return fsUnknown;
+				pDataBlock->SetLocation(pDiskFile, i * blocksize);
 			}
-
-			undoList.push_back(pHashEntry);
-			pHashEntry->SetBlock(pDiskFile, i*blocksize);
 			(*pAvailableBlocks)++;
 		}
 	}
 
-	PrintMessage(Message::mkDetail, "Quickly verified %s file %s",
-		eFileStatus == fsSuccess ? "good" : "damaged", Util::BaseFileName(szFilename));
+	PrintMessage(Message::mkDetail, "Verified %s file %s using checksums computed during download",
+		bComplete ? "good" : "damaged", Util::BaseFileName(szFilename));
 
-	return eFileStatus;
+	return bComplete ? fsSuccess : fsPartial;
 }
 
 bool ParChecker::VerifySuccessDataFile(void* pDiskfile, void* pSourcefile, unsigned long lDownloadCrc)
@@ -1502,11 +3094,12 @@ bool ParChecker::VerifyPartialDataFile(void* pDiskfile, void* pSourcefile, Segme
 	}
 
 	char szErrBuf[256];
-	FILE* infile = fopen(szFilename, FOPEN_RB);
-	if (!infile)
+	int iFile = open(szFilename, O_RDONLY | O_BINARY);
+	if (iFile == -1)
 	{
 		PrintMessage(Message::mkError, "Could not open file %s: %s",
 			szFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+		return false;
 	}
 
 	// For each sequential range of presumably valid blocks:
@@ -1515,6 +3108,8 @@ bool ParChecker::VerifyPartialDataFile(void* pDiskfile, void* pSourcefile, Segme
 	//   overlap - read a little bit of data from the file and calculate its CRC;
 	// - compare two CRCs - they must match; if not - the file is more damaged than we thought -
 	//   let libpar2 do the full verification of the file in this case.
+	// The download-CRCs of the ranges are computed in several threads.
+	RangeCrcVerifier verifier(iFile, pSegments);
 	unsigned long lParCrc = 0;
 	int iBlockStart = -1;
 	pValidBlocks->push_back(false); // end marker
@@ -1538,47 +3133,120 @@ bool ParChecker::VerifyPartialDataFile(void* pDiskfile, void* pSourcefile, Segme
 				int iBlockEnd = i - 1;
 				long long iBytesStart = iBlockStart * blocksize;
 				long long iBytesEnd = iBlockEnd * blocksize + blocksize - 1;
-				unsigned long lDownloadCrc = 0;
-				bool bOK = SmartCalcFileRangeCrc(infile, iBytesStart,
-					iBytesEnd < iFileSize - 1 ? iBytesEnd : iFileSize - 1, pSegments, &lDownloadCrc);
-				if (bOK && iBytesEnd > iFileSize - 1)
-				{
-					// for the last block: extend lDownloadCrc to block size
-					lDownloadCrc = CRCUpdateBlock(lDownloadCrc ^ 0xFFFFFFFF, (size_t)(iBytesEnd - (iFileSize - 1))) ^ 0xFFFFFFFF;
-				}
-
-				if (!bOK || lDownloadCrc != lParCrc)
-				{
-					fclose(infile);
-					return false;
-				}
+				verifier.AddRange(iBytesStart, iBytesEnd < iFileSize - 1 ? iBytesEnd : iFileSize - 1,
+					iBytesEnd > iFileSize - 1 ? iBytesEnd - (iFileSize - 1) : 0, lParCrc);
 			}
 			iBlockStart = -1;
 		}
 	}
 
-	fclose(infile);
+	bool bOK = verifier.Verify(GetMaxThreads());
 
-	return true;
+	close(iFile);
+
+	return bOK;
+}
+
+RangeCrcVerifier::RangeCrcVerifier(int iFile, ParChecker::SegmentList* pSegments)
+{
+	m_iFile = iFile;
+	m_pSegments = pSegments;
+	m_bFailed = false;
+}
+
+void RangeCrcVerifier::AddRange(long long lStart, long long lEnd, long long lPadding, unsigned long lParCrc)
+{
+	Range range;
+	range.m_lStart = lStart;
+	range.m_lEnd = lEnd;
+	range.m_lPadding = lPadding;
+	range.m_lParCrc = lParCrc;
+	m_Ranges.push_back(range);
+}
+
+/*
+ * Verifies all ranges, the calling thread takes part in the work.
+ * Returns false if the download-CRC of any range doesn't match its par-CRC.
+ */
+bool RangeCrcVerifier::Verify(int iThreads)
+{
+	iThreads = iThreads > (int)m_Ranges.size() ? (int)m_Ranges.size() : iThreads;
+
+	std::vector<RangeCrcThread*> threads;
+	for (int i = 1; i < iThreads; i++)
+	{
+		RangeCrcThread* pRangeCrcThread = new RangeCrcThread(this);
+		threads.push_back(pRangeCrcThread);
+		pRangeCrcThread->Start();
+	}
+
+	ProcessRanges();
+
+	for (std::vector<RangeCrcThread*>::iterator it = threads.begin(); it != threads.end(); it++)
+	{
+		RangeCrcThread* pRangeCrcThread = *it;
+		while (pRangeCrcThread->IsRunning())
+		{
+			usleep(SYNC_SLEEP_INTERVAL);
+		}
+		delete pRangeCrcThread;
+	}
+
+	return !m_bFailed;
+}
+
+void RangeCrcVerifier::ProcessRanges()
+{
+	unsigned char* pBuffer = NULL;
+
+	while (!m_bFailed)
+	{
+		long lIndex = m_NextRange.Add(1) - 1;
+		if (lIndex >= (long)m_Ranges.size())
+		{
+			break;
+		}
+
+		if (!pBuffer)
+		{
+			pBuffer = (unsigned char*)malloc(RANGE_CRC_BUFFER_SIZE);
+		}
+
+		Range& range = m_Ranges[lIndex];
+		unsigned long lDownloadCrc = 0;
+		bool bOK = SmartCalcFileRangeCrc(range.m_lStart, range.m_lEnd, pBuffer, &lDownloadCrc);
+		if (bOK && range.m_lPadding > 0)
+		{
+			// for the last block: extend lDownloadCrc to block size
+			lDownloadCrc = CRCUpdateBlock(lDownloadCrc ^ 0xFFFFFFFF, (size_t)range.m_lPadding) ^ 0xFFFFFFFF;
+		}
+
+		if (!bOK || lDownloadCrc != range.m_lParCrc)
+		{
+			m_bFailed = true;
+		}
+	}
+
+	free(pBuffer);
 }
 
 /*
  * Compute CRC of bytes range of file using CRCs of segments and reading some data directly
  * from file if necessary
  */
-bool ParChecker::SmartCalcFileRangeCrc(FILE* pFile, long long lStart, long long lEnd, SegmentList* pSegments,
+bool RangeCrcVerifier::SmartCalcFileRangeCrc(long long lStart, long long lEnd, unsigned char* pBuffer,
 	unsigned long* pDownloadCrc)
 {
 	unsigned long lDownloadCrc = 0;
 	bool bStarted = false;
-	for (SegmentList::iterator it = pSegments->begin(); it != pSegments->end(); it++)
+	for (ParChecker::SegmentList::iterator it = m_pSegments->begin(); it != m_pSegments->end(); it++)
 	{
-		Segment* pSegment = *it;
+		ParChecker::Segment* pSegment = *it;
 
 		if (!bStarted && pSegment->GetOffset() > lStart)
 		{
 			// read start of range from file
-			if (!DumbCalcFileRangeCrc(pFile, lStart, pSegment->GetOffset() - 1, &lDownloadCrc))
+			if (!DumbCalcFileRangeCrc(lStart, pSegment->GetOffset() - 1, pBuffer, &lDownloadCrc))
 			{
 				return false;
 			}
@@ -1604,7 +3272,7 @@ bool ParChecker::SmartCalcFileRangeCrc(FILE* pFile, long long lStart, long long
 		{
 			// read end of range from file
 			unsigned long lPartialCrc = 0;
-			if (!DumbCalcFileRangeCrc(pFile, pSegment->GetOffset(), lEnd, &lPartialCrc))
+			if (!DumbCalcFileRangeCrc(pSegment->GetOffset(), lEnd, pBuffer, &lPartialCrc))
 			{
 				return false;
 			}
@@ -1620,34 +3288,335 @@ bool ParChecker::SmartCalcFileRangeCrc(FILE* pFile, long long lStart, long long
 }
 
 /*
- * Compute CRC of bytes range of file reading the data directly from file
+ * Compute CRC of bytes range of file reading the data directly from file.
+ * Positional reads don't change the file position, the file descriptor
+ * is shared by all threads.
  */
-bool ParChecker::DumbCalcFileRangeCrc(FILE* pFile, long long lStart, long long lEnd, unsigned long* pDownloadCrc)
+bool RangeCrcVerifier::DumbCalcFileRangeCrc(long long lStart, long long lEnd, unsigned char* pBuffer,
+	unsigned long* pDownloadCrc)
 {
-	if (fseek(pFile, lStart, SEEK_SET))
-	{
-		return false;
-	}
-
-	static const int BUFFER_SIZE = 1024 * 64;
-	unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
 	unsigned long lDownloadCrc = 0xFFFFFFFF;
 
-	int cnt = BUFFER_SIZE;
-	while (cnt == BUFFER_SIZE && lStart < lEnd)
+	while (lStart <= lEnd)
 	{
-		int iNeedBytes = lEnd - lStart + 1 > BUFFER_SIZE ? BUFFER_SIZE : (int)(lEnd - lStart + 1);
-		cnt = (int)fread(buffer, 1, iNeedBytes, pFile);
-		lDownloadCrc = Util::Crc32m(lDownloadCrc, buffer, cnt);
+		int iNeedBytes = lEnd - lStart + 1 > RANGE_CRC_BUFFER_SIZE ? RANGE_CRC_BUFFER_SIZE : (int)(lEnd - lStart + 1);
+#ifdef WIN32
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)lStart;
+		overlapped.OffsetHigh = (DWORD)(lStart >> 32);
+		DWORD iRead = 0;
+		int cnt = ReadFile((HANDLE)_get_osfhandle(m_iFile), pBuffer, iNeedBytes, &iRead, &overlapped) ? (int)iRead : -1;
+#else
+		int cnt = (int)pread(m_iFile, pBuffer, iNeedBytes, (off_t)lStart);
+#endif
+		if (cnt <= 0)
+		{
+			return false;
+		}
+		lDownloadCrc = Util::Crc32m(lDownloadCrc, pBuffer, cnt);
 		lStart += cnt;
 	}
 
-	free(buffer);
-
 	lDownloadCrc ^= 0xFFFFFFFF;
 
 	*pDownloadCrc = lDownloadCrc;
 	return true;
 }
 
+ParIndex::FileEntry::FileEntry(const unsigned char* pFileID)
+{
+	m_szFilename = NULL;
+	memcpy(m_FileID, pFileID, 16);
+	m_pParHashes = new ParHashes();
+}
+
+ParIndex::FileEntry::~FileEntry()
+{
+	free(m_szFilename);
+	delete m_pParHashes;
+}
+
+ParIndex::ParIndex()
+{
+	m_lBlockSize = 0;
+}
+
+ParIndex::~ParIndex()
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		delete *it;
+	}
+	m_Files.clear();
+}
+
+ParIndex::FileEntry* ParIndex::GetFileEntry(const unsigned char* pFileID)
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		FileEntry* pFileEntry = *it;
+		if (!memcmp(pFileEntry->m_FileID, pFileID, 16))
+		{
+			return pFileEntry;
+		}
+	}
+
+	FileEntry* pFileEntry = new FileEntry(pFileID);
+	m_Files.push_back(pFileEntry);
+	return pFileEntry;
+}
+
+/*
+ * Reads main, file description and file verification packets. The packets
+ * are found with the same packet search as used by par-check and repair;
+ * the packet positions are shared with them via the packet cache.
+ * Returns false if the file doesn't contain a complete description of the par-set.
+ */
+bool ParIndex::Load(const char* szParFilename, ParPacketCache* pPacketCache)
+{
+	DiskFile diskfile;
+	if (!diskfile.Open(szParFilename))
+	{
+		return false;
+	}
+
+	PacketIndex index;
+	if (!pPacketCache || !pPacketCache->Find(szParFilename, &index))
+	{
+		PacketScanner scanner(&diskfile);
+		PacketIndexEntry entry;
+		while (scanner.Next(entry))
+		{
+			index.push_back(entry);
+		}
+		if (pPacketCache)
+		{
+			pPacketCache->Add(szParFilename, &index);
+		}
+	}
+
+	// only packets of the set of the first packet are used, like during par-check
+	for (PacketIndex::iterator it = index.begin(); it != index.end(); it++)
+	{
+		PACKET_HEADER& header = it->header;
+		if (header.setid != index.front().header.setid)
+		{
+			continue;
+		}
+
+		if (header.type == mainpacket_type)
+		{
+			MainPacket packet;
+			if (packet.Load(&diskfile, it->offset, header))
+			{
+				m_lBlockSize = (long long)packet.BlockSize();
+			}
+		}
+		else if (header.type == filedescriptionpacket_type)
+		{
+			DescriptionPacket packet;
+			if (packet.Load(&diskfile, it->offset, header))
+			{
+				FileEntry* pFileEntry = GetFileEntry(packet.FileId().hash);
+				if (!pFileEntry->m_szFilename)
+				{
+					pFileEntry->m_szFilename = strdup(packet.FileName().c_str());
+					pFileEntry->m_pParHashes->SetFileSize((long long)packet.FileSize());
+					memcpy(pFileEntry->m_pParHashes->GetHashFull(), packet.HashFull().hash, 16);
+					memcpy(pFileEntry->m_pParHashes->GetHash16k(), packet.Hash16k().hash, 16);
+				}
+			}
+		}
+		else if (header.type == fileverificationpacket_type)
+		{
+			VerificationPacket packet;
+			if (packet.Load(&diskfile, it->offset, header))
+			{
+				FileEntry* pFileEntry = GetFileEntry(packet.FileId().hash);
+				ParHashes::BlockHashes* pBlockHashes = pFileEntry->m_pParHashes->GetBlockHashes();
+				if (pBlockHashes->empty())
+				{
+					int iCount = (int)packet.BlockCount();
+					pBlockHashes->resize(iCount);
+					for (int i = 0; i < iCount; i++)
+					{
+						const FILEVERIFICATIONENTRY* pEntry = packet.VerificationEntry(i);
+						(*pBlockHashes)[i].m_lCrc = (u32)pEntry->crc;
+						memcpy((*pBlockHashes)[i].m_Md5, pEntry->hash.hash, 16);
+					}
+				}
+			}
+		}
+	}
+
+	diskfile.Close();
+
+	// remove files with incomplete description
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); )
+	{
+		FileEntry* pFileEntry = *it;
+		ParHashes* pParHashes = pFileEntry->m_pParHashes;
+		long long lBlockCount = m_lBlockSize > 0 ? (pParHashes->GetFileSize() + m_lBlockSize - 1) / m_lBlockSize : -1;
+		if (!pFileEntry->m_szFilename || (long long)pParHashes->GetBlockHashes()->size() != lBlockCount)
+		{
+			delete pFileEntry;
+			it = m_Files.erase(it);
+			continue;
+		}
+		pParHashes->SetBlockSize(m_lBlockSize);
+		it++;
+	}
+
+	return m_lBlockSize > 0 && !m_Files.empty();
+}
+
+ParIndex::FileEntry* ParIndex::FindFile(const char* szFilename)
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		FileEntry* pFileEntry = *it;
+		if (!strcmp(pFileEntry->GetFilename(), szFilename))
+		{
+			return pFileEntry;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Compares block checksums of a file on disk with the checksums from the par-set.
+ * Blocks which are missing on disk are counted as bad too.
+ */
+int ParIndex::CountBadBlocks(ParHashes* pExpected, ParHashes* pActual)
+{
+	ParHashes::BlockHashes* pExpectedBlocks = pExpected->GetBlockHashes();
+	ParHashes::BlockHashes* pActualBlocks = pActual->GetBlockHashes();
+
+	if (pExpected->GetBlockSize() != pActual->GetBlockSize())
+	{
+		return (int)pExpectedBlocks->size();
+	}
+
+	int iBadBlocks = 0;
+	for (int i = 0; i < (int)pExpectedBlocks->size(); i++)
+	{
+		if (i >= (int)pActualBlocks->size() ||
+			(*pExpectedBlocks)[i].m_lCrc != (*pActualBlocks)[i].m_lCrc ||
+			memcmp((*pExpectedBlocks)[i].m_Md5, (*pActualBlocks)[i].m_Md5, 16))
+		{
+			iBadBlocks++;
+		}
+	}
+
+	return iBadBlocks;
+}
+
+
+
+ParPacketCache::FileEntry::FileEntry(const char* szFilename)
+{
+	m_szFilename = strdup(szFilename);
+	m_lSize = Util::FileSize(szFilename);
+	m_tModified = Util::FileModificationTime(szFilename);
+}
+
+ParPacketCache::FileEntry::~FileEntry()
+{
+	free(m_szFilename);
+}
+
+ParPacketCache::ParPacketCache()
+{
+	m_iRefCount = 1;
+}
+
+ParPacketCache::~ParPacketCache()
+{
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		delete *it;
+	}
+}
+
+void ParPacketCache::Retain()
+{
+	m_mutexFiles.Lock();
+	m_iRefCount++;
+	m_mutexFiles.Unlock();
+}
+
+/*
+ * The cache is deleted when the last user releases it.
+ */
+void ParPacketCache::Release()
+{
+	m_mutexFiles.Lock();
+	bool bDelete = --m_iRefCount == 0;
+	m_mutexFiles.Unlock();
+
+	if (bDelete)
+	{
+		delete this;
+	}
+}
+
+bool ParPacketCache::Find(const char* szFilename, void* pPacketIndex)
+{
+	PacketIndex* pIndex = (PacketIndex*)pPacketIndex;
+
+	m_mutexFiles.Lock();
+
+	bool bFound = false;
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		FileEntry* pFileEntry = *it;
+		if (!strcmp(pFileEntry->m_szFilename, szFilename))
+		{
+			bFound = pFileEntry->m_lSize == Util::FileSize(szFilename) &&
+				pFileEntry->m_tModified == Util::FileModificationTime(szFilename);
+			for (Packets::iterator it2 = pFileEntry->m_Packets.begin(); bFound && it2 != pFileEntry->m_Packets.end(); it2++)
+			{
+				PacketIndexEntry entry;
+				entry.offset = (u64)it2->m_lOffset;
+				memcpy(&entry.header, it2->m_Header, sizeof(entry.header));
+				pIndex->push_back(entry);
+			}
+			break;
+		}
+	}
+
+	m_mutexFiles.Unlock();
+
+	return bFound;
+}
+
+void ParPacketCache::Add(const char* szFilename, void* pPacketIndex)
+{
+	PacketIndex* pIndex = (PacketIndex*)pPacketIndex;
+
+	FileEntry* pFileEntry = new FileEntry(szFilename);
+	pFileEntry->m_Packets.resize(pIndex->size());
+	for (size_t i = 0; i < pIndex->size(); i++)
+	{
+		pFileEntry->m_Packets[i].m_lOffset = (long long)(*pIndex)[i].offset;
+		memcpy(pFileEntry->m_Packets[i].m_Header, &(*pIndex)[i].header, sizeof(PACKET_HEADER));
+	}
+
+	m_mutexFiles.Lock();
+
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		if (!strcmp((*it)->m_szFilename, szFilename))
+		{
+			delete *it;
+			m_Files.erase(it);
+			break;
+		}
+	}
+	m_Files.push_back(pFileEntry);
+
+	m_mutexFiles.Unlock();
+}
+
 #endif
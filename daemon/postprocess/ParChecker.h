@@ -26,6 +26,12 @@
 #ifndef PARCHECKER_H
 #define PARCHECKER_H
 
+// Extension of partially repaired files kept to continue an interrupted repair
+#define REPAIR_PART_EXT ".parrepair"
+
+// Extension of files in QueueDir with saved progress of interrupted repairs
+#define REPAIR_STATE_EXT ".parstate"
+
 #ifndef DISABLE_PARCHECK
 
 #include <deque>
@@ -35,6 +41,9 @@
 #include "Thread.h"
 #include "Log.h"
 
+class ParHashes;
+class ParPacketCache;
+
 class ParChecker : public Thread
 {
 public:
@@ -89,8 +98,10 @@ public:
 	typedef std::deque<char*>		FileList;
 	typedef std::deque<void*>		SourceList;
 	typedef std::vector<bool>		ValidBlocks;
+	typedef std::deque<ParChecker*>	ParSets;
 
 	friend class Repairer;
+	friend class ParSetChecker;
 	
 private:
 	char*				m_szInfoName;
@@ -120,10 +131,22 @@ private:
 	bool				m_bParQuick;
 	bool				m_bForceRepair;
 	bool				m_bParFull;
+	Mutex				m_mutexParSets;
+	ParSets				m_RunningParSets;
+	ParSets				m_FinishedParSets;
+	Semaphore			m_semParSetDone;
+	int					m_iMaxParSets;
+	ParChecker*			m_pReportedParSet;
+	ParPacketCache*		m_pPacketCache;
+	int					m_iNZBID;
+	bool				m_bInterrupted;
 
 	void				Cleanup();
 	EStatus				RunParCheckAll();
 	EStatus				RunParCheck(const char* szParFilename);
+	EStatus				RunParSets(FileList* pFileList, int iMaxSets);
+	void				BuildParInfoName(const char* szParFilename, char* szInfoName, int iBufLen);
+	void				UpdateParSetProgress(ParChecker* pParSet);
 	int					PreProcessPar();
 	bool				LoadMainParBak();
 	int					ProcessMorePars();
@@ -140,11 +163,10 @@ private:
 	// declared as void* to prevent the including of libpar2-headers into this header-file
 	// DiskFile* pDiskfile, Par2RepairerSourceFile* pSourcefile
 	EFileStatus			VerifyDataFile(void* pDiskfile, void* pSourcefile, int* pAvailableBlocks);
+	EFileStatus			VerifyDataFileHashes(void* pDiskfile, void* pSourcefile, int* pAvailableBlocks);
+	bool				IsQuickVerifiable(const char* szFilename, void* pSourcefile);
 	bool				VerifySuccessDataFile(void* pDiskfile, void* pSourcefile, unsigned long lDownloadCrc);
 	bool				VerifyPartialDataFile(void* pDiskfile, void* pSourcefile, SegmentList* pSegments, ValidBlocks* pValidBlocks);
-	bool				SmartCalcFileRangeCrc(FILE* pFile, long long lStart, long long lEnd, SegmentList* pSegments,
-							unsigned long* pDownloadCrc);
-	bool				DumbCalcFileRangeCrc(FILE* pFile, long long lStart, long long lEnd, unsigned long* pDownloadCrc);
 	void				CheckEmptyFiles();
 
 protected:
@@ -153,13 +175,16 @@ protected:
 	* returns true, if the files with required number of blocks were unpaused,
 	* or false if there are no more files in queue for this collection or not enough blocks
 	*/
-	virtual bool		RequestMorePars(int iBlockNeeded, int* pBlockFound) = 0;
+	virtual bool		RequestMorePars(const char* szParFilename, int iBlockNeeded, int* pBlockFound) = 0;
 	virtual void		UpdateProgress() {}
 	virtual void		Completed() {}
 	virtual void		PrintMessage(Message::EKind eKind, const char* szFormat, ...) {}
 	virtual void		RegisterParredFile(const char* szFilename) {}
 	virtual bool		IsParredFile(const char* szFilename) { return false; }
 	virtual EFileStatus	FindFileCrc(const char* szFilename, unsigned long* lCrc, SegmentList* pSegments) { return fsUnknown; }
+	virtual bool		FindFileHashes(const char* szFilename, ParHashes* pParHashes) { return false; }
+	virtual int			GetMaxThreads();
+	virtual int			GetParBuffer();
 	EStage				GetStage() { return m_eStage; }
 	const char*			GetProgressLabel() { return m_szProgressLabel; }
 	int					GetFileProgress() { return m_iFileProgress; }
@@ -169,6 +194,7 @@ public:
 						ParChecker();
 	virtual				~ParChecker();
 	virtual void		Run();
+	virtual void		Stop();
 	void				SetDestDir(const char* szDestDir);
 	const char*			GetParFilename() { return m_szParFilename; }
 	const char*			GetInfoName() { return m_szInfoName; }
@@ -180,13 +206,103 @@ public:
 	bool				GetForceRepair() { return m_bForceRepair; }
 	void				SetParFull(bool bParFull) { m_bParFull = bParFull; }
 	bool				GetParFull() { return m_bParFull; }
+	void				SetPacketCache(ParPacketCache* pPacketCache) { m_pPacketCache = pPacketCache; }
+	void				SetNZBID(int iNZBID) { m_iNZBID = iNZBID; }
 	EStatus				GetStatus() { return m_eStatus; }
 	void				AddParFile(const char* szParFilename);
 	void				QueueChanged();
 	void				Cancel();
+	void				Interrupt();
 	bool				GetCancelled() { return m_bCancelled; }
 };
 
+/*
+ * Index of a par-set read from the critical packets of a par2-file:
+ * names, sizes and block checksums of all files protected by the set.
+ */
+class ParIndex
+{
+public:
+	class FileEntry
+	{
+	private:
+		char*				m_szFilename;
+		unsigned char		m_FileID[16];
+		ParHashes*			m_pParHashes;
+
+		friend class ParIndex;
+
+	public:
+							FileEntry(const unsigned char* pFileID);
+							~FileEntry();
+		const char*			GetFilename() { return m_szFilename; }
+		ParHashes*			GetParHashes() { return m_pParHashes; }
+	};
+
+	typedef std::deque<FileEntry*>	Files;
+
+private:
+	long long			m_lBlockSize;
+	Files				m_Files;
+
+	FileEntry*			GetFileEntry(const unsigned char* pFileID);
+
+public:
+						ParIndex();
+						~ParIndex();
+	bool				Load(const char* szParFilename, ParPacketCache* pPacketCache);
+	long long			GetBlockSize() { return m_lBlockSize; }
+	Files*				GetFiles() { return &m_Files; }
+	FileEntry*			FindFile(const char* szFilename);
+	static int			CountBadBlocks(ParHashes* pExpected, ParHashes* pActual);
+};
+
+/*
+ * Packets found in par2-files, shared by par-rename, par-check and repair
+ * of one nzb so that each par2-file is searched for packets only once.
+ * Entries are invalidated by the change of file size or modification time.
+ */
+class ParPacketCache
+{
+private:
+	struct Packet
+	{
+		long long			m_lOffset;
+		unsigned char		m_Header[64];
+	};
+
+	typedef std::vector<Packet>	Packets;
+
+	class FileEntry
+	{
+	public:
+		char*				m_szFilename;
+		long long			m_lSize;
+		time_t				m_tModified;
+		Packets				m_Packets;
+
+							FileEntry(const char* szFilename);
+							~FileEntry();
+	};
+
+	typedef std::deque<FileEntry*>	Files;
+
+	Files				m_Files;
+	Mutex				m_mutexFiles;
+	int					m_iRefCount;
+
+						~ParPacketCache();
+
+public:
+						ParPacketCache();
+	void				Retain();
+	void				Release();
+	// declared as void* to prevent the including of libpar2-headers into this header-file
+	// PacketIndex* pPacketIndex
+	bool				Find(const char* szFilename, void* pPacketIndex);
+	void				Add(const char* szFilename, void* pPacketIndex);
+};
+
 #endif
 
 #endif
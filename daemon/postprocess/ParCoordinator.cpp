@@ -46,6 +46,7 @@
 #include "ParCoordinator.h"
 #include "Options.h"
 #include "DiskState.h"
+#include "ArticleWriter.h"
 #include "Log.h"
 #include "Util.h"
 
@@ -53,14 +54,14 @@ extern Options* g_pOptions;
 extern DiskState* g_pDiskState;
 
 #ifndef DISABLE_PARCHECK
-bool ParCoordinator::PostParChecker::RequestMorePars(int iBlockNeeded, int* pBlockFound)
+bool ParCoordinator::PostParChecker::RequestMorePars(const char* szParFilename, int iBlockNeeded, int* pBlockFound)
 {
-	return m_pOwner->RequestMorePars(m_pPostInfo->GetNZBInfo(), GetParFilename(), iBlockNeeded, pBlockFound);
+	return m_pOwner->RequestMorePars(m_pPostInfo->GetNZBInfo(), szParFilename, iBlockNeeded, pBlockFound);
 }
 
 void ParCoordinator::PostParChecker::UpdateProgress()
 {
-	m_pOwner->UpdateParCheckProgress();
+	m_pOwner->UpdateParCheckProgress(this);
 }
 
 void ParCoordinator::PostParChecker::PrintMessage(Message::EKind eKind, const char* szFormat, ...)
@@ -93,20 +94,23 @@ bool ParCoordinator::PostParChecker::IsParredFile(const char* szFilename)
 	return false;
 }
 
-ParChecker::EFileStatus ParCoordinator::PostParChecker::FindFileCrc(const char* szFilename,
-	unsigned long* lCrc, SegmentList* pSegments)
+CompletedFile* ParCoordinator::PostParChecker::FindCompletedFile(const char* szFilename)
 {
-	CompletedFile* pCompletedFile = NULL;
-
 	for (CompletedFiles::iterator it = m_pPostInfo->GetNZBInfo()->GetCompletedFiles()->begin(); it != m_pPostInfo->GetNZBInfo()->GetCompletedFiles()->end(); it++)
 	{
-		CompletedFile* pCompletedFile2 = *it;
-		if (!strcasecmp(pCompletedFile2->GetFileName(), szFilename))
+		CompletedFile* pCompletedFile = *it;
+		if (!strcasecmp(pCompletedFile->GetFileName(), szFilename))
 		{
-			pCompletedFile = pCompletedFile2;
-			break;
+			return pCompletedFile;
 		}
 	}
+	return NULL;
+}
+
+ParChecker::EFileStatus ParCoordinator::PostParChecker::FindFileCrc(const char* szFilename,
+	unsigned long* lCrc, SegmentList* pSegments)
+{
+	CompletedFile* pCompletedFile = FindCompletedFile(szFilename);
 	if (!pCompletedFile)
 	{
 		return ParChecker::fsUnknown;
@@ -146,9 +150,29 @@ ParChecker::EFileStatus ParCoordinator::PostParChecker::FindFileCrc(const char*
 		ParChecker::fsUnknown;
 }
 
+bool ParCoordinator::PostParChecker::FindFileHashes(const char* szFilename, ParHashes* pParHashes)
+{
+	if (m_pPostInfo->GetForceParFull() || m_pPostInfo->GetNZBInfo()->GetReprocess())
+	{
+		return false;
+	}
+
+	CompletedFile* pCompletedFile = FindCompletedFile(szFilename);
+	return pCompletedFile && pCompletedFile->GetID() > 0 &&
+		g_pDiskState->LoadParHashes(pCompletedFile->GetID(), pParHashes);
+}
+
+int ParCoordinator::PostParChecker::GetParBuffer()
+{
+	// par-checks in all cpu-slots share the memory limit
+	int iSlots = g_pOptions->GetPostCpuSlots() > 0 ? g_pOptions->GetPostCpuSlots() : 1;
+	int iParBuffer = ParChecker::GetParBuffer() / iSlots;
+	return iParBuffer > 0 ? iParBuffer : 1;
+}
+
 void ParCoordinator::PostParRenamer::UpdateProgress()
 {
-	m_pOwner->UpdateParRenameProgress();
+	m_pOwner->UpdateParRenameProgress(this);
 }
 
 void ParCoordinator::PostParRenamer::PrintMessage(Message::EKind eKind, const char* szFormat, ...)
@@ -184,6 +208,392 @@ void ParCoordinator::PostParRenamer::RegisterRenamedFile(const char* szOldFilena
 	}
 }
 
+/**
+ *  Take the hash of the first 16 KB computed during download for files which were
+ *  downloaded into the destination directory and not changed since then.
+ */
+bool ParCoordinator::PostParRenamer::FindFileHash16k(const char* szFilename, unsigned char* pHash16k)
+{
+	NZBInfo* pNZBInfo = m_pPostInfo->GetNZBInfo();
+	if (pNZBInfo->GetReprocess() || pNZBInfo->GetUnpackStatus() != NZBInfo::usNone)
+	{
+		return false;
+	}
+
+	const char* szBasename = Util::BaseFileName(szFilename);
+	int iDirLen = (int)(szBasename - szFilename) - 1;
+	if (iDirLen != (int)strlen(pNZBInfo->GetDestDir()) || strncmp(szFilename, pNZBInfo->GetDestDir(), iDirLen))
+	{
+		return false;
+	}
+
+	for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
+	{
+		CompletedFile* pCompletedFile = *it;
+		if (!strcasecmp(pCompletedFile->GetFileName(), szBasename))
+		{
+			if (!pCompletedFile->GetHash16k())
+			{
+				return false;
+			}
+			memcpy(pHash16k, pCompletedFile->GetHash16k(), 16);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+ParCoordinator::PreChecker::PreChecker()
+{
+	m_pOwner = NULL;
+	m_bStarted = false;
+}
+
+ParCoordinator::PreChecker::~PreChecker()
+{
+	for (NZBStates::iterator it = m_NZBStates.begin(); it != m_NZBStates.end(); it++)
+	{
+		DeleteState(*it);
+	}
+	m_NZBStates.clear();
+}
+
+void ParCoordinator::PreChecker::DeleteState(NZBState* pNZBState)
+{
+	for (ParSets::iterator it = pNZBState->m_ParSets.begin(); it != pNZBState->m_ParSets.end(); it++)
+	{
+		ParSet* pParSet = *it;
+		free(pParSet->m_szParFilename);
+		delete pParSet->m_pParIndex;
+		delete pParSet;
+	}
+	delete pNZBState;
+}
+
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void ParCoordinator::PreChecker::AddNZB(int iNZBID)
+{
+	m_mutexQueue.Lock();
+
+	bool bQueued = false;
+	for (IDList::iterator it = m_Queue.begin(); it != m_Queue.end(); it++)
+	{
+		if (*it == iNZBID)
+		{
+			bQueued = true;
+			break;
+		}
+	}
+	if (!bQueued)
+	{
+		m_Queue.push_back(iNZBID);
+	}
+
+	if (!m_bStarted)
+	{
+		m_bStarted = true;
+		Start();
+	}
+
+	m_mutexQueue.Unlock();
+
+	m_semWake.Post();
+}
+
+void ParCoordinator::PreChecker::Run()
+{
+	while (!IsStopped())
+	{
+		// the background verification has low priority and doesn't compete
+		// with the par-checker for disk and cpu
+		int iNZBID = 0;
+		DownloadQueue::Lock();
+		bool bParCheckRunning = !m_pOwner->m_ParCheckers.empty();
+		DownloadQueue::Unlock();
+		if (!bParCheckRunning)
+		{
+			m_mutexQueue.Lock();
+			if (!m_Queue.empty())
+			{
+				iNZBID = m_Queue.front();
+				m_Queue.pop_front();
+			}
+			m_mutexQueue.Unlock();
+		}
+
+		if (iNZBID > 0)
+		{
+			CheckNZB(iNZBID);
+		}
+		else
+		{
+			// woken up when a file is queued or a par-checker finishes
+			m_semWake.Wait();
+		}
+	}
+}
+
+ParCoordinator::PreChecker::NZBState* ParCoordinator::PreChecker::GetNZBState(int iNZBID)
+{
+	for (NZBStates::iterator it = m_NZBStates.begin(); it != m_NZBStates.end(); it++)
+	{
+		NZBState* pNZBState = *it;
+		if (pNZBState->m_iNZBID == iNZBID)
+		{
+			return pNZBState;
+		}
+	}
+
+	NZBState* pNZBState = new NZBState();
+	pNZBState->m_iNZBID = iNZBID;
+	m_NZBStates.push_back(pNZBState);
+	return pNZBState;
+}
+
+/**
+ * Removes states of nzbs which were deleted or moved to post-processing.
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void ParCoordinator::PreChecker::CleanupStates(DownloadQueue* pDownloadQueue)
+{
+	for (NZBStates::iterator it = m_NZBStates.begin(); it != m_NZBStates.end(); )
+	{
+		NZBState* pNZBState = *it;
+		NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(pNZBState->m_iNZBID);
+		if (!pNZBInfo || pNZBInfo->GetPostInfo())
+		{
+			if (!pNZBInfo)
+			{
+				m_pOwner->ReleasePacketCache(pNZBState->m_iNZBID);
+			}
+			DeleteState(pNZBState);
+			it = m_NZBStates.erase(it);
+			continue;
+		}
+		it++;
+	}
+}
+
+/*
+ * Verifies downloaded files of the nzb against the par-sets already downloaded,
+ * updates the number of missing blocks and unpauses extra par-files if needed.
+ * The block checksums are stored in the disk state and are reused by the
+ * par-checker during post-processing.
+ */
+void ParCoordinator::PreChecker::CheckNZB(int iNZBID)
+{
+	CheckFiles checkFiles;
+	ParFileList newPars;
+
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+	CleanupStates(pDownloadQueue);
+	NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(iNZBID);
+	if (!pNZBInfo || pNZBInfo->GetPostInfo() || pNZBInfo->GetDeleteStatus() != NZBInfo::dsNone)
+	{
+		DownloadQueue::Unlock();
+		return;
+	}
+
+	NZBState* pNZBState = GetNZBState(iNZBID);
+	char* szDestDir = strdup(pNZBInfo->GetDestDir());
+
+	// the packets found in par-files are used later by par-check
+	ParPacketCache* pPacketCache = m_pOwner->GetPacketCache(pNZBInfo);
+	pPacketCache->Retain();
+
+	for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
+	{
+		CompletedFile* pCompletedFile = *it;
+		int iBlocks = 0;
+		if (ParseParFilename(pCompletedFile->GetFileName(), NULL, &iBlocks))
+		{
+			bool bLoaded = false;
+			for (ParSets::iterator it2 = pNZBState->m_ParSets.begin(); it2 != pNZBState->m_ParSets.end(); it2++)
+			{
+				bLoaded |= SameParCollection((*it2)->m_szParFilename, pCompletedFile->GetFileName());
+			}
+			if (iBlocks == 0 && !bLoaded && pCompletedFile->GetStatus() == CompletedFile::cfSuccess)
+			{
+				newPars.push_back(strdup(pCompletedFile->GetFileName()));
+			}
+		}
+		else if (pCompletedFile->GetID() > 0 && !pNZBState->m_CheckedFiles.count(pCompletedFile->GetID()))
+		{
+			CheckFile checkFile;
+			checkFile.m_iID = pCompletedFile->GetID();
+			checkFile.m_szFilename = strdup(pCompletedFile->GetFileName());
+			checkFile.m_bFailure = pCompletedFile->GetStatus() == CompletedFile::cfFailure;
+			checkFiles.push_back(checkFile);
+		}
+	}
+	DownloadQueue::Unlock();
+
+	for (ParFileList::iterator it = newPars.begin(); it != newPars.end(); it++)
+	{
+		char* szParFilename = *it;
+		char szFullFilename[1024];
+		snprintf(szFullFilename, 1024, "%s%c%s", szDestDir, (int)PATH_SEPARATOR, szParFilename);
+		szFullFilename[1024-1] = '\0';
+
+		ParSet* pParSet = new ParSet();
+		pParSet->m_szParFilename = szParFilename;
+		pParSet->m_iRequestedBlocks = 0;
+		pParSet->m_pParIndex = new ParIndex();
+		if (pParSet->m_pParIndex->Load(szFullFilename, pPacketCache))
+		{
+			detail("Loaded par-set %s for background verification", szParFilename);
+		}
+		else
+		{
+			// an unusable par-file isn't loaded again, the par-checker will deal with it
+			delete pParSet->m_pParIndex;
+			pParSet->m_pParIndex = NULL;
+		}
+		pNZBState->m_ParSets.push_back(pParSet);
+	}
+
+	for (CheckFiles::iterator it = checkFiles.begin(); it != checkFiles.end(); it++)
+	{
+		CheckFile& checkFile = *it;
+
+		ParSet* pParSet = NULL;
+		ParIndex::FileEntry* pFileEntry = NULL;
+		for (ParSets::iterator it2 = pNZBState->m_ParSets.begin(); it2 != pNZBState->m_ParSets.end() && !pFileEntry; it2++)
+		{
+			pParSet = *it2;
+			pFileEntry = pParSet->m_pParIndex ? pParSet->m_pParIndex->FindFile(checkFile.m_szFilename) : NULL;
+		}
+
+		if (!pFileEntry || IsStopped())
+		{
+			// the file is checked again when the par-file of its set is downloaded
+			continue;
+		}
+
+		char szFullFilename[1024];
+		snprintf(szFullFilename, 1024, "%s%c%s", szDestDir, (int)PATH_SEPARATOR, checkFile.m_szFilename);
+		szFullFilename[1024-1] = '\0';
+
+		int iBadBlocks = (int)pFileEntry->GetParHashes()->GetBlockHashes()->size();
+		ParHashes parHashes;
+		bool bComputed = false;
+		if (!checkFile.m_bFailure)
+		{
+			long long lFileSize = Util::FileSize(szFullFilename);
+			time_t tModified = Util::FileModificationTime(szFullFilename);
+			if (!g_pDiskState->LoadParHashes(checkFile.m_iID, &parHashes) ||
+				parHashes.GetBlockSize() != pParSet->m_pParIndex->GetBlockSize() ||
+				parHashes.GetFileSize() != lFileSize || parHashes.GetModified() != tModified)
+			{
+				ParHasher parHasher(pParSet->m_pParIndex->GetBlockSize());
+				if (!parHasher.AppendFile(szFullFilename, 0, lFileSize))
+				{
+					continue;
+				}
+				parHashes.GetBlockHashes()->clear();
+				parHasher.GetHashes(&parHashes);
+				parHashes.SetModified(tModified);
+				bComputed = true;
+			}
+			iBadBlocks = ParIndex::CountBadBlocks(pFileEntry->GetParHashes(), &parHashes);
+		}
+
+		pDownloadQueue = DownloadQueue::Lock();
+		pNZBInfo = pDownloadQueue->GetQueue()->Find(iNZBID);
+		if (!pNZBInfo || pNZBInfo->GetPostInfo())
+		{
+			DownloadQueue::Unlock();
+			break;
+		}
+
+		if (bComputed)
+		{
+			g_pDiskState->SaveParHashes(checkFile.m_iID, &parHashes);
+		}
+
+		pNZBState->m_CheckedFiles.insert(checkFile.m_iID);
+		pParSet->m_BadBlocks[checkFile.m_iID] = iBadBlocks;
+
+		if (iBadBlocks > 0)
+		{
+			pNZBInfo->PrintMessage(Message::mkInfo, "File %s%c%s has %i bad block(s)",
+				pNZBInfo->GetName(), (int)PATH_SEPARATOR, checkFile.m_szFilename, iBadBlocks);
+		}
+		else
+		{
+			pNZBInfo->PrintMessage(Message::mkDetail, "File %s%c%s verified successfully",
+				pNZBInfo->GetName(), (int)PATH_SEPARATOR, checkFile.m_szFilename);
+		}
+
+		DownloadQueue::Unlock();
+	}
+
+	for (CheckFiles::iterator it = checkFiles.begin(); it != checkFiles.end(); it++)
+	{
+		free((*it).m_szFilename);
+	}
+
+	pPacketCache->Release();
+
+	// update the number of missing blocks and unpause extra par-files for damaged sets
+	pDownloadQueue = DownloadQueue::Lock();
+	pNZBInfo = pDownloadQueue->GetQueue()->Find(iNZBID);
+	if (pNZBInfo && !pNZBInfo->GetPostInfo() && pNZBInfo->GetDeleteStatus() == NZBInfo::dsNone)
+	{
+		int iMissingBlocks = 0;
+		for (ParSets::iterator it = pNZBState->m_ParSets.begin(); it != pNZBState->m_ParSets.end(); it++)
+		{
+			ParSet* pParSet = *it;
+
+			int iSetMissing = 0;
+			for (std::map<int, int>::iterator it2 = pParSet->m_BadBlocks.begin(); it2 != pParSet->m_BadBlocks.end(); it2++)
+			{
+				iSetMissing += it2->second;
+			}
+			iMissingBlocks += iSetMissing;
+
+			// par-files already downloaded provide their blocks without unpausing
+			int iAvailable = 0;
+			for (CompletedFiles::iterator it2 = pNZBInfo->GetCompletedFiles()->begin(); it2 != pNZBInfo->GetCompletedFiles()->end(); it2++)
+			{
+				CompletedFile* pCompletedFile = *it2;
+				int iBlocks = 0;
+				if (pCompletedFile->GetStatus() == CompletedFile::cfSuccess &&
+					ParseParFilename(pCompletedFile->GetFileName(), NULL, &iBlocks) && iBlocks > 0 &&
+					SameParCollection(pCompletedFile->GetFileName(), pParSet->m_szParFilename))
+				{
+					iAvailable += iBlocks;
+				}
+			}
+
+			int iBlockNeeded = iSetMissing - iAvailable;
+			if (iBlockNeeded > pParSet->m_iRequestedBlocks)
+			{
+				char szFullFilename[1024];
+				snprintf(szFullFilename, 1024, "%s%c%s", szDestDir, (int)PATH_SEPARATOR, pParSet->m_szParFilename);
+				szFullFilename[1024-1] = '\0';
+
+				int iBlockFound = 0;
+				if (!m_pOwner->UnpausePars(pDownloadQueue, pNZBInfo, szFullFilename, iBlockNeeded, &iBlockFound))
+				{
+					pNZBInfo->PrintMessage(Message::mkWarning, "Need %i more par-block(s) for %s%c%s, but only %i block(s) are available",
+						iBlockNeeded, pNZBInfo->GetName(), (int)PATH_SEPARATOR, pParSet->m_szParFilename, iBlockFound);
+				}
+				pParSet->m_iRequestedBlocks = iBlockNeeded;
+			}
+		}
+
+		pNZBInfo->SetParMissingBlocks(iMissingBlocks);
+	}
+	DownloadQueue::Unlock();
+
+	free(szDestDir);
+}
+
 #endif
 
 ParCoordinator::ParCoordinator()
@@ -192,14 +602,20 @@ ParCoordinator::ParCoordinator()
 
 #ifndef DISABLE_PARCHECK
 	m_bStopped = false;
-	m_ParChecker.m_pOwner = this;
-	m_ParRenamer.m_pOwner = this;
+	m_PreChecker.m_pOwner = this;
 #endif
 }
 
 ParCoordinator::~ParCoordinator()
 {
 	debug("Destroying ParCoordinator");
+
+#ifndef DISABLE_PARCHECK
+	for (PacketCaches::iterator it = m_PacketCaches.begin(); it != m_PacketCaches.end(); it++)
+	{
+		it->second->Release();
+	}
+#endif
 }
 
 #ifndef DISABLE_PARCHECK
@@ -209,19 +625,58 @@ void ParCoordinator::Stop()
 
 	m_bStopped = true;
 
-	if (m_ParChecker.IsRunning())
+	// the list of par-checkers is guarded by the queue lock, which must not
+	// be held while waiting because finishing par-checkers need it
+	DownloadQueue::Lock();
+	for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
 	{
-		m_ParChecker.Stop();
+		(*it)->Stop();
+	}
+	DownloadQueue::Unlock();
+
+	int iMSecWait = 5000;
+	bool bRunning = true;
+	while (bRunning && iMSecWait > 0)
+	{
+		bRunning = false;
+		DownloadQueue::Lock();
+		for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
+		{
+			bRunning |= (*it)->IsRunning();
+		}
+		DownloadQueue::Unlock();
+		if (bRunning)
+		{
+			usleep(50 * 1000);
+			iMSecWait -= 50;
+		}
+	}
+
+	DownloadQueue::Lock();
+	for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
+	{
+		PostParChecker* pParChecker = *it;
+		if (pParChecker->IsRunning())
+		{
+			warn("Terminating par-check for %s", pParChecker->GetInfoName());
+			pParChecker->Kill();
+		}
+	}
+	DownloadQueue::Unlock();
+
+	if (m_PreChecker.IsRunning())
+	{
+		m_PreChecker.Stop();
 		int iMSecWait = 5000;
-		while (m_ParChecker.IsRunning() && iMSecWait > 0)
+		while (m_PreChecker.IsRunning() && iMSecWait > 0)
 		{
 			usleep(50 * 1000);
 			iMSecWait -= 50;
 		}
-		if (m_ParChecker.IsRunning())
+		if (m_PreChecker.IsRunning())
 		{
-			warn("Terminating par-check for %s", m_ParChecker.GetInfoName());
-			m_ParChecker.Kill();
+			warn("Terminating background par-verification");
+			m_PreChecker.Kill();
 		}
 	}
 }
@@ -343,21 +798,28 @@ bool ParCoordinator::ParseParFilename(const char* szParFilename, int* iBaseNameL
 #ifndef DISABLE_PARCHECK
 
 /**
+ * Each par-job gets its own checker, which is owned by the post-job (PostThread),
+ * so par-jobs of several nzbs can run at the same time.
  * DownloadQueue must be locked prior to call of this function.
  */
 void ParCoordinator::StartParCheckJob(PostInfo* pPostInfo)
 {
-	m_eCurrentJob = jkParCheck;
-	m_ParChecker.SetPostInfo(pPostInfo);
-	m_ParChecker.SetDestDir(pPostInfo->GetNZBInfo()->GetDestDir());
-	m_ParChecker.SetNZBName(pPostInfo->GetNZBInfo()->GetName());
-	m_ParChecker.SetParTime(time(NULL));
-	m_ParChecker.SetDownloadSec(pPostInfo->GetNZBInfo()->GetDownloadSec());
-	m_ParChecker.SetParQuick(g_pOptions->GetParQuick() && !pPostInfo->GetForceParFull());
-	m_ParChecker.SetForceRepair(pPostInfo->GetForceRepair());
-	m_ParChecker.PrintMessage(Message::mkInfo, "Checking pars for %s", pPostInfo->GetNZBInfo()->GetName());
+	PostParChecker* pParChecker = new PostParChecker();
+	pParChecker->m_pOwner = this;
+	pParChecker->SetPostInfo(pPostInfo);
+	pParChecker->SetDestDir(pPostInfo->GetNZBInfo()->GetDestDir());
+	pParChecker->SetNZBName(pPostInfo->GetNZBInfo()->GetName());
+	pParChecker->SetParTime(time(NULL));
+	pParChecker->SetDownloadSec(pPostInfo->GetNZBInfo()->GetDownloadSec());
+	pParChecker->SetParQuick(g_pOptions->GetParQuick() && !pPostInfo->GetForceParFull());
+	pParChecker->SetForceRepair(pPostInfo->GetForceRepair());
+	pParChecker->SetPacketCache(GetPacketCache(pPostInfo->GetNZBInfo()));
+	pParChecker->SetNZBID(pPostInfo->GetNZBInfo()->GetID());
+	pParChecker->PrintMessage(Message::mkInfo, "Checking pars for %s", pPostInfo->GetNZBInfo()->GetName());
+	pPostInfo->SetPostThread(pParChecker);
 	pPostInfo->SetWorking(true);
-	m_ParChecker.Start();
+	m_ParCheckers.push_back(pParChecker);
+	pParChecker->Start();
 }
 
 /**
@@ -375,36 +837,74 @@ void ParCoordinator::StartParRenameJob(PostInfo* pPostInfo)
 		szDestDir = szFinalDir;
 	}
 
-	m_eCurrentJob = jkParRename;
-	m_ParRenamer.SetPostInfo(pPostInfo);
-	m_ParRenamer.SetDestDir(szDestDir);
-	m_ParRenamer.SetInfoName(pPostInfo->GetNZBInfo()->GetName());
-	m_ParRenamer.SetDetectMissing(pPostInfo->GetNZBInfo()->GetUnpackStatus() == NZBInfo::usNone);
-	m_ParRenamer.PrintMessage(Message::mkInfo, "Checking renamed files for %s", pPostInfo->GetNZBInfo()->GetName());
+	PostParRenamer* pParRenamer = new PostParRenamer();
+	pParRenamer->m_pOwner = this;
+	pParRenamer->SetPostInfo(pPostInfo);
+	pParRenamer->SetDestDir(szDestDir);
+	pParRenamer->SetInfoName(pPostInfo->GetNZBInfo()->GetName());
+	pParRenamer->SetDetectMissing(pPostInfo->GetNZBInfo()->GetUnpackStatus() == NZBInfo::usNone);
+	pParRenamer->SetPacketCache(GetPacketCache(pPostInfo->GetNZBInfo()));
+	pParRenamer->PrintMessage(Message::mkInfo, "Checking renamed files for %s", pPostInfo->GetNZBInfo()->GetName());
+	pPostInfo->SetPostThread(pParRenamer);
 	pPostInfo->SetWorking(true);
-	m_ParRenamer.Start();
+	m_ParRenamers.push_back(pParRenamer);
+	pParRenamer->Start();
+}
+
+/**
+ * Par-rename, par-check and repair of one nzb share the packets found in par2-files.
+ * DownloadQueue must be locked prior to call of this function.
+ */
+ParPacketCache* ParCoordinator::GetPacketCache(NZBInfo* pNZBInfo)
+{
+	ParPacketCache*& pPacketCache = m_PacketCaches[pNZBInfo->GetID()];
+	if (!pPacketCache)
+	{
+		pPacketCache = new ParPacketCache();
+	}
+	return pPacketCache;
+}
+
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void ParCoordinator::ReleasePacketCache(int iNZBID)
+{
+	PacketCaches::iterator it = m_PacketCaches.find(iNZBID);
+	if (it != m_PacketCaches.end())
+	{
+		it->second->Release();
+		m_PacketCaches.erase(it);
+	}
 }
 
-bool ParCoordinator::Cancel()
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+bool ParCoordinator::Cancel(PostInfo* pPostInfo)
 {
-	if (m_eCurrentJob == jkParCheck)
+	for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
 	{
-		if (!m_ParChecker.GetCancelled())
+		PostParChecker* pParChecker = *it;
+		if (pParChecker->GetPostInfo() == pPostInfo && !pParChecker->GetCancelled())
 		{
-			debug("Cancelling par-repair for %s", m_ParChecker.GetInfoName());
-			m_ParChecker.Cancel();
+			debug("Cancelling par-repair for %s", pParChecker->GetInfoName());
+			pParChecker->Cancel();
 			return true;
 		}
 	}
-	else if (m_eCurrentJob == jkParRename)
+
+	for (ParRenamers::iterator it = m_ParRenamers.begin(); it != m_ParRenamers.end(); it++)
 	{
-		if (!m_ParRenamer.GetCancelled())
+		PostParRenamer* pParRenamer = *it;
+		if (pParRenamer->GetPostInfo() == pPostInfo && !pParRenamer->GetCancelled())
 		{
-			debug("Cancelling par-rename for %s", m_ParRenamer.GetInfoName());
-			m_ParRenamer.Cancel();
+			debug("Cancelling par-rename for %s", pParRenamer->GetInfoName());
+			pParRenamer->Cancel();
 			return true;
 		}
 	}
+
 	return false;
 }
 
@@ -413,37 +913,73 @@ bool ParCoordinator::Cancel()
  */
 bool ParCoordinator::AddPar(FileInfo* pFileInfo, bool bDeleted)
 {
-	bool bSameCollection = m_ParChecker.IsRunning() &&
-		pFileInfo->GetNZBInfo() == m_ParChecker.GetPostInfo()->GetNZBInfo();
+	PostParChecker* pParChecker = NULL;
+	for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
+	{
+		if ((*it)->GetPostInfo()->GetNZBInfo() == pFileInfo->GetNZBInfo())
+		{
+			pParChecker = *it;
+			break;
+		}
+	}
+
+	bool bSameCollection = pParChecker && pParChecker->IsRunning();
 	if (bSameCollection && !bDeleted)
 	{
 		char szFullFilename[1024];
 		snprintf(szFullFilename, 1024, "%s%c%s", pFileInfo->GetNZBInfo()->GetDestDir(), (int)PATH_SEPARATOR, pFileInfo->GetFilename());
 		szFullFilename[1024-1] = '\0';
-		m_ParChecker.AddParFile(szFullFilename);
+		pParChecker->AddParFile(szFullFilename);
 	}
 	else
 	{
-		m_ParChecker.QueueChanged();
+		for (ParCheckers::iterator it = m_ParCheckers.begin(); it != m_ParCheckers.end(); it++)
+		{
+			(*it)->QueueChanged();
+		}
 	}
 	return bSameCollection;
 }
 
-void ParCoordinator::ParCheckCompleted()
+/**
+ * Queues the nzb for background verification of downloaded files.
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void ParCoordinator::FileDownloaded(FileInfo* pFileInfo)
+{
+	if (m_bStopped || !g_pOptions->GetParPreCheck() || g_pOptions->GetParCheck() == Options::pcManual)
+	{
+		return;
+	}
+
+	m_PreChecker.AddNZB(pFileInfo->GetNZBInfo()->GetID());
+}
+
+void ParCoordinator::ParCheckCompleted(PostParChecker* pParChecker)
 {
 	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
 
-	PostInfo* pPostInfo = m_ParChecker.GetPostInfo();
+	m_ParCheckers.remove(pParChecker);
+	m_PreChecker.Wake();
+
+	if (m_bStopped)
+	{
+		// the par-check was interrupted by shutdown and runs again after restart
+		DownloadQueue::Unlock();
+		return;
+	}
+
+	PostInfo* pPostInfo = pParChecker->GetPostInfo();
 
 	// Update ParStatus (accumulate result)
-	if ((m_ParChecker.GetStatus() == ParChecker::psRepaired ||
-		m_ParChecker.GetStatus() == ParChecker::psRepairNotNeeded) &&
+	if ((pParChecker->GetStatus() == ParChecker::psRepaired ||
+		pParChecker->GetStatus() == ParChecker::psRepairNotNeeded) &&
 		pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped)
 	{
 		pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psSuccess);
-		pPostInfo->SetParRepaired(m_ParChecker.GetStatus() == ParChecker::psRepaired);
+		pPostInfo->SetParRepaired(pParChecker->GetStatus() == ParChecker::psRepaired);
 	}
-	else if (m_ParChecker.GetStatus() == ParChecker::psRepairPossible &&
+	else if (pParChecker->GetStatus() == ParChecker::psRepairPossible &&
 		pPostInfo->GetNZBInfo()->GetParStatus() != NZBInfo::psFailure)
 	{
 		pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psRepairPossible);
@@ -453,12 +989,12 @@ void ParCoordinator::ParCheckCompleted()
 		pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psFailure);
 	}
 
-	int iWaitTime = pPostInfo->GetNZBInfo()->GetDownloadSec() - m_ParChecker.GetDownloadSec();
+	int iWaitTime = pPostInfo->GetNZBInfo()->GetDownloadSec() - pParChecker->GetDownloadSec();
 	pPostInfo->SetStartTime(pPostInfo->GetStartTime() + (time_t)iWaitTime);
-	int iParSec = (int)(time(NULL) - m_ParChecker.GetParTime()) - iWaitTime;
+	int iParSec = (int)(time(NULL) - pParChecker->GetParTime()) - iWaitTime;
 	pPostInfo->GetNZBInfo()->SetParSec(pPostInfo->GetNZBInfo()->GetParSec() + iParSec);
 
-	pPostInfo->GetNZBInfo()->SetParFull(m_ParChecker.GetParFull());
+	pPostInfo->GetNZBInfo()->SetParFull(pParChecker->GetParFull());
 
 	pPostInfo->SetWorking(false);
 	pPostInfo->SetStage(PostInfo::ptQueued);
@@ -476,7 +1012,17 @@ void ParCoordinator::ParCheckCompleted()
 bool ParCoordinator::RequestMorePars(NZBInfo* pNZBInfo, const char* szParFilename, int iBlockNeeded, int* pBlockFound)
 {
 	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
-	
+	bool bOK = UnpausePars(pDownloadQueue, pNZBInfo, szParFilename, iBlockNeeded, pBlockFound);
+	DownloadQueue::Unlock();
+	return bOK;
+}
+
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+bool ParCoordinator::UnpausePars(DownloadQueue* pDownloadQueue, NZBInfo* pNZBInfo, const char* szParFilename,
+	int iBlockNeeded, int* pBlockFound)
+{
 	Blocks blocks;
 	blocks.clear();
 	int iBlockFound = 0;
@@ -517,7 +1063,7 @@ bool ParCoordinator::RequestMorePars(NZBInfo* pNZBInfo, const char* szParFilenam
 			{
 				if (pBestBlockInfo->m_pFileInfo->GetPaused())
 				{
-					m_ParChecker.PrintMessage(Message::mkInfo, "Unpausing %s%c%s for par-recovery", pNZBInfo->GetName(), (int)PATH_SEPARATOR, pBestBlockInfo->m_pFileInfo->GetFilename());
+					pNZBInfo->PrintMessage(Message::mkInfo, "Unpausing %s%c%s for par-recovery", pNZBInfo->GetName(), (int)PATH_SEPARATOR, pBestBlockInfo->m_pFileInfo->GetFilename());
 					pBestBlockInfo->m_pFileInfo->SetPaused(false);
 					pBestBlockInfo->m_pFileInfo->SetExtraPriority(true);
 				}
@@ -541,7 +1087,7 @@ bool ParCoordinator::RequestMorePars(NZBInfo* pNZBInfo, const char* szParFilenam
 			BlockInfo* pBlockInfo = blocks.front();
 			if (pBlockInfo->m_pFileInfo->GetPaused())
 			{
-				m_ParChecker.PrintMessage(Message::mkInfo, "Unpausing %s%c%s for par-recovery", pNZBInfo->GetName(), (int)PATH_SEPARATOR, pBlockInfo->m_pFileInfo->GetFilename());
+				pNZBInfo->PrintMessage(Message::mkInfo, "Unpausing %s%c%s for par-recovery", pNZBInfo->GetName(), (int)PATH_SEPARATOR, pBlockInfo->m_pFileInfo->GetFilename());
 				pBlockInfo->m_pFileInfo->SetPaused(false);
 				pBlockInfo->m_pFileInfo->SetExtraPriority(true);
 			}
@@ -549,8 +1095,6 @@ bool ParCoordinator::RequestMorePars(NZBInfo* pNZBInfo, const char* szParFilenam
 		}
 	}
 
-	DownloadQueue::Unlock();
-
 	if (pBlockFound)
 	{
 		*pBlockFound = iBlockFound;
@@ -651,19 +1195,19 @@ void ParCoordinator::FindPars(DownloadQueue* pDownloadQueue, NZBInfo* pNZBInfo,
 	}
 }
 
-void ParCoordinator::UpdateParCheckProgress()
+void ParCoordinator::UpdateParCheckProgress(PostParChecker* pParChecker)
 {
 	DownloadQueue::Lock();
 
-	PostInfo* pPostInfo = m_ParChecker.GetPostInfo();
-	if (m_ParChecker.GetFileProgress() == 0)
+	PostInfo* pPostInfo = pParChecker->GetPostInfo();
+	if (pParChecker->GetFileProgress() == 0)
 	{
-		pPostInfo->SetProgressLabel(m_ParChecker.GetProgressLabel());
+		pPostInfo->SetProgressLabel(pParChecker->GetProgressLabel());
 	}
-	pPostInfo->SetFileProgress(m_ParChecker.GetFileProgress());
-	pPostInfo->SetStageProgress(m_ParChecker.GetStageProgress());
+	pPostInfo->SetFileProgress(pParChecker->GetFileProgress());
+	pPostInfo->SetStageProgress(pParChecker->GetStageProgress());
     PostInfo::EStage StageKind[] = { PostInfo::ptLoadingPars, PostInfo::ptVerifyingSources, PostInfo::ptRepairing, PostInfo::ptVerifyingRepaired };
-	PostInfo::EStage eStage = StageKind[m_ParChecker.GetStage()];
+	PostInfo::EStage eStage = StageKind[pParChecker->GetStage()];
 	time_t tCurrent = time(NULL);
 
 	if (pPostInfo->GetStage() != eStage)
@@ -672,20 +1216,20 @@ void ParCoordinator::UpdateParCheckProgress()
 		pPostInfo->SetStageTime(tCurrent);
 		if (pPostInfo->GetStage() == PostInfo::ptRepairing)
 		{
-			m_ParChecker.SetRepairTime(tCurrent);
+			pParChecker->SetRepairTime(tCurrent);
 		}
 		else if (pPostInfo->GetStage() == PostInfo::ptVerifyingRepaired)
 		{
-			int iRepairSec = (int)(tCurrent - m_ParChecker.GetRepairTime());
+			int iRepairSec = (int)(tCurrent - pParChecker->GetRepairTime());
 			pPostInfo->GetNZBInfo()->SetRepairSec(pPostInfo->GetNZBInfo()->GetRepairSec() + iRepairSec);
 		}
 	}
 
 	bool bParCancel = false;
-	if (!m_ParChecker.GetCancelled())
+	if (!pParChecker->GetCancelled())
 	{
 		if ((g_pOptions->GetParTimeLimit() > 0) &&
-			m_ParChecker.GetStage() == ParChecker::ptRepairing &&
+			pParChecker->GetStage() == ParChecker::ptRepairing &&
 			((g_pOptions->GetParTimeLimit() > 5 && tCurrent - pPostInfo->GetStageTime() > 5 * 60) ||
 			(g_pOptions->GetParTimeLimit() <= 5 && tCurrent - pPostInfo->GetStageTime() > 1 * 60)))
 		{
@@ -695,7 +1239,7 @@ void ParCoordinator::UpdateParCheckProgress()
 			if (iEstimatedRepairTime > g_pOptions->GetParTimeLimit() * 60)
 			{
 				debug("Estimated repair time %i seconds", iEstimatedRepairTime);
-				m_ParChecker.PrintMessage(Message::mkWarning, "Cancelling par-repair for %s, estimated repair time (%i minutes) exceeds allowed repair time", m_ParChecker.GetInfoName(), iEstimatedRepairTime / 60);
+				pParChecker->PrintMessage(Message::mkWarning, "Cancelling par-repair for %s, estimated repair time (%i minutes) exceeds allowed repair time", pParChecker->GetInfoName(), iEstimatedRepairTime / 60);
 				bParCancel = true;
 			}
 		}
@@ -703,22 +1247,22 @@ void ParCoordinator::UpdateParCheckProgress()
 
 	if (bParCancel)
 	{
-		m_ParChecker.Cancel();
+		pParChecker->Interrupt();
 	}
 
 	DownloadQueue::Unlock();
 	
-	CheckPauseState(pPostInfo);
+	CheckPauseState(pPostInfo, pParChecker);
 }
 
-void ParCoordinator::CheckPauseState(PostInfo* pPostInfo)
+void ParCoordinator::CheckPauseState(PostInfo* pPostInfo, PostParChecker* pParChecker)
 {
 	if (g_pOptions->GetPausePostProcess() && !pPostInfo->GetNZBInfo()->GetForcePriority())
 	{
 		time_t tStageTime = pPostInfo->GetStageTime();
 		time_t tStartTime = pPostInfo->GetStartTime();
-		time_t tParTime = m_ParChecker.GetParTime();
-		time_t tRepairTime = m_ParChecker.GetRepairTime();
+		time_t tParTime = pParChecker ? pParChecker->GetParTime() : 0;
+		time_t tRepairTime = pParChecker ? pParChecker->GetRepairTime() : 0;
 		time_t tWaitTime = time(NULL);
 		
 		// wait until Post-processor is unpaused
@@ -740,26 +1284,28 @@ void ParCoordinator::CheckPauseState(PostInfo* pPostInfo)
 			}
 			if (tParTime > 0)
 			{
-				m_ParChecker.SetParTime(tParTime + tDelta);
+				pParChecker->SetParTime(tParTime + tDelta);
 			}
 			if (tRepairTime > 0)
 			{
-				m_ParChecker.SetRepairTime(tRepairTime + tDelta);
+				pParChecker->SetRepairTime(tRepairTime + tDelta);
 			}
 		}
 	}
 }
 
-void ParCoordinator::ParRenameCompleted()
+void ParCoordinator::ParRenameCompleted(PostParRenamer* pParRenamer)
 {
 	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+
+	m_ParRenamers.remove(pParRenamer);
 	
-	PostInfo* pPostInfo = m_ParRenamer.GetPostInfo();
-	pPostInfo->GetNZBInfo()->SetRenameStatus(m_ParRenamer.GetStatus() == ParRenamer::psSuccess ? NZBInfo::rsSuccess : NZBInfo::rsFailure);
+	PostInfo* pPostInfo = pParRenamer->GetPostInfo();
+	pPostInfo->GetNZBInfo()->SetRenameStatus(pParRenamer->GetStatus() == ParRenamer::psSuccess ? NZBInfo::rsSuccess : NZBInfo::rsFailure);
 
-	if (m_ParRenamer.HasMissedFiles() && pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped)
+	if (pParRenamer->HasMissedFiles() && pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped)
 	{
-		m_ParRenamer.PrintMessage(Message::mkInfo, "Requesting par-check/repair for %s to restore missing files ", m_ParRenamer.GetInfoName());
+		pParRenamer->PrintMessage(Message::mkInfo, "Requesting par-check/repair for %s to restore missing files ", pParRenamer->GetInfoName());
 		pPostInfo->SetRequestParCheck(true);
 	}
 
@@ -771,13 +1317,13 @@ void ParCoordinator::ParRenameCompleted()
 	DownloadQueue::Unlock();
 }
 
-void ParCoordinator::UpdateParRenameProgress()
+void ParCoordinator::UpdateParRenameProgress(PostParRenamer* pParRenamer)
 {
 	DownloadQueue::Lock();
 	
-	PostInfo* pPostInfo = m_ParRenamer.GetPostInfo();
-	pPostInfo->SetProgressLabel(m_ParRenamer.GetProgressLabel());
-	pPostInfo->SetStageProgress(m_ParRenamer.GetStageProgress());
+	PostInfo* pPostInfo = pParRenamer->GetPostInfo();
+	pPostInfo->SetProgressLabel(pParRenamer->GetProgressLabel());
+	pPostInfo->SetStageProgress(pParRenamer->GetStageProgress());
 	time_t tCurrent = time(NULL);
 	
 	if (pPostInfo->GetStage() != PostInfo::ptRenaming)
@@ -788,7 +1334,7 @@ void ParCoordinator::UpdateParRenameProgress()
 	
 	DownloadQueue::Unlock();
 	
-	CheckPauseState(pPostInfo);
+	CheckPauseState(pPostInfo, NULL);
 }
 
 #endif
@@ -28,6 +28,8 @@
 
 #include <list>
 #include <deque>
+#include <map>
+#include <set>
 
 #include "DownloadInfo.h"
 
@@ -48,14 +50,18 @@ private:
 		time_t			m_tParTime;
 		time_t			m_tRepairTime;
 		int				m_iDownloadSec;
+
+		CompletedFile*	FindCompletedFile(const char* szFilename);
 	protected:
-		virtual bool	RequestMorePars(int iBlockNeeded, int* pBlockFound);
+		virtual bool	RequestMorePars(const char* szParFilename, int iBlockNeeded, int* pBlockFound);
 		virtual void	UpdateProgress();
-		virtual void	Completed() { m_pOwner->ParCheckCompleted(); }
+		virtual void	Completed() { m_pOwner->ParCheckCompleted(this); }
 		virtual void	PrintMessage(Message::EKind eKind, const char* szFormat, ...);
 		virtual void	RegisterParredFile(const char* szFilename);
 		virtual bool	IsParredFile(const char* szFilename);
 		virtual EFileStatus	FindFileCrc(const char* szFilename, unsigned long* lCrc, SegmentList* pSegments);
+		virtual bool	FindFileHashes(const char* szFilename, ParHashes* pParHashes);
+		virtual int		GetParBuffer();
 	public:
 		PostInfo*		GetPostInfo() { return m_pPostInfo; }
 		void			SetPostInfo(PostInfo* pPostInfo) { m_pPostInfo = pPostInfo; }
@@ -76,10 +82,11 @@ private:
 		PostInfo*		m_pPostInfo;
 	protected:
 		virtual void	UpdateProgress();
-		virtual void	Completed() { m_pOwner->ParRenameCompleted(); }
+		virtual void	Completed() { m_pOwner->ParRenameCompleted(this); }
 		virtual void	PrintMessage(Message::EKind eKind, const char* szFormat, ...);
 		virtual void	RegisterParredFile(const char* szFilename);
 		virtual void	RegisterRenamedFile(const char* szOldFilename, const char* szNewFileName);
+		virtual bool	FindFileHash16k(const char* szFilename, unsigned char* pHash16k);
 	public:
 		PostInfo*		GetPostInfo() { return m_pPostInfo; }
 		void			SetPostInfo(PostInfo* pPostInfo) { m_pPostInfo = pPostInfo; }
@@ -87,6 +94,61 @@ private:
 		friend class ParCoordinator;
 	};
 	
+
+	class PreChecker: public Thread
+	{
+	private:
+		struct ParSet
+		{
+			char*			m_szParFilename;
+			ParIndex*		m_pParIndex;
+			std::map<int, int>	m_BadBlocks;
+			int				m_iRequestedBlocks;
+		};
+
+		typedef std::deque<ParSet*>	ParSets;
+
+		struct NZBState
+		{
+			int				m_iNZBID;
+			ParSets			m_ParSets;
+			std::set<int>	m_CheckedFiles;
+		};
+
+		typedef std::deque<NZBState*>	NZBStates;
+
+		struct CheckFile
+		{
+			int				m_iID;
+			char*			m_szFilename;
+			bool			m_bFailure;
+		};
+
+		typedef std::deque<CheckFile>	CheckFiles;
+		typedef std::deque<int>			IDList;
+
+		ParCoordinator*	m_pOwner;
+		IDList			m_Queue;
+		Mutex			m_mutexQueue;
+		Semaphore		m_semWake;
+		bool			m_bStarted;
+		NZBStates		m_NZBStates;
+
+		void			CheckNZB(int iNZBID);
+		NZBState*		GetNZBState(int iNZBID);
+		void			CleanupStates(DownloadQueue* pDownloadQueue);
+		void			DeleteState(NZBState* pNZBState);
+	public:
+						PreChecker();
+						~PreChecker();
+		virtual void	Run();
+		virtual void	Stop() { Thread::Stop(); m_semWake.Post(); }
+		void			AddNZB(int iNZBID);
+		void			Wake() { m_semWake.Post(); }
+
+		friend class ParCoordinator;
+	};
+
 	struct BlockInfo
 	{
 		FileInfo*		m_pFileInfo;
@@ -94,26 +156,28 @@ private:
 	};
 
 	typedef std::list<BlockInfo*> 	Blocks;
-	
-	enum EJobKind
-	{
-		jkParCheck,
-		jkParRename
-	};
+	typedef std::list<PostParChecker*>	ParCheckers;
+	typedef std::list<PostParRenamer*>	ParRenamers;
+	typedef std::map<int, ParPacketCache*>	PacketCaches;
 
 private:
-	PostParChecker		m_ParChecker;
+	ParCheckers			m_ParCheckers;
 	bool				m_bStopped;
-	PostParRenamer		m_ParRenamer;
-	EJobKind			m_eCurrentJob;
+	ParRenamers			m_ParRenamers;
+	PreChecker			m_PreChecker;
+	PacketCaches		m_PacketCaches;
+
+	ParPacketCache*		GetPacketCache(NZBInfo* pNZBInfo);
 
 protected:
-	void				UpdateParCheckProgress();
-	void				UpdateParRenameProgress();
-	void				ParCheckCompleted();
-	void				ParRenameCompleted();
-	void				CheckPauseState(PostInfo* pPostInfo);
+	void				UpdateParCheckProgress(PostParChecker* pParChecker);
+	void				UpdateParRenameProgress(PostParRenamer* pParRenamer);
+	void				ParCheckCompleted(PostParChecker* pParChecker);
+	void				ParRenameCompleted(PostParRenamer* pParRenamer);
+	void				CheckPauseState(PostInfo* pPostInfo, PostParChecker* pParChecker);
 	bool				RequestMorePars(NZBInfo* pNZBInfo, const char* szParFilename, int iBlockNeeded, int* pBlockFound);
+	bool				UnpausePars(DownloadQueue* pDownloadQueue, NZBInfo* pNZBInfo, const char* szParFilename,
+							int iBlockNeeded, int* pBlockFound);
 #endif
 
 public:
@@ -129,12 +193,14 @@ public:
 
 #ifndef DISABLE_PARCHECK
 	bool				AddPar(FileInfo* pFileInfo, bool bDeleted);
+	void				FileDownloaded(FileInfo* pFileInfo);
 	void				FindPars(DownloadQueue* pDownloadQueue, NZBInfo* pNZBInfo, const char* szParFilename, 
 							Blocks* pBlocks, bool bStrictParName, bool bExactParName, int* pBlockFound);
 	void				StartParCheckJob(PostInfo* pPostInfo);
 	void				StartParRenameJob(PostInfo* pPostInfo);
 	void				Stop();
-	bool				Cancel();
+	bool				Cancel(PostInfo* pPostInfo);
+	void				ReleasePacketCache(int iNZBID);
 #endif
 };
 
@@ -56,7 +56,18 @@ extern Options* g_pOptions;
 
 class ParRenamerRepairer : public Par2Repairer
 {
+private:
+	ParPacketCache*	m_pPacketCache;
+
+protected:
+	virtual bool	FindPacketIndex(const string &filename, PacketIndex &index)
+						{ return m_pPacketCache && m_pPacketCache->Find(filename.c_str(), &index); }
+	virtual void	StorePacketIndex(const string &filename, const PacketIndex &index)
+						{ if (m_pPacketCache) m_pPacketCache->Add(filename.c_str(), (void*)&index); }
+
 public:
+					ParRenamerRepairer(ParPacketCache* pPacketCache) { m_pPacketCache = pPacketCache; }
+
 	friend class ParRenamer;
 };
 
@@ -85,6 +96,7 @@ ParRenamer::ParRenamer()
 	m_bCancelled = false;
 	m_bHasMissedFiles = false;
 	m_bDetectMissing = false;
+	m_pPacketCache = NULL;
 }
 
 ParRenamer::~ParRenamer()
@@ -243,7 +255,7 @@ void ParRenamer::LoadParFiles(const char* szDestDir)
 
 void ParRenamer::LoadParFile(const char* szParFilename)
 {
-	ParRenamerRepairer* pRepairer = new ParRenamerRepairer();
+	ParRenamerRepairer* pRepairer = new ParRenamerRepairer(m_pPacketCache);
 
 	if (!pRepairer->LoadPacketsFromFile(szParFilename))
 	{
@@ -348,38 +360,43 @@ bool ParRenamer::IsSplittedFragment(const char* szFilename, const char* szCorrec
 
 void ParRenamer::CheckRegularFile(const char* szDestDir, const char* szFilename)
 {
-	debug("Computing hash for %s", szFilename);
+	MD5Hash hash16k;
 
-	const int iBlockSize = 16*1024;
-	
-	FILE* pFile = fopen(szFilename, FOPEN_RB);
-	if (!pFile)
+	// the hash computed during download makes reading of the file unnecessary
+	if (!FindFileHash16k(szFilename, hash16k.hash))
 	{
-		PrintMessage(Message::mkError, "Could not open file %s", szFilename);
-		return;
-	}
+		debug("Computing hash for %s", szFilename);
 
-	// load first 16K of the file into buffer
-	
-	void* pBuffer = malloc(iBlockSize);
-	
-	int iReadBytes = fread(pBuffer, 1, iBlockSize, pFile);
-	int iError = ferror(pFile);
-	if (iReadBytes != iBlockSize && iError)
-	{
-		PrintMessage(Message::mkError, "Could not read file %s", szFilename);
-		return;
+		const int iBlockSize = 16*1024;
+
+		FILE* pFile = fopen(szFilename, FOPEN_RB);
+		if (!pFile)
+		{
+			PrintMessage(Message::mkError, "Could not open file %s", szFilename);
+			return;
+		}
+
+		// load first 16K of the file into buffer
+
+		void* pBuffer = malloc(iBlockSize);
+
+		int iReadBytes = fread(pBuffer, 1, iBlockSize, pFile);
+		int iError = ferror(pFile);
+		if (iReadBytes != iBlockSize && iError)
+		{
+			PrintMessage(Message::mkError, "Could not read file %s", szFilename);
+			return;
+		}
+
+		fclose(pFile);
+
+		MD5Context context;
+		context.Update(pBuffer, iReadBytes);
+		context.Final(hash16k);
+
+		free(pBuffer);
 	}
-	
-	fclose(pFile);
-	
-	MD5Hash hash16k;
-	MD5Context context;
-	context.Update(pBuffer, iReadBytes);
-	context.Final(hash16k);
-	
-	free(pBuffer);
-	
+
 	debug("file: %s; hash16k: %s", Util::BaseFileName(szFilename), hash16k.print().c_str());
 	
 	for (FileHashList::iterator it = m_FileHashList.begin(); it != m_FileHashList.end(); it++)
@@ -33,6 +33,8 @@
 #include "Thread.h"
 #include "Log.h"
 
+class ParPacketCache;
+
 class ParRenamer : public Thread
 {
 public:
@@ -75,6 +77,7 @@ private:
 	int					m_iRenamedCount;
 	bool				m_bHasMissedFiles;
 	bool				m_bDetectMissing;
+	ParPacketCache*		m_pPacketCache;
 
 	void				Cleanup();
 	void				ClearHashList();
@@ -95,6 +98,7 @@ protected:
 	virtual void		PrintMessage(Message::EKind eKind, const char* szFormat, ...) {}
 	virtual void		RegisterParredFile(const char* szFilename) {}
 	virtual void		RegisterRenamedFile(const char* szOldFilename, const char* szNewFileName) {}
+	virtual bool		FindFileHash16k(const char* szFilename, unsigned char* pHash16k) { return false; }
 	const char*			GetProgressLabel() { return m_szProgressLabel; }
 	int					GetStageProgress() { return m_iStageProgress; }
 
@@ -111,6 +115,7 @@ public:
 	bool				GetCancelled() { return m_bCancelled; }
 	bool				HasMissedFiles() { return m_bHasMissedFiles; }
 	void				SetDetectMissing(bool bDetectMissing) { m_bDetectMissing = bDetectMissing; }
+	void				SetPacketCache(ParPacketCache* pPacketCache) { m_pPacketCache = pPacketCache; }
 };
 
 #endif
@@ -53,9 +53,11 @@
 #include "Scheduler.h"
 #include "Scanner.h"
 #include "Unpack.h"
+#include "ParChecker.h"
 #include "NZBFile.h"
 #include "StatMeter.h"
 #include "QueueScript.h"
+#include "DiskState.h"
 
 extern HistoryCoordinator* g_pHistoryCoordinator;
 extern DupeCoordinator* g_pDupeCoordinator;
@@ -64,13 +66,13 @@ extern Scheduler* g_pScheduler;
 extern Scanner* g_pScanner;
 extern StatMeter* g_pStatMeter;
 extern QueueScriptCoordinator* g_pQueueScriptCoordinator;
+extern DiskState* g_pDiskState;
 
 PrePostProcessor::PrePostProcessor()
 {
 	debug("Creating PrePostProcessor");
 
 	m_iJobCount = 0;
-	m_pCurJob = NULL;
 	m_szPauseReason = NULL;
 
 	m_DownloadQueueObserver.m_pOwner = this;
@@ -141,7 +143,7 @@ void PrePostProcessor::Run()
 		}
 		iHistoryInterval += iStepMSec;
 
-		Util::SetStandByMode(!m_pCurJob);
+		Util::SetStandByMode(m_ActiveJobs.empty());
 
 		usleep(iStepMSec * 1000);
 	}
@@ -154,21 +156,28 @@ void PrePostProcessor::Run()
 void PrePostProcessor::Stop()
 {
 	Thread::Stop();
-	DownloadQueue::Lock();
 
 #ifndef DISABLE_PARCHECK
+	// par-checkers lock the queue when they finish
 	m_ParCoordinator.Stop();
 #endif
 
-	if (m_pCurJob && m_pCurJob->GetPostInfo() &&
-		(m_pCurJob->GetPostInfo()->GetStage() == PostInfo::ptUnpacking ||
-		 m_pCurJob->GetPostInfo()->GetStage() == PostInfo::ptExecutingScript) && 
-		m_pCurJob->GetPostInfo()->GetPostThread())
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+
+	DirectUnpack::StopAll(pDownloadQueue);
+
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); it++)
 	{
-		Thread* pPostThread = m_pCurJob->GetPostInfo()->GetPostThread();
-		m_pCurJob->GetPostInfo()->SetPostThread(NULL);
-		pPostThread->SetAutoDestroy(true);
-		pPostThread->Stop();
+		PostInfo* pPostInfo = it->m_pNZBInfo->GetPostInfo();
+		if ((pPostInfo->GetStage() == PostInfo::ptUnpacking ||
+			 pPostInfo->GetStage() == PostInfo::ptExecutingScript) &&
+			pPostInfo->GetPostThread())
+		{
+			Thread* pPostThread = pPostInfo->GetPostThread();
+			pPostInfo->SetPostThread(NULL);
+			pPostThread->SetAutoDestroy(true);
+			pPostThread->Stop();
+		}
 	}
 
 	DownloadQueue::Unlock();
@@ -208,6 +217,10 @@ void PrePostProcessor::DownloadQueueUpdate(Subject* Caller, void* Aspect)
 		if (pQueueAspect->eAction == DownloadQueue::eaFileCompleted && !pQueueAspect->pNZBInfo->GetPostInfo())
 		{
 			g_pQueueScriptCoordinator->EnqueueScript(pQueueAspect->pNZBInfo, QueueScriptCoordinator::qeFileDownloaded);
+#ifndef DISABLE_PARCHECK
+			m_ParCoordinator.FileDownloaded(pQueueAspect->pFileInfo);
+#endif
+			DirectUnpack::FileDownloaded(pQueueAspect->pDownloadQueue, pQueueAspect->pFileInfo);
 		}
 
 		if (
@@ -372,12 +385,13 @@ void PrePostProcessor::DeleteCleanup(NZBInfo* pNZBInfo)
 			}
 		}
 
-		// delete .out.tmp-files and _brokenlog.txt
+		// delete .out.tmp-files, _brokenlog.txt and partially repaired files
 		DirBrowser dir(pNZBInfo->GetDestDir());
 		while (const char* szFilename = dir.Next())
 		{
 			int iLen = strlen(szFilename);
-			if ((iLen > 8 && !strcmp(szFilename + iLen - 8, ".out.tmp")) || !strcmp(szFilename, "_brokenlog.txt"))
+			if ((iLen > 8 && !strcmp(szFilename + iLen - 8, ".out.tmp")) || !strcmp(szFilename, "_brokenlog.txt") ||
+				Util::MatchFileExt(szFilename, REPAIR_PART_EXT, ","))
 			{
 				char szFullFilename[1024];
 				snprintf(szFullFilename, 1024, "%s%c%s", pNZBInfo->GetDestDir(), PATH_SEPARATOR, szFilename);
@@ -416,99 +430,193 @@ void PrePostProcessor::CheckDiskSpace()
 	}
 }
 
+/**
+ * Several post-jobs can be active at the same time. Every stage of a job
+ * occupies a slot of its resource class (CPU or disk) and a job is started
+ * only if a slot of the required class is free. The jobs are served in
+ * order of their priority; a job waiting for a slot doesn't block jobs
+ * which need resources of another class.
+ */
 void PrePostProcessor::CheckPostQueue()
 {
 	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
 
-	if (!m_pCurJob && m_iJobCount > 0)
-	{
-		m_pCurJob = GetNextJob(pDownloadQueue);
-	}
+	CheckActiveJobs();
 
-	if (m_pCurJob)
+	if (m_iJobCount > 0)
 	{
-		PostInfo* pPostInfo = m_pCurJob->GetPostInfo();
-		if (!pPostInfo->GetWorking() && !IsNZBFileDownloading(m_pCurJob))
+		NZBList jobs;
+		GetNextJobs(pDownloadQueue, &jobs);
+
+		for (NZBList::iterator it = jobs.begin(); it != jobs.end(); it++)
 		{
-#ifndef DISABLE_PARCHECK
-			if (pPostInfo->GetRequestParCheck() &&
-				(pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped ||
-				 (pPostInfo->GetForceRepair() && !pPostInfo->GetNZBInfo()->GetParFull())) &&
-				g_pOptions->GetParCheck() != Options::pcManual)
+			NZBInfo* pNZBInfo = *it;
+			PostInfo* pPostInfo = pNZBInfo->GetPostInfo();
+			if (!pPostInfo->GetWorking() && !IsActiveJob(pNZBInfo) && !IsNZBFileDownloading(pNZBInfo))
 			{
-				pPostInfo->SetForceParFull(pPostInfo->GetNZBInfo()->GetParStatus() > NZBInfo::psSkipped);
-				pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psNone);
-				pPostInfo->SetRequestParCheck(false);
-				pPostInfo->SetStage(PostInfo::ptQueued);
-				pPostInfo->GetNZBInfo()->GetScriptStatuses()->Clear();
-				DeletePostThread(pPostInfo);
+				CheckPostJob(pDownloadQueue, pPostInfo);
 			}
-			else if (pPostInfo->GetRequestParCheck() && pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped &&
-				g_pOptions->GetParCheck() == Options::pcManual)
-			{
-				pPostInfo->SetRequestParCheck(false);
-				pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psManual);
-				DeletePostThread(pPostInfo);
+		}
+	}
 
-				if (!pPostInfo->GetNZBInfo()->GetFileList()->empty())
-				{
-					pPostInfo->GetNZBInfo()->PrintMessage(Message::mkInfo,
-						"Downloading all remaining files for manual par-check for %s", pPostInfo->GetNZBInfo()->GetName());
-					pDownloadQueue->EditEntry(pPostInfo->GetNZBInfo()->GetID(), DownloadQueue::eaGroupResume, 0, NULL);
-					pPostInfo->SetStage(PostInfo::ptFinished);
-				}
-				else
-				{
-					pPostInfo->GetNZBInfo()->PrintMessage(Message::mkInfo,
-						"There are no par-files remain for download for %s", pPostInfo->GetNZBInfo()->GetName());
-					pPostInfo->SetStage(PostInfo::ptQueued);
-				}
-			}
-			
+	bool bNeedPause = false;
+	const char* szPauseReason = NULL;
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); it++)
+	{
+		if (it->m_bPauseQueue)
+		{
+			bNeedPause = true;
+			szPauseReason = it->m_szReason;
+			break;
+		}
+	}
+	UpdatePauseState(bNeedPause, szPauseReason);
+
+	DownloadQueue::Unlock();
+}
+
+void PrePostProcessor::CheckPostJob(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo)
+{
+#ifndef DISABLE_PARCHECK
+	if (pPostInfo->GetRequestParCheck() &&
+		(pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped ||
+		 (pPostInfo->GetForceRepair() && !pPostInfo->GetNZBInfo()->GetParFull())) &&
+		g_pOptions->GetParCheck() != Options::pcManual)
+	{
+		pPostInfo->SetForceParFull(pPostInfo->GetNZBInfo()->GetParStatus() > NZBInfo::psSkipped);
+		pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psNone);
+		pPostInfo->SetRequestParCheck(false);
+		pPostInfo->SetStage(PostInfo::ptQueued);
+		pPostInfo->GetNZBInfo()->GetScriptStatuses()->Clear();
+		DeletePostThread(pPostInfo);
+	}
+	else if (pPostInfo->GetRequestParCheck() && pPostInfo->GetNZBInfo()->GetParStatus() <= NZBInfo::psSkipped &&
+		g_pOptions->GetParCheck() == Options::pcManual)
+	{
+		pPostInfo->SetRequestParCheck(false);
+		pPostInfo->GetNZBInfo()->SetParStatus(NZBInfo::psManual);
+		DeletePostThread(pPostInfo);
+
+		if (!pPostInfo->GetNZBInfo()->GetFileList()->empty())
+		{
+			pPostInfo->GetNZBInfo()->PrintMessage(Message::mkInfo,
+				"Downloading all remaining files for manual par-check for %s", pPostInfo->GetNZBInfo()->GetName());
+			pDownloadQueue->EditEntry(pPostInfo->GetNZBInfo()->GetID(), DownloadQueue::eaGroupResume, 0, NULL);
+			pPostInfo->SetStage(PostInfo::ptFinished);
+		}
+		else
+		{
+			pPostInfo->GetNZBInfo()->PrintMessage(Message::mkInfo,
+				"There are no par-files remain for download for %s", pPostInfo->GetNZBInfo()->GetName());
+			pPostInfo->SetStage(PostInfo::ptQueued);
+		}
+	}
+	
 #endif
-			if (pPostInfo->GetDeleted())
-			{
-				pPostInfo->SetStage(PostInfo::ptFinished);
-			}
+	if (pPostInfo->GetDeleted())
+	{
+		pPostInfo->SetStage(PostInfo::ptFinished);
+	}
 
-			if (pPostInfo->GetStage() == PostInfo::ptQueued &&
-				(!g_pOptions->GetPausePostProcess() || pPostInfo->GetNZBInfo()->GetForcePriority()))
-			{
-				DeletePostThread(pPostInfo);
-				StartJob(pDownloadQueue, pPostInfo);
-			}
-			else if (pPostInfo->GetStage() == PostInfo::ptFinished)
-			{
-				UpdatePauseState(false, NULL);
-				JobCompleted(pDownloadQueue, pPostInfo);
-			}
-			else if (!g_pOptions->GetPausePostProcess())
+	if (pPostInfo->GetStage() == PostInfo::ptQueued &&
+		(!g_pOptions->GetPausePostProcess() || pPostInfo->GetNZBInfo()->GetForcePriority()))
+	{
+		DeletePostThread(pPostInfo);
+		StartJob(pDownloadQueue, pPostInfo);
+	}
+	else if (pPostInfo->GetStage() == PostInfo::ptFinished)
+	{
+		JobCompleted(pDownloadQueue, pPostInfo);
+	}
+	else if (!g_pOptions->GetPausePostProcess())
+	{
+		error("Internal error: invalid state in post-processor");
+		// TODO: cancel (delete) current job
+	}
+}
+
+/**
+ * Returns post-jobs ordered by priority, jobs with the same priority
+ * remain in the queue order.
+ */
+void PrePostProcessor::GetNextJobs(DownloadQueue* pDownloadQueue, NZBList* pJobs)
+{
+	for (NZBList::iterator it = pDownloadQueue->GetQueue()->begin(); it != pDownloadQueue->GetQueue()->end(); it++)
+	{
+		NZBInfo* pNZBInfo = *it;
+		if (pNZBInfo->GetPostInfo() && !g_pQueueScriptCoordinator->HasJob(pNZBInfo->GetID()) &&
+			(!g_pOptions->GetPausePostProcess() || pNZBInfo->GetForcePriority() ||
+			 pNZBInfo->GetPostInfo()->GetStartTime() > 0))
+		{
+			NZBList::iterator itPos = pJobs->begin();
+			while (itPos != pJobs->end() && (*itPos)->GetPriority() >= pNZBInfo->GetPriority())
 			{
-				error("Internal error: invalid state in post-processor");
-				// TODO: cancel (delete) current job
+				itPos++;
 			}
+			pJobs->insert(itPos, pNZBInfo);
 		}
 	}
-	
-	DownloadQueue::Unlock();
 }
 
-NZBInfo* PrePostProcessor::GetNextJob(DownloadQueue* pDownloadQueue)
+/**
+ * Releases the slots of jobs whose stage has finished.
+ */
+void PrePostProcessor::CheckActiveJobs()
 {
-	NZBInfo* pNZBInfo = NULL;
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); )
+	{
+		PostInfo* pPostInfo = it->m_pNZBInfo->GetPostInfo();
+		if (!pPostInfo->GetWorking() &&
+			!(pPostInfo->GetPostThread() && pPostInfo->GetPostThread()->IsRunning()))
+		{
+			it = m_ActiveJobs.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
 
-	for (NZBList::iterator it = pDownloadQueue->GetQueue()->begin(); it != pDownloadQueue->GetQueue()->end(); it++)
+bool PrePostProcessor::HasFreeSlot(EResourceClass eResourceClass)
+{
+	int iSlots = eResourceClass == rcCpu ? g_pOptions->GetPostCpuSlots() : g_pOptions->GetPostDiskSlots();
+	int iUsed = 0;
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); it++)
 	{
-		NZBInfo* pNZBInfo1 = *it;
-		if (pNZBInfo1->GetPostInfo() && !g_pQueueScriptCoordinator->HasJob(pNZBInfo1->GetID()) &&
-			(!pNZBInfo || pNZBInfo1->GetPriority() > pNZBInfo->GetPriority()) &&
-			(!g_pOptions->GetPausePostProcess() || pNZBInfo1->GetForcePriority()))
+		if (it->m_eResourceClass == eResourceClass)
 		{
-			pNZBInfo = pNZBInfo1;
+			iUsed++;
 		}
 	}
+	return iUsed < (iSlots > 0 ? iSlots : 1);
+}
 
-	return pNZBInfo;
+void PrePostProcessor::AddActiveJob(PostInfo* pPostInfo, EResourceClass eResourceClass, bool bPauseQueue, const char* szReason)
+{
+	if (!pPostInfo->GetStartTime())
+	{
+		pPostInfo->SetStartTime(time(NULL));
+	}
+
+	ActiveJob job;
+	job.m_pNZBInfo = pPostInfo->GetNZBInfo();
+	job.m_eResourceClass = eResourceClass;
+	job.m_bPauseQueue = bPauseQueue;
+	job.m_szReason = szReason;
+	m_ActiveJobs.push_back(job);
+}
+
+bool PrePostProcessor::IsActiveJob(NZBInfo* pNZBInfo)
+{
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); it++)
+	{
+		if (it->m_pNZBInfo == pNZBInfo)
+		{
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
@@ -546,25 +654,28 @@ void PrePostProcessor::DeletePostThread(PostInfo* pPostInfo)
 
 void PrePostProcessor::StartJob(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo)
 {
-	if (!pPostInfo->GetStartTime())
-	{
-		pPostInfo->SetStartTime(time(NULL));
-	}
-
 #ifndef DISABLE_PARCHECK
 	if (pPostInfo->GetNZBInfo()->GetRenameStatus() == NZBInfo::rsNone &&
 		pPostInfo->GetNZBInfo()->GetDeleteStatus() == NZBInfo::dsNone)
 	{
-		UpdatePauseState(g_pOptions->GetParPauseQueue(), "par-rename");
-		m_ParCoordinator.StartParRenameJob(pPostInfo);
+		if (HasFreeSlot(rcDisk))
+		{
+			AddActiveJob(pPostInfo, rcDisk, g_pOptions->GetParPauseQueue(), "par-rename");
+			m_ParCoordinator.StartParRenameJob(pPostInfo);
+		}
 		return;
 	}
 	else if (pPostInfo->GetNZBInfo()->GetParStatus() == NZBInfo::psNone &&
 		pPostInfo->GetNZBInfo()->GetDeleteStatus() == NZBInfo::dsNone)
 	{
+		if (!HasFreeSlot(rcCpu))
+		{
+			return;
+		}
+
 		if (m_ParCoordinator.FindMainPars(pPostInfo->GetNZBInfo()->GetDestDir(), NULL))
 		{
-			UpdatePauseState(g_pOptions->GetParPauseQueue(), "par-check");
+			AddActiveJob(pPostInfo, rcCpu, g_pOptions->GetParPauseQueue(), "par-check");
 			m_ParCoordinator.StartParCheckJob(pPostInfo);
 		}
 		else
@@ -652,6 +763,12 @@ void PrePostProcessor::StartJob(DownloadQueue* pDownloadQueue, PostInfo* pPostIn
 		return;
 	}
 
+	EResourceClass eResourceClass = bUnpack || bCleanup || bMoveInter ? rcDisk : rcCpu;
+	if (!HasFreeSlot(eResourceClass))
+	{
+		return;
+	}
+
 	pPostInfo->SetProgressLabel(bUnpack ? "Unpacking" : bMoveInter ? "Moving" : "Executing post-process-script");
 	pPostInfo->SetWorking(true);
 	pPostInfo->SetStage(bUnpack ? PostInfo::ptUnpacking : bMoveInter ? PostInfo::ptMoving : PostInfo::ptExecutingScript);
@@ -664,26 +781,55 @@ void PrePostProcessor::StartJob(DownloadQueue* pDownloadQueue, PostInfo* pPostIn
 
 	if (bUnpack)
 	{
-		UpdatePauseState(g_pOptions->GetUnpackPauseQueue(), "unpack");
+		AddActiveJob(pPostInfo, eResourceClass, g_pOptions->GetUnpackPauseQueue(), "unpack");
 		UnpackController::StartJob(pPostInfo);
 	}
 	else if (bCleanup)
 	{
-		UpdatePauseState(g_pOptions->GetUnpackPauseQueue() || g_pOptions->GetScriptPauseQueue(), "cleanup");
+		AddActiveJob(pPostInfo, eResourceClass, g_pOptions->GetUnpackPauseQueue() || g_pOptions->GetScriptPauseQueue(), "cleanup");
 		CleanupController::StartJob(pPostInfo);
 	}
 	else if (bMoveInter)
 	{
-		UpdatePauseState(g_pOptions->GetUnpackPauseQueue() || g_pOptions->GetScriptPauseQueue(), "move");
+		AddActiveJob(pPostInfo, eResourceClass, g_pOptions->GetUnpackPauseQueue() || g_pOptions->GetScriptPauseQueue(), "move");
 		MoveController::StartJob(pPostInfo);
 	}
 	else
 	{
-		UpdatePauseState(g_pOptions->GetScriptPauseQueue(), "post-process-script");
+		AddActiveJob(pPostInfo, eResourceClass, g_pOptions->GetScriptPauseQueue(), "post-process-script");
 		PostScriptController::StartJob(pPostInfo);
 	}
 }
 
+#ifndef DISABLE_PARCHECK
+/*
+ * The progress of interrupted par-repairs is kept only while the job is in
+ * post-processing. Once the post-processing is finished the partially repaired
+ * files and the saved repair states are deleted.
+ */
+void PrePostProcessor::DeleteRepairProgress(NZBInfo* pNZBInfo)
+{
+	DirBrowser dir(pNZBInfo->GetDestDir());
+	while (const char* szFilename = dir.Next())
+	{
+		if (Util::MatchFileExt(szFilename, REPAIR_PART_EXT, ","))
+		{
+			char szFullFilename[1024];
+			snprintf(szFullFilename, 1024, "%s%c%s", pNZBInfo->GetDestDir(), PATH_SEPARATOR, szFilename);
+			szFullFilename[1024-1] = '\0';
+
+			detail("Deleting file %s", szFilename);
+			remove(szFullFilename);
+		}
+	}
+
+	if (g_pOptions->GetSaveQueue() && g_pOptions->GetServerMode())
+	{
+		g_pDiskState->DiscardRepairStates(pNZBInfo);
+	}
+}
+#endif
+
 void PrePostProcessor::JobCompleted(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo)
 {
 	NZBInfo* pNZBInfo = pPostInfo->GetNZBInfo();
@@ -694,7 +840,20 @@ void PrePostProcessor::JobCompleted(DownloadQueue* pDownloadQueue, PostInfo* pPo
 		pPostInfo->SetStartTime(0);
 	}
 
+	for (ActiveJobs::iterator it = m_ActiveJobs.begin(); it != m_ActiveJobs.end(); it++)
+	{
+		if (it->m_pNZBInfo == pNZBInfo)
+		{
+			m_ActiveJobs.erase(it);
+			break;
+		}
+	}
+
 	DeletePostThread(pPostInfo);
+#ifndef DISABLE_PARCHECK
+	m_ParCoordinator.ReleasePacketCache(pNZBInfo->GetID());
+	DeleteRepairProgress(pNZBInfo);
+#endif
 	pNZBInfo->LeavePostProcess();
 
 	if (IsNZBFileCompleted(pNZBInfo, true, false))
@@ -730,10 +889,6 @@ void PrePostProcessor::JobCompleted(DownloadQueue* pDownloadQueue, PostInfo* pPo
 		NZBCompleted(pDownloadQueue, pNZBInfo, false);
 	}
 
-	if (pNZBInfo == m_pCurJob)
-	{
-		m_pCurJob = NULL;
-	}
 	m_iJobCount--;
 
 	pDownloadQueue->Save();
@@ -829,7 +984,7 @@ bool PrePostProcessor::PostQueueDelete(DownloadQueue* pDownloadQueue, IDList* pI
 #ifndef DISABLE_PARCHECK
 					if (PostInfo::ptLoadingPars <= pPostInfo->GetStage() && pPostInfo->GetStage() <= PostInfo::ptRenaming)
 					{
-						if (m_ParCoordinator.Cancel())
+						if (m_ParCoordinator.Cancel(pPostInfo))
 						{
 							bOK = true;
 						}
@@ -27,6 +27,7 @@
 #define PREPOSTPROCESSOR_H
 
 #include <deque>
+#include <list>
 
 #include "Thread.h"
 #include "Observer.h"
@@ -43,16 +44,37 @@ private:
 		virtual void	Update(Subject* Caller, void* Aspect) { m_pOwner->DownloadQueueUpdate(Caller, Aspect); }
 	};
 
+	enum EResourceClass
+	{
+		rcCpu,
+		rcDisk
+	};
+
+	struct ActiveJob
+	{
+		NZBInfo*		m_pNZBInfo;
+		EResourceClass	m_eResourceClass;
+		bool			m_bPauseQueue;
+		const char*		m_szReason;
+	};
+
+	typedef std::list<ActiveJob>	ActiveJobs;
+
 private:
 	ParCoordinator		m_ParCoordinator;
 	DownloadQueueObserver	m_DownloadQueueObserver;
 	int					m_iJobCount;
-	NZBInfo*			m_pCurJob;
+	ActiveJobs			m_ActiveJobs;
 	const char*			m_szPauseReason;
 
 	bool				IsNZBFileCompleted(NZBInfo* pNZBInfo, bool bIgnorePausedPars, bool bAllowOnlyOneDeleted);
 	bool				IsNZBFileDownloading(NZBInfo* pNZBInfo);
 	void				CheckPostQueue();
+	void				CheckPostJob(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo);
+	void				CheckActiveJobs();
+	bool				HasFreeSlot(EResourceClass eResourceClass);
+	void				AddActiveJob(PostInfo* pPostInfo, EResourceClass eResourceClass, bool bPauseQueue, const char* szReason);
+	bool				IsActiveJob(NZBInfo* pNZBInfo);
 	void				JobCompleted(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo);
 	void				StartJob(DownloadQueue* pDownloadQueue, PostInfo* pPostInfo);
 	void				SaveQueue(DownloadQueue* pDownloadQueue);
@@ -64,9 +86,12 @@ private:
 	void				NZBCompleted(DownloadQueue* pDownloadQueue, NZBInfo* pNZBInfo, bool bSaveQueue);
 	bool				PostQueueDelete(DownloadQueue* pDownloadQueue, IDList* pIDList);
 	void				DeletePostThread(PostInfo* pPostInfo);
-	NZBInfo*			GetNextJob(DownloadQueue* pDownloadQueue);
+	void				GetNextJobs(DownloadQueue* pDownloadQueue, NZBList* pJobs);
 	void				DownloadQueueUpdate(Subject* Caller, void* Aspect);
 	void				DeleteCleanup(NZBInfo* pNZBInfo);
+#ifndef DISABLE_PARCHECK
+	void				DeleteRepairProgress(NZBInfo* pNZBInfo);
+#endif
 
 public:
 						PrePostProcessor();
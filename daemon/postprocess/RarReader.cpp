@@ -0,0 +1,698 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef WIN32
+#include "win32.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "nzbget.h"
+#include "RarReader.h"
+#include "Util.h"
+
+static const unsigned char RAR4_SIGNATURE[] = { 0x52, 0x61, 0x72, 0x21, 0x1A, 0x07, 0x00 };
+static const unsigned char RAR5_SIGNATURE[] = { 0x52, 0x61, 0x72, 0x21, 0x1A, 0x07, 0x01, 0x00 };
+
+// rar4 block types and flags
+static const int RAR4_MAIN_HEAD = 0x73;
+static const int RAR4_FILE_HEAD = 0x74;
+static const int RAR4_NEWSUB_HEAD = 0x7A;
+static const int RAR4_ENDARC_HEAD = 0x7B;
+static const int RAR4_LONG_BLOCK = 0x8000;
+static const int RAR4_MHD_VOLUME = 0x0001;
+static const int RAR4_MHD_NEWNUMBERING = 0x0010;
+static const int RAR4_MHD_PASSWORD = 0x0080;
+static const int RAR4_MHD_FIRSTVOLUME = 0x0100;
+static const int RAR4_LHD_SPLIT_BEFORE = 0x0001;
+static const int RAR4_LHD_SPLIT_AFTER = 0x0002;
+static const int RAR4_LHD_PASSWORD = 0x0004;
+static const int RAR4_LHD_WINDOWMASK = 0x00E0;
+static const int RAR4_LHD_DIRECTORY = 0x00E0;
+static const int RAR4_LHD_LARGE = 0x0100;
+static const int RAR4_LHD_UNICODE = 0x0200;
+static const int RAR4_EARC_NEXT_VOLUME = 0x0001;
+static const int RAR4_METHOD_STORE = 0x30;
+static const int RAR4_HOST_UNIX = 3;
+
+// rar5 header types and flags
+static const int RAR5_HEAD_MAIN = 1;
+static const int RAR5_HEAD_FILE = 2;
+static const int RAR5_HEAD_CRYPT = 4;
+static const int RAR5_HEAD_ENDARC = 5;
+static const int RAR5_HFL_EXTRA = 0x0001;
+static const int RAR5_HFL_DATA = 0x0002;
+static const int RAR5_HFL_SPLITBEFORE = 0x0008;
+static const int RAR5_HFL_SPLITAFTER = 0x0010;
+static const int RAR5_MHFL_VOLUME = 0x0001;
+static const int RAR5_MHFL_VOLNUMBER = 0x0002;
+static const int RAR5_FHFL_DIRECTORY = 0x0001;
+static const int RAR5_FHFL_UTIME = 0x0002;
+static const int RAR5_FHFL_CRC32 = 0x0004;
+static const int RAR5_FHFL_UNPUNKNOWN = 0x0008;
+static const int RAR5_FHEXTRA_CRYPT = 0x01;
+static const int RAR5_FHEXTRA_HTIME = 0x03;
+static const int RAR5_FHEXTRA_REDIR = 0x05;
+static const int RAR5_HTIME_UNIXTIME = 0x0001;
+static const int RAR5_HTIME_MTIME = 0x0002;
+static const int RAR5_EHFL_NEXTVOLUME = 0x0001;
+
+static const int RAR5_MAX_HEADER_SIZE = 2 * 1024 * 1024;
+
+static unsigned int GetU16(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long GetU32(const unsigned char* p)
+{
+	return (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static bool ReadU32(const unsigned char*& p, const unsigned char* end, unsigned long& lValue)
+{
+	if (end - p < 4)
+	{
+		return false;
+	}
+	lValue = GetU32(p);
+	p += 4;
+	return true;
+}
+
+/*
+ * Reads variable length integer used in rar5-headers: seven bits per byte,
+ * the highest bit is set if more bytes follow.
+ */
+static bool ReadVInt(const unsigned char*& p, const unsigned char* end, unsigned long long& lValue)
+{
+	lValue = 0;
+	for (int iShift = 0; p < end && iShift < 64; iShift += 7)
+	{
+		unsigned char b = *p++;
+		lValue |= (unsigned long long)(b & 0x7F) << iShift;
+		if (!(b & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static time_t DosTimeToUnix(unsigned long lDosTime)
+{
+	struct tm tmTime;
+	memset(&tmTime, 0, sizeof(tmTime));
+	tmTime.tm_sec = (lDosTime & 0x1F) * 2;
+	tmTime.tm_min = (lDosTime >> 5) & 0x3F;
+	tmTime.tm_hour = (lDosTime >> 11) & 0x1F;
+	tmTime.tm_mday = (lDosTime >> 16) & 0x1F;
+	tmTime.tm_mon = ((lDosTime >> 21) & 0x0F) - 1;
+	tmTime.tm_year = ((lDosTime >> 25) & 0x7F) + 80;
+	tmTime.tm_isdst = -1;
+	return mktime(&tmTime);
+}
+
+/*
+ * Converts path separators to native ones and checks that the name
+ * doesn't point outside of the destination directory.
+ */
+static bool PrepareFilename(char* szFilename, bool bBackslashSeparator)
+{
+	if (!*szFilename)
+	{
+		return false;
+	}
+
+	for (char* p = szFilename; *p; p++)
+	{
+		if (*p == '/' || (*p == '\\' && bBackslashSeparator))
+		{
+			*p = PATH_SEPARATOR;
+		}
+		else if (*p == '\\')
+		{
+			// part of a unix file name in rar5-archive
+			return false;
+		}
+#ifdef WIN32
+		else if (*p == ':')
+		{
+			return false;
+		}
+#endif
+	}
+
+	if (*szFilename == PATH_SEPARATOR)
+	{
+		return false;
+	}
+
+	for (char* p = szFilename; p; p = strchr(p, PATH_SEPARATOR))
+	{
+		if (*p == PATH_SEPARATOR)
+		{
+			p++;
+		}
+		if (!strncmp(p, "..", 2) && (p[2] == PATH_SEPARATOR || p[2] == '\0'))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+RarArchive::RarFile::RarFile()
+{
+	m_szFilename = NULL;
+	m_bDirectory = false;
+	m_bStored = false;
+	m_bHasCrc = false;
+	m_lCrc = 0;
+	m_lSize = 0;
+	m_tTime = 0;
+}
+
+RarArchive::RarFile::~RarFile()
+{
+	free(m_szFilename);
+}
+
+RarArchive::RarArchive()
+{
+	m_bMultiVolume = false;
+	m_bFirstVolume = false;
+	m_bNewNaming = false;
+	m_bEncrypted = false;
+	m_bComplete = false;
+	m_bHasNextVolume = false;
+	m_bSplitAfter = false;
+}
+
+RarArchive::~RarArchive()
+{
+	for (Volumes::iterator it = m_Volumes.begin(); it != m_Volumes.end(); it++)
+	{
+		free(*it);
+	}
+
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		delete *it;
+	}
+}
+
+bool RarArchive::Read(const char* szFilename)
+{
+	if (!ReadVolume(szFilename))
+	{
+		return false;
+	}
+
+	if (!m_bFirstVolume)
+	{
+		return true;
+	}
+
+	while (m_bMultiVolume && !m_bEncrypted && (m_bHasNextVolume || m_bSplitAfter))
+	{
+		char szNextVolume[1024];
+		if (!NextVolumeName(m_Volumes.back(), szNextVolume, 1024) || !Util::FileExists(szNextVolume))
+		{
+			// the archive is incomplete
+			return true;
+		}
+
+		if (!ReadVolume(szNextVolume))
+		{
+			return false;
+		}
+	}
+
+	m_bComplete = !m_bEncrypted && !m_bSplitAfter;
+
+	return true;
+}
+
+bool RarArchive::ReadVolume(const char* szFilename)
+{
+	long long lVolumeSize = Util::FileSize(szFilename);
+
+	FILE* pFile = fopen(szFilename, FOPEN_RB);
+	if (!pFile)
+	{
+		return false;
+	}
+
+	m_Volumes.push_back(strdup(szFilename));
+	m_bHasNextVolume = false;
+
+	unsigned char signature[8];
+	int iCnt = (int)fread(signature, 1, sizeof(signature), pFile);
+
+	bool bOK = false;
+	if (iCnt == sizeof(RAR5_SIGNATURE) && !memcmp(signature, RAR5_SIGNATURE, sizeof(RAR5_SIGNATURE)))
+	{
+		bOK = ReadRar5Volume(pFile, lVolumeSize);
+	}
+	else if (iCnt >= (int)sizeof(RAR4_SIGNATURE) && !memcmp(signature, RAR4_SIGNATURE, sizeof(RAR4_SIGNATURE)))
+	{
+		bOK = ReadRar4Volume(pFile, lVolumeSize);
+	}
+
+	fclose(pFile);
+
+	return bOK;
+}
+
+bool RarArchive::ReadRar4Volume(FILE* pFile, long long lVolumeSize)
+{
+	bool bFirst = m_Volumes.size() == 1;
+	long long lPos = sizeof(RAR4_SIGNATURE);
+	unsigned char header[65536];
+
+	while (lPos < lVolumeSize)
+	{
+		if (fseek(pFile, lPos, SEEK_SET) || fread(header, 1, 7, pFile) != 7)
+		{
+			return false;
+		}
+
+		int iType = header[2];
+		int iFlags = GetU16(header + 3);
+		int iSize = GetU16(header + 5);
+
+		if (iSize < 7 || (int)fread(header + 7, 1, iSize - 7, pFile) != iSize - 7 ||
+			(Util::Crc32(header + 2, iSize - 2) & 0xFFFF) != GetU16(header))
+		{
+			return false;
+		}
+
+		long long lDataSize = 0;
+		if (iType == RAR4_FILE_HEAD || iType == RAR4_NEWSUB_HEAD)
+		{
+			if (iSize < 32 || ((iFlags & RAR4_LHD_LARGE) && iSize < 40))
+			{
+				return false;
+			}
+			lDataSize = GetU32(header + 7) | (iFlags & RAR4_LHD_LARGE ? (long long)GetU32(header + 32) << 32 : 0);
+		}
+		else if (iFlags & RAR4_LONG_BLOCK)
+		{
+			if (iSize < 11)
+			{
+				return false;
+			}
+			lDataSize = GetU32(header + 7);
+		}
+
+		long long lDataOffset = lPos + iSize;
+		if (lDataOffset + lDataSize > lVolumeSize)
+		{
+			return false;
+		}
+
+		if (iType == RAR4_MAIN_HEAD)
+		{
+			if (bFirst)
+			{
+				m_bMultiVolume = iFlags & RAR4_MHD_VOLUME;
+				m_bFirstVolume = !m_bMultiVolume || (iFlags & RAR4_MHD_FIRSTVOLUME);
+				m_bNewNaming = iFlags & RAR4_MHD_NEWNUMBERING;
+			}
+			if (!m_bFirstVolume)
+			{
+				// files are read only when starting with the first volume
+				return true;
+			}
+			if (iFlags & RAR4_MHD_PASSWORD)
+			{
+				// headers are encrypted
+				m_bEncrypted = true;
+				return true;
+			}
+		}
+		else if (iType == RAR4_FILE_HEAD)
+		{
+			int iHostOS = header[15];
+			unsigned long lCrc = GetU32(header + 16);
+			int iMethod = header[25];
+			int iNameSize = GetU16(header + 26);
+			unsigned long lAttr = GetU32(header + 28);
+			int iNameOffset = iFlags & RAR4_LHD_LARGE ? 40 : 32;
+			if (iNameOffset + iNameSize > iSize)
+			{
+				return false;
+			}
+
+			RarFile* pRarFile = new RarFile();
+			pRarFile->m_bDirectory = (iFlags & RAR4_LHD_WINDOWMASK) == RAR4_LHD_DIRECTORY;
+			pRarFile->m_lSize = GetU32(header + 11) | (iFlags & RAR4_LHD_LARGE ? (long long)GetU32(header + 36) << 32 : 0);
+			pRarFile->m_tTime = DosTimeToUnix(GetU32(header + 20));
+			pRarFile->m_szFilename = (char*)malloc(iNameSize + 1);
+			memcpy(pRarFile->m_szFilename, header + iNameOffset, iNameSize);
+			pRarFile->m_szFilename[iNameSize] = '\0';
+
+			// names with non-ascii characters are either in OEM-codepage or have
+			// an extra field in rar-specific unicode encoding; only utf-8 names are supported
+			bool bNameOK = (int)strlen(pRarFile->m_szFilename) == iNameSize;
+			for (const char* p = pRarFile->m_szFilename; bNameOK && *p; p++)
+			{
+				bNameOK = !(*p & 0x80) || (iFlags & RAR4_LHD_UNICODE);
+			}
+
+			bool bSymLink = iHostOS == RAR4_HOST_UNIX && (lAttr & 0xF000) == 0xA000;
+
+			pRarFile->m_bStored = iMethod == RAR4_METHOD_STORE && !(iFlags & RAR4_LHD_PASSWORD) &&
+				!bSymLink && bNameOK && PrepareFilename(pRarFile->m_szFilename, true);
+
+			if (!AddFile(pRarFile, iFlags & RAR4_LHD_SPLIT_BEFORE, iFlags & RAR4_LHD_SPLIT_AFTER,
+				lDataOffset, lDataSize, true, lCrc))
+			{
+				return false;
+			}
+		}
+		else if (iType == RAR4_ENDARC_HEAD)
+		{
+			m_bHasNextVolume = iFlags & RAR4_EARC_NEXT_VOLUME;
+			return true;
+		}
+
+		lPos = lDataOffset + lDataSize;
+	}
+
+	return true;
+}
+
+bool RarArchive::ReadRar5Volume(FILE* pFile, long long lVolumeSize)
+{
+	bool bFirst = m_Volumes.size() == 1;
+	long long lPos = sizeof(RAR5_SIGNATURE);
+	unsigned char* header = NULL;
+	bool bOK = true;
+
+	while (bOK && lPos < lVolumeSize)
+	{
+		// header crc, header size and the beginning of the header
+		unsigned char start[7];
+		int iCnt = 0;
+		if (!fseek(pFile, lPos, SEEK_SET))
+		{
+			iCnt = (int)fread(start, 1, sizeof(start), pFile);
+		}
+
+		unsigned long long lHeaderSize = 0;
+		const unsigned char* p = start + 4;
+		if (iCnt < 6 || !ReadVInt(p, start + iCnt, lHeaderSize) ||
+			lHeaderSize == 0 || lHeaderSize > RAR5_MAX_HEADER_SIZE)
+		{
+			bOK = false;
+			break;
+		}
+
+		int iSizeLen = (int)(p - (start + 4));
+		int iTotalSize = iSizeLen + (int)lHeaderSize;
+		header = (unsigned char*)realloc(header, iTotalSize);
+		if (fseek(pFile, lPos + 4, SEEK_SET) || (int)fread(header, 1, iTotalSize, pFile) != iTotalSize ||
+			Util::Crc32(header, iTotalSize) != GetU32(start))
+		{
+			bOK = false;
+			break;
+		}
+
+		p = header + iSizeLen;
+		const unsigned char* end = header + iTotalSize;
+		unsigned long long lType, lFlags, lExtraSize = 0, lDataSize = 0;
+		bOK = ReadVInt(p, end, lType) && ReadVInt(p, end, lFlags) &&
+			(!(lFlags & RAR5_HFL_EXTRA) || ReadVInt(p, end, lExtraSize)) &&
+			(!(lFlags & RAR5_HFL_DATA) || ReadVInt(p, end, lDataSize)) &&
+			lExtraSize <= (unsigned long long)(end - p);
+
+		long long lDataOffset = lPos + 4 + iTotalSize;
+		bOK = bOK && lDataSize <= (unsigned long long)(lVolumeSize - lDataOffset);
+		if (!bOK)
+		{
+			break;
+		}
+
+		if (lType == RAR5_HEAD_MAIN)
+		{
+			unsigned long long lArcFlags;
+			bOK = ReadVInt(p, end, lArcFlags);
+			if (bFirst)
+			{
+				m_bMultiVolume = lArcFlags & RAR5_MHFL_VOLUME;
+				m_bFirstVolume = !(lArcFlags & RAR5_MHFL_VOLNUMBER);
+				m_bNewNaming = true;
+			}
+			if (!m_bFirstVolume)
+			{
+				break;
+			}
+		}
+		else if (lType == RAR5_HEAD_FILE)
+		{
+			unsigned long long lFileFlags, lUnpSize, lAttr, lCompInfo, lHostOS, lNameSize;
+			unsigned long lTime = 0, lCrc = 0;
+			bOK = ReadVInt(p, end, lFileFlags) && ReadVInt(p, end, lUnpSize) && ReadVInt(p, end, lAttr) &&
+				(!(lFileFlags & RAR5_FHFL_UTIME) || ReadU32(p, end, lTime)) &&
+				(!(lFileFlags & RAR5_FHFL_CRC32) || ReadU32(p, end, lCrc)) &&
+				ReadVInt(p, end, lCompInfo) && ReadVInt(p, end, lHostOS) && ReadVInt(p, end, lNameSize) &&
+				lNameSize <= (unsigned long long)(end - p);
+			if (!bOK)
+			{
+				break;
+			}
+
+			RarFile* pRarFile = new RarFile();
+			pRarFile->m_bDirectory = lFileFlags & RAR5_FHFL_DIRECTORY;
+			pRarFile->m_lSize = (long long)lUnpSize;
+			pRarFile->m_tTime = (time_t)lTime;
+			pRarFile->m_szFilename = (char*)malloc((int)lNameSize + 1);
+			memcpy(pRarFile->m_szFilename, p, (int)lNameSize);
+			pRarFile->m_szFilename[lNameSize] = '\0';
+			bool bNameOK = strlen(pRarFile->m_szFilename) == lNameSize;
+
+			// extra records are at the end of the header
+			bool bEncrypted = false;
+			bool bRedirection = false;
+			const unsigned char* pe = end - lExtraSize;
+			while (pe < end)
+			{
+				unsigned long long lRecSize, lRecType;
+				if (!ReadVInt(pe, end, lRecSize) || lRecSize > (unsigned long long)(end - pe))
+				{
+					break;
+				}
+				const unsigned char* recEnd = pe + lRecSize;
+				if (ReadVInt(pe, recEnd, lRecType))
+				{
+					unsigned long long lTimeFlags;
+					bEncrypted |= lRecType == RAR5_FHEXTRA_CRYPT;
+					bRedirection |= lRecType == RAR5_FHEXTRA_REDIR;
+					if (lRecType == RAR5_FHEXTRA_HTIME && ReadVInt(pe, recEnd, lTimeFlags) &&
+						(lTimeFlags & RAR5_HTIME_MTIME))
+					{
+						if ((lTimeFlags & RAR5_HTIME_UNIXTIME) && recEnd - pe >= 4)
+						{
+							pRarFile->m_tTime = (time_t)GetU32(pe);
+						}
+						else if (!(lTimeFlags & RAR5_HTIME_UNIXTIME) && recEnd - pe >= 8)
+						{
+							// windows FILETIME: 100-nanosecond intervals since 1601
+							long long lFileTime = (long long)GetU32(pe) | ((long long)GetU32(pe + 4) << 32);
+							pRarFile->m_tTime = (time_t)(lFileTime / 10000000 - 11644473600LL);
+						}
+					}
+				}
+				pe = recEnd;
+			}
+
+			pRarFile->m_bStored = ((lCompInfo >> 7) & 7) == 0 && !bEncrypted && !bRedirection &&
+				!(lFileFlags & RAR5_FHFL_UNPUNKNOWN) && bNameOK &&
+				PrepareFilename(pRarFile->m_szFilename, false);
+
+			bOK = AddFile(pRarFile, lFlags & RAR5_HFL_SPLITBEFORE, lFlags & RAR5_HFL_SPLITAFTER,
+				lDataOffset, (long long)lDataSize, lFileFlags & RAR5_FHFL_CRC32, lCrc);
+		}
+		else if (lType == RAR5_HEAD_CRYPT)
+		{
+			// headers are encrypted
+			m_bEncrypted = true;
+			break;
+		}
+		else if (lType == RAR5_HEAD_ENDARC)
+		{
+			unsigned long long lEndFlags;
+			bOK = ReadVInt(p, end, lEndFlags);
+			m_bHasNextVolume = lEndFlags & RAR5_EHFL_NEXTVOLUME;
+			break;
+		}
+
+		lPos = lDataOffset + (long long)lDataSize;
+	}
+
+	free(header);
+
+	return bOK;
+}
+
+/*
+ * Adds the file or, if the file continues from the previous volume,
+ * adds the data of the file in this volume to the existing entry.
+ */
+bool RarArchive::AddFile(RarFile* pRarFile, bool bSplitBefore, bool bSplitAfter,
+	long long lOffset, long long lSize, bool bHasCrc, unsigned long lCrc)
+{
+	if (bSplitBefore != m_bSplitAfter ||
+		(bSplitBefore && strcmp(m_Files.back()->m_szFilename, pRarFile->m_szFilename)))
+	{
+		// the volume doesn't continue the previous one
+		delete pRarFile;
+		return false;
+	}
+
+	if (bSplitBefore)
+	{
+		m_Files.back()->m_bStored &= pRarFile->m_bStored;
+		delete pRarFile;
+		pRarFile = m_Files.back();
+	}
+	else
+	{
+		m_Files.push_back(pRarFile);
+	}
+
+	Part part;
+	part.m_iVolume = (int)m_Volumes.size() - 1;
+	part.m_lOffset = lOffset;
+	part.m_lSize = lSize;
+	pRarFile->m_Parts.push_back(part);
+
+	// the crc of the last part is the crc of the whole file
+	if (!bSplitAfter)
+	{
+		pRarFile->m_bHasCrc = bHasCrc;
+		pRarFile->m_lCrc = lCrc;
+	}
+
+	m_bSplitAfter = bSplitAfter;
+
+	return true;
+}
+
+/*
+ * Builds the name of the next volume for both naming schemes:
+ * "name.part01.rar", "name.part02.rar", ... or "name.rar", "name.r00", "name.r01", ...
+ */
+bool RarArchive::NextVolumeName(const char* szFilename, char* szBuffer, int iBufSize)
+{
+	strncpy(szBuffer, szFilename, iBufSize);
+	szBuffer[iBufSize-1] = '\0';
+
+	char* szExt = strrchr(szBuffer, '.');
+	if (!szExt || strchr(szExt, PATH_SEPARATOR) || strlen(szExt) != 4)
+	{
+		return false;
+	}
+
+	if (m_bNewNaming && !strcasecmp(szExt, ".rar") && szExt > szBuffer && isdigit(szExt[-1]))
+	{
+		for (char* p = szExt - 1; ; p--)
+		{
+			if (*p != '9')
+			{
+				(*p)++;
+				return true;
+			}
+			*p = '0';
+			if (p == szBuffer || !isdigit(p[-1]))
+			{
+				// the number of digits would change
+				return false;
+			}
+		}
+	}
+
+	if (!strcasecmp(szExt, ".rar"))
+	{
+		szExt[2] = '0';
+		szExt[3] = '0';
+		return true;
+	}
+
+	if (isdigit(szExt[2]) && isdigit(szExt[3]))
+	{
+		int iNum = atoi(szExt + 2) + 1;
+		if (iNum == 100)
+		{
+			szExt[1]++;
+			iNum = 0;
+		}
+		szExt[2] = '0' + iNum / 10;
+		szExt[3] = '0' + iNum % 10;
+		return true;
+	}
+
+	return false;
+}
+
+bool RarArchive::IsStored()
+{
+	if (!m_bComplete)
+	{
+		return false;
+	}
+
+	for (Files::iterator it = m_Files.begin(); it != m_Files.end(); it++)
+	{
+		RarFile* pRarFile = *it;
+		if (!pRarFile->m_bStored)
+		{
+			return false;
+		}
+
+		long long lSize = 0;
+		for (Parts::iterator it2 = pRarFile->m_Parts.begin(); it2 != pRarFile->m_Parts.end(); it2++)
+		{
+			lSize += it2->m_lSize;
+		}
+		if (lSize != (pRarFile->m_bDirectory ? 0 : pRarFile->m_lSize))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
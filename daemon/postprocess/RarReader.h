@@ -0,0 +1,122 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifndef RARREADER_H
+#define RARREADER_H
+
+#include <vector>
+#include <time.h>
+
+/*
+ * Reads the headers of a rar-archive (rar4 or rar5 format) and of all its volumes.
+ * If the files in the archive are stored without compression and encryption
+ * the data of each file is a plain sequence of ranges in the volume files and
+ * the archive can be extracted without unrar.
+ */
+class RarArchive
+{
+public:
+	class Part
+	{
+	public:
+		int				m_iVolume;
+		long long		m_lOffset;
+		long long		m_lSize;
+	};
+
+	typedef std::vector<Part>		Parts;
+
+	class RarFile
+	{
+	private:
+		char*			m_szFilename;
+		bool			m_bDirectory;
+		bool			m_bStored;
+		bool			m_bHasCrc;
+		unsigned long	m_lCrc;
+		long long		m_lSize;
+		time_t			m_tTime;
+		Parts			m_Parts;
+
+		friend class RarArchive;
+
+	public:
+						RarFile();
+						~RarFile();
+		const char*		GetFilename() { return m_szFilename; }
+		bool			GetDirectory() { return m_bDirectory; }
+		bool			GetStored() { return m_bStored; }
+		bool			GetHasCrc() { return m_bHasCrc; }
+		unsigned long	GetCrc() { return m_lCrc; }
+		long long		GetSize() { return m_lSize; }
+		time_t			GetTime() { return m_tTime; }
+		Parts*			GetParts() { return &m_Parts; }
+	};
+
+	typedef std::vector<RarFile*>	Files;
+	typedef std::vector<char*>		Volumes;
+
+private:
+	Volumes				m_Volumes;
+	Files				m_Files;
+	bool				m_bMultiVolume;
+	bool				m_bFirstVolume;
+	bool				m_bNewNaming;
+	bool				m_bEncrypted;
+	bool				m_bComplete;
+	bool				m_bHasNextVolume;
+	bool				m_bSplitAfter;
+
+	bool				ReadVolume(const char* szFilename);
+	bool				ReadRar4Volume(FILE* pFile, long long lVolumeSize);
+	bool				ReadRar5Volume(FILE* pFile, long long lVolumeSize);
+	bool				AddFile(RarFile* pRarFile, bool bSplitBefore, bool bSplitAfter,
+							long long lOffset, long long lSize, bool bHasCrc, unsigned long lCrc);
+	bool				NextVolumeName(const char* szFilename, char* szBuffer, int iBufSize);
+
+public:
+						RarArchive();
+						~RarArchive();
+
+	/*
+	 * Reads the headers of the archive starting with the given volume. Further
+	 * volumes are read only if the given volume is the first one.
+	 * Returns false if the file is not a rar-archive or the headers are damaged.
+	 */
+	bool				Read(const char* szFilename);
+	bool				GetFirstVolume() { return m_bFirstVolume; }
+	bool				GetEncrypted() { return m_bEncrypted; }
+	bool				GetComplete() { return m_bComplete; }
+	Volumes*			GetVolumes() { return &m_Volumes; }
+	Files*				GetFiles() { return &m_Files; }
+
+	/*
+	 * Returns true if all volumes were found and all files can be extracted
+	 * by copying their data from the volumes.
+	 */
+	bool				IsStored();
+};
+
+#endif
@@ -35,8 +35,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#ifndef WIN32
+#ifdef WIN32
+#include <sys/utime.h>
+#else
 #include <unistd.h>
+#include <utime.h>
 #endif
 #include <errno.h>
 
@@ -45,6 +48,7 @@
 #include "Log.h"
 #include "Util.h"
 #include "ParCoordinator.h"
+#include "ParChecker.h"
 #include "Options.h"
 
 extern Options* g_pOptions;
@@ -109,6 +113,8 @@ void UnpackController::Run()
 {
 	time_t tStart = time(NULL);
 
+	WaitDirectUnpack();
+
 	// the locking is needed for accessing the members of NZBInfo
 	DownloadQueue::Lock();
 
@@ -139,6 +145,11 @@ void UnpackController::Run()
 		strncpy(m_szPassword, pParameter->GetValue(), 1024-1);
 		m_szPassword[1024-1] = '\0';
 	}
+
+	// the files extracted during download are removed if the first unpack attempt fails
+	bool bDirectUnpacked = m_pPostInfo->GetNZBInfo()->GetDirectUnpackStatus() == NZBInfo::duSuccess &&
+		m_pPostInfo->GetNZBInfo()->GetRenameStatus() != NZBInfo::rsSuccess &&
+		!m_pPostInfo->GetUnpackTried();
 	
 	DownloadQueue::Unlock();
 
@@ -152,6 +163,8 @@ void UnpackController::Run()
 
 	if (bUnpack)
 	{
+		RecoverInPlaceJoins();
+
 		bool bScanNonStdFiles = m_pPostInfo->GetNZBInfo()->GetRenameStatus() > NZBInfo::rsSkipped ||
 			m_pPostInfo->GetNZBInfo()->GetParStatus() == NZBInfo::psSuccess ||
 			!m_bHasParFiles;
@@ -176,7 +189,11 @@ void UnpackController::Run()
 
 		CreateUnpackDir();
 
-		if (m_bHasRarFiles || m_bHasNonStdRarFiles)
+		if (bDirectUnpacked && m_bHasRarFiles && !m_bHasNonStdRarFiles)
+		{
+			PrintMessage(Message::mkInfo, "Rar-archives of %s were unpacked during download", m_szName);
+		}
+		else if (m_bHasRarFiles || m_bHasNonStdRarFiles)
 		{
 			UnpackArchives(upUnrar, false);
 		}
@@ -254,10 +271,9 @@ void UnpackController::UnpackArchives(EUnpacker eUnpacker, bool bMultiVolumes)
 			return;
 		}
 
+		ParamList passwords;
 		char szPassword[512];
-		while (!m_bUnpackOK && !m_bUnpackStartError && !m_bUnpackSpaceError &&
-			(m_bUnpackDecryptError || m_bUnpackPasswordError) &&
-			fgets(szPassword, sizeof(szPassword) - 1, infile))
+		while (fgets(szPassword, sizeof(szPassword) - 1, infile))
 		{
 			// trim trailing <CR> and <LF>
 			char* szEnd = szPassword + strlen(szPassword) - 1;
@@ -265,21 +281,258 @@ void UnpackController::UnpackArchives(EUnpacker eUnpacker, bool bMultiVolumes)
 
 			if (!Util::EmptyStr(szPassword))
 			{
-				if (IsStopped() && m_bAutoTerminated)
+				passwords.push_back(strdup(szPassword));
+			}
+		}
+		fclose(infile);
+
+		if (g_pOptions->GetUnpackPassThreads() > 0 && passwords.size() > 1)
+		{
+			ProbePasswords(eUnpacker, bMultiVolumes, &passwords);
+		}
+
+		for (ParamList::iterator it = passwords.begin(); it != passwords.end() &&
+			!m_bUnpackOK && !m_bUnpackStartError && !m_bUnpackSpaceError &&
+			(m_bUnpackDecryptError || m_bUnpackPasswordError); it++)
+		{
+			const char* szPassword = *it;
+			if (IsStopped() && m_bAutoTerminated)
+			{
+				ScriptController::Resume();
+				Thread::Resume();
+			}
+			m_bUnpackDecryptError = false;
+			m_bUnpackPasswordError = false;
+			m_bAutoTerminated = false;
+			PrintMessage(Message::mkInfo, "Trying password %s for %s", szPassword, m_szName);
+			ExecuteUnpack(eUnpacker, szPassword, bMultiVolumes);
+		}
+
+		m_bPassListTried = !IsStopped() || m_bAutoTerminated;
+	}
+}
+
+/*
+ * Tests the passwords in several unpacker processes running at the same time
+ * (option UnpackPassThreads). The wrong passwords are removed from the list,
+ * the found password is moved to the front of the list.
+ */
+void UnpackController::ProbePasswords(EUnpacker eUnpacker, bool bMultiVolumes, ParamList* pPasswords)
+{
+	ParamList cmdParams;
+	if (!PrepareCmdParams(eUnpacker == upUnrar ? g_pOptions->GetUnrarCmd() : g_pOptions->GetSevenZipCmd(),
+		&cmdParams, eUnpacker == upUnrar ? "unrar" : "7-Zip"))
+	{
+		return;
+	}
+
+	const char* szMask = eUnpacker == upUnrar ? (m_bHasNonStdRarFiles ? "*.*" : "*.rar") :
+		(bMultiVolumes ? "*.7z.001" : "*.7z");
+
+	if (IsStopped() && m_bAutoTerminated)
+	{
+		ScriptController::Resume();
+		Thread::Resume();
+	}
+	m_bAutoTerminated = false;
+
+	// the error flags must be reset for messages to not cancel the unpack
+	bool bDecryptError = m_bUnpackDecryptError;
+	bool bPasswordError = m_bUnpackPasswordError;
+	m_bUnpackDecryptError = false;
+	m_bUnpackPasswordError = false;
+
+	PrintMessage(Message::mkInfo, "Testing %i passwords for %s", (int)pPasswords->size(), m_szName);
+	SetProgressLabel("Testing passwords");
+	m_pPostInfo->SetStageProgress(0);
+
+	int iCount = (int)pPasswords->size();
+	std::vector<PasswordProbe::EResult> results(iCount, PasswordProbe::prUnknown);
+	PasswordProbes probes(iCount, (PasswordProbe*)NULL);
+	int iNext = 0;
+	int iTested = 0;
+	int iRunning = 0;
+	int iFound = -1;
+
+	while (iRunning > 0 || (iFound == -1 && iNext < iCount && !IsStopped()))
+	{
+		while (iFound == -1 && iNext < iCount && iRunning < g_pOptions->GetUnpackPassThreads() && !IsStopped())
+		{
+			PasswordProbe* pProbe = new PasswordProbe(eUnpacker, &cmdParams, pPasswords->at(iNext), szMask, m_szName);
+			pProbe->SetWorkingDir(m_szDestDir);
+			pProbe->SetAutoDestroy(false);
+			pProbe->Start();
+			probes[iNext++] = pProbe;
+			iRunning++;
+		}
+
+		usleep(50 * 1000);
+
+		iRunning = 0;
+		for (int i = 0; i < iNext; i++)
+		{
+			PasswordProbe* pProbe = probes[i];
+			if (!pProbe)
+			{
+				continue;
+			}
+
+			if (pProbe->IsRunning())
+			{
+				if ((iFound > -1 || IsStopped()) && !pProbe->IsStopped())
 				{
-					ScriptController::Resume();
-					Thread::Resume();
+					pProbe->Stop();
 				}
-				m_bUnpackDecryptError = false;
-				m_bUnpackPasswordError = false;
-				m_bAutoTerminated = false;
-				PrintMessage(Message::mkInfo, "Trying password %s for %s", szPassword, m_szName);
-				ExecuteUnpack(eUnpacker, szPassword, bMultiVolumes);
+				iRunning++;
+				continue;
+			}
+
+			results[i] = pProbe->GetResult();
+			if (results[i] == PasswordProbe::prCorrect && iFound == -1)
+			{
+				iFound = i;
 			}
+			delete pProbe;
+			probes[i] = NULL;
+			iTested++;
 		}
 
-		fclose(infile);
-		m_bPassListTried = !IsStopped() || m_bAutoTerminated;
+		m_pPostInfo->SetStageProgress(iTested * 1000 / iCount);
+	}
+
+	SetProgressLabel("");
+
+	if (IsStopped())
+	{
+		m_bUnpackDecryptError = bDecryptError;
+		m_bUnpackPasswordError = bPasswordError;
+		ParamList empty;
+		pPasswords->swap(empty);
+		return;
+	}
+
+	ParamList candidates;
+	if (iFound > -1)
+	{
+		PrintMessage(Message::mkInfo, "Found password %s for %s", pPasswords->at(iFound), m_szName);
+		candidates.push_back(pPasswords->at(iFound));
+		pPasswords->at(iFound) = NULL;
+	}
+
+	// the passwords which couldn't be tested are tried with full unpack
+	for (int i = 0; i < iCount; i++)
+	{
+		if (pPasswords->at(i) && results[i] == PasswordProbe::prUnknown)
+		{
+			candidates.push_back(pPasswords->at(i));
+			pPasswords->at(i) = NULL;
+		}
+	}
+
+	if (candidates.empty())
+	{
+		PrintMessage(Message::mkError, "No password from %s fits %s", g_pOptions->GetUnpackPassFile(), m_szName);
+		// leaving the same state as after an unpack cancelled due to wrong password
+		Thread::Stop();
+		m_bAutoTerminated = true;
+	}
+
+	m_bUnpackDecryptError = bDecryptError;
+	m_bUnpackPasswordError = bPasswordError;
+	pPasswords->swap(candidates);
+}
+
+UnpackController::PasswordProbe::PasswordProbe(EUnpacker eUnpacker, ParamList* pCmdParams,
+	const char* szPassword, const char* szMask, const char* szName)
+{
+	m_eUnpacker = eUnpacker;
+	m_eResult = prUnknown;
+
+	snprintf(m_szInfoName, 1024, "password test for %s", szName);
+	m_szInfoName[1024-1] = '\0';
+
+	// test mode instead of extraction
+	bool bCommand = false;
+	for (ParamList::iterator it = pCmdParams->begin(); it != pCmdParams->end(); it++)
+	{
+		const char* szParam = *it;
+		bCommand |= !strcmp(szParam, "x") || !strcmp(szParam, "e");
+		m_Params.push_back(strdup(!strcmp(szParam, "x") || !strcmp(szParam, "e") ? "t" : szParam));
+	}
+	if (!bCommand)
+	{
+		m_Params.push_back(strdup("t"));
+	}
+
+	m_Params.push_back(strdup("-y"));
+
+	char szPasswordParam[1024];
+	snprintf(szPasswordParam, 1024, "-p%s", szPassword);
+	szPasswordParam[1024-1] = '\0';
+	m_Params.push_back(strdup(szPasswordParam));
+
+	m_Params.push_back(strdup(szMask));
+	m_Params.push_back(NULL);
+
+	SetArgs((const char**)&m_Params.front(), false);
+	SetScript(m_Params.at(0));
+	SetInfoName(m_szInfoName);
+}
+
+void UnpackController::PasswordProbe::Run()
+{
+	if (IsStopped())
+	{
+		return;
+	}
+
+	int iExitCode = Execute();
+
+	if (!GetTerminated())
+	{
+		// unrar returns 11 on wrong password for rar5-archives
+		SetResult(iExitCode == 0 ? prCorrect : m_eUnpacker == upUnrar && iExitCode == 11 ? prWrong : prUnknown);
+	}
+}
+
+void UnpackController::PasswordProbe::Stop()
+{
+	Thread::Stop();
+	Terminate();
+}
+
+void UnpackController::PasswordProbe::SetResult(EResult eResult)
+{
+	if (m_eResult == prUnknown)
+	{
+		m_eResult = eResult;
+	}
+}
+
+void UnpackController::PasswordProbe::AddMessage(Message::EKind eKind, const char* szText)
+{
+	// the output is only analyzed, not logged
+	debug("%s: %s", m_szInfoName, szText);
+
+	int iLen = strlen(szText);
+
+	if (strstr(szText, "password is incorrect") || strstr(szText, "Incorrect password") ||
+		strstr(szText, "Wrong password") || strstr(szText, "wrong password") ||
+		strstr(szText, "in the encrypted file") || strstr(szText, "in encrypted file"))
+	{
+		SetResult(prWrong);
+	}
+	else if ((m_eUnpacker == upUnrar && !strncmp(szText, "Testing ", 8) &&
+			strncmp(szText, "Testing archive", 15) && iLen > 2 && !strcmp(szText + iLen - 2, "OK")) ||
+		(m_eUnpacker == upUnrar && !strncmp(szText, "All OK", 6)) ||
+		(m_eUnpacker == upSevenZip && !strncmp(szText, "Everything is Ok", 16)))
+	{
+		SetResult(prCorrect);
+	}
+
+	if (m_eResult != prUnknown && !IsStopped())
+	{
+		Stop();
 	}
 }
 
@@ -288,7 +541,10 @@ void UnpackController::ExecuteUnpack(EUnpacker eUnpacker, const char* szPassword
 	switch (eUnpacker)
 	{
 		case upUnrar:
-			ExecuteUnrar(szPassword);
+			if (!ExtractStoredRar())
+			{
+				ExecuteUnrar(szPassword);
+			}
 			break;
 
 		case upSevenZip:
@@ -427,6 +683,229 @@ void UnpackController::ExecuteSevenZip(const char* szPassword, bool bMultiVolume
 	}
 }
 
+/*
+ * Extracts rar-archives containing only files stored without compression by
+ * copying the file data out of the volumes, without starting unrar.
+ * Returns false if the archives can't be extracted this way and unrar
+ * must be used instead.
+ */
+bool UnpackController::ExtractStoredRar()
+{
+	if (!g_pOptions->GetUnpackStored() || m_bHasNonStdRarFiles)
+	{
+		return false;
+	}
+
+	// files verified by par-check don't need to be checked again
+	bool bVerify = m_pPostInfo->GetNZBInfo()->GetParStatus() != NZBInfo::psSuccess;
+
+	typedef std::vector<RarArchive*> Archives;
+	Archives archives;
+	FileList otherVolumes;
+	bool bStored = true;
+	long long lTotalSize = 0;
+
+	RegEx regExRar(".*\\.rar$");
+	DirBrowser dir(m_szDestDir);
+	while (const char* filename = dir.Next())
+	{
+		char szFullFilename[1024];
+		snprintf(szFullFilename, 1024, "%s%c%s", m_szDestDir, PATH_SEPARATOR, filename);
+		szFullFilename[1024-1] = '\0';
+
+		if (bStored && strcmp(filename, ".") && strcmp(filename, "..") &&
+			regExRar.Match(filename) && !Util::DirectoryExists(szFullFilename))
+		{
+			RarArchive* pArchive = new RarArchive();
+			bStored = pArchive->Read(szFullFilename);
+			if (bStored && !pArchive->GetFirstVolume())
+			{
+				otherVolumes.push_back(strdup(szFullFilename));
+				delete pArchive;
+				continue;
+			}
+
+			archives.push_back(pArchive);
+			bStored = bStored && pArchive->IsStored();
+
+			RarArchive::Files* pFiles = pArchive->GetFiles();
+			for (RarArchive::Files::iterator it = pFiles->begin(); bStored && it != pFiles->end(); it++)
+			{
+				RarArchive::RarFile* pRarFile = *it;
+				bStored = !bVerify || pRarFile->GetDirectory() || pRarFile->GetHasCrc();
+				lTotalSize += pRarFile->GetSize();
+			}
+		}
+	}
+
+	// each volume must belong to one of found archives, otherwise
+	// the first volume is missing and unrar reports the error
+	for (FileList::iterator it = otherVolumes.begin(); bStored && it != otherVolumes.end(); it++)
+	{
+		bool bFound = false;
+		for (Archives::iterator it2 = archives.begin(); !bFound && it2 != archives.end(); it2++)
+		{
+			RarArchive::Volumes* pVolumes = (*it2)->GetVolumes();
+			for (RarArchive::Volumes::iterator it3 = pVolumes->begin(); !bFound && it3 != pVolumes->end(); it3++)
+			{
+				bFound = !strcmp(*it, *it3);
+			}
+		}
+		bStored = bFound;
+	}
+	otherVolumes.Clear();
+
+	bool bOK = true;
+	if (bStored && !archives.empty())
+	{
+		m_pPostInfo->SetStageProgress(0);
+		long long lExtracted = 0;
+
+		for (Archives::iterator it = archives.begin(); bOK && it != archives.end(); it++)
+		{
+			RarArchive* pArchive = *it;
+			PrintMessage(Message::mkInfo, "Extracting stored archive %s", Util::BaseFileName(pArchive->GetVolumes()->front()));
+
+			RarArchive::Files* pFiles = pArchive->GetFiles();
+			for (RarArchive::Files::iterator it2 = pFiles->begin(); bOK && !IsStopped() && it2 != pFiles->end(); it2++)
+			{
+				bOK = ExtractStoredFile(pArchive, *it2, bVerify, lTotalSize, &lExtracted);
+			}
+		}
+
+		SetProgressLabel("");
+		m_bUnpackOK = bOK && !GetTerminated();
+	}
+
+	for (Archives::iterator it = archives.begin(); it != archives.end(); it++)
+	{
+		delete *it;
+	}
+
+	return bStored && !archives.empty();
+}
+
+bool UnpackController::ExtractStoredFile(RarArchive* pArchive, RarArchive::RarFile* pRarFile, bool bVerify,
+	long long lTotalSize, long long* pExtracted)
+{
+	char szDestFilename[1024];
+	snprintf(szDestFilename, 1024, "%s%c%s", m_szUnpackDir, PATH_SEPARATOR, pRarFile->GetFilename());
+	szDestFilename[1024-1] = '\0';
+
+	char szErrBuf[256];
+	char szDestDir[1024];
+	strncpy(szDestDir, szDestFilename, 1024);
+	szDestDir[1024-1] = '\0';
+	if (!pRarFile->GetDirectory())
+	{
+		*strrchr(szDestDir, PATH_SEPARATOR) = '\0';
+	}
+	if (!Util::ForceDirectories(szDestDir, szErrBuf, sizeof(szErrBuf)))
+	{
+		PrintMessage(Message::mkError, "Could not create directory %s: %s", szDestDir, szErrBuf);
+		return false;
+	}
+
+	if (pRarFile->GetDirectory())
+	{
+		return true;
+	}
+
+	char szMessage[1024];
+	snprintf(szMessage, 1024, "Extracting %s", pRarFile->GetFilename());
+	szMessage[1024-1] = '\0';
+	PrintMessage(Message::mkInfo, "%s", szMessage);
+	SetProgressLabel(szMessage);
+
+	FILE* pOutFile = fopen(szDestFilename, FOPEN_WB);
+	if (!pOutFile)
+	{
+		PrintMessage(Message::mkError, "Could not create file %s: %s", szDestFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+		return false;
+	}
+
+	// the data is copied in chunks to update the progress and to react on cancelling
+	static const int COPY_CHUNK_SIZE = 1024 * 1024 * 16;
+	static const int BUFFER_SIZE = 1024 * 64;
+	char* buffer = bVerify ? (char*)malloc(BUFFER_SIZE) : NULL;
+	unsigned long lCrc = 0xFFFFFFFF;
+	long long lWritten = 0;
+	bool bOK = true;
+
+	RarArchive::Parts* pParts = pRarFile->GetParts();
+	for (RarArchive::Parts::iterator it = pParts->begin(); bOK && !IsStopped() && it != pParts->end(); it++)
+	{
+		RarArchive::Part& part = *it;
+		const char* szVolume = pArchive->GetVolumes()->at(part.m_iVolume);
+		FILE* pInFile = fopen(szVolume, FOPEN_RB);
+		if (!pInFile || fseek(pInFile, part.m_lOffset, SEEK_SET))
+		{
+			PrintMessage(Message::mkError, "Could not read file %s: %s", szVolume, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+			if (pInFile)
+			{
+				fclose(pInFile);
+			}
+			bOK = false;
+			break;
+		}
+
+		for (long long lDone = 0; bOK && !IsStopped() && lDone < part.m_lSize; )
+		{
+			int iChunkSize = bVerify ? BUFFER_SIZE : COPY_CHUNK_SIZE;
+			if (part.m_lSize - lDone < iChunkSize)
+			{
+				iChunkSize = (int)(part.m_lSize - lDone);
+			}
+
+			if (bVerify)
+			{
+				bOK = (int)fread(buffer, 1, iChunkSize, pInFile) == iChunkSize;
+				lCrc = Util::Crc32m(lCrc, (unsigned char*)buffer, iChunkSize);
+				bOK = bOK && (int)fwrite(buffer, 1, iChunkSize, pOutFile) == iChunkSize;
+			}
+			else
+			{
+				bOK = Util::CopyFileRange(pInFile, part.m_lOffset + lDone, pOutFile, lWritten, iChunkSize);
+			}
+
+			lDone += iChunkSize;
+			lWritten += iChunkSize;
+			*pExtracted += iChunkSize;
+			m_pPostInfo->SetStageProgress(lTotalSize > 0 ? int(*pExtracted * 1000 / lTotalSize) : 0);
+		}
+
+		fclose(pInFile);
+	}
+
+	free(buffer);
+
+	bOK = fclose(pOutFile) == 0 && bOK;
+	if (!bOK)
+	{
+		m_bUnpackSpaceError = errno == ENOSPC;
+		PrintMessage(Message::mkError, "Could not extract file %s: %s", pRarFile->GetFilename(), Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+		return false;
+	}
+
+	if (IsStopped())
+	{
+		return false;
+	}
+
+	if (bVerify && (lCrc ^ 0xFFFFFFFF) != pRarFile->GetCrc())
+	{
+		PrintMessage(Message::mkError, "CRC error in extracted file %s", pRarFile->GetFilename());
+		return false;
+	}
+
+	struct utimbuf ut;
+	ut.actime = pRarFile->GetTime();
+	ut.modtime = pRarFile->GetTime();
+	utime(szDestFilename, &ut);
+
+	return true;
+}
+
 bool UnpackController::PrepareCmdParams(const char* szCommand, ParamList* pParams, const char* szInfoName)
 {
 	if (Util::FileExists(szCommand))
@@ -559,27 +1038,81 @@ bool UnpackController::JoinFile(const char* szFragBaseName)
 	snprintf(szDestFilename, 1024, "%s%c%s", m_szUnpackDir, PATH_SEPARATOR, szDestBaseName);
 	szDestFilename[1024-1] = '\0';
 
-	FILE* pOutFile = fopen(szDestFilename, FOPEN_WBP);
-	if (!pOutFile)
-	{
-		PrintMessage(Message::mkError, "Could not create file %s: %s", szDestFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
-		return false;
-	}
-	if (g_pOptions->GetWriteBuffer() > 0)
-	{
-		setvbuf(pOutFile, NULL, _IOFBF, g_pOptions->GetWriteBuffer() * 1024);
-	}
-
 	long long lTotalSize = lFirstSegmentSize * (iCount - 1) + lDifSegmentSize;
 	long long lWritten = 0;
+	int iFirst = iMin;
+
+	// If the fragments are deleted after unpack anyway the first fragment is moved
+	// into unpack directory and the other fragments are appended to it. The data
+	// of the first fragment is then not copied at all. A marker file in unpack
+	// directory allows to restore the first fragment if the program is killed
+	// during joining (see RecoverInPlaceJoins).
+	// the in-place join is not used if the names don't fit into the buffers
+	char szFirstFragBaseName[1024];
+	char szFirstFragFilename[1024];
+	char szMarkerFilename[1024];
+	bool bNamesOK =
+		snprintf(szFirstFragBaseName, 1024, "%s.%.3i", szDestBaseName, iMin) < 1024 &&
+		snprintf(szFirstFragFilename, 1024, "%s%c%s", m_szDestDir, PATH_SEPARATOR, szFirstFragBaseName) < 1024 &&
+		snprintf(szMarkerFilename, 1024, "%s%c.%s.join", m_szUnpackDir, PATH_SEPARATOR, szDestBaseName) < 1024;
+	long long lFirstFragSize = bNamesOK ? Util::FileSize(szFirstFragFilename) : 0;
+
+	char szMarker[1100];
+	snprintf(szMarker, 1100, "%lli\n%s\n", lFirstFragSize, szFirstFragBaseName);
+	szMarker[1100-1] = '\0';
+
+	FILE* pOutFile = NULL;
+	if (g_pOptions->GetUnpackCleanupDisk() && iCount > 1 && bNamesOK &&
+		Util::DeviceId(m_szDestDir) == Util::DeviceId(m_szUnpackDir) &&
+		Util::SaveBufferIntoFile(szMarkerFilename, szMarker, strlen(szMarker)))
+	{
+		if (rename(szFirstFragFilename, szDestFilename) == 0)
+		{
+			pOutFile = fopen(szDestFilename, FOPEN_RBP);
+			if (!pOutFile)
+			{
+				rename(szDestFilename, szFirstFragFilename);
+			}
+		}
 
-	static const int BUFFER_SIZE = 1024 * 50;
-	char* buffer = (char*)malloc(BUFFER_SIZE);
-
-	bool bOK = true;
-	for (int i = iMin; i <= iMax; i++)
-	{
-		PrintMessage(Message::mkInfo, "Joining from %s.%.3i", szDestBaseName, i);
+		if (!pOutFile)
+		{
+			remove(szMarkerFilename);
+		}
+		else
+		{
+			PrintMessage(Message::mkInfo, "Joining from %s", szFirstFragBaseName);
+
+			InPlaceJoin join;
+			join.m_szFragFilename = strdup(szFirstFragFilename);
+			join.m_szDestFilename = strdup(szDestFilename);
+			join.m_szMarkerFilename = strdup(szMarkerFilename);
+			join.m_lFragSize = lFirstFragSize;
+			m_InPlaceJoins.push_back(join);
+
+			lWritten = lFirstFragSize;
+			iFirst++;
+			m_pPostInfo->SetStageProgress(int(lWritten * 1000 / lTotalSize));
+		}
+	}
+
+	if (!pOutFile)
+	{
+		pOutFile = fopen(szDestFilename, FOPEN_WBP);
+		if (!pOutFile)
+		{
+			PrintMessage(Message::mkError, "Could not create file %s: %s", szDestFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+			return false;
+		}
+	}
+
+	// the data is copied in chunks to update the progress and to react on cancelling
+	static const long long COPY_CHUNK_SIZE = 1024 * 1024 * 64;
+
+	bool bOK = true;
+	for (int i = iFirst; i <= iMax && bOK && !IsStopped(); i++)
+	{
+		PrintMessage(Message::mkInfo, "Joining from %s.%.3i", szDestBaseName, i);
 
 		char szMessage[1024];
 		snprintf(szMessage, 1024, "Joining from %s.%.3i", szDestBaseName, i);
@@ -594,36 +1127,128 @@ bool UnpackController::JoinFile(const char* szFragBaseName)
 			break;
 		}
 
+		long long lFragSize = Util::FileSize(szFragFilename);
 		FILE* pInFile = fopen(szFragFilename, FOPEN_RB);
-		if (pInFile)
+		if (!pInFile)
+		{
+			PrintMessage(Message::mkError, "Could not open file %s", szFragFilename);
+			bOK = false;
+			break;
+		}
+
+		for (long long lDone = 0; lDone < lFragSize && !IsStopped(); )
 		{
-			int cnt = BUFFER_SIZE;
-			while (cnt == BUFFER_SIZE)
+			long long lChunkSize = lFragSize - lDone < COPY_CHUNK_SIZE ? lFragSize - lDone : COPY_CHUNK_SIZE;
+			if (!Util::CopyFileRange(pInFile, lDone, pOutFile, lWritten, lChunkSize))
 			{
-				cnt = (int)fread(buffer, 1, BUFFER_SIZE, pInFile);
-				fwrite(buffer, 1, cnt, pOutFile);
-				lWritten += cnt;
-				m_pPostInfo->SetStageProgress(int(lWritten * 1000 / lTotalSize));
+				PrintMessage(Message::mkError, "Could not write file %s: %s", szDestFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+				bOK = false;
+				break;
 			}
-			fclose(pInFile);
+			lDone += lChunkSize;
+			lWritten += lChunkSize;
+			m_pPostInfo->SetStageProgress(int(lWritten * 1000 / lTotalSize));
+		}
 
-			char szFragFilename[1024];
-			snprintf(szFragFilename, 1024, "%s.%.3i", szDestBaseName, i);
-			szFragFilename[1024-1] = '\0';
-			m_JoinedFiles.push_back(strdup(szFragFilename));
+		fclose(pInFile);
+
+		snprintf(szFragFilename, 1024, "%s.%.3i", szDestBaseName, i);
+		szFragFilename[1024-1] = '\0';
+		m_JoinedFiles.push_back(strdup(szFragFilename));
+	}
+
+	if (fclose(pOutFile) != 0 && bOK)
+	{
+		PrintMessage(Message::mkError, "Could not write file %s: %s", szDestFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+		bOK = false;
+	}
+
+	return bOK && !IsStopped();
+}
+
+/*
+ * Restores the first fragments of files which were joined in place if the
+ * previous unpack attempt could not restore them (for example because
+ * the program was killed during joining).
+ */
+void UnpackController::RecoverInPlaceJoins()
+{
+	char szFinalDir[1024];
+	char szUnpackDir[1024];
+	BuildUnpackDir(m_pPostInfo->GetNZBInfo(), szFinalDir, szUnpackDir, 1024);
+
+	if (!Util::DirectoryExists(szUnpackDir))
+	{
+		return;
+	}
+
+	RegEx regExMarker("^\\..*\\.join$");
+
+	DirBrowser dir(szUnpackDir);
+	while (const char* filename = dir.Next())
+	{
+		if (!regExMarker.Match(filename))
+		{
+			continue;
 		}
-		else
+
+		// the name of joined file is the name of marker without leading dot and ".join"
+		char szMarkerFilename[1024];
+		char szDestFilename[1024];
+		if (snprintf(szMarkerFilename, 1024, "%s%c%s", szUnpackDir, PATH_SEPARATOR, filename) >= 1024 ||
+			snprintf(szDestFilename, 1024, "%s%c%.*s", szUnpackDir, PATH_SEPARATOR, (int)strlen(filename) - 6, filename + 1) >= 1024)
 		{
-			PrintMessage(Message::mkError, "Could not open file %s", szFragFilename);
-			bOK = false;
-			break;
+			continue;
 		}
-	}
 
-	fclose(pOutFile);
-	free(buffer);
+		char* szMarker = NULL;
+		int iMarkerLen = 0;
+		long long lFragSize = 0;
+		char* szFragBaseName = NULL;
+		if (Util::LoadFileIntoBuffer(szMarkerFilename, &szMarker, &iMarkerLen))
+		{
+			lFragSize = atoll(szMarker);
+			szFragBaseName = strchr(szMarker, '\n');
+			if (szFragBaseName)
+			{
+				szFragBaseName++;
+				Util::TrimRight(szFragBaseName);
+			}
+		}
 
-	return bOK;
+		// an unreadable marker is kept together with the joined file
+		bool bOK = !Util::EmptyStr(szFragBaseName);
+		if (bOK && Util::FileExists(szDestFilename))
+		{
+			char szFragFilename[1024];
+			bOK = snprintf(szFragFilename, 1024, "%s%c%s", m_szDestDir, PATH_SEPARATOR, szFragBaseName) < 1024;
+
+			if (bOK && Util::FileExists(szFragFilename))
+			{
+				// the fragment was restored by par-repair
+				remove(szDestFilename);
+			}
+			else if (bOK)
+			{
+				PrintMessage(Message::mkInfo, "Restoring file %s", szFragBaseName);
+				bOK = Util::TruncateFile(szDestFilename, lFragSize) &&
+					Util::MoveFile(szDestFilename, szFragFilename);
+				if (!bOK)
+				{
+					char szErrBuf[256];
+					PrintMessage(Message::mkError, "Could not restore file %s: %s", szFragFilename,
+						Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+				}
+			}
+		}
+
+		if (bOK)
+		{
+			remove(szMarkerFilename);
+		}
+
+		free(szMarker);
+	}
 }
 
 void UnpackController::Completed()
@@ -686,20 +1311,11 @@ void UnpackController::RequestParCheck(bool bForceRepair)
 
 void UnpackController::CreateUnpackDir()
 {
-	m_bInterDir = strlen(g_pOptions->GetInterDir()) > 0 &&
-		!strncmp(m_szDestDir, g_pOptions->GetInterDir(), strlen(g_pOptions->GetInterDir()));
+	m_bInterDir = BuildUnpackDir(m_pPostInfo->GetNZBInfo(), m_szFinalDir, m_szUnpackDir, 1024);
 	if (m_bInterDir)
 	{
-		m_pPostInfo->GetNZBInfo()->BuildFinalDirName(m_szFinalDir, 1024);
-		m_szFinalDir[1024-1] = '\0';
-		snprintf(m_szUnpackDir, 1024, "%s%c%s", m_szFinalDir, PATH_SEPARATOR, "_unpack");
 		m_bFinalDirCreated = !Util::DirectoryExists(m_szFinalDir);
 	}
-	else
-	{
-		snprintf(m_szUnpackDir, 1024, "%s%c%s", m_szDestDir, PATH_SEPARATOR, "_unpack");
-	}
-	m_szUnpackDir[1024-1] = '\0';
 
 	char szErrBuf[1024];
 	if (!Util::ForceDirectories(m_szUnpackDir, szErrBuf, sizeof(szErrBuf)))
@@ -708,6 +1324,29 @@ void UnpackController::CreateUnpackDir()
 	}
 }
 
+/*
+ * Builds the name of directory for extracted files. If the intermediate directory
+ * is used the files are extracted directly into the final directory.
+ * Returns true if the intermediate directory is used.
+ */
+bool UnpackController::BuildUnpackDir(NZBInfo* pNZBInfo, char* szFinalDir, char* szUnpackDir, int iBufSize)
+{
+	bool bInterDir = strlen(g_pOptions->GetInterDir()) > 0 &&
+		!strncmp(pNZBInfo->GetDestDir(), g_pOptions->GetInterDir(), strlen(g_pOptions->GetInterDir()));
+	if (bInterDir)
+	{
+		pNZBInfo->BuildFinalDirName(szFinalDir, iBufSize);
+		szFinalDir[iBufSize-1] = '\0';
+		snprintf(szUnpackDir, iBufSize, "%s%c%s", szFinalDir, PATH_SEPARATOR, "_unpack");
+	}
+	else
+	{
+		snprintf(szUnpackDir, iBufSize, "%s%c%s", pNZBInfo->GetDestDir(), PATH_SEPARATOR, "_unpack");
+	}
+	szUnpackDir[iBufSize-1] = '\0';
+
+	return bInterDir;
+}
 
 void UnpackController::CheckArchiveFiles(bool bScanNonStdFiles)
 {
@@ -794,6 +1433,31 @@ bool UnpackController::Cleanup()
 
 	bool bOK = true;
 
+	// first fragments used as beginning of joined files are restored;
+	// if that fails the unpack directory is kept, it contains the data
+	// of the first fragments
+	for (InPlaceJoins::iterator it = m_InPlaceJoins.begin(); it != m_InPlaceJoins.end(); it++)
+	{
+		InPlaceJoin& join = *it;
+		if (!m_bUnpackOK &&
+			!(Util::TruncateFile(join.m_szDestFilename, join.m_lFragSize) &&
+			  Util::MoveFile(join.m_szDestFilename, join.m_szFragFilename)))
+		{
+			char szErrBuf[256];
+			PrintMessage(Message::mkError, "Could not restore file %s: %s", join.m_szFragFilename,
+				Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+			bOK = false;
+		}
+		else
+		{
+			remove(join.m_szMarkerFilename);
+		}
+		free(join.m_szFragFilename);
+		free(join.m_szDestFilename);
+		free(join.m_szMarkerFilename);
+	}
+	m_InPlaceJoins.clear();
+
 	FileList extractedFiles;
 
 	if (m_bUnpackOK)
@@ -1039,107 +1703,810 @@ void UnpackController::SetProgressLabel(const char* szProgressLabel)
 	DownloadQueue::Unlock();
 }
 
-
-void MoveController::StartJob(PostInfo* pPostInfo)
+/*
+ * Waits until the direct unpack has processed all downloaded volumes.
+ */
+void UnpackController::WaitDirectUnpack()
 {
-	MoveController* pMoveController = new MoveController();
-	pMoveController->m_pPostInfo = pPostInfo;
-	pMoveController->SetAutoDestroy(false);
+	bool bWaiting = false;
+	while (!IsStopped())
+	{
+		DownloadQueue::Lock();
+		bool bRunning = m_pPostInfo->GetNZBInfo()->GetUnpackThread() != NULL;
+		if (bRunning && !bWaiting)
+		{
+			m_pPostInfo->GetNZBInfo()->PrintMessage(Message::mkInfo, "Waiting for direct unpack of %s",
+				m_pPostInfo->GetNZBInfo()->GetName());
+			bWaiting = true;
+		}
+		DownloadQueue::Unlock();
 
-	pPostInfo->SetPostThread(pMoveController);
+		if (!bRunning)
+		{
+			break;
+		}
 
-	pMoveController->Start();
+		usleep(100 * 1000);
+	}
 }
 
-void MoveController::Run()
+
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void DirectUnpack::FileDownloaded(DownloadQueue* pDownloadQueue, FileInfo* pFileInfo)
 {
-	// the locking is needed for accessing the members of NZBInfo
-	DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = pFileInfo->GetNZBInfo();
 
-	char szNZBName[1024];
-	strncpy(szNZBName, m_pPostInfo->GetNZBInfo()->GetName(), 1024);
-	szNZBName[1024-1] = '\0';
+	if (!g_pOptions->GetDirectUnpack() || pNZBInfo->GetDirectUnpackStatus() != NZBInfo::duNone ||
+		pNZBInfo->GetDeleteStatus() != NZBInfo::dsNone || !IsFirstVolume(pFileInfo->GetFilename()))
+	{
+		return;
+	}
 
-	char szInfoName[1024];
-	snprintf(szInfoName, 1024, "move for %s", m_pPostInfo->GetNZBInfo()->GetName());
-	szInfoName[1024-1] = '\0';
-	SetInfoName(szInfoName);
+	NZBParameter* pParameter = pNZBInfo->GetParameters()->Find("*Unpack:", false);
+	if (pParameter && !strcasecmp(pParameter->GetValue(), "no"))
+	{
+		return;
+	}
 
-	strncpy(m_szInterDir, m_pPostInfo->GetNZBInfo()->GetDestDir(), 1024);
-	m_szInterDir[1024-1] = '\0';
+	DirectUnpack* pDirectUnpack = new DirectUnpack();
+	pDirectUnpack->m_iNZBID = pNZBInfo->GetID();
+	pDirectUnpack->SetAutoDestroy(true);
 
-	m_pPostInfo->GetNZBInfo()->BuildFinalDirName(m_szDestDir, 1024);
-	m_szDestDir[1024-1] = '\0';
+	pNZBInfo->SetUnpackThread(pDirectUnpack);
+	pNZBInfo->SetDirectUnpackStatus(NZBInfo::duRunning);
 
-	DownloadQueue::Unlock();
+	pDirectUnpack->Start();
+}
 
-	PrintMessage(Message::mkInfo, "Moving completed files for %s", szNZBName);
+/**
+ * DownloadQueue must be locked prior to call of this function.
+ */
+void DirectUnpack::StopAll(DownloadQueue* pDownloadQueue)
+{
+	for (NZBList::iterator it = pDownloadQueue->GetQueue()->begin(); it != pDownloadQueue->GetQueue()->end(); it++)
+	{
+		NZBInfo* pNZBInfo = *it;
+		if (pNZBInfo->GetUnpackThread())
+		{
+			pNZBInfo->GetUnpackThread()->Stop();
+		}
+	}
+}
 
-	bool bOK = MoveFiles();
+bool DirectUnpack::IsFirstVolume(const char* szFilename)
+{
+	RegEx regExRar(".*\\.rar$");
+	RegEx regExRarPart(".*\\.part[0-9]+\\.rar$");
+	RegEx regExRarFirstPart(".*\\.part0*1\\.rar$");
 
-	szInfoName[0] = 'M'; // uppercase
+	return regExRarFirstPart.Match(szFilename) ||
+		(regExRar.Match(szFilename) && !regExRarPart.Match(szFilename));
+}
 
-	if (bOK)
+void DirectUnpack::Run()
+{
+	m_szPassword[0] = '\0';
+	m_szFinalDir[0] = '\0';
+	m_bFinalDirCreated = false;
+
+	// the locking is needed for accessing the members of NZBInfo
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(m_iNZBID);
+	if (!pNZBInfo)
 	{
-		PrintMessage(Message::mkInfo, "%s successful", szInfoName);
-		// save new dest dir
-		DownloadQueue::Lock();
-		m_pPostInfo->GetNZBInfo()->SetDestDir(m_szDestDir);
-		m_pPostInfo->GetNZBInfo()->SetMoveStatus(NZBInfo::msSuccess);
+		// the nzb was deleted before the thread has started
 		DownloadQueue::Unlock();
+		return;
 	}
-	else
+
+	strncpy(m_szName, pNZBInfo->GetName(), 1024);
+	m_szName[1024-1] = '\0';
+
+	snprintf(m_szInfoName, 1024, "direct unpack for %s", pNZBInfo->GetName());
+	m_szInfoName[1024-1] = '\0';
+
+	strncpy(m_szDestDir, pNZBInfo->GetDestDir(), 1024);
+	m_szDestDir[1024-1] = '\0';
+
+	NZBParameter* pParameter = pNZBInfo->GetParameters()->Find("*Unpack:Password", false);
+	if (pParameter)
 	{
-		PrintMessage(Message::mkError, "%s failed", szInfoName);
-		m_pPostInfo->GetNZBInfo()->SetMoveStatus(NZBInfo::msFailure);
+		strncpy(m_szPassword, pParameter->GetValue(), 1024-1);
+		m_szPassword[1024-1] = '\0';
 	}
 
-	m_pPostInfo->SetStage(PostInfo::ptQueued);
-	m_pPostInfo->SetWorking(false);
-}
+	if (UnpackController::BuildUnpackDir(pNZBInfo, m_szFinalDir, m_szUnpackDir, 1024))
+	{
+		m_bFinalDirCreated = !Util::DirectoryExists(m_szFinalDir);
+	}
+
+	DownloadQueue::Unlock();
+
+	SetInfoName(m_szInfoName);
+	SetWorkingDir(m_szDestDir);
+
+	PrintMessage(Message::mkInfo, "Directly unpacking %s", m_szName);
+
+	bool bSuccess = true;
 
-bool MoveController::MoveFiles()
-{
 	char szErrBuf[1024];
-	if (!Util::ForceDirectories(m_szDestDir, szErrBuf, sizeof(szErrBuf)))
+	if (!Util::ForceDirectories(m_szUnpackDir, szErrBuf, sizeof(szErrBuf)))
 	{
-		PrintMessage(Message::mkError, "Could not create directory %s: %s", m_szDestDir, szErrBuf);
-		return false;
+		PrintMessage(Message::mkError, "Could not create directory %s: %s", m_szUnpackDir, szErrBuf);
+		bSuccess = false;
 	}
 
-	bool bOK = true;
-	DirBrowser dir(m_szInterDir);
-	while (const char* filename = dir.Next())
+	while (bSuccess && !IsStopped())
 	{
-		if (strcmp(filename, ".") && strcmp(filename, ".."))
+		char szArchive[1024];
+		EArchiveState eState = FindNextArchive(szArchive, 1024);
+
+		if (eState == asFound)
 		{
-			char szSrcFile[1024];
-			snprintf(szSrcFile, 1024, "%s%c%s", m_szInterDir, PATH_SEPARATOR, filename);
-			szSrcFile[1024-1] = '\0';
+			bSuccess = ExecuteUnrar(szArchive);
+			m_ExtractedArchives.push_back(strdup(Util::BaseFileName(szArchive)));
+		}
+		else if (eState == asWait)
+		{
+			usleep(100 * 1000);
+		}
+		else
+		{
+			bSuccess = eState == asDone;
+			break;
+		}
+	}
 
-			char szDstFile[1024];
-			Util::MakeUniqueFilename(szDstFile, 1024, m_szDestDir, filename);
+	Completed(bSuccess && !IsStopped());
 
-			bool bHiddenFile = filename[0] == '.';
+	m_ExtractedArchives.Clear();
+}
 
-			if (!bHiddenFile)
-			{
-				PrintMessage(Message::mkInfo, "Moving file %s to %s", Util::BaseFileName(szSrcFile), m_szDestDir);
-			}
+/*
+ * Looks for the first volume of an archive which wasn't extracted yet.
+ * Waits while the nzb is downloading, the download may bring more archives.
+ */
+DirectUnpack::EArchiveState DirectUnpack::FindNextArchive(char* szArchive, int iBufSize)
+{
+	EArchiveState eState = asWait;
 
-			if (!Util::MoveFile(szSrcFile, szDstFile) && !bHiddenFile)
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(m_iNZBID);
+
+	NZBParameter* pParameter = pNZBInfo ? pNZBInfo->GetParameters()->Find("*Unpack:", false) : NULL;
+	if (!pNZBInfo || pNZBInfo->GetDeleteStatus() != NZBInfo::dsNone || strcmp(pNZBInfo->GetDestDir(), m_szDestDir) ||
+		(pParameter && !strcasecmp(pParameter->GetValue(), "no")))
+	{
+		eState = asFailure;
+	}
+	else
+	{
+		for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
+		{
+			CompletedFile* pCompletedFile = *it;
+			if (IsFirstVolume(pCompletedFile->GetFileName()) && !m_ExtractedArchives.Exists(pCompletedFile->GetFileName()))
 			{
-				char szErrBuf[256];
-				PrintMessage(Message::mkError, "Could not move file %s to %s: %s", szSrcFile, szDstFile,
-					Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
-				bOK = false;
+				if (pCompletedFile->GetStatus() != CompletedFile::cfSuccess)
+				{
+					PrintMessage(Message::mkWarning, "Cancelling %s: file %s is damaged", m_szInfoName, pCompletedFile->GetFileName());
+					eState = asFailure;
+					break;
+				}
+				snprintf(szArchive, iBufSize, "%s%c%s", m_szDestDir, PATH_SEPARATOR, pCompletedFile->GetFileName());
+				szArchive[iBufSize-1] = '\0';
+				eState = asFound;
+				break;
 			}
 		}
+
+		if (eState == asWait && pNZBInfo->GetPostInfo())
+		{
+			eState = asDone;
+		}
 	}
 
-	if (bOK && !Util::DeleteDirectoryWithContent(m_szInterDir, szErrBuf, sizeof(szErrBuf)))
-	{
-		PrintMessage(Message::mkWarning, "Could not delete intermediate directory %s: %s", m_szInterDir, szErrBuf);
+	DownloadQueue::Unlock();
+
+	return eState;
+}
+
+bool DirectUnpack::ExecuteUnrar(const char* szArchive)
+{
+	// Format: 
+	//   unrar x -y -p- -o+ -vp archive.part01.rar ./_unpack/
+
+	UnpackController::ParamList params;
+
+	if (Util::FileExists(g_pOptions->GetUnrarCmd()))
+	{
+		params.push_back(strdup(g_pOptions->GetUnrarCmd()));
+	}
+	else
+	{
+		char** pCmdArgs = NULL;
+		if (!Util::SplitCommandLine(g_pOptions->GetUnrarCmd(), &pCmdArgs))
+		{
+			PrintMessage(Message::mkError, "Could not start unrar, failed to parse command line: %s", g_pOptions->GetUnrarCmd());
+			return false;
+		}
+		for (char** szArgPtr = pCmdArgs; *szArgPtr; szArgPtr++)
+		{
+			params.push_back(*szArgPtr);
+		}
+		free(pCmdArgs);
+	}
+
+	if (!params.Exists("x") && !params.Exists("e"))
+	{
+		params.push_back(strdup("x"));
+	}
+
+	params.push_back(strdup("-y"));
+
+	if (!Util::EmptyStr(m_szPassword))
+	{
+		char szPasswordParam[1024];
+		snprintf(szPasswordParam, 1024, "-p%s", m_szPassword);
+		szPasswordParam[1024-1] = '\0';
+		params.push_back(strdup(szPasswordParam));
+	}
+	else
+	{
+		params.push_back(strdup("-p-"));
+	}
+
+	if (!params.Exists("-o+") && !params.Exists("-o-"))
+	{
+		params.push_back(strdup("-o+"));
+	}
+
+	// pause before each volume
+	params.push_back(strdup("-vp"));
+
+	params.push_back(strdup(szArchive));
+
+	char szUnpackDirParam[1024];
+	snprintf(szUnpackDirParam, 1024, "%s%c", m_szUnpackDir, PATH_SEPARATOR);
+	szUnpackDirParam[1024-1] = '\0';
+	params.push_back(strdup(szUnpackDirParam));
+
+	params.push_back(NULL);
+	SetArgs((const char**)&params.front(), false);
+	SetScript(params.at(0));
+	SetLogPrefix("Unrar");
+	SetNeedWrite(true);
+	ResetEnv();
+
+	m_bAllOKMessageReceived = false;
+	m_bVolumeFailed = false;
+
+	int iExitCode = Execute();
+	SetLogPrefix(NULL);
+
+	bool bOK = iExitCode == 0 && m_bAllOKMessageReceived && !m_bVolumeFailed && !GetTerminated();
+
+	if (!bOK && iExitCode > 0 && !m_bVolumeFailed)
+	{
+		PrintMessage(Message::mkError, "Unrar error code: %i", iExitCode);
+	}
+
+	return bOK;
+}
+
+/**
+ * Unrar asks for the next volume with a prompt, which doesn't end with new line.
+ * We analyze the output after every char to detect the prompt.
+ */
+bool DirectUnpack::ReadLine(char* szBuf, int iBufSize, FILE* pStream)
+{
+	int i = 0;
+
+	for (; i < iBufSize - 1; i++)
+	{
+		int ch = fgetc(pStream);
+		szBuf[i] = ch;
+		szBuf[i+1] = '\0';
+		if (ch == EOF)
+		{
+			break;
+		}
+		if (ch == '\n')
+		{
+			i++;
+			break;
+		}
+
+		char* szPrompt = ch == ' ' ? strstr(szBuf, " [C]ontinue, [Q]uit ") : NULL;
+		char* szVolume = szPrompt ? strstr(szBuf, "Insert disk with ") : NULL;
+		if (szVolume && szVolume < szPrompt)
+		{
+			*szPrompt = '\0';
+			WaitNextVolume(szVolume + 17);
+			szBuf[0] = '\0';
+			return true;
+		}
+	}
+
+	szBuf[i] = '\0';
+
+	return i > 0;
+}
+
+/*
+ * Lets unrar continue as soon as the next volume is downloaded.
+ * The unpack is cancelled if the volume is damaged or will not be downloaded.
+ */
+void DirectUnpack::WaitNextVolume(const char* szVolume)
+{
+	const char* szVolumeName = Util::BaseFileName(szVolume);
+	debug("Waiting for volume %s", szVolumeName);
+
+	while (!IsStopped())
+	{
+		CompletedFile::EStatus eStatus = CompletedFile::cfUnknown;
+		bool bFound = false;
+		bool bAbort = false;
+
+		DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+		NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(m_iNZBID);
+		if (pNZBInfo)
+		{
+			for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
+			{
+				CompletedFile* pCompletedFile = *it;
+				if (!strcmp(pCompletedFile->GetFileName(), szVolumeName))
+				{
+					eStatus = pCompletedFile->GetStatus();
+					bFound = true;
+					break;
+				}
+			}
+		}
+		// when the nzb is in post-processing queue all files are already downloaded
+		bAbort = !pNZBInfo || pNZBInfo->GetDeleteStatus() != NZBInfo::dsNone ||
+			strcmp(pNZBInfo->GetDestDir(), m_szDestDir) || (!bFound && pNZBInfo->GetPostInfo());
+		DownloadQueue::Unlock();
+
+		if (bFound && eStatus == CompletedFile::cfSuccess)
+		{
+			Write("C\n");
+			return;
+		}
+
+		if (bFound || bAbort)
+		{
+			PrintMessage(Message::mkWarning, "Cancelling %s: volume %s is %s", m_szInfoName, szVolumeName,
+				bFound ? "damaged" : "missing");
+			break;
+		}
+
+		usleep(100 * 1000);
+	}
+
+	m_bVolumeFailed = true;
+	Write("Q\n");
+}
+
+void DirectUnpack::Completed(bool bSuccess)
+{
+	if (!bSuccess)
+	{
+		char szErrBuf[256];
+		if (Util::DirectoryExists(m_szUnpackDir) &&
+			!Util::DeleteDirectoryWithContent(m_szUnpackDir, szErrBuf, sizeof(szErrBuf)))
+		{
+			PrintMessage(Message::mkError, "Could not delete temporary directory %s: %s", m_szUnpackDir, szErrBuf);
+		}
+
+		if (m_bFinalDirCreated)
+		{
+			Util::RemoveDirectory(m_szFinalDir);
+		}
+	}
+
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(m_iNZBID);
+	if (pNZBInfo)
+	{
+		pNZBInfo->SetUnpackThread(NULL);
+		pNZBInfo->SetDirectUnpackStatus(bSuccess ? NZBInfo::duSuccess : NZBInfo::duFailure);
+		if (bSuccess)
+		{
+			pNZBInfo->PrintMessage(Message::mkInfo, "Direct unpack for %s successful", m_szName);
+		}
+		else
+		{
+			pNZBInfo->PrintMessage(Message::mkInfo, "Direct unpack for %s failed, archives will be unpacked after download", m_szName);
+		}
+	}
+	DownloadQueue::Unlock();
+}
+
+void DirectUnpack::AddMessage(Message::EKind eKind, const char* szText)
+{
+	// Modify unrar messages for better readability:
+	// remove the destination path part from message "Extracting file.xxx"
+	char szMsgText[1024];
+	if (!strncmp(szText, "Unrar: Extracting  ", 19) &&
+		!strncmp(szText + 19, m_szUnpackDir, strlen(m_szUnpackDir)))
+	{
+		snprintf(szMsgText, 1024, "Unrar: Extracting %s", szText + 19 + strlen(m_szUnpackDir) + 1);
+	}
+	else
+	{
+		strncpy(szMsgText, szText, 1024);
+	}
+	szMsgText[1024-1] = '\0';
+
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+	NZBInfo* pNZBInfo = pDownloadQueue->GetQueue()->Find(m_iNZBID);
+	if (pNZBInfo)
+	{
+		pNZBInfo->AddMessage(eKind, szMsgText);
+	}
+	DownloadQueue::Unlock();
+
+	if (!strncmp(szText, "Unrar: All OK", 13))
+	{
+		m_bAllOKMessageReceived = true;
+	}
+}
+
+void DirectUnpack::Stop()
+{
+	debug("Stopping direct unpack");
+	Thread::Stop();
+	Terminate();
+}
+
+
+void MoveController::StartJob(PostInfo* pPostInfo)
+{
+	MoveController* pMoveController = new MoveController();
+	pMoveController->m_pPostInfo = pPostInfo;
+	pMoveController->SetAutoDestroy(false);
+
+	pPostInfo->SetPostThread(pMoveController);
+
+	pMoveController->Start();
+}
+
+void MoveController::Run()
+{
+	// the locking is needed for accessing the members of NZBInfo
+	DownloadQueue::Lock();
+
+	char szNZBName[1024];
+	strncpy(szNZBName, m_pPostInfo->GetNZBInfo()->GetName(), 1024);
+	szNZBName[1024-1] = '\0';
+
+	char szInfoName[1024];
+	snprintf(szInfoName, 1024, "move for %s", m_pPostInfo->GetNZBInfo()->GetName());
+	szInfoName[1024-1] = '\0';
+	SetInfoName(szInfoName);
+
+	strncpy(m_szInterDir, m_pPostInfo->GetNZBInfo()->GetDestDir(), 1024);
+	m_szInterDir[1024-1] = '\0';
+
+	m_pPostInfo->GetNZBInfo()->BuildFinalDirName(m_szDestDir, 1024);
+	m_szDestDir[1024-1] = '\0';
+
+	DownloadQueue::Unlock();
+
+	PrintMessage(Message::mkInfo, "Moving completed files for %s", szNZBName);
+
+	bool bOK = MoveFiles();
+
+	szInfoName[0] = 'M'; // uppercase
+
+	if (bOK)
+	{
+		PrintMessage(Message::mkInfo, "%s successful", szInfoName);
+		// save new dest dir
+		DownloadQueue::Lock();
+		m_pPostInfo->GetNZBInfo()->SetDestDir(m_szDestDir);
+		m_pPostInfo->GetNZBInfo()->SetMoveStatus(NZBInfo::msSuccess);
+		DownloadQueue::Unlock();
+	}
+	else
+	{
+		PrintMessage(Message::mkError, "%s failed", szInfoName);
+		m_pPostInfo->GetNZBInfo()->SetMoveStatus(NZBInfo::msFailure);
+	}
+
+	m_pPostInfo->SetStage(PostInfo::ptQueued);
+	m_pPostInfo->SetWorking(false);
+}
+
+bool MoveController::MoveFiles()
+{
+	char szErrBuf[1024];
+	if (!Util::ForceDirectories(m_szDestDir, szErrBuf, sizeof(szErrBuf)))
+	{
+		PrintMessage(Message::mkError, "Could not create directory %s: %s", m_szDestDir, szErrBuf);
+		return false;
+	}
+
+	if (Util::DeviceId(m_szInterDir) != Util::DeviceId(m_szDestDir))
+	{
+		// renaming is not possible, the files must be copied to another disk
+		bool bOK = CopyFiles();
+		if (bOK && !Util::DeleteDirectoryWithContent(m_szInterDir, szErrBuf, sizeof(szErrBuf)))
+		{
+			PrintMessage(Message::mkWarning, "Could not delete intermediate directory %s: %s", m_szInterDir, szErrBuf);
+		}
+		return bOK;
+	}
+
+	// partially repaired files are not moved, they are deleted together with intermediate directory
+	bool bOK = true;
+	DirBrowser dir(m_szInterDir);
+	while (const char* filename = dir.Next())
+	{
+		if (strcmp(filename, ".") && strcmp(filename, "..") &&
+			!Util::MatchFileExt(filename, REPAIR_PART_EXT, ","))
+		{
+			char szSrcFile[1024];
+			snprintf(szSrcFile, 1024, "%s%c%s", m_szInterDir, PATH_SEPARATOR, filename);
+			szSrcFile[1024-1] = '\0';
+
+			char szDstFile[1024];
+			Util::MakeUniqueFilename(szDstFile, 1024, m_szDestDir, filename);
+
+			bool bHiddenFile = filename[0] == '.';
+
+			if (!bHiddenFile)
+			{
+				PrintMessage(Message::mkInfo, "Moving file %s to %s", Util::BaseFileName(szSrcFile), m_szDestDir);
+			}
+
+			if (!Util::MoveFile(szSrcFile, szDstFile) && !bHiddenFile)
+			{
+				char szErrBuf[256];
+				PrintMessage(Message::mkError, "Could not move file %s to %s: %s", szSrcFile, szDstFile,
+					Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+				bOK = false;
+			}
+		}
+	}
+
+	if (bOK && !Util::DeleteDirectoryWithContent(m_szInterDir, szErrBuf, sizeof(szErrBuf)))
+	{
+		PrintMessage(Message::mkWarning, "Could not delete intermediate directory %s: %s", m_szInterDir, szErrBuf);
+	}
+
+	return bOK;
+}
+
+/*
+ * Moves the files to another disk. Several files are copied at the same time
+ * (option MoveThreads). The copies are flushed to disk all together after
+ * copying and only then the source files are deleted.
+ */
+bool MoveController::CopyFiles()
+{
+	bool bOK = true;
+	long long lTotalSize = 0;
+
+	DirBrowser dir(m_szInterDir);
+	while (const char* filename = dir.Next())
+	{
+		if (strcmp(filename, ".") && strcmp(filename, "..") &&
+			!Util::MatchFileExt(filename, REPAIR_PART_EXT, ","))
+		{
+			char szSrcFile[1024];
+			snprintf(szSrcFile, 1024, "%s%c%s", m_szInterDir, PATH_SEPARATOR, filename);
+			szSrcFile[1024-1] = '\0';
+
+			char szDstFile[1024];
+			Util::MakeUniqueFilename(szDstFile, 1024, m_szDestDir, filename);
+
+			bool bHiddenFile = filename[0] == '.';
+
+			if (Util::DirectoryExists(szSrcFile))
+			{
+				// directories are moved as before
+				if (!Util::MoveFile(szSrcFile, szDstFile) && !bHiddenFile)
+				{
+					char szErrBuf[256];
+					PrintMessage(Message::mkError, "Could not move file %s to %s: %s", szSrcFile, szDstFile,
+						Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+					bOK = false;
+				}
+				continue;
+			}
+
+			// creating the file now reserves the name for the copy
+			FILE* pFile = fopen(szDstFile, FOPEN_WB);
+			if (!pFile)
+			{
+				if (!bHiddenFile)
+				{
+					char szErrBuf[256];
+					PrintMessage(Message::mkError, "Could not create file %s: %s", szDstFile,
+						Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+					bOK = false;
+				}
+				continue;
+			}
+			fclose(pFile);
+
+			MoveItem item;
+			item.m_szSrcFilename = strdup(szSrcFile);
+			item.m_szDstFilename = strdup(szDstFile);
+			item.m_lSize = Util::FileSize(szSrcFile);
+			item.m_bHidden = bHiddenFile;
+			item.m_bCopied = false;
+			m_MoveItems.push_back(item);
+
+			lTotalSize += item.m_lSize;
+		}
+	}
+
+	m_iNextItem = 0;
+	m_lCopiedSize = 0;
+	m_pPostInfo->SetStageProgress(0);
+
+	int iThreads = g_pOptions->GetMoveThreads() > 0 ? g_pOptions->GetMoveThreads() : 1;
+	if (iThreads > (int)m_MoveItems.size())
+	{
+		iThreads = (int)m_MoveItems.size();
+	}
+
+	std::vector<CopyThread*> threads;
+	for (int i = 0; i < iThreads; i++)
+	{
+		CopyThread* pCopyThread = new CopyThread(this);
+		pCopyThread->SetAutoDestroy(false);
+		pCopyThread->Start();
+		threads.push_back(pCopyThread);
+	}
+
+	bool bRunning = !threads.empty();
+	while (bRunning)
+	{
+		usleep(100 * 1000);
+
+		bRunning = false;
+		for (std::vector<CopyThread*>::iterator it = threads.begin(); it != threads.end(); it++)
+		{
+			bRunning |= (*it)->IsRunning();
+		}
+
+		m_mutexMoveItems.Lock();
+		long long lCopiedSize = m_lCopiedSize;
+		m_mutexMoveItems.Unlock();
+
+		m_pPostInfo->SetStageProgress(lTotalSize > 0 ? int(lCopiedSize * 1000 / lTotalSize) : 1000);
+	}
+
+	for (std::vector<CopyThread*>::iterator it = threads.begin(); it != threads.end(); it++)
+	{
+		delete *it;
+	}
+
+	// flushing after all files are copied lets the OS write the data in larger batches
+	for (MoveItems::iterator it = m_MoveItems.begin(); it != m_MoveItems.end(); it++)
+	{
+		MoveItem* pMoveItem = &*it;
+		if (pMoveItem->m_bCopied)
+		{
+			FILE* pFile = fopen(pMoveItem->m_szDstFilename, FOPEN_RBP);
+			pMoveItem->m_bCopied = pFile && Util::FlushFile(pFile);
+			if (pFile)
+			{
+				fclose(pFile);
+			}
+			if (!pMoveItem->m_bCopied && !pMoveItem->m_bHidden)
+			{
+				char szErrBuf[256];
+				PrintMessage(Message::mkError, "Could not write file %s: %s", pMoveItem->m_szDstFilename,
+					Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+			}
+		}
+	}
+
+	for (MoveItems::iterator it = m_MoveItems.begin(); it != m_MoveItems.end(); it++)
+	{
+		MoveItem* pMoveItem = &*it;
+		if (pMoveItem->m_bCopied)
+		{
+			if (remove(pMoveItem->m_szSrcFilename) && !pMoveItem->m_bHidden)
+			{
+				char szErrBuf[256];
+				PrintMessage(Message::mkError, "Could not delete file %s: %s", pMoveItem->m_szSrcFilename,
+					Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+				bOK = false;
+			}
+		}
+		else
+		{
+			remove(pMoveItem->m_szDstFilename);
+			bOK &= pMoveItem->m_bHidden;
+		}
+		free(pMoveItem->m_szSrcFilename);
+		free(pMoveItem->m_szDstFilename);
+	}
+	m_MoveItems.clear();
+
+	return bOK;
+}
+
+MoveController::MoveItem* MoveController::NextMoveItem()
+{
+	MoveItem* pMoveItem = NULL;
+
+	m_mutexMoveItems.Lock();
+	if (!IsStopped() && m_iNextItem < m_MoveItems.size())
+	{
+		pMoveItem = &m_MoveItems[m_iNextItem++];
+	}
+	m_mutexMoveItems.Unlock();
+
+	return pMoveItem;
+}
+
+void MoveController::AddCopiedSize(long long lSize)
+{
+	m_mutexMoveItems.Lock();
+	m_lCopiedSize += lSize;
+	m_mutexMoveItems.Unlock();
+}
+
+void MoveController::CopyThread::Run()
+{
+	while (MoveItem* pMoveItem = m_pOwner->NextMoveItem())
+	{
+		pMoveItem->m_bCopied = m_pOwner->CopyMoveItem(pMoveItem);
+	}
+}
+
+bool MoveController::CopyMoveItem(MoveItem* pMoveItem)
+{
+	if (!pMoveItem->m_bHidden)
+	{
+		PrintMessage(Message::mkInfo, "Moving file %s to %s", Util::BaseFileName(pMoveItem->m_szSrcFilename), m_szDestDir);
+	}
+
+	FILE* pInFile = fopen(pMoveItem->m_szSrcFilename, FOPEN_RB);
+	FILE* pOutFile = pInFile ? fopen(pMoveItem->m_szDstFilename, FOPEN_WBP) : NULL;
+
+	// copying in chunks to report progress
+	static const long long CHUNK_SIZE = 16 * 1024 * 1024;
+	bool bOK = pInFile && pOutFile;
+	for (long long lOffset = 0; bOK && lOffset < pMoveItem->m_lSize && !IsStopped(); lOffset += CHUNK_SIZE)
+	{
+		long long lChunk = pMoveItem->m_lSize - lOffset < CHUNK_SIZE ? pMoveItem->m_lSize - lOffset : CHUNK_SIZE;
+		bOK = Util::CopyFileRange(pInFile, lOffset, pOutFile, lOffset, lChunk);
+		AddCopiedSize(lChunk);
+	}
+	bOK = bOK && !IsStopped();
+
+	if (!bOK && !pMoveItem->m_bHidden && !IsStopped())
+	{
+		char szErrBuf[256];
+		PrintMessage(Message::mkError, "Could not move file %s to %s: %s", pMoveItem->m_szSrcFilename,
+			pMoveItem->m_szDstFilename, Util::GetLastErrorMessage(szErrBuf, sizeof(szErrBuf)));
+	}
+
+	if (pInFile)
+	{
+		fclose(pInFile);
+	}
+	if (pOutFile)
+	{
+		bOK = fclose(pOutFile) == 0 && bOK;
+	}
+
+	if (bOK)
+	{
+		time_t tTime = Util::FileModificationTime(pMoveItem->m_szSrcFilename);
+		struct utimbuf ut;
+		ut.actime = tTime;
+		ut.modtime = tTime;
+		utime(pMoveItem->m_szDstFilename, &ut);
 	}
 
 	return bOK;
@@ -33,6 +33,7 @@
 #include "Thread.h"
 #include "DownloadInfo.h"
 #include "Script.h"
+#include "RarReader.h"
 
 class UnpackController : public Thread, public ScriptController
 {
@@ -51,6 +52,17 @@ private:
 		bool			Exists(const char* szFilename);
 	};
 
+	class InPlaceJoin
+	{
+	public:
+		char*			m_szFragFilename;
+		char*			m_szDestFilename;
+		char*			m_szMarkerFilename;
+		long long		m_lFragSize;
+	};
+
+	typedef std::vector<InPlaceJoin>	InPlaceJoins;
+
 	typedef std::vector<char*>		ParamListBase;
 	class ParamList : public ParamListBase
 	{
@@ -59,6 +71,42 @@ private:
 		bool			Exists(const char* szParam);
 	};
 
+	/*
+	 * Tests one password by running the unpacker in test mode. The unpacker is
+	 * stopped as soon as the password proves to be wrong or the first file of
+	 * the archive is tested successfully.
+	 */
+	class PasswordProbe : public Thread, public ScriptController
+	{
+	public:
+		enum EResult
+		{
+			prUnknown,
+			prWrong,
+			prCorrect
+		};
+
+	private:
+		EUnpacker		m_eUnpacker;
+		ParamList		m_Params;
+		char			m_szInfoName[1024];
+		EResult			m_eResult;
+
+		void			SetResult(EResult eResult);
+
+	protected:
+		virtual void	Run();
+		virtual void	AddMessage(Message::EKind eKind, const char* szText);
+
+	public:
+						PasswordProbe(EUnpacker eUnpacker, ParamList* pCmdParams, const char* szPassword,
+							const char* szMask, const char* szName);
+		virtual void	Stop();
+		EResult			GetResult() { return m_eResult; }
+	};
+
+	typedef std::vector<PasswordProbe*>	PasswordProbes;
+
 private:
 	PostInfo*			m_pPostInfo;
 	char				m_szName[1024];
@@ -87,6 +135,7 @@ private:
 	EUnpacker			m_eUnpacker;
 	bool				m_bFinalDirCreated;
 	FileList			m_JoinedFiles;
+	InPlaceJoins		m_InPlaceJoins;
 	bool				m_bPassListTried;
 
 protected:
@@ -95,9 +144,14 @@ protected:
 	void				ExecuteUnpack(EUnpacker eUnpacker, const char* szPassword, bool bMultiVolumes);
 	void				ExecuteUnrar(const char* szPassword);
 	void				ExecuteSevenZip(const char* szPassword, bool bMultiVolumes);
+	bool				ExtractStoredRar();
+	bool				ExtractStoredFile(RarArchive* pArchive, RarArchive::RarFile* pRarFile, bool bVerify,
+							long long lTotalSize, long long* pExtracted);
 	void				UnpackArchives(EUnpacker eUnpacker, bool bMultiVolumes);
+	void				ProbePasswords(EUnpacker eUnpacker, bool bMultiVolumes, ParamList* pPasswords);
 	void				JoinSplittedFiles();
 	bool				JoinFile(const char* szFragBaseName);
+	void				RecoverInPlaceJoins();
 	void				Completed();
 	void				CreateUnpackDir();
 	bool				Cleanup();
@@ -108,6 +162,10 @@ protected:
 #endif
 	bool				FileHasRarSignature(const char* szFilename);
 	bool				PrepareCmdParams(const char* szCommand, ParamList* pParams, const char* szInfoName);
+	void				WaitDirectUnpack();
+	static bool			BuildUnpackDir(NZBInfo* pNZBInfo, char* szFinalDir, char* szUnpackDir, int iBufSize);
+
+	friend class DirectUnpack;
 
 public:
 	virtual void		Run();
@@ -115,14 +173,91 @@ public:
 	static void			StartJob(PostInfo* pPostInfo);
 };
 
+/*
+ * Extracts rar-archives while the nzb is still downloading. Unrar is started
+ * with the first volume and pauses before each next volume until the volume
+ * is downloaded.
+ */
+class DirectUnpack : public Thread, public ScriptController
+{
+private:
+	enum EArchiveState
+	{
+		asFound,
+		asWait,
+		asDone,
+		asFailure
+	};
+
+	int					m_iNZBID;
+	char				m_szName[1024];
+	char				m_szInfoName[1024];
+	char				m_szDestDir[1024];
+	char				m_szFinalDir[1024];
+	char				m_szUnpackDir[1024];
+	char				m_szPassword[1024];
+	bool				m_bFinalDirCreated;
+	bool				m_bAllOKMessageReceived;
+	bool				m_bVolumeFailed;
+	UnpackController::FileList	m_ExtractedArchives;
+
+	EArchiveState		FindNextArchive(char* szArchive, int iBufSize);
+	bool				ExecuteUnrar(const char* szArchive);
+	void				WaitNextVolume(const char* szVolume);
+	void				Completed(bool bSuccess);
+
+protected:
+	virtual bool		ReadLine(char* szBuf, int iBufSize, FILE* pStream);
+	virtual void		AddMessage(Message::EKind eKind, const char* szText);
+
+public:
+	virtual void		Run();
+	virtual void		Stop();
+	static bool			IsFirstVolume(const char* szFilename);
+	static void			FileDownloaded(DownloadQueue* pDownloadQueue, FileInfo* pFileInfo);
+	static void			StopAll(DownloadQueue* pDownloadQueue);
+};
+
 class MoveController : public Thread, public ScriptController
 {
 private:
+	class MoveItem
+	{
+	public:
+		char*			m_szSrcFilename;
+		char*			m_szDstFilename;
+		long long		m_lSize;
+		bool			m_bHidden;
+		bool			m_bCopied;
+	};
+
+	typedef std::vector<MoveItem>	MoveItems;
+
+	class CopyThread : public Thread
+	{
+	private:
+		MoveController*	m_pOwner;
+
+	protected:
+		virtual void	Run();
+
+	public:
+						CopyThread(MoveController* pOwner) : m_pOwner(pOwner) {}
+	};
+
 	PostInfo*			m_pPostInfo;
 	char				m_szInterDir[1024];
 	char				m_szDestDir[1024];
+	MoveItems			m_MoveItems;
+	Mutex				m_mutexMoveItems;
+	unsigned int		m_iNextItem;
+	long long			m_lCopiedSize;
 
 	bool				MoveFiles();
+	bool				CopyFiles();
+	bool				CopyMoveItem(MoveItem* pMoveItem);
+	MoveItem*			NextMoveItem();
+	void				AddCopiedSize(long long lSize);
 
 protected:
 	virtual void		AddMessage(Message::EKind eKind, const char* szText);
@@ -49,6 +49,7 @@
 #include "Options.h"
 #include "Log.h"
 #include "Util.h"
+#include "ParChecker.h"
 
 extern Options* g_pOptions;
 
@@ -139,7 +140,7 @@ bool DiskState::SaveDownloadQueue(DownloadQueue* pDownloadQueue)
 		return false;
 	}
 
-	fprintf(outfile, "%s%i\n", FORMATVERSION_SIGNATURE, 53);
+	fprintf(outfile, "%s%i\n", FORMATVERSION_SIGNATURE, 54);
 
 	// save nzb-infos
 	SaveNZBQueue(pDownloadQueue, outfile);
@@ -182,7 +183,7 @@ bool DiskState::LoadDownloadQueue(DownloadQueue* pDownloadQueue, Servers* pServe
 	char FileSignatur[128];
 	fgets(FileSignatur, sizeof(FileSignatur), infile);
 	iFormatVersion = ParseFormatVersion(FileSignatur);
-	if (iFormatVersion < 3 || iFormatVersion > 53)
+	if (iFormatVersion < 3 || iFormatVersion > 54)
 	{
 		error("Could not load diskstate due to file version mismatch");
 		fclose(infile);
@@ -396,8 +397,14 @@ void DiskState::SaveNZBInfo(NZBInfo* pNZBInfo, FILE* outfile)
 	for (CompletedFiles::iterator it = pNZBInfo->GetCompletedFiles()->begin(); it != pNZBInfo->GetCompletedFiles()->end(); it++)
 	{
 		CompletedFile* pCompletedFile = *it;
-		fprintf(outfile, "%i,%i,%lu,%s\n", pCompletedFile->GetID(), (int)pCompletedFile->GetStatus(),
-			pCompletedFile->GetCrc(), pCompletedFile->GetFileName());
+		char szHash16k[33];
+		szHash16k[0] = '\0';
+		if (pCompletedFile->GetHash16k())
+		{
+			FormatHash(pCompletedFile->GetHash16k(), szHash16k);
+		}
+		fprintf(outfile, "%i,%i,%lu,%s,%s\n", pCompletedFile->GetID(), (int)pCompletedFile->GetStatus(),
+			pCompletedFile->GetCrc(), szHash16k, pCompletedFile->GetFileName());
 	}
 
 	fprintf(outfile, "%i\n", (int)pNZBInfo->GetParameters()->size());
@@ -782,6 +789,7 @@ bool DiskState::LoadNZBInfo(NZBInfo* pNZBInfo, Servers* pServers, FILE* infile,
 			char* szFileName = buf;
 			int iStatus = 0;
 			unsigned long lCrc = 0;
+			char* szHash16k = NULL;
 
 			if (iFormatVersion >= 49)
 			{
@@ -791,6 +799,11 @@ bool DiskState::LoadNZBInfo(NZBInfo* pNZBInfo, Servers* pServers, FILE* infile,
 					szFileName = strchr(buf, ',');
 					if (szFileName) szFileName = strchr(szFileName+1, ',');
 					if (szFileName) szFileName = strchr(szFileName+1, ',');
+					if (szFileName && iFormatVersion >= 54)
+					{
+						szHash16k = szFileName + 1;
+						szFileName = strchr(szFileName+1, ',');
+					}
 				}
 				else
 				{
@@ -803,7 +816,13 @@ bool DiskState::LoadNZBInfo(NZBInfo* pNZBInfo, Servers* pServers, FILE* infile,
 				}
 			}
 
-			pNZBInfo->GetCompletedFiles()->push_back(new CompletedFile(iID, szFileName, (CompletedFile::EStatus)iStatus, lCrc));
+			CompletedFile* pCompletedFile = new CompletedFile(iID, szFileName, (CompletedFile::EStatus)iStatus, lCrc);
+			unsigned char Hash16k[16];
+			if (szHash16k && szFileName && szFileName - szHash16k == 33 && ParseHash(szHash16k, Hash16k))
+			{
+				pCompletedFile->SetHash16k(Hash16k);
+			}
+			pNZBInfo->GetCompletedFiles()->push_back(pCompletedFile);
 		}
 	}
 
@@ -1222,7 +1241,7 @@ bool DiskState::SaveFileState(FileInfo* pFileInfo, bool bCompleted)
 		return false;
 	}
 
-	fprintf(outfile, "%s%i\n", FORMATVERSION_SIGNATURE, 2);
+	fprintf(outfile, "%s%i\n", FORMATVERSION_SIGNATURE, 3);
 
 	fprintf(outfile, "%i,%i\n", pFileInfo->GetSuccessArticles(), pFileInfo->GetFailedArticles());
 
@@ -1232,6 +1251,15 @@ bool DiskState::SaveFileState(FileInfo* pFileInfo, bool bCompleted)
 	Util::SplitInt64(pFileInfo->GetFailedSize(), &High3, &Low3);
 	fprintf(outfile, "%lu,%lu,%lu,%lu,%lu,%lu\n", High1, Low1, High2, Low2, High3, Low3);
 
+	char szHash16k[33];
+	memset(szHash16k, '0', 32);
+	szHash16k[32] = '\0';
+	if (pFileInfo->GetHash16k())
+	{
+		FormatHash(pFileInfo->GetHash16k(), szHash16k);
+	}
+	fprintf(outfile, "%i,%s\n", (int)(pFileInfo->GetHash16k() != NULL), szHash16k);
+
 	SaveServerStats(pFileInfo->GetServerStats(), outfile);
 
 	fprintf(outfile, "%i\n", (int)pFileInfo->GetArticles()->size());
@@ -1269,7 +1297,7 @@ bool DiskState::LoadFileState(FileInfo* pFileInfo, Servers* pServers, bool bComp
 	{
 		if (buf[0] != 0) buf[strlen(buf)-1] = 0; // remove traling '\n'
 		iFormatVersion = ParseFormatVersion(buf);
-		if (iFormatVersion > 2)
+		if (iFormatVersion > 3)
 		{
 			error("Could not load diskstate due to file version mismatch");
 			goto error;
@@ -1291,6 +1319,15 @@ bool DiskState::LoadFileState(FileInfo* pFileInfo, Servers* pServers, bool bComp
 	pFileInfo->SetSuccessSize(Util::JoinInt64(High2, Low3));
 	pFileInfo->SetFailedSize(Util::JoinInt64(High3, Low3));
 
+	if (iFormatVersion >= 3)
+	{
+		int iHasHash16k;
+		char szHash16k[33];
+		unsigned char Hash16k[16];
+		if (fscanf(infile, "%i,%32s\n", &iHasHash16k, szHash16k) != 2 || !ParseHash(szHash16k, Hash16k)) goto error;
+		pFileInfo->SetHash16k(iHasHash16k ? Hash16k : NULL);
+	}
+
 	if (!LoadServerStats(pFileInfo->GetServerStats(), pServers, infile)) goto error;
 
 	int iCompletedArticles;
@@ -1354,6 +1391,130 @@ error:
 	return false;
 }
 
+void DiskState::FormatHash(unsigned char* pHash, char* szBuf)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		sprintf(szBuf + i * 2, "%02x", (int)pHash[i]);
+	}
+}
+
+bool DiskState::ParseHash(const char* szBuf, unsigned char* pHash)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int iByte;
+		if (sscanf(szBuf + i * 2, "%2x", &iByte) != 1)
+		{
+			return false;
+		}
+		pHash[i] = (unsigned char)iByte;
+	}
+	return true;
+}
+
+bool DiskState::SaveParHashes(int iFileID, ParHashes* pParHashes)
+{
+	debug("Saving ParHashes to disk");
+
+	char szFilename[1024];
+	snprintf(szFilename, 1024, "%s%ih", g_pOptions->GetQueueDir(), iFileID);
+	szFilename[1024-1] = '\0';
+
+	FILE* outfile = fopen(szFilename, FOPEN_WB);
+
+	if (!outfile)
+	{
+		error("Error saving diskstate: could not create file %s", szFilename);
+		return false;
+	}
+
+	fprintf(outfile, "%s%i\n", FORMATVERSION_SIGNATURE, 1);
+
+	unsigned long High1, Low1, High2, Low2;
+	Util::SplitInt64(pParHashes->GetBlockSize(), &High1, &Low1);
+	Util::SplitInt64(pParHashes->GetFileSize(), &High2, &Low2);
+	fprintf(outfile, "%lu,%lu,%lu,%lu,%i\n", High1, Low1, High2, Low2, (int)pParHashes->GetModified());
+
+	char szHash[33];
+	FormatHash(pParHashes->GetHashFull(), szHash);
+	fprintf(outfile, "%s\n", szHash);
+	FormatHash(pParHashes->GetHash16k(), szHash);
+	fprintf(outfile, "%s\n", szHash);
+
+	fprintf(outfile, "%i\n", (int)pParHashes->GetBlockHashes()->size());
+	for (ParHashes::BlockHashes::iterator it = pParHashes->GetBlockHashes()->begin(); it != pParHashes->GetBlockHashes()->end(); it++)
+	{
+		ParHashes::BlockHash& blockHash = *it;
+		FormatHash(blockHash.m_Md5, szHash);
+		fprintf(outfile, "%lu,%s\n", blockHash.m_lCrc, szHash);
+	}
+
+	fclose(outfile);
+	return true;
+}
+
+bool DiskState::LoadParHashes(int iFileID, ParHashes* pParHashes)
+{
+	char szFilename[1024];
+	snprintf(szFilename, 1024, "%s%ih", g_pOptions->GetQueueDir(), iFileID);
+	szFilename[1024-1] = '\0';
+
+	FILE* infile = fopen(szFilename, FOPEN_RB);
+
+	if (!infile)
+	{
+		// the hashes are optional, no error message
+		return false;
+	}
+
+	char buf[1024];
+	int iFormatVersion = 0;
+
+	if (fgets(buf, sizeof(buf), infile))
+	{
+		if (buf[0] != 0) buf[strlen(buf)-1] = 0; // remove traling '\n'
+		iFormatVersion = ParseFormatVersion(buf);
+		if (iFormatVersion > 1)
+		{
+			error("Could not load diskstate due to file version mismatch");
+			goto error;
+		}
+	}
+	else
+	{
+		goto error;
+	}
+
+	unsigned long High1, Low1, High2, Low2;
+	int iModified;
+	if (fscanf(infile, "%lu,%lu,%lu,%lu,%i\n", &High1, &Low1, &High2, &Low2, &iModified) != 5) goto error;
+	pParHashes->SetBlockSize(Util::JoinInt64(High1, Low1));
+	pParHashes->SetFileSize(Util::JoinInt64(High2, Low2));
+	pParHashes->SetModified((time_t)iModified);
+
+	char szHash[33];
+	if (fscanf(infile, "%32s\n", szHash) != 1 || !ParseHash(szHash, pParHashes->GetHashFull())) goto error;
+	if (fscanf(infile, "%32s\n", szHash) != 1 || !ParseHash(szHash, pParHashes->GetHash16k())) goto error;
+
+	int size;
+	if (fscanf(infile, "%i\n", &size) != 1) goto error;
+	pParHashes->GetBlockHashes()->resize(size);
+	for (int i = 0; i < size; i++)
+	{
+		ParHashes::BlockHash& blockHash = pParHashes->GetBlockHashes()->at(i);
+		if (fscanf(infile, "%lu,%32s\n", &blockHash.m_lCrc, szHash) != 2 || !ParseHash(szHash, blockHash.m_Md5)) goto error;
+	}
+
+	fclose(infile);
+	return true;
+
+error:
+	fclose(infile);
+	error("Error reading diskstate for file %s", szFilename);
+	return false;
+}
+
 void DiskState::DiscardFiles(NZBInfo* pNZBInfo)
 {
 	for (FileList::iterator it = pNZBInfo->GetFileList()->begin(); it != pNZBInfo->GetFileList()->end(); it++)
@@ -1381,11 +1542,42 @@ void DiskState::DiscardFiles(NZBInfo* pNZBInfo)
 			szFilename[1024-1] = '\0';
 			remove(szFilename);
 		}
+
+		if (pCompletedFile->GetID() > 0)
+		{
+			snprintf(szFilename, 1024, "%s%ih", g_pOptions->GetQueueDir(), pCompletedFile->GetID());
+			szFilename[1024-1] = '\0';
+			remove(szFilename);
+		}
 	}
 
 	snprintf(szFilename, 1024, "%sn%i.log", g_pOptions->GetQueueDir(), pNZBInfo->GetID());
 	szFilename[1024-1] = '\0';
 	remove(szFilename);
+
+	DiscardRepairStates(pNZBInfo);
+}
+
+/*
+ * Deletes saved progress of interrupted par-repairs.
+ */
+void DiskState::DiscardRepairStates(NZBInfo* pNZBInfo)
+{
+	char szPrefix[20];
+	snprintf(szPrefix, 20, "n%i-", pNZBInfo->GetID());
+	szPrefix[20-1] = '\0';
+
+	DirBrowser dir(g_pOptions->GetQueueDir());
+	while (const char* filename = dir.Next())
+	{
+		if (!strncmp(filename, szPrefix, strlen(szPrefix)) && strstr(filename, REPAIR_STATE_EXT))
+		{
+			char szFilename[1024];
+			snprintf(szFilename, 1024, "%s%s", g_pOptions->GetQueueDir(), filename);
+			szFilename[1024-1] = '\0';
+			remove(szFilename);
+		}
+	}
 }
 
 bool DiskState::LoadPostQueue12(DownloadQueue* pDownloadQueue, NZBList* pNZBList, FILE* infile, int iFormatVersion)
@@ -1995,6 +2187,14 @@ void DiskState::DiscardFile(FileInfo* pFileInfo, bool bDeleteData, bool bDeleteP
 		fileName[1024-1] = '\0';
 		remove(fileName);
 	}
+
+	// par-hashes file
+	if (bDeleteCompletedState)
+	{
+		snprintf(fileName, 1024, "%s%ih", g_pOptions->GetQueueDir(), pFileInfo->GetID());
+		fileName[1024-1] = '\0';
+		remove(fileName);
+	}
 }
 
 void DiskState::CleanupTempDir(DownloadQueue* pDownloadQueue)
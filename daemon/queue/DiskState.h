@@ -62,6 +62,8 @@ private:
 	bool				LoadAllFileStates(DownloadQueue* pDownloadQueue, Servers* pServers);
 	void				SaveServerStats(ServerStatList* pServerStatList, FILE* outfile);
 	bool				LoadServerStats(ServerStatList* pServerStatList, Servers* pServers, FILE* infile);
+	void				FormatHash(unsigned char* pHash, char* szBuf);
+	bool				ParseHash(const char* szBuf, unsigned char* pHash);
 
 	// backward compatibility functions (conversions from older formats)
 	bool				LoadPostQueue12(DownloadQueue* pDownloadQueue, NZBList* pNZBList, FILE* infile, int iFormatVersion);
@@ -83,9 +85,12 @@ public:
 	bool				SaveFileState(FileInfo* pFileInfo, bool bCompleted);
 	bool				LoadFileState(FileInfo* pFileInfo, Servers* pServers, bool bCompleted);
 	bool				LoadArticles(FileInfo* pFileInfo);
+	bool				SaveParHashes(int iFileID, ParHashes* pParHashes);
+	bool				LoadParHashes(int iFileID, ParHashes* pParHashes);
 	void				DiscardDownloadQueue();
 	void				DiscardFile(FileInfo* pFileInfo, bool bDeleteData, bool bDeletePartialState, bool bDeleteCompletedState);
 	void				DiscardFiles(NZBInfo* pNZBInfo);
+	void				DiscardRepairStates(NZBInfo* pNZBInfo);
 	bool				SaveFeeds(Feeds* pFeeds, FeedHistory* pFeedHistory);
 	bool				LoadFeeds(Feeds* pFeeds, FeedHistory* pFeedHistory);
 	bool				SaveStats(Servers* pServers, ServerVolumes* pServerVolumes);
@@ -345,6 +345,10 @@ NZBInfo::NZBInfo() : m_FileList(true)
 	m_bReprocess = false;
 	m_tQueueScriptTime = 0;
 	m_bParFull = false;
+	m_lParBlockSize = 0;
+	m_iParMissingBlocks = 0;
+	m_eDirectUnpackStatus = duNone;
+	m_pUnpackThread = NULL;
 	m_iMessageCount = 0;
 	m_iCachedMessageCount = 0;
 }
@@ -1089,6 +1093,8 @@ FileInfo::FileInfo(int iID)
 	m_bAutoDeleted = false;
 	m_iCachedArticles = 0;
 	m_bPartialChanged = false;
+	m_pParHasher = NULL;
+	m_bHash16k = false;
 	m_iID = iID ? iID : ++m_iIDGen;
 }
 
@@ -1100,6 +1106,9 @@ FileInfo::~ FileInfo()
 	free(m_szFilename);
 	free(m_szOutputFilename);
 	delete m_pMutexOutputFile;
+#ifndef DISABLE_PARCHECK
+	delete m_pParHasher;
+#endif
 
 	for (Groups::iterator it = m_Groups.begin(); it != m_Groups.end() ;it++)
 	{
@@ -1183,6 +1192,15 @@ void FileInfo::SetOutputFilename(const char* szOutputFilename)
 	m_szOutputFilename = strdup(szOutputFilename);
 }
 
+void FileInfo::SetHash16k(const unsigned char* pHash16k)
+{
+	m_bHash16k = pHash16k != NULL;
+	if (pHash16k)
+	{
+		memcpy(m_Hash16k, pHash16k, sizeof(m_Hash16k));
+	}
+}
+
 void FileInfo::SetActiveDownloads(int iActiveDownloads)
 {
 	m_iActiveDownloads = iActiveDownloads;
@@ -1233,6 +1251,20 @@ CompletedFile::CompletedFile(int iID, const char* szFileName, EStatus eStatus, u
 	m_szFileName = strdup(szFileName);
 	m_eStatus = eStatus;
 	m_lCrc = lCrc;
+	m_bHash16k = false;
+}
+
+/*
+ * MD5 of the first 16 KB of the file (as used in par2 file descriptions),
+ * NULL if unknown.
+ */
+void CompletedFile::SetHash16k(const unsigned char* pHash16k)
+{
+	m_bHash16k = pHash16k != NULL;
+	if (pHash16k)
+	{
+		memcpy(m_Hash16k, pHash16k, sizeof(m_Hash16k));
+	}
 }
 
 void CompletedFile::SetFileName(const char* szFileName)
@@ -1246,6 +1278,16 @@ CompletedFile::~CompletedFile()
 	free(m_szFileName);
 }
 
+
+ParHashes::ParHashes()
+{
+	m_lBlockSize = 0;
+	m_lFileSize = 0;
+	m_tModified = 0;
+	memset(m_HashFull, 0, sizeof(m_HashFull));
+	memset(m_Hash16k, 0, sizeof(m_Hash16k));
+}
+
 PostInfo::PostInfo()
 {
 	debug("Creating PostInfo");
@@ -38,6 +38,7 @@
 class NZBInfo;
 class DownloadQueue;
 class PostInfo;
+class ParHasher;
 
 class ServerStat
 {
@@ -157,6 +158,9 @@ private:
 	bool				m_bAutoDeleted;
 	int					m_iCachedArticles;
 	bool				m_bPartialChanged;
+	ParHasher*			m_pParHasher;
+	bool				m_bHash16k;
+	unsigned char		m_Hash16k[16];
 
 	static int			m_iIDGen;
 	static int			m_iIDMax;
@@ -226,6 +230,10 @@ public:
 	bool				GetPartialChanged() { return m_bPartialChanged; }
 	void				SetPartialChanged(bool bPartialChanged) { m_bPartialChanged = bPartialChanged; }
 	ServerStatList*		GetServerStats() { return &m_ServerStats; }
+	ParHasher*			GetParHasher() { return m_pParHasher; }
+	void				SetParHasher(ParHasher* pParHasher) { m_pParHasher = pParHasher; }
+	unsigned char*		GetHash16k() { return m_bHash16k ? m_Hash16k : NULL; }
+	void				SetHash16k(const unsigned char* pHash16k);
 };
                               
 typedef std::deque<FileInfo*> FileListBase;
@@ -257,6 +265,8 @@ private:
 	char*				m_szFileName;
 	EStatus				m_eStatus;
 	unsigned long		m_lCrc;
+	bool				m_bHash16k;
+	unsigned char		m_Hash16k[16];
 
 public:
 						CompletedFile(int iID, const char* szFileName, EStatus eStatus, unsigned long lCrc);
@@ -266,10 +276,48 @@ public:
 	const char*			GetFileName() { return m_szFileName; }
 	EStatus				GetStatus() { return m_eStatus; }
 	unsigned long		GetCrc() { return m_lCrc; }
+	unsigned char*		GetHash16k() { return m_bHash16k ? m_Hash16k : NULL; }
+	void				SetHash16k(const unsigned char* pHash16k);
 };
 
 typedef std::deque<CompletedFile*>	CompletedFiles;
 
+/*
+ * Par2-block checksums of a file computed during download, used by par-checker
+ * to verify the file without reading it from disk.
+ */
+class ParHashes
+{
+public:
+	struct BlockHash
+	{
+		unsigned long	m_lCrc;
+		unsigned char	m_Md5[16];
+	};
+
+	typedef std::vector<BlockHash>	BlockHashes;
+
+private:
+	long long			m_lBlockSize;
+	long long			m_lFileSize;
+	time_t				m_tModified;
+	unsigned char		m_HashFull[16];
+	unsigned char		m_Hash16k[16];
+	BlockHashes			m_BlockHashes;
+
+public:
+						ParHashes();
+	long long			GetBlockSize() { return m_lBlockSize; }
+	void				SetBlockSize(long long lBlockSize) { m_lBlockSize = lBlockSize; }
+	long long			GetFileSize() { return m_lFileSize; }
+	void				SetFileSize(long long lFileSize) { m_lFileSize = lFileSize; }
+	time_t				GetModified() { return m_tModified; }
+	void				SetModified(time_t tModified) { m_tModified = tModified; }
+	unsigned char*		GetHashFull() { return m_HashFull; }
+	unsigned char*		GetHash16k() { return m_Hash16k; }
+	BlockHashes*		GetBlockHashes() { return &m_BlockHashes; }
+};
+
 class NZBParameter
 {
 private:
@@ -371,6 +419,14 @@ public:
 		usPassword
 	};
 
+	enum EDirectUnpackStatus
+	{
+		duNone,
+		duRunning,
+		duFailure,
+		duSuccess
+	};
+
 	enum ECleanupStatus
 	{
 		csNone,
@@ -501,6 +557,10 @@ private:
 	bool				m_bReprocess;
 	time_t				m_tQueueScriptTime;
 	bool				m_bParFull;
+	long long			m_lParBlockSize;
+	int					m_iParMissingBlocks;
+	EDirectUnpackStatus	m_eDirectUnpackStatus;
+	Thread*				m_pUnpackThread;
 	int					m_iMessageCount;
 	int					m_iCachedMessageCount;
 
@@ -660,6 +720,14 @@ public:
 	void 				SetQueueScriptTime(time_t tQueueScriptTime) { m_tQueueScriptTime = tQueueScriptTime; }
 	void				SetParFull(bool bParFull) { m_bParFull = bParFull; }
 	bool				GetParFull() { return m_bParFull; }
+	long long			GetParBlockSize() { return m_lParBlockSize; }
+	void				SetParBlockSize(long long lParBlockSize) { m_lParBlockSize = lParBlockSize; }
+	int					GetParMissingBlocks() { return m_iParMissingBlocks; }
+	void				SetParMissingBlocks(int iParMissingBlocks) { m_iParMissingBlocks = iParMissingBlocks; }
+	EDirectUnpackStatus	GetDirectUnpackStatus() { return m_eDirectUnpackStatus; }
+	void				SetDirectUnpackStatus(EDirectUnpackStatus eDirectUnpackStatus) { m_eDirectUnpackStatus = eDirectUnpackStatus; }
+	Thread*				GetUnpackThread() { return m_pUnpackThread; }
+	void				SetUnpackThread(Thread* pUnpackThread) { m_pUnpackThread = pUnpackThread; }
 
 	void				CopyFileList(NZBInfo* pSrcNZBInfo);
 	void				UpdateMinMaxTime();
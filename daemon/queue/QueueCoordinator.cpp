@@ -106,6 +106,12 @@ QueueCoordinator::~QueueCoordinator()
 	}
 	m_ActiveDownloads.clear();
 
+	for (CompletionQueue::iterator it = m_CompletionQueue.begin(); it != m_CompletionQueue.end(); it++)
+	{
+		delete *it;
+	}
+	m_CompletionQueue.clear();
+
 	CoordinatorDownloadQueue::Final();
 
 	debug("QueueCoordinator destroyed");
@@ -215,8 +221,10 @@ void QueueCoordinator::Run()
 			bool bHasMoreArticles = GetNextArticle(pDownloadQueue, pFileInfo, pArticleInfo);
 			bArticeDownloadsRunning = !m_ActiveDownloads.empty();
 			bDownloadsChecked = true;
-			m_bHasMoreJobs = bHasMoreArticles || bArticeDownloadsRunning;
+			m_bHasMoreJobs = bHasMoreArticles || bArticeDownloadsRunning ||
+				!m_CompletionQueue.empty() || !m_ActiveCompletions.empty();
 			if (bHasMoreArticles && !IsStopped() && (int)m_ActiveDownloads.size() < m_iDownloadsLimit &&
+				!CompletionQueueFull() &&
 				(!g_pOptions->GetTempPauseDownload() || pFileInfo->GetExtraPriority()))
 			{
 				StartArticleDownload(pFileInfo, pArticleInfo, pConnection);
@@ -280,13 +288,14 @@ void QueueCoordinator::Run()
 		}
 	}
 
-	// waiting for downloads
+	// waiting for downloads and file completions
 	debug("QueueCoordinator: waiting for Downloads to complete");
 	bool completed = false;
 	while (!completed)
 	{
 		DownloadQueue::Lock();
-		completed = m_ActiveDownloads.size() == 0;
+		completed = m_ActiveDownloads.size() == 0 &&
+			m_CompletionQueue.size() == 0 && m_ActiveCompletions.size() == 0;
 		DownloadQueue::Unlock();
 		usleep(100 * 1000);
 		ResetHangingDownloads();
@@ -308,8 +317,8 @@ void QueueCoordinator::AdjustDownloadsLimit()
 		return;
 	}
 
-	// two extra threads for completing files (when connections are not needed)
-	int iDownloadsLimit = 2;
+	// files are completed in separate threads (see FileCompleter), no extra download threads needed
+	int iDownloadsLimit = 0;
 
 	// allow one thread per 0-level (main) and 1-level (backup) server connection
 	for (Servers::iterator it = g_pServerPool->GetServers()->begin(); it != g_pServerPool->GetServers()->end(); it++)
@@ -626,6 +635,8 @@ void QueueCoordinator::ArticleCompleted(ArticleDownloader* pArticleDownloader)
 	ArticleInfo* pArticleInfo = pArticleDownloader->GetArticleInfo();
 	bool bRetry = false;
 	bool fileCompleted = false;
+	FileCompleter* pFileCompleter = NULL;
+	char szDestDir[1024];
 
 	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
 
@@ -692,11 +703,12 @@ void QueueCoordinator::ArticleCompleted(ArticleDownloader* pArticleDownloader)
 
 	if (fileCompleted && !pFileInfo->GetDeleted())
 	{
-		// all jobs done
-		DownloadQueue::Unlock();
-		pArticleDownloader->CompleteFileParts();
-		pDownloadQueue = DownloadQueue::Lock();
-		deleteFileObj = true;
+		// all jobs done, the file is joined by a completion thread,
+		// the download thread and its connection are not blocked
+		pFileCompleter = QueueFileCompletion(pFileInfo, pArticleDownloader->GetFormat());
+		strncpy(szDestDir, pNZBInfo->GetDestDir(), 1024);
+		szDestDir[1024-1] = '\0';
+		fileCompleted = false;
 	}
 
 	CheckHealth(pDownloadQueue, pFileInfo);
@@ -726,6 +738,169 @@ void QueueCoordinator::ArticleCompleted(ArticleDownloader* pArticleDownloader)
 	}
 
 	DownloadQueue::Unlock();
+
+	if (pFileCompleter)
+	{
+		ResolveCompletionDevice(pFileCompleter, szDestDir);
+	}
+}
+
+QueueCoordinator::FileCompleter::FileCompleter(QueueCoordinator* pOwner, FileInfo* pFileInfo,
+	Decoder::EFormat eFormat)
+{
+	m_pOwner = pOwner;
+	m_pFileInfo = pFileInfo;
+	m_eFormat = eFormat;
+	m_iDeviceId = 0;
+	m_bDeviceResolved = false;
+}
+
+void QueueCoordinator::FileCompleter::Run()
+{
+	ArticleWriter articleWriter;
+	articleWriter.SetFileInfo(m_pFileInfo);
+	articleWriter.SetFormat(m_eFormat);
+	articleWriter.CompleteFileParts();
+
+	m_pOwner->FileCompleted(this);
+}
+
+/*
+ * Puts the downloaded file into completion queue.
+ * The file is counted as active download until it is completed,
+ * this prevents it from being deleted or flushed by article cache.
+ * The completion is not started until its disk is known (see ResolveCompletionDevice).
+ * Must be called with locked download queue.
+ */
+QueueCoordinator::FileCompleter* QueueCoordinator::QueueFileCompletion(FileInfo* pFileInfo, Decoder::EFormat eFormat)
+{
+	debug("Queueing completion of %s", pFileInfo->GetFilename());
+
+	FileCompleter* pFileCompleter = new FileCompleter(this, pFileInfo, eFormat);
+	pFileCompleter->SetAutoDestroy(true);
+
+	pFileInfo->SetActiveDownloads(pFileInfo->GetActiveDownloads() + 1);
+	pFileInfo->GetNZBInfo()->SetActiveDownloads(pFileInfo->GetNZBInfo()->GetActiveDownloads() + 1);
+
+	m_CompletionQueue.push_back(pFileCompleter);
+
+	return pFileCompleter;
+}
+
+/*
+ * Determines the disk of destination directory and starts the completion.
+ * Must be called without lock of download queue: the stat may block
+ * for a long time on a stalled disk or network share.
+ */
+void QueueCoordinator::ResolveCompletionDevice(FileCompleter* pFileCompleter, const char* szDestDir)
+{
+	long long iDeviceId = Util::DeviceId(szDestDir);
+
+	DownloadQueue::Lock();
+	pFileCompleter->SetDeviceId(iDeviceId);
+	StartFileCompletions();
+	DownloadQueue::Unlock();
+}
+
+/*
+ * Starts completion threads for waiting files respecting the limit
+ * of simultaneous completions per disk (option CompleteThreads).
+ * Must be called with locked download queue.
+ */
+void QueueCoordinator::StartFileCompletions()
+{
+	int iMaxThreads = g_pOptions->GetCompleteThreads() > 0 ? g_pOptions->GetCompleteThreads() : 1;
+
+	for (CompletionQueue::iterator it = m_CompletionQueue.begin(); it != m_CompletionQueue.end(); )
+	{
+		FileCompleter* pFileCompleter = *it;
+
+		if (!pFileCompleter->GetDeviceResolved())
+		{
+			it++;
+			continue;
+		}
+
+		int iRunning = 0;
+		for (ActiveCompletions::iterator it2 = m_ActiveCompletions.begin(); it2 != m_ActiveCompletions.end(); it2++)
+		{
+			FileCompleter* pActiveCompleter = *it2;
+			if (pActiveCompleter->GetDeviceId() == pFileCompleter->GetDeviceId())
+			{
+				iRunning++;
+			}
+		}
+
+		if (iRunning < iMaxThreads)
+		{
+			it = m_CompletionQueue.erase(it);
+			m_ActiveCompletions.push_back(pFileCompleter);
+			pFileCompleter->Start();
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void QueueCoordinator::FileCompleted(FileCompleter* pFileCompleter)
+{
+	debug("File completed");
+
+	FileInfo* pFileInfo = pFileCompleter->GetFileInfo();
+	NZBInfo* pNZBInfo = pFileInfo->GetNZBInfo();
+
+	DownloadQueue* pDownloadQueue = DownloadQueue::Lock();
+
+	CheckHealth(pDownloadQueue, pFileInfo);
+
+	m_ActiveCompletions.erase(std::find(m_ActiveCompletions.begin(), m_ActiveCompletions.end(), pFileCompleter));
+
+	pFileInfo->SetActiveDownloads(pFileInfo->GetActiveDownloads() - 1);
+	pNZBInfo->SetActiveDownloads(pNZBInfo->GetActiveDownloads() - 1);
+
+	// the file could have been deleted while it was being completed
+	DeleteFileInfo(pDownloadQueue, pFileInfo, !pFileInfo->GetDeleted());
+	pDownloadQueue->Save();
+
+	StartFileCompletions();
+
+	DownloadQueue::Unlock();
+}
+
+/*
+ * Back-pressure for download threads: if the disks cannot keep up with
+ * the completion of downloaded files no new articles are downloaded
+ * until the completion queue shrinks. The allowed number of waiting
+ * files grows with the number of completion threads (option CompleteThreads).
+ */
+bool QueueCoordinator::CompletionQueueFull()
+{
+	static const int WAITING_COMPLETIONS_PER_THREAD = 5;
+	int iMaxThreads = g_pOptions->GetCompleteThreads() > 0 ? g_pOptions->GetCompleteThreads() : 1;
+	return (int)m_CompletionQueue.size() >= iMaxThreads * WAITING_COMPLETIONS_PER_THREAD;
+}
+
+bool QueueCoordinator::IsFileCompleting(FileInfo* pFileInfo)
+{
+	for (CompletionQueue::iterator it = m_CompletionQueue.begin(); it != m_CompletionQueue.end(); it++)
+	{
+		if ((*it)->GetFileInfo() == pFileInfo)
+		{
+			return true;
+		}
+	}
+
+	for (ActiveCompletions::iterator it = m_ActiveCompletions.begin(); it != m_ActiveCompletions.end(); it++)
+	{
+		if ((*it)->GetFileInfo() == pFileInfo)
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void QueueCoordinator::StatFileInfo(FileInfo* pFileInfo, bool bCompleted)
@@ -911,6 +1086,7 @@ void QueueCoordinator::LogDebugInfo()
 
 	info("   ---------- QueueCoordinator");
 	info("    Active Downloads: %i, Limit: %i", m_ActiveDownloads.size(), m_iDownloadsLimit);
+	info("    File Completions: %i active, %i waiting", m_ActiveCompletions.size(), m_CompletionQueue.size());
 	for (ActiveDownloads::iterator it = m_ActiveDownloads.begin(); it != m_ActiveDownloads.end(); it++)
 	{
 		ArticleDownloader* pArticleDownloader = *it;
@@ -992,6 +1168,9 @@ bool QueueCoordinator::DeleteQueueEntry(DownloadQueue* pDownloadQueue, FileInfo*
 		}
 	}
 
+	// the file will be deleted after its completion
+	bDownloading |= IsFileCompleting(pFileInfo);
+
 	if (!bDownloading)
 	{
 		DeleteFileInfo(pDownloadQueue, pFileInfo, false);
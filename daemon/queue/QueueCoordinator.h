@@ -56,9 +56,33 @@ private:
 		virtual void		Save();
 	};
 
+private:
+	class FileCompleter : public Thread
+	{
+	private:
+		QueueCoordinator*	m_pOwner;
+		FileInfo*			m_pFileInfo;
+		Decoder::EFormat	m_eFormat;
+		long long			m_iDeviceId;
+		bool				m_bDeviceResolved;
+	public:
+							FileCompleter(QueueCoordinator* pOwner, FileInfo* pFileInfo,
+								Decoder::EFormat eFormat);
+		virtual void		Run();
+		FileInfo*			GetFileInfo() { return m_pFileInfo; }
+		long long			GetDeviceId() { return m_iDeviceId; }
+		void				SetDeviceId(long long iDeviceId) { m_iDeviceId = iDeviceId; m_bDeviceResolved = true; }
+		bool				GetDeviceResolved() { return m_bDeviceResolved; }
+	};
+
+	typedef std::deque<FileCompleter*>		CompletionQueue;
+	typedef std::list<FileCompleter*>		ActiveCompletions;
+
 private:
 	CoordinatorDownloadQueue	m_DownloadQueue;
 	ActiveDownloads				m_ActiveDownloads;
+	CompletionQueue				m_CompletionQueue;
+	ActiveCompletions			m_ActiveCompletions;
 	QueueEditor					m_QueueEditor;
 	bool						m_bHasMoreJobs;
 	int							m_iDownloadsLimit;
@@ -67,6 +91,12 @@ private:
 	bool					GetNextArticle(DownloadQueue* pDownloadQueue, FileInfo* &pFileInfo, ArticleInfo* &pArticleInfo);
 	void					StartArticleDownload(FileInfo* pFileInfo, ArticleInfo* pArticleInfo, NNTPConnection* pConnection);
 	void					ArticleCompleted(ArticleDownloader* pArticleDownloader);
+	FileCompleter*			QueueFileCompletion(FileInfo* pFileInfo, Decoder::EFormat eFormat);
+	void					ResolveCompletionDevice(FileCompleter* pFileCompleter, const char* szDestDir);
+	void					StartFileCompletions();
+	void					FileCompleted(FileCompleter* pFileCompleter);
+	bool					CompletionQueueFull();
+	bool					IsFileCompleting(FileInfo* pFileInfo);
 	void					DeleteFileInfo(DownloadQueue* pDownloadQueue, FileInfo* pFileInfo, bool bCompleted);
 	void					StatFileInfo(FileInfo* pFileInfo, bool bCompleted);
 	void					CheckHealth(DownloadQueue* pDownloadQueue, FileInfo* pFileInfo);
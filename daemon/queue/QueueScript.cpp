@@ -52,6 +52,9 @@ extern QueueScriptCoordinator* g_pQueueScriptCoordinator;
 
 static const char* QUEUE_EVENT_NAMES[] = { "FILE_DOWNLOADED", "NZB_ADDED", "NZB_DOWNLOADED" };
 
+// Maximum time a persistent queue-script may spend processing one event (seconds)
+#define PERSISTENT_EVENT_TIMEOUT 600
+
 class QueueScriptController : public Thread, public NZBScriptController
 {
 private:
@@ -69,6 +72,9 @@ private:
 	bool				m_bMarkBad;
 
 	void				PrepareParams(const char* szScriptName);
+	void				SendEvent(Options::Script* pScript);
+
+	friend class QueueScriptWorker;
 
 protected:
 	virtual void		ExecuteScript(Options::Script* pScript);
@@ -80,6 +86,43 @@ public:
 	static void			StartScript(NZBInfo* pNZBInfo, Options::Script* pScript, QueueScriptCoordinator::EEvent eEvent);
 };
 
+/*
+ * Runs a persistent queue-script (header line "### QUEUE MODE: PERSISTENT").
+ * The script is started once and receives events via stdin. Each event is
+ * a record: a line with the length of record data in bytes followed by the
+ * data - variables "NAME=VALUE", each terminated with null-character.
+ * The script prints "[NZB] DONE" when it has processed the event.
+ * The worker thread starts the script on the first event and restarts it
+ * on the next event after the script has terminated.
+ */
+class QueueScriptWorker : public Thread, public NZBScriptController
+{
+private:
+	Options::Script*	m_pScript;
+	QueueScriptController*	m_pController;
+	bool				m_bEventDone;
+	bool				m_bStarted;
+	int					m_iRuns;
+	Mutex				m_mutexController;
+	Semaphore			m_semStart;
+	Semaphore			m_semSignal;
+	int					m_iPrefixLen;
+
+	bool				WaitSignal(int iRuns, bool bEvent, int iTimeoutSec);
+
+protected:
+	virtual void		ExecuteScript(Options::Script* pScript);
+	virtual void		AddMessage(Message::EKind eKind, const char* szText);
+	virtual void		ProcessStarted();
+
+public:
+						QueueScriptWorker(Options::Script* pScript);
+	virtual void		Run();
+	virtual void		Stop();
+	Options::Script*	GetScript() { return m_pScript; }
+	bool				ProcessEvent(QueueScriptController* pController, const char* szRecord, int iLen);
+};
+
 
 /**
  * If szStripPrefix is not NULL, only pp-parameters, whose names start with the prefix
@@ -225,17 +268,51 @@ void QueueScriptController::ExecuteScript(Options::Script* pScript)
 
 	SetLogPrefix(pScript->GetDisplayName());
 	m_iPrefixLen = strlen(pScript->GetDisplayName()) + 2; // 2 = strlen(": ");
-	PrepareParams(pScript->GetName());
 
-	Execute();
+	if (pScript->GetQueuePersistent())
+	{
+		SendEvent(pScript);
+	}
+	else
+	{
+		ResetEnv();
+		PrepareParams(pScript->GetName());
+		Execute();
+	}
 
 	SetLogPrefix(NULL);
 }
 
-void QueueScriptController::PrepareParams(const char* szScriptName)
+void QueueScriptController::SendEvent(Options::Script* pScript)
 {
-	ResetEnv();
+	// the record contains only the event variables, the options were passed on start of the script
+	GetEnvironmentStrings()->Clear();
+	PrepareParams(pScript->GetName());
+
+	int iDataLen;
+	char* szData = GetEnvironmentStrings()->GetBlock(&iDataLen);
 
+	char szHeader[20];
+	snprintf(szHeader, 20, "%i\n", iDataLen);
+	szHeader[20-1] = '\0';
+	int iHeaderLen = strlen(szHeader);
+
+	char* szRecord = (char*)malloc(iHeaderLen + iDataLen);
+	memcpy(szRecord, szHeader, iHeaderLen);
+	memcpy(szRecord + iHeaderLen, szData, iDataLen);
+	free(szData);
+
+	QueueScriptWorker* pWorker = g_pQueueScriptCoordinator->GetWorker(pScript);
+	if (!pWorker->ProcessEvent(this, szRecord, iHeaderLen + iDataLen))
+	{
+		PrintMessage(Message::mkError, "Could not process %s event for %s", QUEUE_EVENT_NAMES[m_eEvent], m_szNZBName);
+	}
+
+	free(szRecord);
+}
+
+void QueueScriptController::PrepareParams(const char* szScriptName)
+{
 	SetEnvVar("NZBNA_NZBNAME", m_szNZBName);
 	SetIntEnvVar("NZBNA_NZBID", m_iID);
 	SetEnvVar("NZBNA_FILENAME", m_szNZBFilename);
@@ -303,6 +380,191 @@ void QueueScriptController::AddMessage(Message::EKind eKind, const char* szText)
 }
 
 
+QueueScriptWorker::QueueScriptWorker(Options::Script* pScript)
+{
+	m_pScript = pScript;
+	m_pController = NULL;
+	m_bEventDone = false;
+	m_bStarted = false;
+	m_iRuns = 0;
+	m_iPrefixLen = 0;
+}
+
+void QueueScriptWorker::Run()
+{
+	while (true)
+	{
+		// wait for the first or next event
+		m_semStart.Wait();
+		if (IsStopped())
+		{
+			break;
+		}
+
+		ExecuteScript(m_pScript);
+		// forget the finished process
+		ScriptController::Resume();
+
+		m_mutexController.Lock();
+		m_bStarted = false;
+		m_iRuns++;
+		m_mutexController.Unlock();
+		m_semSignal.Post();
+	}
+}
+
+void QueueScriptWorker::Stop()
+{
+	Thread::Stop();
+	m_semStart.Post();
+	m_semSignal.Post();
+}
+
+void QueueScriptWorker::ProcessStarted()
+{
+	m_mutexController.Lock();
+	m_bStarted = true;
+	m_mutexController.Unlock();
+	m_semSignal.Post();
+}
+
+void QueueScriptWorker::ExecuteScript(Options::Script* pScript)
+{
+	PrintMessage(Message::mkInfo, "Starting persistent queue-script %s", pScript->GetName());
+
+	SetScript(pScript->GetLocation());
+	SetArgs(NULL, false);
+
+	char szInfoName[1024];
+	snprintf(szInfoName, 1024, "queue-script %s", pScript->GetName());
+	szInfoName[1024-1] = '\0';
+	SetInfoName(szInfoName);
+
+	SetLogPrefix(pScript->GetDisplayName());
+	m_iPrefixLen = strlen(pScript->GetDisplayName()) + 2; // 2 = strlen(": ");
+	SetNeedWrite(true);
+	ResetEnv();
+	PrepareEnvScript(NULL, pScript->GetName());
+
+	Execute();
+
+	SetLogPrefix(NULL);
+
+	if (!GetTerminated())
+	{
+		PrintMessage(Message::mkWarning, "Persistent queue-script %s has terminated, it will be restarted on next event", pScript->GetName());
+	}
+}
+
+void QueueScriptWorker::AddMessage(Message::EKind eKind, const char* szText)
+{
+	const char* szMsgText = szText + m_iPrefixLen;
+
+	m_mutexController.Lock();
+	if (!strcmp(szMsgText, "[NZB] DONE"))
+	{
+		m_bEventDone = true;
+		m_semSignal.Post();
+	}
+	else if (m_pController)
+	{
+		// messages and commands printed during processing of an event belong to that event
+		m_pController->AddMessage(eKind, szText);
+	}
+	else
+	{
+		ScriptController::AddMessage(eKind, szText);
+	}
+	m_mutexController.Unlock();
+}
+
+/*
+ * Waits until the script has started (bEvent == false) or has processed the current
+ * event (bEvent == true). Returns false if the script has terminated (the run of the
+ * script is identified by the number of finished runs before it) or if the worker is
+ * stopped. Returns false also if the timeout has elapsed, unless the timeout is 0.
+ */
+bool QueueScriptWorker::WaitSignal(int iRuns, bool bEvent, int iTimeoutSec)
+{
+	time_t tStart = time(NULL);
+	while (true)
+	{
+		m_mutexController.Lock();
+		bool bOK = bEvent ? m_bEventDone : m_bStarted;
+		bool bFinished = m_iRuns > iRuns || IsStopped();
+		m_mutexController.Unlock();
+
+		if (bOK || bFinished)
+		{
+			return bOK;
+		}
+
+		if (iTimeoutSec == 0)
+		{
+			m_semSignal.Wait();
+		}
+		else
+		{
+			int iWaitSec = iTimeoutSec - (int)(time(NULL) - tStart);
+			if (iWaitSec <= 0 || !m_semSignal.Wait(iWaitSec * 1000))
+			{
+				return false;
+			}
+		}
+	}
+}
+
+/*
+ * Sends the event record to the script and waits until the script has processed it.
+ * Returns false if the script could not be started or has terminated before. A script
+ * which doesn't process the event in time is terminated.
+ */
+bool QueueScriptWorker::ProcessEvent(QueueScriptController* pController, const char* szRecord, int iLen)
+{
+	m_mutexController.Lock();
+	bool bStarted = m_bStarted;
+	int iRuns = m_iRuns;
+	m_mutexController.Unlock();
+
+	if (!bStarted)
+	{
+		m_semStart.Post();
+		if (!WaitSignal(iRuns, false, 0))
+		{
+			return false;
+		}
+	}
+
+	m_mutexController.Lock();
+	m_pController = pController;
+	m_bEventDone = false;
+	m_mutexController.Unlock();
+
+	if (Write(szRecord, iLen) && !WaitSignal(iRuns, true, PERSISTENT_EVENT_TIMEOUT))
+	{
+		m_mutexController.Lock();
+		bool bFinished = m_iRuns > iRuns;
+		m_mutexController.Unlock();
+
+		if (!bFinished)
+		{
+			PrintMessage(Message::mkError, "Persistent queue-script %s has not processed the event within %i seconds, terminating",
+				m_pScript->GetName(), PERSISTENT_EVENT_TIMEOUT);
+			Terminate();
+			// the script is restarted on the next event
+			WaitSignal(iRuns, false, 0);
+		}
+	}
+
+	m_mutexController.Lock();
+	bool bDone = m_bEventDone;
+	m_pController = NULL;
+	m_mutexController.Unlock();
+
+	return bDone;
+}
+
+
 QueueScriptCoordinator::QueueItem::QueueItem(int iNZBID, Options::Script* pScript, EEvent eEvent)
 {
 	m_iNZBID = iNZBID;
@@ -322,6 +584,18 @@ QueueScriptCoordinator::~QueueScriptCoordinator()
 	{
 		delete *it;
 	}
+
+	// persistent scripts were terminated together with all other scripts on shutdown
+	for (Workers::iterator it = m_Workers.begin(); it != m_Workers.end(); it++)
+	{
+		QueueScriptWorker* pWorker = *it;
+		pWorker->Stop();
+		while (pWorker->IsRunning())
+		{
+			usleep(10 * 1000);
+		}
+		delete pWorker;
+	}
 }
 
 void QueueScriptCoordinator::InitOptions()
@@ -517,6 +791,37 @@ void QueueScriptCoordinator::StartScript(NZBInfo* pNZBInfo, QueueItem* pQueueIte
 	QueueScriptController::StartScript(pNZBInfo, pQueueItem->GetScript(), pQueueItem->GetEvent());
 }
 
+/*
+ * Returns the worker of a persistent queue-script; starts the script
+ * if it isn't running yet or has terminated.
+ */
+QueueScriptWorker* QueueScriptCoordinator::GetWorker(Options::Script* pScript)
+{
+	m_mutexWorkers.Lock();
+
+	QueueScriptWorker* pWorker = NULL;
+	for (Workers::iterator it = m_Workers.begin(); it != m_Workers.end(); it++)
+	{
+		if ((*it)->GetScript() == pScript)
+		{
+			pWorker = *it;
+			break;
+		}
+	}
+
+	if (!pWorker)
+	{
+		pWorker = new QueueScriptWorker(pScript);
+		pWorker->SetAutoDestroy(false);
+		m_Workers.push_back(pWorker);
+		pWorker->Start();
+	}
+
+	m_mutexWorkers.Unlock();
+
+	return pWorker;
+}
+
 bool QueueScriptCoordinator::HasJob(int iNZBID)
 {
 	m_mutexQueue.Lock();
@@ -27,6 +27,7 @@
 #define QUEUESCRIPT_H
 
 #include <list>
+#include <vector>
 
 #include "Script.h"
 #include "Thread.h"
@@ -42,6 +43,8 @@ protected:
 	virtual void		ExecuteScript(Options::Script* pScript) = 0;
 };
 
+class QueueScriptWorker;
+
 class QueueScriptCoordinator
 {
 public:
@@ -67,11 +70,14 @@ private:
 	};
 
 	typedef std::list<QueueItem*> Queue;
+	typedef std::vector<QueueScriptWorker*> Workers;
 	
 	Queue				m_Queue;
 	Mutex				m_mutexQueue;
 	QueueItem*			m_pCurItem;
 	bool				m_bHasQueueScripts;
+	Workers				m_Workers;
+	Mutex				m_mutexWorkers;
 
 	void				StartScript(NZBInfo* pNZBInfo, QueueItem* pQueueItem);
 
@@ -82,6 +88,7 @@ public:
 	void				EnqueueScript(NZBInfo* pNZBInfo, EEvent eEvent);
 	void				CheckQueue();
 	bool				HasJob(int iNZBID);
+	QueueScriptWorker*	GetWorker(Options::Script* pScript);
 };
 
 #endif
@@ -1665,6 +1665,7 @@ void NzbInfoXmlCommand::AppendNZBInfoFields(NZBInfo* pNZBInfo)
 		"<member><name>FailedArticles</name><value><i4>%i</i4></value></member>\n"
 		"<member><name>Health</name><value><i4>%i</i4></value></member>\n"
 		"<member><name>CriticalHealth</name><value><i4>%i</i4></value></member>\n"
+		"<member><name>ParMissingBlocks</name><value><i4>%i</i4></value></member>\n"
 		"<member><name>DupeKey</name><value><string>%s</string></value></member>\n"
 		"<member><name>DupeScore</name><value><i4>%i</i4></value></member>\n"
 		"<member><name>DupeMode</name><value><string>%s</string></value></member>\n"
@@ -1719,6 +1720,7 @@ void NzbInfoXmlCommand::AppendNZBInfoFields(NZBInfo* pNZBInfo)
 		"\"FailedArticles\" : %i,\n"
 		"\"Health\" : %i,\n"
 		"\"CriticalHealth\" : %i,\n"
+		"\"ParMissingBlocks\" : %i,\n"
 		"\"DupeKey\" : \"%s\",\n"
 		"\"DupeScore\" : %i,\n"
 		"\"DupeMode\" : \"%s\",\n"
@@ -1825,7 +1827,7 @@ void NzbInfoXmlCommand::AppendNZBInfoFields(NZBInfo* pNZBInfo)
 			 iFileSizeLo, iFileSizeHi, iFileSizeMB, pNZBInfo->GetFileCount(),
 			 pNZBInfo->GetMinTime(), pNZBInfo->GetMaxTime(),
 			 pNZBInfo->GetTotalArticles(), pNZBInfo->GetCurrentSuccessArticles(), pNZBInfo->GetCurrentFailedArticles(),
-			 pNZBInfo->CalcHealth(), pNZBInfo->CalcCriticalHealth(false),
+			 pNZBInfo->CalcHealth(), pNZBInfo->CalcCriticalHealth(false), pNZBInfo->GetParMissingBlocks(),
 			 xmlDupeKey, pNZBInfo->GetDupeScore(), szDupeModeName[pNZBInfo->GetDupeMode()],
 			 BoolToStr(pNZBInfo->GetDeleteStatus() != NZBInfo::dsNone),
 			 iDownloadedSizeLo, iDownloadedSizeHi, iDownloadedSizeMB, pNZBInfo->GetDownloadSec(), 
@@ -62,8 +62,21 @@ extern char* (*g_szEnvironmentVariables)[];
 
 ScriptController::RunningScripts ScriptController::m_RunningScripts;
 Mutex ScriptController::m_mutexRunning;
+ScriptController::EnvOptionsCache ScriptController::m_EnvOptionsCache;
+Mutex ScriptController::m_mutexEnvOptions;
 
-#ifndef WIN32
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+/**
+ * Forking of a process with large memory (article cache) takes long because
+ * the page tables must be copied. posix_spawn creates the child process without
+ * copying of memory. The working directory of the spawned process can be set
+ * since glibc 2.29.
+ */
+#define USE_POSIX_SPAWN 1
+#include <spawn.h>
+#endif
+
+#if !defined(WIN32) && !defined(USE_POSIX_SPAWN)
 #define CHILD_WATCHDOG 1
 #endif
 
@@ -148,6 +161,74 @@ void EnvironmentStrings::Append(char* szString)
 	m_strings.push_back(szString);
 }
 
+void EnvironmentStrings::Append(EnvironmentStrings* pStrings)
+{
+	for (Strings::iterator it = pStrings->m_strings.begin(); it != pStrings->m_strings.end(); it++)
+	{
+		Append(strdup(*it));
+	}
+}
+
+void EnvironmentStrings::AppendVar(const char* szName, const char* szValue)
+{
+	int iLen = strlen(szName) + strlen(szValue) + 2;
+	char* szVar = (char*)malloc(iLen);
+	snprintf(szVar, iLen, "%s=%s", szName, szValue);
+	Append(szVar);
+}
+
+void EnvironmentStrings::AppendSpecialVar(const char* szPrefix, const char* szName, const char* szValue)
+{
+	char szVarname[1024];
+	snprintf(szVarname, sizeof(szVarname), "%s_%s", szPrefix, szName);
+	szVarname[1024-1] = '\0';
+	
+	// Original name
+	AppendVar(szVarname, szValue);
+	
+	char szNormVarname[1024];
+	strncpy(szNormVarname, szVarname, sizeof(szVarname));
+	szNormVarname[1024-1] = '\0';
+	
+	// Replace special characters  with "_" and convert to upper case
+	for (char* szPtr = szNormVarname; *szPtr; szPtr++)
+	{
+		if (strchr(".:*!\"$%&/()=`+~#'{}[]@- ", *szPtr)) *szPtr = '_';
+		*szPtr = toupper(*szPtr);
+	}
+	
+	// Another env var with normalized name (replaced special chars and converted to upper case)
+	if (strcmp(szVarname, szNormVarname))
+	{
+		AppendVar(szNormVarname, szValue);
+	}
+}
+
+/*
+ * Returns all strings as one block, each string is terminated with null-character.
+ * The allocated memory must be freed by caller using "free()".
+ */
+char* EnvironmentStrings::GetBlock(int* pLen)
+{
+	int iSize = 0;
+	for (Strings::iterator it = m_strings.begin(); it != m_strings.end(); it++)
+	{
+		iSize += strlen(*it) + 1;
+	}
+
+	char* szBlock = (char*)malloc(iSize + 1);
+	char* szPtr = szBlock;
+	for (Strings::iterator it = m_strings.begin(); it != m_strings.end(); it++)
+	{
+		char* szVar = *it;
+		strcpy(szPtr, szVar);
+		szPtr += strlen(szVar) + 1;
+	}
+
+	*pLen = iSize;
+	return szBlock;
+}
+
 #ifdef WIN32
 /*
  * Returns environment block in format suitable for using with CreateProcess. 
@@ -209,6 +290,8 @@ ScriptController::ScriptController()
 	m_bTerminated = false;
 	m_bDetached = false;
 	m_hProcess = 0;
+	m_bNeedWrite = false;
+	m_pWritepipe = NULL;
 	ResetEnv();
 
 	m_mutexRunning.Lock();
@@ -249,10 +332,7 @@ void ScriptController::ResetEnv()
 
 void ScriptController::SetEnvVar(const char* szName, const char* szValue)
 {
-	int iLen = strlen(szName) + strlen(szValue) + 2;
-	char* szVar = (char*)malloc(iLen);
-	snprintf(szVar, iLen, "%s=%s", szName, szValue);
-	m_environmentStrings.Append(szVar);
+	m_environmentStrings.AppendVar(szName, szValue);
 }
 
 void ScriptController::SetIntEnvVar(const char* szName, int iValue)
@@ -267,55 +347,74 @@ void ScriptController::SetIntEnvVar(const char* szName, int iValue)
  * If szStripPrefix is not NULL, only options, whose names start with the prefix
  * are processed. The prefix is then stripped from the names.
  * If szStripPrefix is NULL, all options are processed; without stripping.
+ * The env vars are built once per prefix and then taken from the cache.
  */
 void ScriptController::PrepareEnvOptions(const char* szStripPrefix)
 {
-	int iPrefixLen = szStripPrefix ? strlen(szStripPrefix) : 0;
+	m_mutexEnvOptions.Lock();
 
-	Options::OptEntries* pOptEntries = g_pOptions->LockOptEntries();
-
-	for (Options::OptEntries::iterator it = pOptEntries->begin(); it != pOptEntries->end(); it++)
+	EnvOptions* pEnvOptions = NULL;
+	for (EnvOptionsCache::iterator it = m_EnvOptionsCache.begin(); it != m_EnvOptionsCache.end(); it++)
 	{
-		Options::OptEntry* pOptEntry = *it;
-		
-		if (szStripPrefix && !strncmp(pOptEntry->GetName(), szStripPrefix, iPrefixLen) && (int)strlen(pOptEntry->GetName()) > iPrefixLen)
+		EnvOptions* pCached = *it;
+		if (szStripPrefix ? pCached->m_szPrefix && !strcmp(pCached->m_szPrefix, szStripPrefix) : !pCached->m_szPrefix)
 		{
-			SetEnvVarSpecial("NZBPO", pOptEntry->GetName() + iPrefixLen, pOptEntry->GetValue());
+			pEnvOptions = pCached;
+			break;
 		}
-		else if (!szStripPrefix)
+	}
+
+	if (!pEnvOptions)
+	{
+		pEnvOptions = new EnvOptions();
+		pEnvOptions->m_szPrefix = szStripPrefix ? strdup(szStripPrefix) : NULL;
+		m_EnvOptionsCache.push_back(pEnvOptions);
+
+		int iPrefixLen = szStripPrefix ? strlen(szStripPrefix) : 0;
+
+		Options::OptEntries* pOptEntries = g_pOptions->LockOptEntries();
+
+		for (Options::OptEntries::iterator it = pOptEntries->begin(); it != pOptEntries->end(); it++)
 		{
-			SetEnvVarSpecial("NZBOP", pOptEntry->GetName(), pOptEntry->GetValue());
+			Options::OptEntry* pOptEntry = *it;
+			
+			if (szStripPrefix && !strncmp(pOptEntry->GetName(), szStripPrefix, iPrefixLen) && (int)strlen(pOptEntry->GetName()) > iPrefixLen)
+			{
+				pEnvOptions->m_strings.AppendSpecialVar("NZBPO", pOptEntry->GetName() + iPrefixLen, pOptEntry->GetValue());
+			}
+			else if (!szStripPrefix)
+			{
+				pEnvOptions->m_strings.AppendSpecialVar("NZBOP", pOptEntry->GetName(), pOptEntry->GetValue());
+			}
 		}
+
+		g_pOptions->UnlockOptEntries();
 	}
 
-	g_pOptions->UnlockOptEntries();
+	m_environmentStrings.Append(&pEnvOptions->m_strings);
+
+	m_mutexEnvOptions.Unlock();
 }
 
-void ScriptController::SetEnvVarSpecial(const char* szPrefix, const char* szName, const char* szValue)
+/*
+ * Must be called when the options are reloaded.
+ */
+void ScriptController::ClearEnvCache()
 {
-	char szVarname[1024];
-	snprintf(szVarname, sizeof(szVarname), "%s_%s", szPrefix, szName);
-	szVarname[1024-1] = '\0';
-	
-	// Original name
-	SetEnvVar(szVarname, szValue);
-	
-	char szNormVarname[1024];
-	strncpy(szNormVarname, szVarname, sizeof(szVarname));
-	szNormVarname[1024-1] = '\0';
-	
-	// Replace special characters  with "_" and convert to upper case
-	for (char* szPtr = szNormVarname; *szPtr; szPtr++)
+	m_mutexEnvOptions.Lock();
+	for (EnvOptionsCache::iterator it = m_EnvOptionsCache.begin(); it != m_EnvOptionsCache.end(); it++)
 	{
-		if (strchr(".:*!\"$%&/()=`+~#'{}[]@- ", *szPtr)) *szPtr = '_';
-		*szPtr = toupper(*szPtr);
-	}
-	
-	// Another env var with normalized name (replaced special chars and converted to upper case)
-	if (strcmp(szVarname, szNormVarname))
-	{
-		SetEnvVar(szNormVarname, szValue);
+		EnvOptions* pEnvOptions = *it;
+		free(pEnvOptions->m_szPrefix);
+		delete pEnvOptions;
 	}
+	m_EnvOptionsCache.clear();
+	m_mutexEnvOptions.Unlock();
+}
+
+void ScriptController::SetEnvVarSpecial(const char* szPrefix, const char* szName, const char* szValue)
+{
+	m_environmentStrings.AppendSpecialVar(szPrefix, szName, szValue);
 }
 
 void ScriptController::PrepareArgs()
@@ -375,6 +474,7 @@ int ScriptController::Execute()
 
 	int iExitCode = 0;
 	int pipein;
+	int pipestdin = -1;
 
 #ifdef CHILD_WATCHDOG
 	bool bChildConfirmed = false;
@@ -414,11 +514,19 @@ int ScriptController::Execute()
 
 	SetHandleInformation(hReadPipe, HANDLE_FLAG_INHERIT, 0);
 
+	// create pipe for stdin of the child process
+	HANDLE hReadStdinPipe = 0, hWriteStdinPipe = 0;
+	if (m_bNeedWrite)
+	{
+		CreatePipe(&hReadStdinPipe, &hWriteStdinPipe, &SecurityAttributes, 0);
+		SetHandleInformation(hWriteStdinPipe, HANDLE_FLAG_INHERIT, 0);
+	}
+
 	STARTUPINFO StartupInfo;
 	memset(&StartupInfo, 0, sizeof(StartupInfo));
 	StartupInfo.cb = sizeof(StartupInfo);
 	StartupInfo.dwFlags = STARTF_USESTDHANDLES;
-	StartupInfo.hStdInput = 0;
+	StartupInfo.hStdInput = hReadStdinPipe;
 	StartupInfo.hStdOutput = hWritePipe;
 	StartupInfo.hStdError = hWritePipe;
 
@@ -446,6 +554,11 @@ int ScriptController::Execute()
 			PrintMessage(Message::mkError, "Could not find file %s", m_szScript);
 		}
 		free(szEnvironmentStrings);
+		if (m_bNeedWrite)
+		{
+			CloseHandle(hReadStdinPipe);
+			CloseHandle(hWriteStdinPipe);
+		}
 		return -1;
 	}
 
@@ -460,10 +573,18 @@ int ScriptController::Execute()
 
 	pipein = _open_osfhandle((intptr_t)hReadPipe, _O_RDONLY);
 
+	if (m_bNeedWrite)
+	{
+		// close unused "read" end of stdin-pipe
+		CloseHandle(hReadStdinPipe);
+		pipestdin = _open_osfhandle((intptr_t)hWriteStdinPipe, _O_WRONLY);
+	}
+
 #else
 
 	int p[2];
 	int pipeout;
+	int pw[2];
 
 	// create the pipe
 	if (pipe(p))
@@ -472,11 +593,77 @@ int ScriptController::Execute()
 		return -1;
 	}
 
+	// create pipe for stdin of the child process
+	if (m_bNeedWrite && pipe(pw))
+	{
+		PrintMessage(Message::mkError, "Could not open pipe: errno %i", errno);
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+
 	char** pEnvironmentStrings = m_environmentStrings.GetStrings();
 
 	pipein = p[0];
 	pipeout = p[1];
 
+#ifdef USE_POSIX_SPAWN
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+
+	// make the pipeout to be the same as stdout and stderr
+	posix_spawn_file_actions_addclose(&fileActions, pipein);
+	posix_spawn_file_actions_adddup2(&fileActions, pipeout, 1);
+	posix_spawn_file_actions_adddup2(&fileActions, pipeout, 2);
+	posix_spawn_file_actions_addclose(&fileActions, pipeout);
+
+	if (m_bNeedWrite)
+	{
+		// make the "read" end of stdin-pipe to be the stdin
+		posix_spawn_file_actions_addclose(&fileActions, pw[1]);
+		posix_spawn_file_actions_adddup2(&fileActions, pw[0], 0);
+		posix_spawn_file_actions_addclose(&fileActions, pw[0]);
+	}
+
+	if (m_szWorkingDir && Util::DirectoryExists(m_szWorkingDir))
+	{
+		posix_spawn_file_actions_addchdir_np(&fileActions, m_szWorkingDir);
+	}
+
+	// create new session and process group (see Terminate() where it is used)
+	posix_spawnattr_t spawnAttr;
+	posix_spawnattr_init(&spawnAttr);
+	posix_spawnattr_setflags(&spawnAttr, POSIX_SPAWN_SETSID);
+
+	debug("spawning");
+	pid_t pid = 0;
+	int iError = posix_spawnp(&pid, m_szScript, &fileActions, &spawnAttr, (char* const*)m_szArgs, pEnvironmentStrings);
+	if (iError == EACCES)
+	{
+		PrintMessage(Message::mkWarning, "Fixing permissions for %s", m_szScript);
+		Util::FixExecPermission(m_szScript);
+		iError = posix_spawnp(&pid, m_szScript, &fileActions, &spawnAttr, (char* const*)m_szArgs, pEnvironmentStrings);
+	}
+
+	posix_spawn_file_actions_destroy(&fileActions);
+	posix_spawnattr_destroy(&spawnAttr);
+
+	if (iError)
+	{
+		PrintMessage(Message::mkError, "Could not start %s: %s", m_szScript, strerror(iError));
+		free(pEnvironmentStrings);
+		close(pipein);
+		close(pipeout);
+		if (m_bNeedWrite)
+		{
+			close(pw[0]);
+			close(pw[1]);
+		}
+		return -1;
+	}
+
+	debug("spawned");
+#else
 	debug("forking");
 	pid_t pid = fork();
 
@@ -484,6 +671,11 @@ int ScriptController::Execute()
 	{
 		PrintMessage(Message::mkError, "Could not start %s: errno %i", m_szInfoName, errno);
 		free(pEnvironmentStrings);
+		if (m_bNeedWrite)
+		{
+			close(pw[0]);
+			close(pw[1]);
+		}
 		return -1;
 	}
 	else if (pid == 0)
@@ -502,6 +694,14 @@ int ScriptController::Execute()
 		
 		close(pipeout);
 
+		if (m_bNeedWrite)
+		{
+			// make the "read" end of stdin-pipe to be the stdin
+			close(pw[1]);
+			dup2(pw[0], 0);
+			close(pw[0]);
+		}
+
 #ifdef CHILD_WATCHDOG
 		fwrite("\n", 1, 1, stdout);
 		fflush(stdout);
@@ -528,6 +728,7 @@ int ScriptController::Execute()
 
 	// continue the first instance
 	debug("forked");
+#endif
 	debug("Child Process-ID: %i", (int)pid);
 
 	free(pEnvironmentStrings);
@@ -536,6 +737,13 @@ int ScriptController::Execute()
 
 	// close unused "write" end
 	close(pipeout);
+
+	if (m_bNeedWrite)
+	{
+		// close unused "read" end of stdin-pipe
+		close(pw[0]);
+		pipestdin = pw[1];
+	}
 #endif
 
 	// open the read end
@@ -545,6 +753,21 @@ int ScriptController::Execute()
 		PrintMessage(Message::mkError, "Could not open pipe to %s", m_szInfoName);
 		return -1;
 	}
+
+	if (m_bNeedWrite)
+	{
+		// open the write end
+		m_mutexWritepipe.Lock();
+		m_pWritepipe = fdopen(pipestdin, "w");
+		m_mutexWritepipe.Unlock();
+		if (!m_pWritepipe)
+		{
+			PrintMessage(Message::mkError, "Could not open write pipe to %s", m_szInfoName);
+			return -1;
+		}
+	}
+
+	ProcessStarted();
 	
 #ifdef CHILD_WATCHDOG
 	debug("Creating child watchdog");
@@ -600,6 +823,13 @@ int ScriptController::Execute()
 	{
 		fclose(m_pReadpipe);
 	}
+	m_mutexWritepipe.Lock();
+	if (m_pWritepipe)
+	{
+		fclose(m_pWritepipe);
+		m_pWritepipe = NULL;
+	}
+	m_mutexWritepipe.Unlock();
 
 	if (m_bTerminated)
 	{
@@ -708,6 +938,24 @@ void ScriptController::Resume()
 	m_hProcess = 0;
 }
 
+/**
+ * Sends a text to stdin of the child process.
+ * The option "NeedWrite" must be set prior to calling of Execute().
+ * Returns false if the child process is not running.
+ */
+bool ScriptController::Write(const char* szStr)
+{
+	return Write(szStr, strlen(szStr));
+}
+
+bool ScriptController::Write(const char* szData, int iLen)
+{
+	m_mutexWritepipe.Lock();
+	bool bOK = m_pWritepipe && (int)fwrite(szData, 1, iLen, m_pWritepipe) == iLen && !fflush(m_pWritepipe);
+	m_mutexWritepipe.Unlock();
+	return bOK;
+}
+
 bool ScriptController::ReadLine(char* szBuf, int iBufSize, FILE* pStream)
 {
 	return fgets(szBuf, iBufSize, pStream);
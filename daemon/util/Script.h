@@ -44,6 +44,10 @@ public:
 	void				Clear();
 	void				InitFromCurrentProcess();
 	void				Append(char* szString);
+	void				Append(EnvironmentStrings* pStrings);
+	void				AppendVar(const char* szName, const char* szValue);
+	void				AppendSpecialVar(const char* szPrefix, const char* szName, const char* szValue);
+	char*				GetBlock(int* pLen);
 #ifdef WIN32
 	char*				GetStrings();
 #else	
@@ -65,6 +69,9 @@ private:
 	bool				m_bTerminated;
 	bool				m_bDetached;
 	FILE*				m_pReadpipe;
+	bool				m_bNeedWrite;
+	FILE*				m_pWritepipe;
+	Mutex				m_mutexWritepipe;
 #ifdef WIN32
 	HANDLE				m_hProcess;
 	char				m_szCmdLine[2048];
@@ -76,13 +83,26 @@ private:
 	static RunningScripts	m_RunningScripts;
 	static Mutex			m_mutexRunning;
 
+	class EnvOptions
+	{
+	public:
+		char*				m_szPrefix;
+		EnvironmentStrings	m_strings;
+	};
+
+	typedef std::vector<EnvOptions*>	EnvOptionsCache;
+	static EnvOptionsCache	m_EnvOptionsCache;
+	static Mutex			m_mutexEnvOptions;
+
 protected:
 	void				ProcessOutput(char* szText);
 	virtual bool		ReadLine(char* szBuf, int iBufSize, FILE* pStream);
 	void				PrintMessage(Message::EKind eKind, const char* szFormat, ...);
 	virtual void		AddMessage(Message::EKind eKind, const char* szText);
+	virtual void		ProcessStarted() {} // called when the process is started and the pipes are open
 	bool				GetTerminated() { return m_bTerminated; }
 	void				ResetEnv();
+	EnvironmentStrings*	GetEnvironmentStrings() { return &m_environmentStrings; }
 	void				PrepareEnvOptions(const char* szStripPrefix);
 	void				PrepareArgs();
 	void				UnregisterRunningScript();
@@ -95,6 +115,7 @@ public:
 	void				Resume();
 	void				Detach();
 	static void			TerminateAll();
+	static void			ClearEnvCache();
 
 	void				SetScript(const char* szScript) { m_szScript = szScript; }
 	const char*			GetScript() { return m_szScript; }
@@ -106,6 +127,9 @@ public:
 	void				SetEnvVar(const char* szName, const char* szValue);
 	void				SetEnvVarSpecial(const char* szPrefix, const char* szName, const char* szValue);
 	void				SetIntEnvVar(const char* szName, int iValue);
+	void				SetNeedWrite(bool bNeedWrite) { m_bNeedWrite = bNeedWrite; }
+	bool				Write(const char* szStr);
+	bool				Write(const char* szData, int iLen);
 };
 
 #endif
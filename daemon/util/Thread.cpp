@@ -41,6 +41,7 @@
 #else
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/time.h>
 #endif
 
 #include "Log.h"
@@ -140,6 +141,115 @@ void SpinLock::Unlock()
 #endif
 
 
+/*
+ * Adds the value and returns the new value of the counter.
+ */
+long AtomicCounter::Add(long lDelta)
+{
+#ifdef WIN32
+	return InterlockedExchangeAdd(&m_lValue, lDelta) + lDelta;
+#else
+	return __sync_add_and_fetch(&m_lValue, lDelta);
+#endif
+}
+
+
+#ifndef WIN32
+struct SemaphoreObj
+{
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	int					count;
+};
+#endif
+
+Semaphore::Semaphore()
+{
+#ifdef WIN32
+	m_pSemaphoreObj = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+#else
+	SemaphoreObj* pSem = (SemaphoreObj*)malloc(sizeof(SemaphoreObj));
+	pthread_mutex_init(&pSem->mutex, NULL);
+	pthread_cond_init(&pSem->cond, NULL);
+	pSem->count = 0;
+	m_pSemaphoreObj = pSem;
+#endif
+}
+
+Semaphore::~Semaphore()
+{
+#ifdef WIN32
+	CloseHandle((HANDLE)m_pSemaphoreObj);
+#else
+	SemaphoreObj* pSem = (SemaphoreObj*)m_pSemaphoreObj;
+	pthread_cond_destroy(&pSem->cond);
+	pthread_mutex_destroy(&pSem->mutex);
+	free(pSem);
+#endif
+}
+
+void Semaphore::Post()
+{
+#ifdef WIN32
+	ReleaseSemaphore((HANDLE)m_pSemaphoreObj, 1, NULL);
+#else
+	SemaphoreObj* pSem = (SemaphoreObj*)m_pSemaphoreObj;
+	pthread_mutex_lock(&pSem->mutex);
+	pSem->count++;
+	pthread_cond_signal(&pSem->cond);
+	pthread_mutex_unlock(&pSem->mutex);
+#endif
+}
+
+void Semaphore::Wait()
+{
+#ifdef WIN32
+	WaitForSingleObject((HANDLE)m_pSemaphoreObj, INFINITE);
+#else
+	SemaphoreObj* pSem = (SemaphoreObj*)m_pSemaphoreObj;
+	pthread_mutex_lock(&pSem->mutex);
+	while (pSem->count == 0)
+	{
+		pthread_cond_wait(&pSem->cond, &pSem->mutex);
+	}
+	pSem->count--;
+	pthread_mutex_unlock(&pSem->mutex);
+#endif
+}
+
+/*
+ * Returns false if the semaphore was not posted within the timeout.
+ */
+bool Semaphore::Wait(int iTimeoutMSec)
+{
+#ifdef WIN32
+	return WaitForSingleObject((HANDLE)m_pSemaphoreObj, iTimeoutMSec) == WAIT_OBJECT_0;
+#else
+	timeval tNow;
+	gettimeofday(&tNow, NULL);
+	long long lNSec = (long long)tNow.tv_usec * 1000 + (long long)(iTimeoutMSec % 1000) * 1000000;
+	timespec tDeadline;
+	tDeadline.tv_sec = tNow.tv_sec + iTimeoutMSec / 1000 + (time_t)(lNSec / 1000000000);
+	tDeadline.tv_nsec = (long)(lNSec % 1000000000);
+
+	SemaphoreObj* pSem = (SemaphoreObj*)m_pSemaphoreObj;
+	pthread_mutex_lock(&pSem->mutex);
+	int iResult = 0;
+	while (pSem->count == 0 && iResult != ETIMEDOUT)
+	{
+		iResult = pthread_cond_timedwait(&pSem->cond, &pSem->mutex, &tDeadline);
+	}
+	bool bPosted = pSem->count > 0;
+	if (bPosted)
+	{
+		pSem->count--;
+	}
+	pthread_mutex_unlock(&pSem->mutex);
+	return bPosted;
+#endif
+}
+
+
 void Thread::Init()
 {
 	debug("Initializing global thread data");
@@ -57,6 +57,37 @@ public:
 };
 #endif
 
+/*
+ * Integer with atomic operations, for counters shared between threads
+ * which are updated too often to protect them with a mutex.
+ */
+class AtomicCounter
+{
+private:
+	volatile long			m_lValue;
+
+public:
+							AtomicCounter() : m_lValue(0) {}
+	long					Add(long lDelta);
+	long					Get() { return Add(0); }
+};
+
+/*
+ * Counting semaphore for threads waiting until other threads have done their work.
+ */
+class Semaphore
+{
+private:
+	void*					m_pSemaphoreObj;
+
+public:
+							Semaphore();
+							~Semaphore();
+	void					Post();
+	void					Wait();
+	bool					Wait(int iTimeoutMSec);
+};
+
 class Thread
 {
 private:
@@ -47,6 +47,11 @@
 #include <pwd.h>
 #include <dirent.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
@@ -532,16 +537,27 @@ bool Util::CreateSparseFile(const char* szFilename, long long iSize)
 	return bOK;
 }
 
-bool Util::TruncateFile(const char* szFilename, int iSize)
+bool Util::TruncateFile(const char* szFilename, long long lSize)
 {
 	bool bOK = false;
 #ifdef WIN32
 	FILE *file = fopen(szFilename, FOPEN_RBP);
-	fseek(file, iSize, SEEK_SET);
+	fseek(file, lSize, SEEK_SET);
 	bOK = SetEndOfFile((HANDLE)_get_osfhandle(_fileno(file))) != 0;
 	fclose(file);
 #else
-	bOK = truncate(szFilename, iSize) == 0;
+	bOK = truncate(szFilename, lSize) == 0;
+#endif
+	return bOK;
+}
+
+bool Util::FlushFile(FILE* pFile)
+{
+	bool bOK = fflush(pFile) == 0;
+#ifdef WIN32
+	bOK = bOK && _commit(_fileno(pFile)) == 0;
+#else
+	bOK = bOK && fsync(fileno(pFile)) == 0;
 #endif
 	return bOK;
 }
@@ -742,6 +758,67 @@ bool Util::MoveFile(const char* szSrcFilename, const char* szDstFilename)
 	return bOK;
 }
 
+bool Util::CopyFileRange(FILE* pInFile, long long lInOffset, FILE* pOutFile, long long lOutOffset, long long lSize)
+{
+	if (fflush(pOutFile))
+	{
+		return false;
+	}
+
+#if defined(__linux__) && defined(FICLONERANGE)
+	// share the blocks, works only on file systems supporting reflinks and for aligned ranges
+	struct file_clone_range range;
+	range.src_fd = fileno(pInFile);
+	range.src_offset = lInOffset;
+	range.src_length = lSize;
+	range.dest_offset = lOutOffset;
+	if (ioctl(fileno(pOutFile), FICLONERANGE, &range) == 0)
+	{
+		return true;
+	}
+#endif
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	while (lSize > 0)
+	{
+		long long lCopied = syscall(SYS_copy_file_range, fileno(pInFile), &lInOffset, fileno(pOutFile), &lOutOffset,
+			(size_t)(lSize < 0x40000000 ? lSize : 0x40000000), 0);
+		if (lCopied <= 0)
+		{
+			// not supported by kernel or file system (older kernels can't copy between
+			// different file systems), the rest is copied via buffer
+			break;
+		}
+		lSize -= lCopied;
+	}
+
+	if (lSize == 0)
+	{
+		return true;
+	}
+#endif
+
+	if (fseek(pInFile, lInOffset, SEEK_SET) || fseek(pOutFile, lOutOffset, SEEK_SET))
+	{
+		return false;
+	}
+
+	static const int BUFFER_SIZE = 1024 * 50;
+	char* buffer = (char*)malloc(BUFFER_SIZE);
+
+	bool bOK = true;
+	while (bOK && lSize > 0)
+	{
+		int iNeed = lSize < BUFFER_SIZE ? (int)lSize : BUFFER_SIZE;
+		bOK = (int)fread(buffer, 1, iNeed, pInFile) == iNeed && (int)fwrite(buffer, 1, iNeed, pOutFile) == iNeed;
+		lSize -= iNeed;
+	}
+
+	free(buffer);
+
+	return bOK;
+}
+
 bool Util::FileExists(const char* szFilename)
 {
 #ifdef WIN32
@@ -860,6 +937,21 @@ long long Util::FileSize(const char* szFilename)
 	return buffer.st_size;
 }
 
+time_t Util::FileModificationTime(const char* szFilename)
+{
+#ifdef WIN32
+	struct _stat32i64 buffer;
+	if (_stat32i64(szFilename, &buffer))
+#else
+	struct stat buffer;
+	if (stat(szFilename, &buffer))
+#endif
+	{
+		return 0;
+	}
+	return buffer.st_mtime;
+}
+
 long long Util::FreeDiskSize(const char* szPath)
 {
 #ifdef WIN32
@@ -878,6 +970,50 @@ long long Util::FreeDiskSize(const char* szPath)
 	return -1;
 }
 
+long long Util::DeviceId(const char* szPath)
+{
+	char szDir[1024];
+	strncpy(szDir, szPath, 1024);
+	szDir[1024-1] = '\0';
+
+	while (*szDir)
+	{
+#ifdef WIN32
+		struct _stat32i64 buffer;
+		if (!_stat32i64(szDir, &buffer))
+#else
+		struct stat buffer;
+		if (!stat(szDir, &buffer))
+#endif
+		{
+			return (long long)buffer.st_dev;
+		}
+
+		// go one level up
+		char* szEnd = strrchr(szDir, PATH_SEPARATOR);
+		char* szAltEnd = strrchr(szDir, ALT_PATH_SEPARATOR);
+		if (szAltEnd > szEnd)
+		{
+			szEnd = szAltEnd;
+		}
+		if (!szEnd)
+		{
+			break;
+		}
+		if (szEnd == szDir)
+		{
+			szEnd++;
+		}
+		if (!*szEnd)
+		{
+			break;
+		}
+		*szEnd = '\0';
+	}
+
+	return -1;
+}
+
 bool Util::RenameBak(const char* szFilename, const char* szBakPart, bool bRemoveOldExtension, char* szNewNameBuf, int iNewNameBufSize)
 {
 	char szChangedFilename[1024];
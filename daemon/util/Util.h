@@ -88,10 +88,23 @@ public:
 	static bool LoadFileIntoBuffer(const char* szFileName, char** pBuffer, int* pBufferLength);
 	static bool SaveBufferIntoFile(const char* szFileName, const char* szBuffer, int iBufLen);
 	static bool CreateSparseFile(const char* szFilename, long long iSize);
-	static bool TruncateFile(const char* szFilename, int iSize);
+	static bool TruncateFile(const char* szFilename, long long lSize);
+
+	/*
+	 * Writes buffered data and asks the OS to write the file data to disk.
+	 */
+	static bool FlushFile(FILE* pFile);
 	static void MakeValidFilename(char* szFilename, char cReplaceChar, bool bAllowSlashes);
 	static bool MakeUniqueFilename(char* szDestBufFilename, int iDestBufSize, const char* szDestDir, const char* szBasename);
 	static bool MoveFile(const char* szSrcFilename, const char* szDstFilename);
+
+	/*
+	 * Copies a range of the input file into the output file at the given offset.
+	 * On Linux the data is copied within the kernel, on file systems supporting
+	 * reflinks the data blocks are shared (if the offsets are aligned to blocks).
+	 * The current positions of both files are undefined after the call.
+	 */
+	static bool CopyFileRange(FILE* pInFile, long long lInOffset, FILE* pOutFile, long long lOutOffset, long long lSize);
 	static bool FileExists(const char* szFilename);
 	static bool FileExists(const char* szPath, const char* szFilenameWithoutPath);
 	static bool DirectoryExists(const char* szDirFilename);
@@ -102,7 +115,14 @@ public:
 	static bool GetCurrentDirectory(char* szBuffer, int iBufSize);
 	static bool SetCurrentDirectory(const char* szDirFilename);
 	static long long FileSize(const char* szFilename);
+	static time_t FileModificationTime(const char* szFilename);
 	static long long FreeDiskSize(const char* szPath);
+
+	/*
+	 * Returns an identifier of the disk (device) the path resides on or -1 on error.
+	 * If the path doesn't exist yet the nearest existing parent directory is checked.
+	 */
+	static long long DeviceId(const char* szPath);
 	static bool DirEmpty(const char* szDirFilename);
 	static bool RenameBak(const char* szFilename, const char* szBakPart, bool bRemoveOldExtension, char* szNewNameBuf, int iNewNameBufSize);
 #ifndef WIN32
@@ -198,6 +198,47 @@ bool DiskFile::Open(string _filename, u64 _filesize)
   return true;
 }
 
+// Open an existing file for writing
+
+bool DiskFile::OpenWrite(string _filename, u64 _filesize)
+{
+  assert(hFile == INVALID_HANDLE_VALUE);
+
+  filename = _filename;
+  filesize = _filesize;
+
+  hFile = ::CreateFileA(_filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    DWORD error = ::GetLastError();
+
+    cerr << "Could not open \"" << _filename << "\": " << ErrorMessage(error) << endl;
+
+    return false;
+  }
+
+  offset = 0;
+  exists = true;
+
+  return true;
+}
+
+bool DiskFile::Flush(void)
+{
+  assert(hFile != INVALID_HANDLE_VALUE);
+
+  if (!::FlushFileBuffers(hFile))
+  {
+    DWORD error = ::GetLastError();
+
+    cerr << "Could not flush \"" << filename << "\": " << ErrorMessage(error) << endl;
+
+    return false;
+  }
+
+  return true;
+}
+
 // Read some data from disk
 
 bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
@@ -364,6 +405,16 @@ list<string>* DiskFile::FindFiles(string path, string wildcard)
 #define LengthType unsigned int
 #define MaxLength 0xffffffffUL
 
+// Memory mapping is used only on 64-bit systems where the address space
+// is large enough for mapping whole files
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0 && (defined(__LP64__) || defined(_LP64))
+#define DISKFILE_MMAP
+#include <sys/mman.h>
+#endif
+
+// Amount of data which is requested in advance when reading from a mapped file
+#define READAHEAD_SIZE (8*1024*1024)
+
 DiskFile::DiskFile(void)
 {
   //filename;
@@ -371,14 +422,15 @@ DiskFile::DiskFile(void)
   offset = 0;
 
   file = 0;
+  mapping = 0;
+  advised = 0;
 
   exists = false;
 }
 
 DiskFile::~DiskFile(void)
 {
-  if (file != 0)
-    fclose(file);
+  Close();
 }
 
 // Create new file on disk and make sure that there is enough
@@ -502,6 +554,64 @@ bool DiskFile::Open(string _filename, u64 _filesize)
   offset = 0;
   exists = true;
 
+#if defined(POSIX_FADV_SEQUENTIAL)
+  // Files are mostly read from the start to the end
+  posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+#ifdef DISKFILE_MMAP
+  if (filesize > 0 && filesize <= mmaplimit)
+  {
+    void *addr = mmap(0, (size_t)filesize, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (addr != MAP_FAILED)
+    {
+      mapping = (const u8*)addr;
+      advised = 0;
+    }
+  }
+#endif
+
+  return true;
+}
+
+// Open an existing file for writing
+
+bool DiskFile::OpenWrite(string _filename, u64 _filesize)
+{
+  assert(file == 0);
+
+  filename = _filename;
+  filesize = _filesize;
+
+  if (_filesize > (u64)MaxOffset)
+  {
+    cerr << "File size for " << _filename << " is too large." << endl;
+    return false;
+  }
+
+  file = fopen(filename.c_str(), "r+b");
+  if (file == 0)
+  {
+    cerr << "Could not open: " << _filename << endl;
+    return false;
+  }
+
+  offset = 0;
+  exists = true;
+
+  return true;
+}
+
+bool DiskFile::Flush(void)
+{
+  assert(file != 0);
+
+  if (fflush(file) || fsync(fileno(file)))
+  {
+    cerr << "Could not flush: " << filename << endl;
+    return false;
+  }
+
   return true;
 }
 
@@ -511,6 +621,29 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
 {
   assert(file != 0);
 
+#ifdef DISKFILE_MMAP
+  if (mapping != 0)
+  {
+    if (_offset + length > filesize)
+    {
+      cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
+      return false;
+    }
+
+    // Ask the system to read the following data in the background,
+    // also when the reading restarts at a lower offset
+    if (_offset + length > advised || _offset + READAHEAD_SIZE < advised)
+    {
+      u64 start = _offset & ~(u64)(sysconf(_SC_PAGESIZE) - 1);
+      advised = min(start + READAHEAD_SIZE + length, filesize);
+      madvise((void*)(mapping + start), (size_t)(advised - start), MADV_WILLNEED);
+    }
+
+    memcpy(buffer, mapping + _offset, length);
+    return true;
+  }
+#endif
+
   if (offset != _offset)
   {
     if (_offset > (u64)MaxOffset)
@@ -547,6 +680,14 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
 
 void DiskFile::Close(void)
 {
+#ifdef DISKFILE_MMAP
+  if (mapping != 0)
+  {
+    munmap((void*)mapping, (size_t)filesize);
+    mapping = 0;
+  }
+#endif
+
   if (file != 0)
   {
     fclose(file);
@@ -713,6 +854,8 @@ list<string>* DiskFile::FindFiles(string path, string wildcard)
 
 
 
+
+u64 DiskFile::mmaplimit = 0;
 
 bool DiskFile::Open(void)
 {
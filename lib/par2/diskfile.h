@@ -40,6 +40,12 @@ public:
   bool Open(string filename);
   bool Open(string filename, u64 filesize);
 
+  // Open an existing file for writing
+  bool OpenWrite(string filename, u64 filesize);
+
+  // Make sure that the written data is stored on disk
+  bool Flush(void);
+
   // Check to see if the file is open
 #ifdef WIN32
   bool IsOpen(void) const {return hFile != INVALID_HANDLE_VALUE;}
@@ -78,6 +84,10 @@ public:
   static bool FileExists(string filename);
   static u64 GetFileSize(string filename);
 
+  // Files up to this size are read via memory mapping (where supported),
+  // 0 disables memory mapping
+  static void SetMmapLimit(u64 limit) {mmaplimit = limit;}
+
   // Search the specified path for files which match the specified wildcard
   // and return their names in a list.
   static list<string>* FindFiles(string path, string wildcard);
@@ -91,11 +101,19 @@ protected:
   HANDLE hFile;
 #else
   FILE *file;
+
+  // Memory mapping of the file if it was opened for reading
+  const u8 *mapping;
+
+  // End of the range for which the read-ahead was requested
+  u64    advised;
 #endif
 
   // Current offset within the file
   u64    offset;
 
+  static u64 mmaplimit;
+
   // Does the file exist
   bool   exists;
 
@@ -53,7 +53,7 @@ FileCheckSummer::~FileCheckSummer(void)
 // Start reading the file at the beginning
 bool FileCheckSummer::Start(void)
 {
-  currentoffset = readoffset = 0;
+  currentoffset = readoffset = hashedoffset = 0;
 
   tailpointer = outpointer = buffer;
   inpointer = &buffer[blocksize];
@@ -90,6 +90,7 @@ bool FileCheckSummer::Jump(u64 distance)
   currentoffset += distance;
   if (currentoffset >= filesize)
   {
+    FlushHashes(filesize);
     currentoffset = filesize;
     tailpointer = outpointer = buffer;
     memset(buffer, 0, (size_t)blocksize);
@@ -102,6 +103,8 @@ bool FileCheckSummer::Jump(u64 distance)
   outpointer += distance;
   assert(outpointer <= tailpointer);
 
+  FlushHashes(currentoffset);
+
   // Is there any data left in the buffer that we are keeping
   size_t keep = tailpointer - outpointer;
   if (keep > 0)
@@ -127,6 +130,44 @@ bool FileCheckSummer::Jump(u64 distance)
   return true;
 }
 
+// Step forward until the checksum might belong to a data block. Checking
+// the table directly in a tight loop is much faster than calling Step and
+// FindMatch for each byte, which makes a difference when scanning damaged
+// files.
+bool FileCheckSummer::StepToMatch(const VerificationHashTable &hashtable)
+{
+  // Are we already at the end of the file
+  if (currentoffset >= filesize)
+    return false;
+
+  // How many steps can be made without refilling the buffer or
+  // reaching the end of the file
+  u64 steps = min((u64)(&buffer[blocksize] - outpointer), filesize - currentoffset) - 1;
+  if (steps == 0)
+    return Step();
+
+  const unsigned char *in = (const unsigned char*)inpointer;
+  const unsigned char *out = (const unsigned char*)outpointer;
+  u32 crc = windowmask ^ checksum;
+
+  u64 step = 0;
+  while (step < steps)
+  {
+    crc = CRCSlideChar(crc, in[step], out[step], windowtable);
+    step++;
+
+    if (hashtable.MayContain(windowmask ^ crc))
+      break;
+  }
+
+  inpointer += step;
+  outpointer += step;
+  currentoffset += step;
+  checksum = windowmask ^ crc;
+
+  return true;
+}
+
 // Fill the buffer from disk
 
 bool FileCheckSummer::Fill(void)
@@ -144,7 +185,6 @@ bool FileCheckSummer::Fill(void)
     if (!diskfile->Read(readoffset, tailpointer, want))
       return false;
 
-    UpdateHashes(readoffset, tailpointer, want);
     readoffset += want;
     tailpointer += want;
   }
@@ -190,9 +230,26 @@ void FileCheckSummer::UpdateHashes(u64 offset, const void *buffer, size_t length
   }
 }
 
+// Update the hashes with the data which has been read but not hashed yet
+void FileCheckSummer::FlushHashes(u64 offset)
+{
+  offset = min(offset, readoffset);
+  if (offset > hashedoffset)
+  {
+    // File offset of the start of the buffer
+    u64 bufferoffset = readoffset - (tailpointer - buffer);
+    assert(hashedoffset >= bufferoffset);
+
+    UpdateHashes(hashedoffset, &buffer[hashedoffset - bufferoffset], (size_t)(offset - hashedoffset));
+    hashedoffset = offset;
+  }
+}
+
 // Return the full file hash and the 16k file hash
-void FileCheckSummer::GetFileHashes(MD5Hash &hashfull, MD5Hash &hash16k) const
+void FileCheckSummer::GetFileHashes(MD5Hash &hashfull, MD5Hash &hash16k)
 {
+  FlushHashes(filesize);
+
   // Compute the hash of the first 16k
   MD5Context context = context16k;
   context.Final(hash16k);
@@ -215,7 +272,21 @@ void FileCheckSummer::GetFileHashes(MD5Hash &hashfull, MD5Hash &hash16k) const
 MD5Hash FileCheckSummer::Hash(void)
 {
   MD5Context context;
-  context.Update(outpointer, (size_t)blocksize);
+
+  // Does the window contain the next data for the file hash
+  FlushHashes(currentoffset);
+  if (hashedoffset == currentoffset && hashedoffset >= 16384 && currentoffset + blocksize <= readoffset)
+  {
+    // Compute the block hash and continue the file hash in one go
+    MD5Context *contexts[2] = {&contextfull, &context};
+    const void *buffers[2] = {outpointer, outpointer};
+    MD5Context::UpdateMulti(contexts, buffers, 2, (size_t)blocksize);
+    hashedoffset += blocksize;
+  }
+  else
+  {
+    context.Update(outpointer, (size_t)blocksize);
+  }
 
   MD5Hash hash;
   context.Final(hash);
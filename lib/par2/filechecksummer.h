@@ -31,7 +31,11 @@
 // has been confirmed, the object jumps forward to where the next
 // block of data is expected to start. Whilst the file is being scanned
 // the object also computes the MD5 Hash of the whole file and of
-// the first 16k of the file for later tests.
+// the first 16k of the file for later tests. The file hash is only
+// updated when data is about to leave the buffer, so that it can be
+// computed together with the hash of a block (see MD5Context::UpdateMulti).
+
+class VerificationHashTable;
 
 class FileCheckSummer
 {
@@ -51,6 +55,10 @@ public:
   // Step forward one byte
   bool Step(void);
 
+  // Step forward one byte at a time until a checksum is found which is in the
+  // hash table (or at least until the window has to be refilled)
+  bool StepToMatch(const VerificationHashTable &hashtable);
+
   // Return the current checksum
   u32 Checksum(void) const;
 
@@ -69,7 +77,7 @@ public:
   u64 Offset(void) const;
 
   // Return the full file hash and the 16k file hash
-  void GetFileHashes(MD5Hash &hashfull, MD5Hash &hash16k) const;
+  void GetFileHashes(MD5Hash &hashfull, MD5Hash &hash16k);
 
   // Which disk file is this
   const DiskFile* GetDiskFile(void) const {return diskfile;}
@@ -91,6 +99,9 @@ protected:
   // File offset for next read
   u64         readoffset;
 
+  // File offset up to which the hashes were computed
+  u64         hashedoffset;
+
   // The current checksum
   u32         checksum;
 
@@ -102,6 +113,9 @@ protected:
   //void ComputeCurrentCRC(void);
   void UpdateHashes(u64 offset, const void *buffer, size_t length);
 
+  // Update the hashes with the data in the buffer up to the file offset
+  void FlushHashes(u64 offset);
+
   //// Fill the buffers with more data from disk
   bool Fill(void);
 };
@@ -143,6 +157,7 @@ inline bool FileCheckSummer::Step(void)
   // we have reached the end of the file
   if (++currentoffset >= filesize)
   {
+    FlushHashes(filesize);
     currentoffset = filesize;
     tailpointer = outpointer = buffer;
     memset(buffer, 0, (size_t)blocksize);
@@ -164,6 +179,8 @@ inline bool FileCheckSummer::Step(void)
 
   assert(outpointer == &buffer[blocksize]);
 
+  FlushHashes(currentoffset);
+
   // Copy the data back to the beginning of the buffer
   memmove(buffer, outpointer, (size_t)blocksize);
   inpointer = outpointer;
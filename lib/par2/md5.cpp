@@ -262,6 +262,209 @@ void MD5Context::Update(const void *buffer, size_t length)
   } 
 }
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define MD5_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef MD5_SIMD
+// The 64 MD5 steps; R is called with the function, the state words,
+// the index of the data word, the shift and the additive constant.
+#define MD5_STEPS(R) \
+  R(F1, a, b, c, d,  0,  7, 0xd76aa478); R(F1, d, a, b, c,  1, 12, 0xe8c7b756); \
+  R(F1, c, d, a, b,  2, 17, 0x242070db); R(F1, b, c, d, a,  3, 22, 0xc1bdceee); \
+  R(F1, a, b, c, d,  4,  7, 0xf57c0faf); R(F1, d, a, b, c,  5, 12, 0x4787c62a); \
+  R(F1, c, d, a, b,  6, 17, 0xa8304613); R(F1, b, c, d, a,  7, 22, 0xfd469501); \
+  R(F1, a, b, c, d,  8,  7, 0x698098d8); R(F1, d, a, b, c,  9, 12, 0x8b44f7af); \
+  R(F1, c, d, a, b, 10, 17, 0xffff5bb1); R(F1, b, c, d, a, 11, 22, 0x895cd7be); \
+  R(F1, a, b, c, d, 12,  7, 0x6b901122); R(F1, d, a, b, c, 13, 12, 0xfd987193); \
+  R(F1, c, d, a, b, 14, 17, 0xa679438e); R(F1, b, c, d, a, 15, 22, 0x49b40821); \
+  R(F2, a, b, c, d,  1,  5, 0xf61e2562); R(F2, d, a, b, c,  6,  9, 0xc040b340); \
+  R(F2, c, d, a, b, 11, 14, 0x265e5a51); R(F2, b, c, d, a,  0, 20, 0xe9b6c7aa); \
+  R(F2, a, b, c, d,  5,  5, 0xd62f105d); R(F2, d, a, b, c, 10,  9, 0x02441453); \
+  R(F2, c, d, a, b, 15, 14, 0xd8a1e681); R(F2, b, c, d, a,  4, 20, 0xe7d3fbc8); \
+  R(F2, a, b, c, d,  9,  5, 0x21e1cde6); R(F2, d, a, b, c, 14,  9, 0xc33707d6); \
+  R(F2, c, d, a, b,  3, 14, 0xf4d50d87); R(F2, b, c, d, a,  8, 20, 0x455a14ed); \
+  R(F2, a, b, c, d, 13,  5, 0xa9e3e905); R(F2, d, a, b, c,  2,  9, 0xfcefa3f8); \
+  R(F2, c, d, a, b,  7, 14, 0x676f02d9); R(F2, b, c, d, a, 12, 20, 0x8d2a4c8a); \
+  R(F3, a, b, c, d,  5,  4, 0xfffa3942); R(F3, d, a, b, c,  8, 11, 0x8771f681); \
+  R(F3, c, d, a, b, 11, 16, 0x6d9d6122); R(F3, b, c, d, a, 14, 23, 0xfde5380c); \
+  R(F3, a, b, c, d,  1,  4, 0xa4beea44); R(F3, d, a, b, c,  4, 11, 0x4bdecfa9); \
+  R(F3, c, d, a, b,  7, 16, 0xf6bb4b60); R(F3, b, c, d, a, 10, 23, 0xbebfbc70); \
+  R(F3, a, b, c, d, 13,  4, 0x289b7ec6); R(F3, d, a, b, c,  0, 11, 0xeaa127fa); \
+  R(F3, c, d, a, b,  3, 16, 0xd4ef3085); R(F3, b, c, d, a,  6, 23, 0x04881d05); \
+  R(F3, a, b, c, d,  9,  4, 0xd9d4d039); R(F3, d, a, b, c, 12, 11, 0xe6db99e5); \
+  R(F3, c, d, a, b, 15, 16, 0x1fa27cf8); R(F3, b, c, d, a,  2, 23, 0xc4ac5665); \
+  R(F4, a, b, c, d,  0,  6, 0xf4292244); R(F4, d, a, b, c,  7, 10, 0x432aff97); \
+  R(F4, c, d, a, b, 14, 15, 0xab9423a7); R(F4, b, c, d, a,  5, 21, 0xfc93a039); \
+  R(F4, a, b, c, d, 12,  6, 0x655b59c3); R(F4, d, a, b, c,  3, 10, 0x8f0ccc92); \
+  R(F4, c, d, a, b, 10, 15, 0xffeff47d); R(F4, b, c, d, a,  1, 21, 0x85845dd1); \
+  R(F4, a, b, c, d,  8,  6, 0x6fa87e4f); R(F4, d, a, b, c, 15, 10, 0xfe2ce6e0); \
+  R(F4, c, d, a, b,  6, 15, 0xa3014314); R(F4, b, c, d, a, 13, 21, 0x4e0811a1); \
+  R(F4, a, b, c, d,  4,  6, 0xf7537e82); R(F4, d, a, b, c, 11, 10, 0xbd3af235); \
+  R(F4, c, d, a, b,  2, 15, 0x2ad7d2bb); R(F4, b, c, d, a,  9, 21, 0xeb86d391);
+
+// Process "blocks" blocks of 64 bytes for 4 streams, each lane of the
+// vectors holds the state of one stream
+__attribute__((target("sse2")))
+static void UpdateStatesSSE2(u32 *states[4], const u8 *data[4], size_t blocks)
+{
+#define VF1(x,y,z) _mm_or_si128(_mm_and_si128(x, y), _mm_andnot_si128(x, z))
+#define VF2(x,y,z) _mm_or_si128(_mm_and_si128(x, z), _mm_andnot_si128(z, y))
+#define VF3(x,y,z) _mm_xor_si128(_mm_xor_si128(x, y), z)
+#define VF4(x,y,z) _mm_xor_si128(y, _mm_or_si128(x, _mm_xor_si128(z, ones)))
+#define VSTEP(f,w,x,y,z,k,s,ti) \
+  w = _mm_add_epi32(w, _mm_add_epi32(V##f(x,y,z), _mm_add_epi32(m[k], _mm_set1_epi32((int)ti)))); \
+  w = _mm_add_epi32(x, _mm_or_si128(_mm_slli_epi32(w, s), _mm_srli_epi32(w, 32-s)))
+
+  const __m128i ones = _mm_set1_epi32(-1);
+  __m128i a = _mm_set_epi32(states[3][0], states[2][0], states[1][0], states[0][0]);
+  __m128i b = _mm_set_epi32(states[3][1], states[2][1], states[1][1], states[0][1]);
+  __m128i c = _mm_set_epi32(states[3][2], states[2][2], states[1][2], states[0][2]);
+  __m128i d = _mm_set_epi32(states[3][3], states[2][3], states[1][3], states[0][3]);
+
+  for (size_t block = 0; block < blocks; block++)
+  {
+    __m128i m[16];
+    for (int i = 0; i < 16; i++)
+    {
+      // x86 is little endian, the words can be read directly
+      m[i] = _mm_set_epi32(((const int*)data[3])[i], ((const int*)data[2])[i],
+                           ((const int*)data[1])[i], ((const int*)data[0])[i]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+      data[i] += 64;
+    }
+
+    __m128i aa = a, bb = b, cc = c, dd = d;
+    MD5_STEPS(VSTEP);
+    a = _mm_add_epi32(a, aa);
+    b = _mm_add_epi32(b, bb);
+    c = _mm_add_epi32(c, cc);
+    d = _mm_add_epi32(d, dd);
+  }
+
+  u32 out[4][4];
+  _mm_storeu_si128((__m128i*)out[0], a);
+  _mm_storeu_si128((__m128i*)out[1], b);
+  _mm_storeu_si128((__m128i*)out[2], c);
+  _mm_storeu_si128((__m128i*)out[3], d);
+  for (int lane = 0; lane < 4; lane++)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      states[lane][i] = out[i][lane];
+    }
+  }
+
+#undef VF1
+#undef VF2
+#undef VF3
+#undef VF4
+#undef VSTEP
+}
+
+static bool DetectSSE2()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+// Process "blocks" blocks of 64 bytes for up to 4 streams if SSE2 is
+// available. Unused lanes are fed with the data of the first stream and
+// their results are discarded.
+static bool UpdateStatesSimd(u32 *states[], const u8 *data[], unsigned int count, size_t blocks)
+{
+  static const bool sse2 = DetectSSE2();
+  if (!sse2)
+    return false;
+
+  u32 dummy[4][4];
+  u32 *laneStates[4];
+  const u8 *laneData[4];
+  for (unsigned int lane = 0; lane < 4; lane++)
+  {
+    if (lane < count)
+    {
+      laneStates[lane] = states[lane];
+      laneData[lane] = data[lane];
+    }
+    else
+    {
+      memcpy(dummy[lane], states[0], sizeof(dummy[lane]));
+      laneStates[lane] = dummy[lane];
+      laneData[lane] = data[0];
+    }
+  }
+
+  UpdateStatesSSE2(laneStates, laneData, blocks);
+
+  return true;
+}
+#endif
+
+void MD5Context::UpdateMulti(MD5Context *contexts[], const void *buffers[], unsigned int count, size_t length)
+{
+#ifdef MD5_SIMD
+  // Streams processed by one call of the SIMD function
+  enum {maxlanes = 4};
+
+  for (unsigned int first = 0; first < count; first += maxlanes)
+  {
+    unsigned int lanes = min(count - first, (unsigned int)maxlanes);
+
+    // Fill the partial blocks of the contexts, then all contexts are at a
+    // block boundary but may have different amounts of data left
+    const u8 *data[maxlanes];
+    size_t blocks = length / buffersize;
+    for (unsigned int i = 0; i < lanes; i++)
+    {
+      MD5Context *context = contexts[first + i];
+      data[i] = (const u8*)buffers[first + i];
+      if (context->used > 0)
+      {
+        size_t head = min(buffersize - context->used, length);
+        context->Update(data[i], head);
+        data[i] += head;
+      }
+      blocks = min(blocks, (length - (data[i] - (const u8*)buffers[first + i])) / buffersize);
+    }
+
+    if (lanes > 1 && blocks > 0)
+    {
+      u32 *states[maxlanes];
+      for (unsigned int i = 0; i < lanes; i++)
+      {
+        states[i] = contexts[first + i]->state;
+      }
+
+      if (UpdateStatesSimd(states, data, lanes, blocks))
+      {
+        for (unsigned int i = 0; i < lanes; i++)
+        {
+          contexts[first + i]->bytes += blocks * buffersize;
+          data[i] += blocks * buffersize;
+        }
+      }
+    }
+
+    // Process the rest one by one
+    for (unsigned int i = 0; i < lanes; i++)
+    {
+      size_t done = data[i] - (const u8*)buffers[first + i];
+      contexts[first + i]->Update(data[i], length - done);
+    }
+  }
+#else
+  for (unsigned int i = 0; i < count; i++)
+  {
+    contexts[i]->Update(buffers[i], length);
+  }
+#endif
+}
+
 // Finalise the computation and extract the Hash value
 void MD5Context::Final(MD5Hash &output)
 {
@@ -49,6 +49,13 @@ Par2Repairer::Par2Repairer(void)
   inputbuffer = 0;
   outputbuffer = 0;
 
+  inputbatchsize = 1;
+  tilesize = 0;
+  prefetchdepth = 0;
+  inputring = 0;
+  inputfile = 0;
+  rsparallel = 0;
+
   noiselevel = CommandLine::nlNormal;
   headers = new ParHeaders;
   alreadyloaded = false;
@@ -58,7 +65,7 @@ Par2Repairer::Par2Repairer(void)
 
 Par2Repairer::~Par2Repairer(void)
 {
-  delete [] (u8*)inputbuffer;
+  delete [] inputring;
   delete [] (u8*)outputbuffer;
 
   map<u32,RecoveryPacket*>::iterator rp = recoverypacketmap.begin();
@@ -78,6 +85,8 @@ Par2Repairer::~Par2Repairer(void)
     ++sf;
   }
 
+  FreeScanJobs();
+
   delete mainpacket;
   delete creatorpacket;
   delete headers;
@@ -291,8 +300,9 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
 	      
 	      BeginRepair();
 
-	      // Start at an offset of 0 within a block.
-	      u64 blockoffset = 0;
+	      // Start at an offset of 0 within a block or where an interrupted repair stopped.
+	      u64 blockoffset = ResumeRepair();
+	      progress = blockoffset * sourceblockcount * (missingblockcount > 0 ? missingblockcount : 1);
 	      while (blockoffset < blocksize) // Continue until the end of the block.
 		{
 		  // Work out how much data to process this time.
@@ -310,6 +320,8 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
 		  
 		  // Advance to the need offset within each block
 		  blockoffset += blocklength;
+
+		  ChunkCompleted(blockoffset);
 		}
 	      
 	      EndRepair();
@@ -382,225 +394,261 @@ bool Par2Repairer::LoadPacketsFromFile(string filename)
   // How many recovery packets were there
   u32 recoverypackets = 0;
 
+  // Packets of a file which was scanned before are loaded without
+  // searching and hashing the file again
+  PacketIndex index;
+  bool indexed = FindPacketIndex(filename, index);
+  for (PacketIndex::iterator it = index.begin(); indexed && it != index.end(); it++)
+  {
+    LoadPacket(diskfile, it->offset, it->header, packets, recoverypackets);
+  }
+
   // How big is the file
   u64 filesize = diskfile->FileSize();
-  if (filesize > 0)
+  if (filesize > 0 && !indexed)
   {
-    // Allocate a buffer to read data into
-    // The buffer should be large enough to hold a whole 
-    // critical packet (i.e. file verification, file description, main,
-    // and creator), but not necessarily a whole recovery packet.
-    size_t buffersize = (size_t)min((u64)1048576, filesize);
-    u8 *buffer = new u8[buffersize];
+    PacketScanner scanner(diskfile);
 
     // Progress indicator
     u64 progress = 0;
 
-    // Start at the beginning of the file
-    u64 offset = 0;
-
-    // Continue as long as there is at least enough for the packet header
-    while (offset + sizeof(PACKET_HEADER) <= filesize)
+    PacketIndexEntry entry;
+    while (!cancelled && scanner.Next(entry))
     {
       if (noiselevel > CommandLine::nlQuiet)
       {
         // Update a progress indicator
         u32 oldfraction = (u32)(1000 * progress / filesize);
-        u32 newfraction = (u32)(1000 * offset / filesize);
+        u32 newfraction = (u32)(1000 * scanner.Offset() / filesize);
         if (oldfraction != newfraction)
         {
           cout << "Loading: " << newfraction/10 << '.' << newfraction%10 << "%\r" << flush;
-          progress = offset;
+          progress = scanner.Offset();
 	sig_progress(newfraction);
-
-          if (cancelled)
-          {
-            break;
-          }
         }
       }
 
-      // Attempt to read the next packet header
-      PACKET_HEADER header;
-      if (!diskfile->Read(offset, &header, sizeof(header)))
-        break;
+      index.push_back(entry);
 
-      // Does this look like it might be a packet
-      if (packet_magic != header.magic)
-      {
-        offset++;
+      LoadPacket(diskfile, entry.offset, entry.header, packets, recoverypackets);
+    }
 
-        // Is there still enough for at least a whole packet header
-        while (offset + sizeof(PACKET_HEADER) <= filesize)
-        {
-          // How much can we read into the buffer
-          size_t want = (size_t)min((u64)buffersize, filesize-offset);
+    if (!cancelled)
+    {
+      StorePacketIndex(filename, index);
+    }
+  }
 
-          // Fill the buffer
-          if (!diskfile->Read(offset, buffer, want))
-          {
-            offset = filesize;
-            break;
-          }
+  // We have finished with the file for now
+  diskfile->Close();
 
-          // Scan the buffer for the magic value
-          u8 *current = buffer;
-          u8 *limit = &buffer[want-sizeof(PACKET_HEADER)];
-          while (current <= limit && packet_magic != ((PACKET_HEADER*)current)->magic)
-          {
-            current++;
-          }
+  // Did we actually find any interesting packets
+  if (packets > 0)
+  {
+    if (noiselevel > CommandLine::nlQuiet)
+    {
+      cout << "Loaded " << packets << " new packets";
+      if (recoverypackets > 0) cout << " including " << recoverypackets << " recovery blocks";
+      cout << endl;
+    }
 
-          // What file offset did we reach
-          offset += current-buffer;
+    // Remember that the file was processed
+    bool success = diskFileMap.Insert(diskfile);
+    assert(success);
+  }
+  else
+  {
+    if (noiselevel > CommandLine::nlQuiet)
+      cout << "No new packets found" << endl;
+    delete diskfile;
+  }
+  
+  if (cancelled)
+  {
+    return false;
+  }
 
-          // Did we find the magic
-          if (current <= limit)
-          {
-            memcpy(&header, current, sizeof(header));
-            break;
-          }
-        }
+  return true;
+}
 
-        // Did we reach the end of the file
-        if (offset + sizeof(PACKET_HEADER) > filesize)
-        {
-          break;
-        }
-      }
+PacketScanner::PacketScanner(DiskFile *_diskfile)
+: diskfile(_diskfile)
+, filesize(_diskfile->FileSize())
+, offset(0)
+{
+  // The buffer should be large enough to hold a whole critical packet
+  // (i.e. file verification, file description, main, and creator), but
+  // not necessarily a whole recovery packet.
+  buffersize = (size_t)min((u64)1048576, filesize);
+  buffer = new u8[buffersize > 0 ? buffersize : 1];
+}
 
-      // We have found the magic
+PacketScanner::~PacketScanner(void)
+{
+  delete [] buffer;
+}
 
-      // Check the packet length
-      if (sizeof(PACKET_HEADER) > header.length || // packet length is too small
-          0 != (header.length & 3) ||              // packet length is not a multiple of 4
-          filesize < offset + header.length)       // packet would extend beyond the end of the file
-      {
-        offset++;
-        continue;
-      }
+bool PacketScanner::Next(PacketIndexEntry &entry)
+{
+  // Continue as long as there is at least enough for the packet header
+  while (offset + sizeof(PACKET_HEADER) <= filesize)
+  {
+    // Attempt to read the next packet header
+    PACKET_HEADER header;
+    if (!diskfile->Read(offset, &header, sizeof(header)))
+      return false;
 
-      // Compute the MD5 Hash of the packet
-      MD5Context context;
-      context.Update(&header.setid, sizeof(header)-offsetof(PACKET_HEADER, setid));
+    // Does this look like it might be a packet
+    if (packet_magic != header.magic)
+    {
+      offset++;
 
-      // How much more do I need to read to get the whole packet
-      u64 current = offset+sizeof(PACKET_HEADER);
-      u64 limit = offset+header.length;
-      while (current < limit)
+      // Is there still enough for at least a whole packet header
+      while (offset + sizeof(PACKET_HEADER) <= filesize)
       {
-        size_t want = (size_t)min((u64)buffersize, limit-current);
+        // How much can we read into the buffer
+        size_t want = (size_t)min((u64)buffersize, filesize-offset);
 
-        if (!diskfile->Read(current, buffer, want))
+        // Fill the buffer
+        if (!diskfile->Read(offset, buffer, want))
+        {
+          offset = filesize;
           break;
+        }
 
-        context.Update(buffer, want);
+        // Scan the buffer for the magic value
+        u8 *current = buffer;
+        u8 *limit = &buffer[want-sizeof(PACKET_HEADER)];
+        while (current <= limit && packet_magic != ((PACKET_HEADER*)current)->magic)
+        {
+          current++;
+        }
 
-        current += want;
-      }
+        // What file offset did we reach
+        offset += current-buffer;
 
-      // Did the whole packet get processed
-      if (current<limit)
-      {
-        offset++;
-        continue;
+        // Did we find the magic
+        if (current <= limit)
+        {
+          memcpy(&header, current, sizeof(header));
+          break;
+        }
       }
 
-      // Check the calculated packet hash against the value in the header
-      MD5Hash hash;
-      context.Final(hash);
-      if (hash != header.hash)
+      // Did we reach the end of the file
+      if (offset + sizeof(PACKET_HEADER) > filesize)
       {
-        offset++;
-        continue;
+        return false;
       }
+    }
 
-      // If this is the first packet that we have found then record the setid
-      if (firstpacket)
-      {
-        setid = header.setid;
-        firstpacket = false;
-      }
+    // We have found the magic
 
-      // Is the packet from the correct set
-      if (setid == header.setid)
-      {
-        // Is it a packet type that we are interested in
-        if (recoveryblockpacket_type == header.type)
-        {
-          if (LoadRecoveryPacket(diskfile, offset, header))
-          {
-            recoverypackets++;
-            packets++;
-          }
-        }
-        else if (fileverificationpacket_type == header.type)
-        {
-          if (LoadVerificationPacket(diskfile, offset, header))
-          {
-            packets++;
-          }
-        }
-        else if (filedescriptionpacket_type == header.type)
-        {
-          if (LoadDescriptionPacket(diskfile, offset, header))
-          {
-            packets++;
-          }
-        }
-        else if (mainpacket_type == header.type)
-        {
-          if (LoadMainPacket(diskfile, offset, header))
-          {
-            packets++;
-          }
-        }
-        else if (creatorpacket_type == header.type)
-        {
-          if (LoadCreatorPacket(diskfile, offset, header))
-          {
-            packets++;
-          }
-        }
-      }
+    // Check the packet length
+    if (sizeof(PACKET_HEADER) > header.length || // packet length is too small
+        0 != (header.length & 3) ||              // packet length is not a multiple of 4
+        filesize < offset + header.length)       // packet would extend beyond the end of the file
+    {
+      offset++;
+      continue;
+    }
+
+    // Compute the MD5 Hash of the packet
+    MD5Context context;
+    context.Update(&header.setid, sizeof(header)-offsetof(PACKET_HEADER, setid));
+
+    // How much more do I need to read to get the whole packet
+    u64 current = offset+sizeof(PACKET_HEADER);
+    u64 limit = offset+header.length;
+    while (current < limit)
+    {
+      size_t want = (size_t)min((u64)buffersize, limit-current);
+
+      if (!diskfile->Read(current, buffer, want))
+        break;
 
-      // Advance to the next packet
-      offset += header.length;
+      context.Update(buffer, want);
+
+      current += want;
+    }
+
+    // Did the whole packet get processed
+    if (current<limit)
+    {
+      offset++;
+      continue;
+    }
+
+    // Check the calculated packet hash against the value in the header
+    MD5Hash hash;
+    context.Final(hash);
+    if (hash != header.hash)
+    {
+      offset++;
+      continue;
     }
 
-    delete [] buffer;
+    entry.offset = offset;
+    entry.header = header;
+
+    // Advance to the next packet
+    offset += header.length;
+
+    return true;
   }
 
-  // We have finished with the file for now
-  diskfile->Close();
+  return false;
+}
 
-  // Did we actually find any interesting packets
-  if (packets > 0)
+// Load one packet found in a file, if it is from the correct set
+bool Par2Repairer::LoadPacket(DiskFile *diskfile, u64 offset, PACKET_HEADER &header, u32 &packets, u32 &recoverypackets)
+{
+  // If this is the first packet that we have found then record the setid
+  if (firstpacket)
   {
-    if (noiselevel > CommandLine::nlQuiet)
+    setid = header.setid;
+    firstpacket = false;
+  }
+
+  // Is the packet from the correct set
+  if (setid != header.setid)
+  {
+    return false;
+  }
+
+  // Is it a packet type that we are interested in
+  bool loaded = false;
+  if (recoveryblockpacket_type == header.type)
+  {
+    loaded = LoadRecoveryPacket(diskfile, offset, header);
+    if (loaded)
     {
-      cout << "Loaded " << packets << " new packets";
-      if (recoverypackets > 0) cout << " including " << recoverypackets << " recovery blocks";
-      cout << endl;
+      recoverypackets++;
     }
-
-    // Remember that the file was processed
-    bool success = diskFileMap.Insert(diskfile);
-    assert(success);
   }
-  else
+  else if (fileverificationpacket_type == header.type)
   {
-    if (noiselevel > CommandLine::nlQuiet)
-      cout << "No new packets found" << endl;
-    delete diskfile;
+    loaded = LoadVerificationPacket(diskfile, offset, header);
   }
-  
-  if (cancelled)
+  else if (filedescriptionpacket_type == header.type)
   {
-    return false;
+    loaded = LoadDescriptionPacket(diskfile, offset, header);
+  }
+  else if (mainpacket_type == header.type)
+  {
+    loaded = LoadMainPacket(diskfile, offset, header);
+  }
+  else if (creatorpacket_type == header.type)
+  {
+    loaded = LoadCreatorPacket(diskfile, offset, header);
   }
 
-  return true;
+  if (loaded)
+  {
+    packets++;
+  }
+
+  return loaded;
 }
 
 // Finish loading a recovery packet
@@ -1247,6 +1295,18 @@ bool Par2Repairer::VerifySourceFiles(void)
 
   sort(sortedfiles.begin(), sortedfiles.end(), SortSourceFilesByFileName);
 
+  // Give the caller the chance to scan the existing files in advance
+  vector<pair<string, Par2RepairerSourceFile*> > scanfiles;
+  for (sf = sortedfiles.begin(); sf != sortedfiles.end(); ++sf)
+  {
+    string filename = (*sf)->TargetFileName();
+    if (DiskFile::FileExists(filename))
+    {
+      scanfiles.push_back(pair<string, Par2RepairerSourceFile*>(filename, *sf));
+    }
+  }
+  PrepareScanJobs(scanfiles);
+
   // Start verifying the files
   sf = sortedfiles.begin();
   while (sf != sortedfiles.end())
@@ -1315,12 +1375,31 @@ bool Par2Repairer::VerifySourceFiles(void)
     ++sf;
   }
 
+  FreeScanJobs();
+
   return finalresult;
 }
 
 // Scan any extra files specified on the command line
 bool Par2Repairer::VerifyExtraFiles(const list<CommandLine::ExtraFile> &extrafiles)
 {
+  // Give the caller the chance to scan the files in advance
+  vector<pair<string, Par2RepairerSourceFile*> > scanfiles;
+  for (ExtraFileIterator i=extrafiles.begin(); i!=extrafiles.end(); ++i)
+  {
+    string filename = i->FileName();
+    if (string::npos == filename.find(".par2") &&
+        string::npos == filename.find(".PAR2"))
+    {
+      filename = DiskFile::GetCanonicalPathname(filename);
+      if (diskFileMap.Find(filename) == 0)
+      {
+        scanfiles.push_back(pair<string, Par2RepairerSourceFile*>(filename, (Par2RepairerSourceFile*)0));
+      }
+    }
+  }
+  PrepareScanJobs(scanfiles);
+
   for (ExtraFileIterator i=extrafiles.begin(); 
        i!=extrafiles.end() && completefilecount<mainpacket->RecoverableFileCount(); 
        ++i)
@@ -1362,6 +1441,8 @@ bool Par2Repairer::VerifyExtraFiles(const list<CommandLine::ExtraFile> &extrafil
     }
   }
 
+  FreeScanJobs();
+
   return true;
 }
 
@@ -1533,36 +1614,15 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
   return true;
 }
 
-// Perform a sliding window scan of the DiskFile looking for blocks of data that 
-// might belong to any of the source files (for which a verification packet was
-// available). If a block of data might be from more than one source file, prefer
-// the one specified by the "sourcefile" parameter. If the first data block
-// found is for a different source file then "sourcefile" is changed accordingly.
-bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
-                                Par2RepairerSourceFile* &sourcefile,  // [in/out]
-                                MatchType               &matchtype,   // [out]
-                                MD5Hash                 &hashfull,    // [out]
-                                MD5Hash                 &hash16k,     // [out]
-                                u32                     &count)       // [out]
+// Perform the sliding window scan of the DiskFile. If "record" is set the found
+// blocks are only recorded in the scan job and not assigned to the source blocks;
+// such a scan can be executed in parallel with other scans.
+bool Par2Repairer::ScanDataFileBlocks(DiskFile *diskfile, ScanJob &scan, bool record)
 {
-  // Remember which file we wanted to match
-  Par2RepairerSourceFile *originalsourcefile = sourcefile;
-
-  matchtype = eNoMatch;
-
-  // Is the file empty
-  if (diskfile->FileSize() == 0)
-  {
-    // If the file is empty, then just return
-    return true;
-  }
-
   string path;
   string name;
   DiskFile::SplitFilename(diskfile->FileName(), path, name);
 
-  sig_filename(name);
-
   string shortname;
   if (name.size() > 56)
   {
@@ -1573,6 +1633,12 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
     shortname = name;
   }
 
+  Par2RepairerSourceFile* &sourcefile = scan.sourcefile;
+  MatchType &matchtype = scan.matchtype;
+  u32 &count = scan.count;
+  u32 &duplicatecount = scan.duplicatecount;
+  bool &multipletargets = scan.multipletargets;
+
   // Create the checksummer for the file and start reading from it
   FileCheckSummer filechecksummer(diskfile, blocksize, windowtable, windowmask);
   if (!filechecksummer.Start())
@@ -1585,10 +1651,10 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
   count = 0;
 
   // How many blocks have already been found
-  u32 duplicatecount = 0;
+  duplicatecount = 0;
 
   // Have we found data blocks in this file that belong to more than one target file
-  bool multipletargets = false;
+  multipletargets = false;
 
   // Which block do we expect to find first
   const VerificationHashEntry *nextentry = 0;
@@ -1598,20 +1664,20 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
   // Whilst we have not reached the end of the file
   while (filechecksummer.Offset() < diskfile->FileSize())
   {
-    if (noiselevel > CommandLine::nlQuiet)
+    // Update a progress indicator
+    u32 oldfraction = (u32)(1000 * progress / diskfile->FileSize());
+    u32 newfraction = (u32)(1000 * (progress = filechecksummer.Offset()) / diskfile->FileSize());
+    if (oldfraction != newfraction)
     {
-      // Update a progress indicator
-      u32 oldfraction = (u32)(1000 * progress / diskfile->FileSize());
-      u32 newfraction = (u32)(1000 * (progress = filechecksummer.Offset()) / diskfile->FileSize());
-      if (oldfraction != newfraction)
+      if (noiselevel > CommandLine::nlQuiet && !record)
       {
         cout << "Scanning: \"" << shortname << "\": " << newfraction/10 << '.' << newfraction%10 << "%\r" << flush;
 	sig_progress(newfraction);
+      }
 
-        if (cancelled)
-        {
-          break;
-        }
+      if (cancelled)
+      {
+        break;
       }
     }
 
@@ -1656,7 +1722,12 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
         }
       }
 
-      if (blocksallocated)
+      if (record)
+      {
+        // Remember the match, it is assigned later
+        scan.matches.push_back(pair<const VerificationHashEntry*, u64>(currententry, filechecksummer.Offset()));
+      }
+      else if (blocksallocated)
       {
         // Record the match
         currententry->SetBlock(diskfile, filechecksummer.Offset());
@@ -1694,8 +1765,8 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
         // What entry do we expect next
         nextentry = 0;
 
-        // Advance 1 byte
-        if (!filechecksummer.Step())
+        // Advance to the next position which might match a block
+        if (!filechecksummer.StepToMatch(verificationhashtable))
           return false;
       }
     }
@@ -1707,7 +1778,154 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
   }
 
   // Get the Full and 16k hash values of the file
-  filechecksummer.GetFileHashes(hashfull, hash16k);
+  filechecksummer.GetFileHashes(scan.hashfull, scan.hash16k);
+
+  return true;
+}
+
+// Assign the blocks found by a scan executed in advance. The scan in advance
+// doesn't see the blocks found in the meantime in other files nor the blocks
+// found earlier in the same file; if one of the recorded blocks was already
+// found the serial scan could choose another block with the same checksum
+// (for example for files with repeated identical blocks) and the file must
+// be scanned again.
+bool Par2Repairer::ApplyScanJob(DiskFile *diskfile, ScanJob &scan)
+{
+  if (blocksallocated)
+  {
+    vector<const VerificationHashEntry*> entries;
+    entries.reserve(scan.matches.size());
+
+    for (vector<pair<const VerificationHashEntry*, u64> >::iterator match = scan.matches.begin();
+         match != scan.matches.end();
+         ++match)
+    {
+      if (match->first->IsSet())
+        return false;
+      entries.push_back(match->first);
+    }
+
+    sort(entries.begin(), entries.end());
+    if (adjacent_find(entries.begin(), entries.end()) != entries.end())
+      return false;
+
+    for (vector<pair<const VerificationHashEntry*, u64> >::iterator match = scan.matches.begin();
+         match != scan.matches.end();
+         ++match)
+    {
+      match->first->SetBlock(diskfile, match->second);
+    }
+  }
+
+  scan.matches.clear();
+
+  return true;
+}
+
+// Scan a data file in advance, can be executed in parallel with other scan jobs.
+void Par2Repairer::RunScanJob(ScanJob *scan)
+{
+  DiskFile diskfile;
+  scan->success = diskfile.Open(scan->filename) &&
+    (diskfile.FileSize() == 0 || ScanDataFileBlocks(&diskfile, *scan, true));
+  diskfile.Close();
+  scan->done = true;
+}
+
+// Create scan jobs for the files and let them scan in advance (in parallel).
+void Par2Repairer::PrepareScanJobs(const vector<pair<string, Par2RepairerSourceFile*> > &files)
+{
+  vector<ScanJob*> jobs;
+
+  for (vector<pair<string, Par2RepairerSourceFile*> >::const_iterator file = files.begin();
+       file != files.end();
+       ++file)
+  {
+    if (scanjobs.find(file->first) == scanjobs.end())
+    {
+      ScanJob *scan = new ScanJob;
+      scan->filename = file->first;
+      scan->preferredfile = file->second;
+      scan->sourcefile = file->second;
+      scanjobs[file->first] = scan;
+      jobs.push_back(scan);
+    }
+  }
+
+  ScanDataFiles(jobs);
+}
+
+void Par2Repairer::FreeScanJobs(void)
+{
+  for (map<string, ScanJob*>::iterator sj = scanjobs.begin(); sj != scanjobs.end(); ++sj)
+  {
+    delete sj->second;
+  }
+  scanjobs.clear();
+}
+
+// Perform a sliding window scan of the DiskFile looking for blocks of data that 
+// might belong to any of the source files (for which a verification packet was
+// available). If a block of data might be from more than one source file, prefer
+// the one specified by the "sourcefile" parameter. If the first data block
+// found is for a different source file then "sourcefile" is changed accordingly.
+bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
+                                Par2RepairerSourceFile* &sourcefile,  // [in/out]
+                                MatchType               &matchtype,   // [out]
+                                MD5Hash                 &hashfull,    // [out]
+                                MD5Hash                 &hash16k,     // [out]
+                                u32                     &count)       // [out]
+{
+  // Remember which file we wanted to match
+  Par2RepairerSourceFile *originalsourcefile = sourcefile;
+
+  matchtype = eNoMatch;
+
+  // Is the file empty
+  if (diskfile->FileSize() == 0)
+  {
+    // If the file is empty, then just return
+    return true;
+  }
+
+  string path;
+  string name;
+  DiskFile::SplitFilename(diskfile->FileName(), path, name);
+
+  sig_filename(name);
+
+  ScanJob  localscan;
+  ScanJob *scan = &localscan;
+
+  // Was the file already scanned in advance
+  map<string, ScanJob*>::iterator sj = scanjobs.find(diskfile->FileName());
+  if (sj != scanjobs.end() && sj->second->done && sj->second->preferredfile == sourcefile &&
+      (!sj->second->success || ApplyScanJob(diskfile, *sj->second)))
+  {
+    scan = sj->second;
+    if (!scan->success)
+      return false;
+  }
+  else
+  {
+    localscan.filename = diskfile->FileName();
+    localscan.sourcefile = sourcefile;
+    if (!ScanDataFileBlocks(diskfile, localscan, false))
+      return false;
+  }
+
+  if (cancelled)
+  {
+    return false;
+  }
+
+  sourcefile = scan->sourcefile;
+  matchtype = scan->matchtype;
+  hashfull = scan->hashfull;
+  hash16k = scan->hash16k;
+  count = scan->count;
+  u32 duplicatecount = scan->duplicatecount;
+  bool multipletargets = scan->multipletargets;
 
   // Did we make any matches at all
   if (count > 0)
@@ -2027,9 +2245,12 @@ bool Par2Repairer::RenameTargetFiles(void)
       // Rename it
       diskFileMap.Remove(targetfile);
 
+      string filename = targetfile->FileName();
       if (!targetfile->Rename())
         return false;
 
+      renamedfiles[filename] = targetfile->FileName();
+
       bool success = diskFileMap.Insert(targetfile);
       assert(success);
 
@@ -2100,7 +2321,7 @@ bool Par2Repairer::CreateTargetFiles(void)
       u64 filesize = sourcefile->GetDescriptionPacket()->FileSize();
 
       // Create the target file
-      if (!targetfile->Create(filename, filesize))
+      if (!CreateTargetFile(targetfile, filename, filesize))
       {
         delete targetfile;
         return false;
@@ -2235,7 +2456,7 @@ bool Par2Repairer::ComputeRSmatrix(void)
   if (missingblockcount == 0)
     return true;
   
-  bool success = rs.Compute(noiselevel);
+  bool success = SolveRSmatrix();
 
   return success;  
 }
@@ -2243,22 +2464,41 @@ bool Par2Repairer::ComputeRSmatrix(void)
 // Allocate memory buffers for reading and writing data to disk.
 bool Par2Repairer::AllocateBuffers(size_t memorylimit)
 {
+  // The output blocks and at least one block per input buffer share the memory limit
+  u32 inputbuffercount = prefetchdepth > 0 ? 2 : 1;
+  u64 reservedblocks = (u64)missingblockcount + inputbuffercount;
+
   // Would single pass processing use too much memory
-  if (blocksize * missingblockcount > memorylimit)
+  if (blocksize * reservedblocks > memorylimit)
   {
     // Pick a size that is small enough
-    chunksize = ~3 & (memorylimit / missingblockcount);
+    chunksize = ~3 & (memorylimit / reservedblocks);
   }
   else
   {
     chunksize = (size_t)blocksize;
   }
 
-  // Allocate the two buffers
-  inputbuffer = new u8[(size_t)chunksize];
+  // The memory left after the output blocks limits the size of the input batches
+  // and how many of them are read ahead; a shallower read-ahead is preferred
+  // over smaller batches
+  u64 freeblocks = memorylimit / chunksize - missingblockcount;
+  while (prefetchdepth > 1 && (u64)inputbatchsize * (prefetchdepth + 1) > freeblocks)
+  {
+    prefetchdepth--;
+  }
+  inputbuffercount = prefetchdepth + 1;
+  if ((u64)inputbatchsize * inputbuffercount > freeblocks)
+  {
+    inputbatchsize = max((u32)1, (u32)(freeblocks / inputbuffercount));
+  }
+
+  // Allocate the buffers
+  inputring = new u8[(size_t)chunksize * inputbatchsize * inputbuffercount];
+  inputbuffer = inputring;
   outputbuffer = new u8[(size_t)chunksize * missingblockcount];
 
-  if (inputbuffer == NULL || outputbuffer == NULL)
+  if (inputring == NULL || outputbuffer == NULL)
   {
     cerr << "Could not allocate buffer memory." << endl;
     return false;
@@ -2267,6 +2507,77 @@ bool Par2Repairer::AllocateBuffers(size_t memorylimit)
   return true;
 }
 
+// Multiply a batch of input blocks into the output blocks. Each output block is
+// processed in tiles of tilesize bytes; a tile stays in the cache while all
+// input blocks of the batch are applied to it.
+void Par2Repairer::RepairBlocks(u32 inputindex, u32 inputcount, size_t blocklength, u32 outputindex, u32 outputcount)
+{
+  size_t tile = tilesize > 0 && tilesize < blocklength ? ~(size_t)3 & tilesize : blocklength;
+
+  for (size_t offset = 0; offset < blocklength; offset += tile)
+  {
+    size_t length = min(tile, blocklength - offset);
+
+    for (u32 output = outputindex; output < outputindex + outputcount; output++)
+    {
+      // Select the appropriate part of the output buffer
+      void *outbuf = &((u8*)outputbuffer)[chunksize * output + offset];
+
+      for (u32 input = 0; input < inputcount; input++)
+      {
+        void *inbuf = &((u8*)inputbuffer)[chunksize * input + offset];
+        rs.Process(length, inputindex + input, inbuf, output, outbuf);
+      }
+    }
+  }
+}
+
+// Read a batch of input blocks into the buffer. Input blocks which also need
+// to be copied to the target files are written back to disk.
+bool Par2Repairer::ReadInputBlocks(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount, void *buffer, u64 &totalwritten)
+{
+  for (u32 index = inputindex; index < inputindex + inputcount; index++)
+  {
+    DataBlock *inputblock = inputblocks[index];
+    void *inbuf = &((u8*)buffer)[chunksize * (index - inputindex)];
+
+    // Are we reading from a new file?
+    if (inputfile != inputblock->GetDiskFile())
+    {
+      // Close the last file
+      if (inputfile != NULL)
+      {
+        inputfile->Close();
+      }
+
+      // Open the new file
+      inputfile = inputblock->GetDiskFile();
+      if (!inputfile->Open())
+      {
+        return false;
+      }
+    }
+
+    // Read data from the current input block
+    if (!inputblock->ReadData(blockoffset, blocklength, inbuf))
+      return false;
+
+    // Does this block need to be copied to the target file
+    if (index < copyblocks.size() && copyblocks[index]->IsSet())
+    {
+      size_t wrote;
+
+      // Write the block back to disk in the new target file
+      if (!copyblocks[index]->WriteData(blockoffset, blocklength, inbuf, wrote))
+        return false;
+
+      totalwritten += wrote;
+    }
+  }
+
+  return true;
+}
+
 // Read source data, process it through the RS matrix and write it to disk.
 bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
 {
@@ -2277,70 +2588,54 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
 
   vector<DataBlock*>::iterator inputblock = inputblocks.begin();
   vector<DataBlock*>::iterator copyblock  = copyblocks.begin();
-  u32                          inputindex = 0;
 
   DiskFile *lastopenfile = NULL;
 
   // Are there any blocks which need to be reconstructed
   if (missingblockcount > 0)
   {
-    // For each input block
-    while (inputblock != inputblocks.end())       
-    {
-      // Are we reading from a new file?
-      if (lastopenfile != (*inputblock)->GetDiskFile())
-      {
-        // Close the last file
-        if (lastopenfile != NULL)
-        {
-          lastopenfile->Close();
-        }
+    u32 inputcount = (u32)inputblocks.size();
+    u32 batchindex = 0;
+    u32 batchcount = min(inputbatchsize, inputcount);
+    size_t ringslotsize = (size_t)chunksize * inputbatchsize;
+    u32 ringslots = prefetchdepth + 1;
 
-        // Open the new file
-        lastopenfile = (*inputblock)->GetDiskFile();
-        if (!lastopenfile->Open())
-        {
-          return false;
-        }
-      }
+    // Read the first batch of input blocks
+    inputbuffer = inputring;
+    bool success = ReadInputBlocks(blockoffset, blocklength, batchindex, batchcount, inputbuffer, totalwritten);
 
-      // Read data from the current input block
-      if (!(*inputblock)->ReadData(blockoffset, blocklength, inputbuffer))
-        return false;
+    u32 readindex = batchcount;   // First input block which is neither read nor being read
+    u32 pendingbatches = 0;       // How many batches are being read in background
 
-      // Have we reached the last source data block
-      if (copyblock != copyblocks.end())
+    // For each batch of input blocks
+    while (success && batchcount > 0)
+    {
+      // Read the next batches into the free slots of the ring while this batch is being processed
+      while (readindex < inputcount && pendingbatches < prefetchdepth && !cancelled)
       {
-        // Does this block need to be copied to the target file
-        if ((*copyblock)->IsSet())
+        u32 readcount = min(inputbatchsize, inputcount - readindex);
+        void *readbuffer = &inputring[ringslotsize * ((readindex / inputbatchsize) % ringslots)];
+        if (!BeginReadInputBlocks(blockoffset, blocklength, readindex, readcount, readbuffer, totalwritten))
         {
-          size_t wrote;
-
-          // Write the block back to disk in the new target file
-          if (!(*copyblock)->WriteData(blockoffset, blocklength, inputbuffer, wrote))
-            return false;
-
-          totalwritten += wrote;
+          break;
         }
-        ++copyblock;
+        readindex += readcount;
+        pendingbatches++;
       }
 
-      if (!RepairData(inputindex, blocklength))
+      if (!RepairData(batchindex, batchcount, blocklength))
       {
       // For each output block
       for (u32 outputindex=0; outputindex<missingblockcount; outputindex++)
       {
-        // Select the appropriate part of the output buffer
-        void *outbuf = &((u8*)outputbuffer)[chunksize * outputindex];
-
         // Process the data
-        rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf);
+        RepairBlocks(batchindex, batchcount, blocklength, outputindex, 1);
 
         if (noiselevel > CommandLine::nlQuiet)
         {
           // Update a progress indicator
           u32 oldfraction = (u32)(1000 * progress / totaldata);
-          progress += blocklength;
+          progress += blocklength * batchcount;
           u32 newfraction = (u32)(1000 * progress / totaldata);
 
           if (oldfraction != newfraction)
@@ -2357,13 +2652,49 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
       }
       }
 
+      u32 nextindex = batchindex + batchcount;
+      u32 nextcount = min(inputbatchsize, inputcount - nextindex);
+
+      // The slot of the next batch becomes the input buffer
+      inputbuffer = &inputring[ringslotsize * ((nextindex / inputbatchsize) % ringslots)];
+
+      if (pendingbatches > 0)
+      {
+        // The next batch is the oldest one being read in background
+        success = EndReadInputBlocks();
+        pendingbatches--;
+      }
+      else if (nextcount > 0 && !cancelled)
+      {
+        success = ReadInputBlocks(blockoffset, blocklength, nextindex, nextcount, inputbuffer, totalwritten);
+        readindex += nextcount;
+      }
+
       if (cancelled)
       {
         break;
       }
 
-      ++inputblock;
-      ++inputindex;
+      batchindex = nextindex;
+      batchcount = nextcount;
+    }
+
+    // Wait for the batches still being read before the buffers can be reused
+    for (; pendingbatches > 0; pendingbatches--)
+    {
+      EndReadInputBlocks();
+    }
+
+    // Close the last file
+    if (inputfile != NULL)
+    {
+      inputfile->Close();
+      inputfile = NULL;
+    }
+
+    if (!success)
+    {
+      return false;
     }
   }
   else
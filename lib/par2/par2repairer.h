@@ -22,6 +22,59 @@
 
 #include "parheaders.h"
 
+// A scan of a data file which is executed in advance, possibly in parallel
+// with scans of other files. The found blocks are assigned to the source
+// files later, in the same order as during the serial verification.
+struct ScanJob
+{
+  ScanJob(void) : preferredfile(0), sourcefile(0), done(false), success(false),
+    matchtype(eNoMatch), count(0), duplicatecount(0), multipletargets(false) {}
+
+  string                    filename;          // The file to scan
+  Par2RepairerSourceFile   *preferredfile;     // The source file the data file is expected to match
+  Par2RepairerSourceFile   *sourcefile;        // The source file matched
+  bool                      done;              // Whether the scan was executed
+  bool                      success;           // Whether the file could be read
+  MatchType                 matchtype;         // The type of match
+  MD5Hash                   hashfull;          // The full hash of the file
+  MD5Hash                   hash16k;           // The hash of the first 16k
+  u32                       count;             // The number of blocks found
+  u32                       duplicatecount;    // The number of blocks already found in other files
+  bool                      multipletargets;   // Whether blocks of several source files were found
+
+  vector<pair<const VerificationHashEntry*, u64> > matches; // Found blocks and their offsets
+};
+
+// The position and header of a valid packet found in a PAR2 file
+struct PacketIndexEntry
+{
+  u64           offset;
+  PACKET_HEADER header;
+};
+
+typedef vector<PacketIndexEntry> PacketIndex;
+
+// Searches a PAR2 file for packets; only packets with a correct hash are returned
+class PacketScanner
+{
+public:
+  PacketScanner(DiskFile *diskfile);
+  ~PacketScanner(void);
+
+  // Find the next packet; returns false if there are no more packets
+  bool Next(PacketIndexEntry &entry);
+
+  // The position reached in the file
+  u64 Offset(void) const {return offset;}
+
+protected:
+  DiskFile *diskfile;
+  u64       filesize;
+  u64       offset;
+  size_t    buffersize;
+  u8       *buffer;
+};
+
 class Par2Repairer
 {
 public:
@@ -36,6 +89,12 @@ protected:
 
   // Load packets from the specified file
   bool LoadPacketsFromFile(string filename);
+  // Load one packet found in a file, if it is from the correct set
+  bool LoadPacket(DiskFile *diskfile, u64 offset, PACKET_HEADER &header, u32 &packets, u32 &recoverypackets);
+  // Get the packets of a file which was scanned before; returns false if the file must be scanned
+  virtual bool FindPacketIndex(const string &filename, PacketIndex &index) { return false; }
+  // Remember the packets found while scanning a file
+  virtual void StorePacketIndex(const string &filename, const PacketIndex &index) {}
   // Finish loading a recovery packet
   bool LoadRecoveryPacket(DiskFile *diskfile, u64 offset, PACKET_HEADER &header);
   // Finish loading a file description packet
@@ -93,6 +152,24 @@ protected:
                     MD5Hash                 &hash16k,    // [out]    The hash of the first 16k
                     u32                     &count);     // [out]    The number of blocks found
 
+  // Perform the sliding window scan for ScanDataFile, optionally only recording the found blocks
+  bool ScanDataFileBlocks(DiskFile *diskfile, ScanJob &scan, bool record);
+
+  // Assign the blocks found by a scan executed in advance; returns false
+  // if the file must be scanned again
+  bool ApplyScanJob(DiskFile *diskfile, ScanJob &scan);
+
+  // Create scan jobs for the files and let ScanDataFiles execute them
+  void PrepareScanJobs(const vector<pair<string, Par2RepairerSourceFile*> > &files);
+  void FreeScanJobs(void);
+
+  // Scan a data file in advance (thread safe)
+  void RunScanJob(ScanJob *scan);
+
+  // Execute scan jobs in advance, for example in several threads; jobs which
+  // are not executed are scanned during normal verification.
+  virtual void ScanDataFiles(vector<ScanJob*> &jobs) {}
+
   // Find out how much data we have found
   void UpdateVerificationResults(void);
 
@@ -106,10 +183,16 @@ protected:
   // target DataBlocks to them, and remember them for later verification.
   bool CreateTargetFiles(void);
 
+  // Create one target file
+  virtual bool CreateTargetFile(DiskFile *targetfile, string filename, u64 filesize) { return targetfile->Create(filename, filesize); }
+
   // Work out which data blocks are available, which need to be copied
   // directly to the output, and which need to be recreated, and compute
   // the appropriate Reed Solomon matrix.
-  bool ComputeRSmatrix(void);
+  virtual bool ComputeRSmatrix(void);
+
+  // Solve the Reed Solomon matrix
+  virtual bool SolveRSmatrix(void) { return rs.Compute(noiselevel, rsparallel); }
 
   // Allocate memory buffers for reading and writing data to disk.
   bool AllocateBuffers(size_t memorylimit);
@@ -117,11 +200,18 @@ protected:
   // Read source data, process it through the RS matrix and write it to disk.
   bool ProcessData(u64 blockoffset, size_t blocklength);
 
+  // Read a batch of input blocks into the buffer and copy blocks to the target files.
+  bool ReadInputBlocks(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount, void *buffer, u64 &totalwritten);
+
+  // Process a batch of input blocks (already in the input buffer) into a range
+  // of output blocks, tile by tile.
+  void RepairBlocks(u32 inputindex, u32 inputcount, size_t blocklength, u32 outputindex, u32 outputcount);
+
   // Verify that all of the reconstructed target files are now correct
   bool VerifyTargetFiles(void);
 
   // Delete all of the partly reconstructed files
-  bool DeleteIncompleteTargetFiles(void);
+  virtual bool DeleteIncompleteTargetFiles(void);
 
   // Signals
   virtual void sig_filename(std::string filename) {}
@@ -135,8 +225,24 @@ protected:
   // Repair ended
   virtual void EndRepair() {}
 
-  // Repair chunk of data (returns "true" if repaired or "false" if default repair-routine should be used)
-  virtual bool RepairData(u32 inputindex, size_t blocklength) { return false; }
+  // Get the offset within the blocks from which an interrupted repair continues
+  virtual u64 ResumeRepair() { return 0; }
+
+  // The data of all blocks up to the offset was written to the target files
+  virtual void ChunkCompleted(u64 blockoffset) {}
+
+  // Start reading of a batch of input blocks in background, see ReadInputBlocks
+  // (returns "true" if started or "false" if the blocks should be read synchronously).
+  // Several batches can be started before the first of them is finished.
+  virtual bool BeginReadInputBlocks(u64 blockoffset, size_t blocklength, u32 inputindex, u32 inputcount, void *buffer, u64 &totalwritten) { return false; }
+
+  // Wait until the background reading of the oldest started batch is finished
+  // (returns result of ReadInputBlocks)
+  virtual bool EndReadInputBlocks() { return false; }
+
+  // Repair chunk of data for a batch of input blocks
+  // (returns "true" if repaired or "false" if default repair-routine should be used)
+  virtual bool RepairData(u32 inputindex, u32 inputcount, size_t blocklength) { return false; }
 
 protected:
   ParHeaders* headers;                                 // Headers
@@ -157,6 +263,7 @@ protected:
   map<MD5Hash,Par2RepairerSourceFile*> sourcefilemap;// Map from FileId to SourceFile
   vector<Par2RepairerSourceFile*>      sourcefiles;  // The source files
   vector<Par2RepairerSourceFile*>      verifylist;   // Those source files that are being repaired
+  map<string, string>                  renamedfiles; // Damaged target files renamed before repair
 
   u64                       blocksize;               // The block size.
   u64                       chunksize;               // How much of a block can be processed.
@@ -185,14 +292,24 @@ protected:
   vector<DataBlock*>        outputblocks;            // Which DataBlocks have to calculated using RS
 
   ReedSolomon<Galois16>     rs;                      // The Reed Solomon matrix.
+  RSParallel               *rsparallel;              // Used to solve the matrix in several threads (optional).
 
-  void                     *inputbuffer;             // Buffer for reading DataBlocks (chunksize)
+  void                     *inputbuffer;             // Buffer of the batch being processed (part of inputring)
   void                     *outputbuffer;            // Buffer for writing DataBlocks (chunksize * missingblockcount)
 
+  u32                       inputbatchsize;          // How many input blocks are read and processed at once.
+  u32                       prefetchdepth;           // How many batches are read ahead while the current one is processed.
+  u8                       *inputring;               // Buffers for the batch being processed and the batches read ahead
+                                                     // (chunksize * inputbatchsize * (prefetchdepth + 1))
+  DiskFile                 *inputfile;               // The file currently open for reading input blocks
+  size_t                    tilesize;                // How much of an output block is processed at once (0 - whole chunk).
+
   u64                       progress;                // How much data has been processed.
   u64                       totaldata;               // Total amount of data to be processed.
   u64                       totalsize;               // Total data size
 
+  map<string, ScanJob*>     scanjobs;                // Files scanned in advance
+
   bool                      cancelled;               // repair cancelled
 };
 
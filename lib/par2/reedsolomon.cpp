@@ -267,6 +267,147 @@ template <> bool ReedSolomon<Galois16>::SetInput(u32 count)
   return true;
 }
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define GF16_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef GF16_SIMD
+// Multiplication by a constant factor is linear in GF(2^16), so the product
+// of a source word is the XOR of the products of its four nibbles. For each
+// nibble position build two 16-entry tables (low and high byte of the product),
+// which fit into a single SSE register and can be looked up with PSHUFB.
+static void BuildNibbleTables(Galois16 factor, u8 *tables)
+{
+  for (unsigned int i=0; i<4; i++)
+  {
+    for (unsigned int n=0; n<16; n++)
+    {
+      u16 product = Galois16((u16)(n << (4*i))) * factor;
+      tables[(0+i)*16 + n] = (u8)(product & 0xff);
+      tables[(4+i)*16 + n] = (u8)(product >> 8);
+    }
+  }
+}
+
+// Process blocks of 32 bytes, returns the number of processed bytes
+__attribute__((target("ssse3")))
+static size_t ProcessSSSE3(const u8 *tables, size_t size, const u8 *src, u8 *dst)
+{
+  __m128i tl0 = _mm_loadu_si128((const __m128i*)&tables[0*16]);
+  __m128i tl1 = _mm_loadu_si128((const __m128i*)&tables[1*16]);
+  __m128i tl2 = _mm_loadu_si128((const __m128i*)&tables[2*16]);
+  __m128i tl3 = _mm_loadu_si128((const __m128i*)&tables[3*16]);
+  __m128i th0 = _mm_loadu_si128((const __m128i*)&tables[4*16]);
+  __m128i th1 = _mm_loadu_si128((const __m128i*)&tables[5*16]);
+  __m128i th2 = _mm_loadu_si128((const __m128i*)&tables[6*16]);
+  __m128i th3 = _mm_loadu_si128((const __m128i*)&tables[7*16]);
+
+  // gathers low bytes of words into lower half and high bytes into upper half
+  __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  __m128i mask = _mm_set1_epi8(0x0f);
+
+  size_t length = size & ~(size_t)31;
+
+  for (size_t i=0; i<length; i+=32)
+  {
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i]), deinterleave);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i+16]), deinterleave);
+    __m128i lo = _mm_unpacklo_epi64(a, b);
+    __m128i hi = _mm_unpackhi_epi64(a, b);
+
+    __m128i n0 = _mm_and_si128(lo, mask);
+    __m128i n1 = _mm_and_si128(_mm_srli_epi16(lo, 4), mask);
+    __m128i n2 = _mm_and_si128(hi, mask);
+    __m128i n3 = _mm_and_si128(_mm_srli_epi16(hi, 4), mask);
+
+    __m128i rl = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(tl0, n0), _mm_shuffle_epi8(tl1, n1)),
+                               _mm_xor_si128(_mm_shuffle_epi8(tl2, n2), _mm_shuffle_epi8(tl3, n3)));
+    __m128i rh = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(th0, n0), _mm_shuffle_epi8(th1, n1)),
+                               _mm_xor_si128(_mm_shuffle_epi8(th2, n2), _mm_shuffle_epi8(th3, n3)));
+
+    __m128i d0 = _mm_loadu_si128((const __m128i*)&dst[i]);
+    __m128i d1 = _mm_loadu_si128((const __m128i*)&dst[i+16]);
+    _mm_storeu_si128((__m128i*)&dst[i], _mm_xor_si128(d0, _mm_unpacklo_epi8(rl, rh)));
+    _mm_storeu_si128((__m128i*)&dst[i+16], _mm_xor_si128(d1, _mm_unpackhi_epi8(rl, rh)));
+  }
+
+  return length;
+}
+
+// Same as ProcessSSSE3 but with 256-bit registers, processes blocks of 64 bytes.
+// PSHUFB and unpack work within 128-bit lanes, which keeps the word order intact.
+__attribute__((target("avx2")))
+static size_t ProcessAVX2(const u8 *tables, size_t size, const u8 *src, u8 *dst)
+{
+  __m256i tl0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[0*16]));
+  __m256i tl1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[1*16]));
+  __m256i tl2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[2*16]));
+  __m256i tl3 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[3*16]));
+  __m256i th0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[4*16]));
+  __m256i th1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[5*16]));
+  __m256i th2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[6*16]));
+  __m256i th3 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&tables[7*16]));
+
+  __m256i deinterleave = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+
+  size_t length = size & ~(size_t)63;
+
+  for (size_t i=0; i<length; i+=64)
+  {
+    __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i]), deinterleave);
+    __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i+32]), deinterleave);
+    __m256i lo = _mm256_unpacklo_epi64(a, b);
+    __m256i hi = _mm256_unpackhi_epi64(a, b);
+
+    __m256i n0 = _mm256_and_si256(lo, mask);
+    __m256i n1 = _mm256_and_si256(_mm256_srli_epi16(lo, 4), mask);
+    __m256i n2 = _mm256_and_si256(hi, mask);
+    __m256i n3 = _mm256_and_si256(_mm256_srli_epi16(hi, 4), mask);
+
+    __m256i rl = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(tl0, n0), _mm256_shuffle_epi8(tl1, n1)),
+                                  _mm256_xor_si256(_mm256_shuffle_epi8(tl2, n2), _mm256_shuffle_epi8(tl3, n3)));
+    __m256i rh = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(th0, n0), _mm256_shuffle_epi8(th1, n1)),
+                                  _mm256_xor_si256(_mm256_shuffle_epi8(th2, n2), _mm256_shuffle_epi8(th3, n3)));
+
+    __m256i d0 = _mm256_loadu_si256((const __m256i*)&dst[i]);
+    __m256i d1 = _mm256_loadu_si256((const __m256i*)&dst[i+32]);
+    _mm256_storeu_si256((__m256i*)&dst[i], _mm256_xor_si256(d0, _mm256_unpacklo_epi8(rl, rh)));
+    _mm256_storeu_si256((__m256i*)&dst[i+32], _mm256_xor_si256(d1, _mm256_unpackhi_epi8(rl, rh)));
+  }
+
+  return length;
+}
+
+// 1 - no simd, 2 - ssse3, 3 - avx2
+static int DetectSimdLevel()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? 3 : __builtin_cpu_supports("ssse3") ? 2 : 1;
+}
+
+// Multiply-accumulate with the best available instruction set.
+// Returns the number of processed bytes, the rest must be processed by the caller.
+static size_t ProcessSimd(Galois16 factor, size_t size, const u8 *src, u8 *dst)
+{
+  // initialized once, also if several repair threads get here at the same time
+  static const int simdlevel = DetectSimdLevel();
+
+  if (simdlevel == 1 || size < 32)
+    return 0;
+
+  u8 tables[8*16];
+  BuildNibbleTables(factor, tables);
+
+  size_t done = 0;
+  if (simdlevel == 3)
+    done = ProcessAVX2(tables, size, src, dst);
+  return done + ProcessSSSE3(tables, size - done, src + done, dst + done);
+}
+#endif
+
 template <> bool ReedSolomon<Galois16>::Process(size_t size, u32 inputindex, const void *inputbuffer, u32 outputindex, void *outputbuffer)
 {
   // Look up the appropriate element in the RS matrix
@@ -277,6 +418,17 @@ template <> bool ReedSolomon<Galois16>::Process(size_t size, u32 inputindex, con
     return eSuccess;
 
 #ifdef LONGMULTIPLY
+#ifdef GF16_SIMD
+  size_t done = ProcessSimd(factor, size, (const u8*)inputbuffer, (u8*)outputbuffer);
+  if (done == size)
+    return eSuccess;
+
+  // The tail is processed with lookup tables
+  size -= done;
+  inputbuffer = &((const u8*)inputbuffer)[done];
+  outputbuffer = &((u8*)outputbuffer)[done];
+#endif
+
   // The 8-bit long multiplication tables
   Galois16 *table = glmt->tables;
 
@@ -369,3 +521,21 @@ template <> bool ReedSolomon<Galois16>::Process(size_t size, u32 inputindex, con
   return eSuccess;
 }
 
+
+// Rows of the RS matrix are multiplied and subtracted (added) the same way
+// as the data blocks, which is much faster for large matrices.
+template <> void ReedSolomon<Galois16>::RowMultiplySubtract(Galois16 factor, const Galois16 *src, Galois16 *dst, unsigned int count)
+{
+  if (factor == 0)
+    return;
+
+  unsigned int col = 0;
+#ifdef GF16_SIMD
+  col = (unsigned int)(ProcessSimd(factor, count * sizeof(Galois16), (const u8*)src, (u8*)dst) / sizeof(Galois16));
+#endif
+
+  for (; col<count; col++)
+  {
+    dst[col] -= src[col] * factor;
+  }
+}
@@ -38,6 +38,29 @@ public:
   u16 exponent;
 };
 
+// When the RS matrix is solved, the pivot column is eliminated from all other
+// rows of the matrix, which is done independently for each row. RSParallel
+// allows to distribute these rows to several threads, the default
+// implementation processes them in the calling thread.
+
+class RSRowJob
+{
+public:
+  virtual ~RSRowJob(void) {}
+
+  // Process the rows [firstrow, lastrow)
+  virtual void ProcessRows(u32 firstrow, u32 lastrow) = 0;
+};
+
+class RSParallel
+{
+public:
+  virtual ~RSParallel(void) {}
+
+  // Process all rows of the job and return when done
+  virtual void Run(RSRowJob &job, u32 rows) {job.ProcessRows(0, rows);}
+};
+
 template<class g>
 class ReedSolomon
 {
@@ -55,8 +78,13 @@ public:
   bool SetOutput(bool present, u16 exponent);
   bool SetOutput(bool present, u16 lowexponent, u16 highexponent);
 
-  // Compute the RS Matrix
-  bool Compute(CommandLine::NoiseLevel noiselevel);
+  // Compute the RS Matrix (optionally solving it in several threads)
+  bool Compute(CommandLine::NoiseLevel noiselevel, RSParallel *parallel = 0);
+
+  // Get the solved RS Matrix or use a matrix solved before for the same
+  // input and output blocks instead of computing it
+  const G* GetMatrix(u32 &rows, u32 &cols) const;
+  bool SetMatrix(const G *matrix, u32 rows, u32 cols);
 
   // Process a block of data
   bool Process(size_t size,             // The size of the block of data
@@ -72,7 +100,28 @@ protected:
                  unsigned int leftcols, 
                  G *leftmatrix, 
                  G *rightmatrix, 
-                 unsigned int datamissing);
+                 unsigned int datamissing,
+                 RSParallel *parallel);
+
+  // Subtract "count" values of "src" multiplied by "factor" from "dst"
+  static void RowMultiplySubtract(G factor, const G *src, G *dst, unsigned int count);
+
+  // Elimination of the pivot column from other rows during Gaussian Elimination
+  class RowElimination : public RSRowJob
+  {
+  public:
+    RowElimination(unsigned int _row, unsigned int _rows, unsigned int _leftcols, G *_leftmatrix, G *_rightmatrix)
+      : row(_row), rows(_rows), leftcols(_leftcols), leftmatrix(_leftmatrix), rightmatrix(_rightmatrix) {}
+
+    virtual void ProcessRows(u32 firstrow, u32 lastrow);
+
+  protected:
+    unsigned int row;
+    unsigned int rows;
+    unsigned int leftcols;
+    G *leftmatrix;
+    G *rightmatrix;
+  };
 
 protected:
   u32 inputcount;        // Total number of input blocks
@@ -185,9 +234,34 @@ inline bool ReedSolomon<g>::SetOutput(bool present, u16 lowexponent, u16 highexp
   return true;
 }
 
+template<class g>
+inline const typename ReedSolomon<g>::G* ReedSolomon<g>::GetMatrix(u32 &rows, u32 &cols) const
+{
+  rows = datamissing + parmissing;
+  cols = datapresent + datamissing;
+
+  return leftmatrix;
+}
+
+template<class g>
+inline bool ReedSolomon<g>::SetMatrix(const G *matrix, u32 rows, u32 cols)
+{
+  u32 outcount = datamissing + parmissing;
+  u32 incount = datapresent + datamissing;
+
+  if (rows != outcount || cols != incount || outcount == 0)
+    return false;
+
+  delete [] leftmatrix;
+  leftmatrix = new G[outcount * incount];
+  std::copy(matrix, matrix + outcount * incount, leftmatrix);
+
+  return true;
+}
+
 // Construct the Vandermonde matrix and solve it if necessary
 template<class g>
-inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
+inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel, RSParallel *parallel)
 {
   u32 outcount = datamissing + parmissing;
   u32 incount = datapresent + datamissing;
@@ -334,7 +408,7 @@ inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
   {
     // Perform Gaussian Elimination and then delete the right matrix (which 
     // will no longer be required).
-    bool success = GaussElim(noiselevel, outcount, incount, leftmatrix, rightmatrix, datamissing);
+    bool success = GaussElim(noiselevel, outcount, incount, leftmatrix, rightmatrix, datamissing, parallel);
     delete [] rightmatrix;
     return success;
   }
@@ -342,9 +416,57 @@ inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
   return true;
 }
 
+// Subtract a multiple of one row from another
+template<class g>
+inline void ReedSolomon<g>::RowMultiplySubtract(G factor, const G *src, G *dst, unsigned int count)
+{
+  if (factor == 1)
+  {
+    // If the scaling factor happens to be 1, just subtract rows
+    for (unsigned int col=0; col<count; col++)
+    {
+      if (src[col] != 0)
+      {
+        dst[col] -= src[col];
+      }
+    }
+  }
+  else if (factor != 0)
+  {
+    // If the scaling factor is not 0, then compute accordingly.
+    for (unsigned int col=0; col<count; col++)
+    {
+      if (src[col] != 0)
+      {
+        dst[col] -= src[col] * factor;
+      }
+    }
+  }
+}
+
+// GF(2^16) rows are processed with the SIMD routines used for data blocks
+template <> void ReedSolomon<Galois16>::RowMultiplySubtract(Galois16 factor, const Galois16 *src, Galois16 *dst, unsigned int count);
+
+// Eliminate the pivot column from the rows [firstrow, lastrow) except the pivot row itself
+template<class g>
+inline void ReedSolomon<g>::RowElimination::ProcessRows(u32 firstrow, u32 lastrow)
+{
+  for (unsigned int row2=firstrow; row2<lastrow; row2++)
+  {
+    if (row != row2)
+    {
+      // Get the scaling factor for this row.
+      G scalevalue = rightmatrix[row2 * rows + row];
+
+      RowMultiplySubtract(scalevalue, &leftmatrix[row * leftcols], &leftmatrix[row2 * leftcols], leftcols);
+      RowMultiplySubtract(scalevalue, &rightmatrix[row * rows + row], &rightmatrix[row2 * rows + row], rows - row);
+    }
+  }
+}
+
 // Use Gaussian Elimination to solve the matrices
 template<class g>
-inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing)
+inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing, RSParallel *parallel)
 {
   if (noiselevel == CommandLine::nlDebug)
   {
@@ -417,63 +539,25 @@ inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsign
       }
     }
 
-    // For every other row in the matrix
-    for (unsigned int row2=0; row2<rows; row2++)
+    if (noiselevel > CommandLine::nlQuiet)
     {
-      if (noiselevel > CommandLine::nlQuiet)
+      int newprogress = row * 1000 / datamissing;
+      if (progress != newprogress)
       {
-        int newprogress = (row*rows+row2) * 1000 / (datamissing*rows);
-        if (progress != newprogress)
-        {
-          progress = newprogress;
-          cout << "Solving: " << progress/10 << '.' << progress%10 << "%\r" << flush;
-        }
+        progress = newprogress;
+        cout << "Solving: " << progress/10 << '.' << progress%10 << "%\r" << flush;
       }
+    }
 
-      if (row != row2)
-      {
-        // Get the scaling factor for this row.
-        G scalevalue = rightmatrix[row2 * rows + row];
-
-        if (scalevalue == 1)
-        {
-          // If the scaling factor happens to be 1, just subtract rows
-          for (unsigned int col=0; col<leftcols; col++)
-          {
-            if (leftmatrix[row * leftcols + col] != 0)
-            {
-              leftmatrix[row2 * leftcols + col] -= leftmatrix[row * leftcols + col];
-            }
-          }
-
-          for (unsigned int col=row; col<rows; col++)
-          {
-            if (rightmatrix[row * rows + col] != 0)
-            {
-              rightmatrix[row2 * rows + col] -= rightmatrix[row * rows + col];
-            }
-          }
-        }
-        else if (scalevalue != 0)
-        {
-          // If the scaling factor is not 0, then compute accordingly.
-          for (unsigned int col=0; col<leftcols; col++)
-          {
-            if (leftmatrix[row * leftcols + col] != 0)
-            {
-              leftmatrix[row2 * leftcols + col] -= leftmatrix[row * leftcols + col] * scalevalue;
-            }
-          }
-
-          for (unsigned int col=row; col<rows; col++)
-          {
-            if (rightmatrix[row * rows + col] != 0)
-            {
-              rightmatrix[row2 * rows + col] -= rightmatrix[row * rows + col] * scalevalue;
-            }
-          }
-        }
-      }
+    // For every other row in the matrix
+    RowElimination job(row, rows, leftcols, leftmatrix, rightmatrix);
+    if (parallel)
+    {
+      parallel->Run(job, rows);
+    }
+    else
+    {
+      job.ProcessRows(0, rows);
     }
   }
   if (noiselevel > CommandLine::nlQuiet)
@@ -31,6 +31,8 @@ VerificationHashTable::VerificationHashTable(void)
 {
   hashmask = 0;
   hashtable = 0;
+  filter = 0;
+  filtershift = 0;
 }
 
 VerificationHashTable::~VerificationHashTable(void)
@@ -38,30 +40,43 @@ VerificationHashTable::~VerificationHashTable(void)
   // Destroy the hash table
   if (hashtable)
   {
-    for (unsigned int entry=0; entry<=hashmask; entry++)
+    for (unsigned int slot=0; slot<=hashmask; slot++)
     {
-      delete hashtable[entry];
+      delete hashtable[slot].entry;
     }
   }
 
   delete [] hashtable;
+  delete [] filter;
 }
 
 // Allocate the hash table with a reasonable size
 void VerificationHashTable::SetLimit(u32 limit)
 {
-  // Pick a good size for the hash table
+  // Pick a size for the hash table which keeps it at most half full
   hashmask = 256;
-  while (hashmask < limit && hashmask < 65536)
+  while (hashmask < 2 * (u64)limit)
   {
     hashmask <<= 1;
   }
 
   // Allocate and clear the hash table
-  hashtable = new VerificationHashEntry*[hashmask];
+  hashtable = new Slot[hashmask];
   memset(hashtable, 0, hashmask * sizeof(hashtable[0]));
 
   hashmask--;
+
+  // The filter has 16 bits per entry, at least 64k bits
+  unsigned int filterbits = 65536;
+  filtershift = 16;
+  while (filterbits < 16 * (u64)limit && filtershift > 0)
+  {
+    filterbits <<= 1;
+    filtershift--;
+  }
+
+  filter = new u32[filterbits / 32];
+  memset(filter, 0, filterbits / 8);
 }
 
 // Load data from a verification packet
@@ -91,7 +106,12 @@ void VerificationHashTable::Load(Par2RepairerSourceFile *sourcefile, u64 blocksi
                                                              verificationentry);
 
     // Insert the entry in the hash table
-    entry->Insert(&hashtable[entry->Checksum() & hashmask]);
+    Slot *slot = FindSlot(entry->Checksum());
+    slot->crc = entry->Checksum();
+    entry->Insert(&slot->entry);
+
+    u32 bit = entry->Checksum() >> filtershift;
+    filter[bit >> 5] |= 1u << (bit & 31);
 
     // Make the previous entry point forwards to this one
     if (preventry)
@@ -23,8 +23,9 @@
 class Par2RepairerSourceFile;
 class VerificationHashTable;
 
-// The VerificationHashEntry objects form the nodes of a binary trees stored
-// in a VerificationHashTable object.
+// The VerificationHashEntry objects with the same crc form the nodes of a
+// binary tree (ordered by hash) stored in one slot of a VerificationHashTable
+// object.
 
 // There is one VerificationHashEntry object for each data block in the original
 // source files.
@@ -57,9 +58,6 @@ public:
   // Insert the current object is a child of the specified parent
   void Insert(VerificationHashEntry **parent);
 
-  // Search (starting at the specified parent) for an object with a matching crc
-  static const VerificationHashEntry* Search(const VerificationHashEntry *entry, u32 crc);
-
   // Search (starting at the specified parent) for an object with a matching hash
   static const VerificationHashEntry* Search(const VerificationHashEntry *entry, const MD5Hash &hash);
 
@@ -154,28 +152,6 @@ inline void VerificationHashEntry::Insert(VerificationHashEntry **parent)
   *parent = this;
 }
 
-// Search the tree for an entry with the correct crc
-inline const VerificationHashEntry* VerificationHashEntry::Search(const VerificationHashEntry *entry, u32 crc)
-{
-  while (entry)
-  {
-    if (entry->crc < crc)
-    {
-      entry = entry->right;
-    }
-    else if (entry->crc > crc)
-    {
-      entry = entry->left;
-    }
-    else
-    {
-      break;
-    }
-  }
-
-  return entry;
-}
-
 // Search the tree for an entry with the correct hash
 inline const VerificationHashEntry* VerificationHashEntry::Search(const VerificationHashEntry *entry, const MD5Hash &hash)
 {
@@ -207,6 +183,14 @@ inline const VerificationHashEntry* VerificationHashEntry::Search(const Verifica
 // It is initialised by loading data from all available verification packets for the
 // source files.
 
+// The table is a flat array of slots using open addressing with linear probing.
+// Each slot holds a crc and the tree of entries with that crc. The table is
+// kept at most half full so that a lookup usually inspects only one slot,
+// without touching the entries themselves. In addition a small bit filter
+// (16 bits per entry) allows to reject most crcs which are not in the table
+// (which happens at almost every byte offset when scanning damaged files)
+// without a lookup.
+
 class VerificationHashTable
 {
 public:
@@ -232,6 +216,9 @@ public:
                                          FileCheckSummer &checksummer,
                                          bool &duplicate) const;
 
+  // Quick test if there may be an entry with the crc
+  bool MayContain(u32 crc) const;
+
   // Look up based on the block crc
   const VerificationHashEntry* Lookup(u32 crc) const;
 
@@ -240,16 +227,47 @@ public:
                                       const MD5Hash &hash);
 
 protected:
-  VerificationHashEntry **hashtable;
+  struct Slot
+  {
+    u32                    crc;
+    VerificationHashEntry *entry;
+  };
+
+  // Find the slot for the crc: either the one holding the crc or the empty
+  // slot where it would be inserted
+  Slot* FindSlot(u32 crc) const;
+
+  Slot *hashtable;
   unsigned int hashmask;
+
+  u32 *filter;
+  unsigned int filtershift;
 };
 
+inline bool VerificationHashTable::MayContain(u32 crc) const
+{
+  u32 bit = crc >> filtershift;
+  return (filter[bit >> 5] & (1u << (bit & 31))) != 0;
+}
+
+inline VerificationHashTable::Slot* VerificationHashTable::FindSlot(u32 crc) const
+{
+  Slot *slot = &hashtable[crc & hashmask];
+
+  while (slot->entry && slot->crc != crc)
+  {
+    slot = &hashtable[(slot - hashtable + 1) & hashmask];
+  }
+
+  return slot;
+}
+
 // Search for an entry with the specified crc
 inline const VerificationHashEntry* VerificationHashTable::Lookup(u32 crc) const
 {
-  if (hashmask)
+  if (hashtable)
   {
-    return VerificationHashEntry::Search(hashtable[crc & hashmask], crc);
+    return FindSlot(crc)->entry;
   }
 
   return 0;
@@ -316,7 +334,7 @@ inline const VerificationHashEntry* VerificationHashTable::FindMatch(const Verif
   }
 
   // Look for other possible matches for the checksum
-  const VerificationHashEntry *nextentry = VerificationHashEntry::Search(hashtable[crc & hashmask], crc);
+  const VerificationHashEntry *nextentry = FindSlot(crc)->entry;
   if (0 == nextentry)
     return 0;
 
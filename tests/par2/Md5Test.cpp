@@ -0,0 +1,89 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "par2cmdline.h"
+
+#include "Par2Test.h"
+
+/*
+ * UpdateMulti must produce the same hashes as Update for any number of
+ * contexts, also if some of the contexts have a partial block pending
+ * and if the length is not a multiple of the MD5 block size.
+ */
+void TestMd5()
+{
+	const int MAX_CONTEXTS = 9;
+	const size_t lengths[] = { 0, 1, 63, 64, 65, 127, 128, 1000, 4096, 16384 + 17 };
+	const size_t prefixes[] = { 0, 1, 31, 64, 100 };
+
+	unsigned char* pData = new unsigned char[MAX_CONTEXTS * 20000];
+	FillTestData(pData, MAX_CONTEXTS * 20000, 1);
+
+	for (unsigned int iCount = 1; iCount <= MAX_CONTEXTS; iCount++)
+	{
+		for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+		{
+			for (unsigned int p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++)
+			{
+				MD5Context multi[MAX_CONTEXTS];
+				MD5Context single[MAX_CONTEXTS];
+				MD5Context* contexts[MAX_CONTEXTS];
+				const void* buffers[MAX_CONTEXTS];
+
+				for (unsigned int i = 0; i < iCount; i++)
+				{
+					// different contexts have different amounts of pending data
+					size_t iPrefix = prefixes[(p + i) % (sizeof(prefixes) / sizeof(prefixes[0]))];
+					const unsigned char* pStream = pData + i * 20000;
+					multi[i].Update(pStream, iPrefix);
+					single[i].Update(pStream, iPrefix);
+					contexts[i] = &multi[i];
+					// the last two contexts share the same buffer
+					buffers[i] = i > 0 && i == iCount - 1 ? buffers[i - 1] : pStream + iPrefix;
+				}
+
+				for (unsigned int i = 0; i < iCount; i++)
+				{
+					single[i].Update(buffers[i], lengths[l]);
+				}
+				MD5Context::UpdateMulti(contexts, buffers, iCount, lengths[l]);
+
+				for (unsigned int i = 0; i < iCount; i++)
+				{
+					MD5Hash hashMulti, hashSingle;
+					multi[i].Final(hashMulti);
+					single[i].Final(hashSingle);
+					CHECK(hashMulti == hashSingle);
+				}
+			}
+		}
+	}
+
+	delete[] pData;
+}
@@ -0,0 +1,62 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "Par2Test.h"
+
+int g_iChecks = 0;
+int g_iFailures = 0;
+
+void CheckFailed(const char* szFile, int iLine, const char* szCondition)
+{
+	printf("%s:%i: check failed: %s\n", szFile, iLine, szCondition);
+	g_iFailures++;
+}
+
+void FillTestData(unsigned char* pBuffer, int iSize, unsigned int iSeed)
+{
+	unsigned int iState = iSeed * 2654435761u + 1;
+	for (int i = 0; i < iSize; i++)
+	{
+		iState = iState * 1103515245 + 12345;
+		pBuffer[i] = (unsigned char)(iState >> 16);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	TestMd5();
+	TestReedSolomon();
+	TestVerify();
+	TestRarReader();
+
+	printf("%i checks, %i failed\n", g_iChecks, g_iFailures);
+	return g_iFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifndef PAR2TEST_H
+#define PAR2TEST_H
+
+/*
+ * Checks of the optimized code paths of libpar2 against the plain
+ * implementations and of the rar reader used for stored archives.
+ * The program is built and run by "make check".
+ */
+
+extern int g_iChecks;
+extern int g_iFailures;
+
+void CheckFailed(const char* szFile, int iLine, const char* szCondition);
+
+#define CHECK(condition) \
+	do { g_iChecks++; if (!(condition)) CheckFailed(__FILE__, __LINE__, #condition); } while (0)
+
+// deterministic pseudo random data, the same on every run
+void FillTestData(unsigned char* pBuffer, int iSize, unsigned int iSeed);
+
+void TestMd5();
+void TestReedSolomon();
+void TestVerify();
+void TestRarReader();
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "par2cmdline.h"
+
+#include "Par2Test.h"
+
+/*
+ * ReedSolomon<Galois16>::Process uses SIMD instructions if the CPU supports
+ * them and processes the rest with lookup tables. The result must be the
+ * same as multiplying word by word with Galois16, for any size and for
+ * buffers which are not aligned.
+ */
+void TestReedSolomon()
+{
+	const size_t sizes[] = { 2, 4, 30, 32, 34, 62, 64, 66, 94, 96, 126, 130, 1026, 4094, 65538 };
+	const size_t offsets[] = { 0, 1, 2, 3, 17 };
+	const u16 factors[] = { 1, 2, 0x1234, 0x8000, 0xffff };
+
+	const size_t iMaxSize = 65538 + 32;
+	unsigned char* pSrc = new unsigned char[iMaxSize];
+	unsigned char* pDst = new unsigned char[iMaxSize];
+	unsigned char* pExpected = new unsigned char[iMaxSize];
+	FillTestData(pSrc, iMaxSize, 2);
+
+	for (unsigned int f = 0; f < sizeof(factors) / sizeof(factors[0]); f++)
+	{
+		Galois16 factor(factors[f]);
+
+		ReedSolomon<Galois16> rs;
+		rs.SetInput(1);
+		rs.SetOutput(false, 0);
+		CHECK(rs.SetMatrix(&factor, 1, 1));
+
+		for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		{
+			for (unsigned int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+			{
+				size_t iSize = sizes[s];
+				const unsigned char* pIn = pSrc + offsets[o];
+				unsigned char* pOut = pDst + offsets[(o + 1) % (sizeof(offsets) / sizeof(offsets[0]))];
+
+				FillTestData(pOut, iSize, 3 + s);
+				memcpy(pExpected, pOut, iSize);
+
+				for (size_t i = 0; i < iSize; i += 2)
+				{
+					Galois16 in((u16)(pIn[i] | (pIn[i + 1] << 8)));
+					u16 product = in * factor;
+					pExpected[i] ^= product & 0xff;
+					pExpected[i + 1] ^= product >> 8;
+				}
+
+				rs.Process(iSize, 0, pIn, 0, pOut);
+
+				CHECK(memcmp(pOut, pExpected, iSize) == 0);
+			}
+		}
+	}
+
+	delete[] pSrc;
+	delete[] pDst;
+	delete[] pExpected;
+}
@@ -0,0 +1,215 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "par2cmdline.h"
+
+#include "Par2Test.h"
+
+/*
+ * Par2Repairer remembering the number of blocks found in the data file.
+ */
+class CountingRepairer : public Par2Repairer
+{
+public:
+	int				m_iAvailable;
+
+					CountingRepairer() : m_iAvailable(-1) {}
+
+protected:
+	virtual void	sig_done(std::string filename, int available, int total) { m_iAvailable = available; }
+};
+
+/*
+ * Executes the scan jobs in advance, like the par-checker does in its
+ * scan threads, but here one after another.
+ */
+class PrescanRepairer : public CountingRepairer
+{
+protected:
+	virtual void	ScanDataFiles(vector<ScanJob*> &jobs)
+	{
+		for (vector<ScanJob*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+		{
+			RunScanJob(*it);
+		}
+	}
+};
+
+static const int BLOCK_SIZE = 1024;
+
+static MD5Hash Md5(const string& data)
+{
+	MD5Context context;
+	context.Update(data.data(), data.size());
+	MD5Hash hash;
+	context.Final(hash);
+	return hash;
+}
+
+static string AsString(const void* pData, size_t iSize)
+{
+	return string((const char*)pData, iSize);
+}
+
+static void AddPacket(string& par, const MD5Hash& setid, const PACKETTYPE& type, const string& body)
+{
+	PACKET_HEADER header;
+	header.magic = packet_magic;
+	header.length = sizeof(PACKET_HEADER) + body.size();
+	header.setid = setid;
+	header.type = type;
+
+	MD5Context context;
+	context.Update(&header.setid, sizeof(header) - offsetof(PACKET_HEADER, setid));
+	context.Update(body.data(), body.size());
+	context.Final(header.hash);
+
+	par += AsString(&header, sizeof(header));
+	par += body;
+}
+
+/*
+ * Creates a par2-file without recovery blocks for one data file.
+ */
+static string CreatePar(const char* szFilename, const string& data)
+{
+	string name = szFilename;
+	leu64 lLength = data.size();
+
+	MD5Hash hashfull = Md5(data);
+	MD5Hash hash16k = Md5(data.substr(0, 16384));
+	MD5Hash fileid = Md5(AsString(&hash16k, sizeof(hash16k)) + AsString(&lLength, sizeof(lLength)) + name);
+
+	leu64 lBlockSize = BLOCK_SIZE;
+	leu32 iFileCount = 1;
+	string main = AsString(&lBlockSize, sizeof(lBlockSize)) + AsString(&iFileCount, sizeof(iFileCount)) +
+		AsString(&fileid, sizeof(fileid));
+	MD5Hash setid = Md5(main);
+
+	string description = AsString(&fileid, sizeof(fileid)) + AsString(&hashfull, sizeof(hashfull)) +
+		AsString(&hash16k, sizeof(hash16k)) + AsString(&lLength, sizeof(lLength)) + name;
+	description.resize((description.size() + 3) & ~3, '\0');
+
+	string verification = AsString(&fileid, sizeof(fileid));
+	for (size_t iOffset = 0; iOffset < data.size(); iOffset += BLOCK_SIZE)
+	{
+		string block = data.substr(iOffset, BLOCK_SIZE);
+		block.resize(BLOCK_SIZE, '\0');
+		FILEVERIFICATIONENTRY entry;
+		entry.hash = Md5(block);
+		entry.crc = ~0 ^ CRCUpdateBlock(~0, block.size(), block.data());
+		verification += AsString(&entry, sizeof(entry));
+	}
+
+	string par;
+	AddPacket(par, setid, mainpacket_type, main);
+	AddPacket(par, setid, filedescriptionpacket_type, description);
+	AddPacket(par, setid, fileverificationpacket_type, verification);
+	return par;
+}
+
+static void WriteFile(const string& filename, const string& data)
+{
+	FILE* pFile = fopen(filename.c_str(), "wb");
+	CHECK(pFile != NULL);
+	if (pFile)
+	{
+		CHECK(fwrite(data.data(), 1, data.size(), pFile) == data.size());
+		fclose(pFile);
+	}
+}
+
+static Result Verify(Par2Repairer* pRepairer, const string& parFilename)
+{
+	CommandLine commandLine;
+	const char* argv[] = { "par2", "r", "-q", "-q", parFilename.c_str() };
+	if (!commandLine.Parse(5, (char**)argv))
+	{
+		return eInvalidCommandLineArguments;
+	}
+
+	Result res = pRepairer->PreProcess(commandLine);
+	if (res == eSuccess)
+	{
+		res = pRepairer->Process(commandLine, false);
+	}
+	return res;
+}
+
+/*
+ * Files with repeated identical blocks (for example ranges of zeros) must be
+ * verified the same way with and without the scan in advance. After a damaged
+ * block the scan looks up the following blocks by their checksums; a repeated
+ * block must then be assigned to an entry which wasn't found yet.
+ */
+void TestVerify()
+{
+	char szDir[] = "par2test.XXXXXX";
+	CHECK(mkdtemp(szDir) != NULL);
+	string dataFilename = string(szDir) + "/data.bin";
+	string parFilename = string(szDir) + "/data.par2";
+
+	unsigned char random[BLOCK_SIZE * 3];
+	FillTestData(random, sizeof(random), 4);
+	string zeros(BLOCK_SIZE, '\0');
+	string repeated = AsString(random + BLOCK_SIZE * 2, BLOCK_SIZE);
+
+	string data = AsString(random, BLOCK_SIZE) + zeros + zeros + repeated +
+		AsString(random + BLOCK_SIZE, BLOCK_SIZE) + zeros + repeated + repeated +
+		AsString(random, BLOCK_SIZE / 2);
+	const int iBlocks = 9;
+
+	WriteFile(dataFilename, data);
+	WriteFile(parFilename, CreatePar("data.bin", data));
+
+	CountingRepairer serialRepairer;
+	CHECK(Verify(&serialRepairer, parFilename) == eSuccess);
+
+	PrescanRepairer prescanRepairer;
+	CHECK(Verify(&prescanRepairer, parFilename) == eSuccess);
+
+	// damage the block before the second range of repeated blocks
+	data[BLOCK_SIZE * 4 + 10] ^= 1;
+	WriteFile(dataFilename, data);
+
+	CountingRepairer damagedSerialRepairer;
+	CHECK(Verify(&damagedSerialRepairer, parFilename) == eRepairNotPossible);
+	CHECK(damagedSerialRepairer.m_iAvailable == iBlocks - 1);
+
+	PrescanRepairer damagedPrescanRepairer;
+	CHECK(Verify(&damagedPrescanRepairer, parFilename) == eRepairNotPossible);
+	CHECK(damagedPrescanRepairer.m_iAvailable == iBlocks - 1);
+
+	remove(dataFilename.c_str());
+	remove(parFilename.c_str());
+	rmdir(szDir);
+}
@@ -0,0 +1,407 @@
+/*
+ *  This file is part of nzbget
+ *
+ *  Copyright (C) 2015 Andrey Prygunkov <hugbug@users.sourceforge.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * $Revision$
+ * $Date$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+
+#include "nzbget.h"
+#include "RarReader.h"
+#include "Util.h"
+
+#include "../par2/Par2Test.h"
+
+using std::string;
+
+static const char RAR4_SIGNATURE[] = "Rar!\x1A\x07\x00";
+static const char RAR5_SIGNATURE[] = "Rar!\x1A\x07\x01\x00";
+
+static const int RAR4_MAIN_HEAD = 0x73;
+static const int RAR4_FILE_HEAD = 0x74;
+static const int RAR4_ENDARC_HEAD = 0x7B;
+static const int RAR4_LONG_BLOCK = 0x8000;
+static const int RAR4_MHD_VOLUME = 0x0001;
+static const int RAR4_MHD_NEWNUMBERING = 0x0010;
+static const int RAR4_MHD_PASSWORD = 0x0080;
+static const int RAR4_MHD_FIRSTVOLUME = 0x0100;
+static const int RAR4_LHD_SPLIT_BEFORE = 0x0001;
+static const int RAR4_LHD_SPLIT_AFTER = 0x0002;
+static const int RAR4_LHD_PASSWORD = 0x0004;
+static const int RAR4_EARC_NEXT_VOLUME = 0x0001;
+static const int RAR4_METHOD_STORE = 0x30;
+static const int RAR4_METHOD_NORMAL = 0x33;
+
+static const int RAR5_HEAD_MAIN = 1;
+static const int RAR5_HEAD_FILE = 2;
+static const int RAR5_HEAD_CRYPT = 4;
+static const int RAR5_HEAD_ENDARC = 5;
+static const int RAR5_HFL_EXTRA = 0x0001;
+static const int RAR5_HFL_DATA = 0x0002;
+static const int RAR5_HFL_SPLITBEFORE = 0x0008;
+static const int RAR5_HFL_SPLITAFTER = 0x0010;
+static const int RAR5_MHFL_VOLUME = 0x0001;
+static const int RAR5_MHFL_VOLNUMBER = 0x0002;
+static const int RAR5_FHFL_CRC32 = 0x0004;
+static const int RAR5_FHEXTRA_CRYPT = 0x01;
+static const int RAR5_EHFL_NEXTVOLUME = 0x0001;
+static const int RAR5_METHOD_NORMAL = 3 << 7;
+
+static const int DATA_SIZE = 5000;
+static const int SPLIT_SIZE = 3000;
+
+static unsigned long Crc32(const string& data)
+{
+	return Util::Crc32((unsigned char*)data.data(), (unsigned long)data.size());
+}
+
+static string U16(unsigned int iValue)
+{
+	string s;
+	s += (char)(iValue & 0xFF);
+	s += (char)((iValue >> 8) & 0xFF);
+	return s;
+}
+
+static string U32(unsigned long lValue)
+{
+	return U16(lValue & 0xFFFF) + U16((lValue >> 16) & 0xFFFF);
+}
+
+static string VInt(unsigned long long lValue)
+{
+	string s;
+	do
+	{
+		unsigned char b = lValue & 0x7F;
+		lValue >>= 7;
+		s += (char)(lValue ? b | 0x80 : b);
+	} while (lValue);
+	return s;
+}
+
+static string Rar4Block(int iType, int iFlags, const string& body)
+{
+	string block = (char)iType + U16(iFlags) + U16(7 + body.size()) + body;
+	return U16(Crc32(block) & 0xFFFF) + block;
+}
+
+static string Rar4MainHead(int iFlags)
+{
+	return Rar4Block(RAR4_MAIN_HEAD, iFlags, string(6, '\0'));
+}
+
+static string Rar4FileHead(int iFlags, const char* szName, int iMethod, const string& data,
+	long long lUnpSize, unsigned long lCrc)
+{
+	string name = szName;
+	string body = U32(data.size()) + U32(lUnpSize) + (char)2 + U32(lCrc) + U32(0x46A40000) +
+		(char)29 + (char)iMethod + U16(name.size()) + U32(0x20) + name;
+	return Rar4Block(RAR4_FILE_HEAD, iFlags | RAR4_LONG_BLOCK, body) + data;
+}
+
+static string Rar4EndArc(int iFlags)
+{
+	return Rar4Block(RAR4_ENDARC_HEAD, iFlags, "");
+}
+
+/*
+ * Rar5 header: crc32, size and the header fields, which start with
+ * the header type and flags.
+ */
+static string Rar5Block(const string& fields)
+{
+	string header = VInt(fields.size()) + fields;
+	return U32(Crc32(header)) + header;
+}
+
+static string Rar5MainHead(int iArcFlags)
+{
+	return Rar5Block(VInt(RAR5_HEAD_MAIN) + VInt(0) + VInt(iArcFlags) +
+		(iArcFlags & RAR5_MHFL_VOLNUMBER ? VInt(1) : ""));
+}
+
+static string Rar5FileHead(int iFlags, const char* szName, int iCompInfo, const string& data,
+	long long lUnpSize, unsigned long lCrc, const string& extra)
+{
+	string name = szName;
+	string fields = VInt(RAR5_HEAD_FILE) + VInt(iFlags | RAR5_HFL_DATA | (extra.empty() ? 0 : RAR5_HFL_EXTRA)) +
+		(extra.empty() ? "" : VInt(extra.size())) + VInt(data.size()) +
+		VInt(RAR5_FHFL_CRC32) + VInt(lUnpSize) + VInt(0x20) + U32(lCrc) +
+		VInt(iCompInfo) + VInt(0) + VInt(name.size()) + name + extra;
+	return Rar5Block(fields) + data;
+}
+
+static string Rar5EndArc(int iEndFlags)
+{
+	return Rar5Block(VInt(RAR5_HEAD_ENDARC) + VInt(0) + VInt(iEndFlags));
+}
+
+static void WriteFile(const string& filename, const string& data)
+{
+	FILE* pFile = fopen(filename.c_str(), "wb");
+	CHECK(pFile != NULL);
+	if (pFile)
+	{
+		CHECK(fwrite(data.data(), 1, data.size(), pFile) == data.size());
+		fclose(pFile);
+	}
+}
+
+/*
+ * Reads the data of the file from all volumes, like the unpacker does
+ * when it extracts a stored file.
+ */
+static string ReadParts(RarArchive* pArchive, RarArchive::RarFile* pRarFile)
+{
+	string data;
+	RarArchive::Parts* pParts = pRarFile->GetParts();
+	for (RarArchive::Parts::iterator it = pParts->begin(); it != pParts->end(); it++)
+	{
+		FILE* pFile = fopen(pArchive->GetVolumes()->at(it->m_iVolume), "rb");
+		CHECK(pFile != NULL);
+		if (!pFile)
+		{
+			continue;
+		}
+		string part(it->m_lSize, '\0');
+		CHECK(!fseek(pFile, it->m_lOffset, SEEK_SET) &&
+			fread(&part[0], 1, part.size(), pFile) == part.size());
+		fclose(pFile);
+		data += part;
+	}
+	return data;
+}
+
+/*
+ * A stored file split across two volumes of the new naming scheme. The crc
+ * of the first part is stored in the first volume, the crc of the whole
+ * file in the last one.
+ */
+static void TestRar4Split(const string& dir, const string& data)
+{
+	string vol1 = dir + "/split.part1.rar";
+	string vol2 = dir + "/split.part2.rar";
+	string part1 = data.substr(0, SPLIT_SIZE);
+	string part2 = data.substr(SPLIT_SIZE);
+
+	string rar1 = string(RAR4_SIGNATURE, sizeof(RAR4_SIGNATURE) - 1) +
+		Rar4MainHead(RAR4_MHD_VOLUME | RAR4_MHD_NEWNUMBERING | RAR4_MHD_FIRSTVOLUME) +
+		Rar4FileHead(RAR4_LHD_SPLIT_AFTER, "dir\\data.bin", RAR4_METHOD_STORE, part1, data.size(), Crc32(part1)) +
+		Rar4EndArc(RAR4_EARC_NEXT_VOLUME);
+	string rar2 = string(RAR4_SIGNATURE, sizeof(RAR4_SIGNATURE) - 1) +
+		Rar4MainHead(RAR4_MHD_VOLUME | RAR4_MHD_NEWNUMBERING) +
+		Rar4FileHead(RAR4_LHD_SPLIT_BEFORE, "dir\\data.bin", RAR4_METHOD_STORE, part2, data.size(), Crc32(data)) +
+		Rar4EndArc(0);
+	WriteFile(vol1, rar1);
+	WriteFile(vol2, rar2);
+
+	RarArchive archive;
+	CHECK(archive.Read(vol1.c_str()));
+	CHECK(archive.GetFirstVolume());
+	CHECK(!archive.GetEncrypted());
+	CHECK(archive.GetComplete());
+	CHECK(archive.GetVolumes()->size() == 2);
+	CHECK(archive.GetFiles()->size() == 1);
+	CHECK(archive.IsStored());
+
+	if (archive.GetFiles()->size() == 1)
+	{
+		RarArchive::RarFile* pRarFile = archive.GetFiles()->front();
+		string filename = string("dir") + PATH_SEPARATOR + "data.bin";
+		CHECK(filename == pRarFile->GetFilename());
+		CHECK(pRarFile->GetSize() == (long long)data.size());
+		CHECK(pRarFile->GetHasCrc());
+		CHECK(pRarFile->GetCrc() == Crc32(data));
+		CHECK(pRarFile->GetParts()->size() == 2);
+		if (pRarFile->GetParts()->size() == 2)
+		{
+			CHECK(pRarFile->GetParts()->at(0).m_iVolume == 0);
+			CHECK(pRarFile->GetParts()->at(0).m_lSize == SPLIT_SIZE);
+			CHECK(pRarFile->GetParts()->at(1).m_iVolume == 1);
+			CHECK(pRarFile->GetParts()->at(1).m_lSize == DATA_SIZE - SPLIT_SIZE);
+		}
+		CHECK(ReadParts(&archive, pRarFile) == data);
+	}
+
+	// a later volume alone isn't read
+	RarArchive laterArchive;
+	CHECK(laterArchive.Read(vol2.c_str()));
+	CHECK(!laterArchive.GetFirstVolume());
+	CHECK(laterArchive.GetFiles()->empty());
+
+	// damaged data is read as is; the crc from the last volume
+	// doesn't match and the unpacker reports the error
+	string damaged = rar2;
+	damaged[damaged.size() - 30] ^= 1;
+	WriteFile(vol2, damaged);
+	RarArchive damagedArchive;
+	CHECK(damagedArchive.Read(vol1.c_str()));
+	CHECK(damagedArchive.IsStored());
+	CHECK(damagedArchive.GetFiles()->size() == 1);
+	if (damagedArchive.GetFiles()->size() == 1)
+	{
+		RarArchive::RarFile* pDamagedFile = damagedArchive.GetFiles()->front();
+		CHECK(Crc32(ReadParts(&damagedArchive, pDamagedFile)) != pDamagedFile->GetCrc());
+	}
+
+	// a damaged header fails the header crc and the archive is left to unrar
+	damaged = rar2;
+	damaged[sizeof(RAR4_SIGNATURE) - 1 + 13 + 10] ^= 1;
+	WriteFile(vol2, damaged);
+	RarArchive badHeaderArchive;
+	CHECK(!badHeaderArchive.Read(vol1.c_str()));
+
+	// without the second volume the archive is incomplete
+	remove(vol2.c_str());
+	RarArchive incompleteArchive;
+	CHECK(incompleteArchive.Read(vol1.c_str()));
+	CHECK(!incompleteArchive.GetComplete());
+	CHECK(!incompleteArchive.IsStored());
+
+	remove(vol1.c_str());
+}
+
+/*
+ * Compressed and encrypted files can't be copied and must be extracted by unrar.
+ */
+static void TestRar4NotStored(const string& dir, const string& data)
+{
+	string filename = dir + "/single.rar";
+	string signature(RAR4_SIGNATURE, sizeof(RAR4_SIGNATURE) - 1);
+
+	WriteFile(filename, signature + Rar4MainHead(0) +
+		Rar4FileHead(0, "data.bin", RAR4_METHOD_STORE, data, data.size(), Crc32(data)) + Rar4EndArc(0));
+	RarArchive storedArchive;
+	CHECK(storedArchive.Read(filename.c_str()));
+	CHECK(storedArchive.IsStored());
+
+	WriteFile(filename, signature + Rar4MainHead(0) +
+		Rar4FileHead(0, "data.bin", RAR4_METHOD_NORMAL, data, data.size(), Crc32(data)) + Rar4EndArc(0));
+	RarArchive compressedArchive;
+	CHECK(compressedArchive.Read(filename.c_str()));
+	CHECK(compressedArchive.GetComplete());
+	CHECK(!compressedArchive.IsStored());
+
+	WriteFile(filename, signature + Rar4MainHead(0) +
+		Rar4FileHead(RAR4_LHD_PASSWORD, "data.bin", RAR4_METHOD_STORE, data, data.size(), Crc32(data)) + Rar4EndArc(0));
+	RarArchive encryptedArchive;
+	CHECK(encryptedArchive.Read(filename.c_str()));
+	CHECK(!encryptedArchive.GetEncrypted());
+	CHECK(!encryptedArchive.IsStored());
+
+	// with encrypted headers the files aren't listed at all
+	WriteFile(filename, signature + Rar4MainHead(RAR4_MHD_PASSWORD) + string(64, 'x'));
+	RarArchive encryptedHeadersArchive;
+	CHECK(encryptedHeadersArchive.Read(filename.c_str()));
+	CHECK(encryptedHeadersArchive.GetEncrypted());
+	CHECK(!encryptedHeadersArchive.IsStored());
+
+	remove(filename.c_str());
+}
+
+static void TestRar5(const string& dir, const string& data)
+{
+	string vol1 = dir + "/rar5.part1.rar";
+	string vol2 = dir + "/rar5.part2.rar";
+	string part1 = data.substr(0, SPLIT_SIZE);
+	string part2 = data.substr(SPLIT_SIZE);
+	string signature(RAR5_SIGNATURE, sizeof(RAR5_SIGNATURE) - 1);
+
+	WriteFile(vol1, signature + Rar5MainHead(RAR5_MHFL_VOLUME) +
+		Rar5FileHead(RAR5_HFL_SPLITAFTER, "dir/data.bin", 0, part1, data.size(), Crc32(part1), "") +
+		Rar5EndArc(RAR5_EHFL_NEXTVOLUME));
+	WriteFile(vol2, signature + Rar5MainHead(RAR5_MHFL_VOLUME | RAR5_MHFL_VOLNUMBER) +
+		Rar5FileHead(RAR5_HFL_SPLITBEFORE, "dir/data.bin", 0, part2, data.size(), Crc32(data), "") +
+		Rar5EndArc(0));
+
+	RarArchive archive;
+	CHECK(archive.Read(vol1.c_str()));
+	CHECK(archive.GetComplete());
+	CHECK(archive.GetVolumes()->size() == 2);
+	CHECK(archive.GetFiles()->size() == 1);
+	CHECK(archive.IsStored());
+	if (archive.GetFiles()->size() == 1)
+	{
+		RarArchive::RarFile* pRarFile = archive.GetFiles()->front();
+		CHECK(pRarFile->GetParts()->size() == 2);
+		CHECK(pRarFile->GetCrc() == Crc32(data));
+		CHECK(ReadParts(&archive, pRarFile) == data);
+	}
+	remove(vol2.c_str());
+
+	string filename = dir + "/single5.rar";
+
+	WriteFile(filename, signature + Rar5MainHead(0) +
+		Rar5FileHead(0, "data.bin", RAR5_METHOD_NORMAL, data, data.size(), Crc32(data), "") + Rar5EndArc(0));
+	RarArchive compressedArchive;
+	CHECK(compressedArchive.Read(filename.c_str()));
+	CHECK(compressedArchive.GetComplete());
+	CHECK(!compressedArchive.IsStored());
+
+	// the encryption record: size, type and some encryption parameters
+	string crypt = VInt(RAR5_FHEXTRA_CRYPT) + VInt(0) + VInt(0) + string(16, 'x');
+	WriteFile(filename, signature + Rar5MainHead(0) +
+		Rar5FileHead(0, "data.bin", 0, data, data.size(), Crc32(data), VInt(crypt.size()) + crypt) + Rar5EndArc(0));
+	RarArchive encryptedArchive;
+	CHECK(encryptedArchive.Read(filename.c_str()));
+	CHECK(encryptedArchive.GetComplete());
+	CHECK(!encryptedArchive.IsStored());
+
+	WriteFile(filename, signature + Rar5Block(VInt(RAR5_HEAD_CRYPT) + VInt(0) + VInt(0) + string(16, 'x')) +
+		string(64, 'x'));
+	RarArchive encryptedHeadersArchive;
+	CHECK(encryptedHeadersArchive.Read(filename.c_str()));
+	CHECK(encryptedHeadersArchive.GetEncrypted());
+	CHECK(!encryptedHeadersArchive.IsStored());
+
+	remove(vol1.c_str());
+	remove(filename.c_str());
+}
+
+/*
+ * The rar reader decides if an archive can be extracted by copying the
+ * data of stored files or if unrar is needed. The archives are assembled
+ * here header by header.
+ */
+void TestRarReader()
+{
+	char szDir[] = "rartest.XXXXXX";
+	CHECK(mkdtemp(szDir) != NULL);
+
+	unsigned char buffer[DATA_SIZE];
+	FillTestData(buffer, sizeof(buffer), 5);
+	string data((const char*)buffer, sizeof(buffer));
+
+	TestRar4Split(szDir, data);
+	TestRar4NotStored(szDir, data);
+	TestRar5(szDir, data);
+
+	rmdir(szDir);
+}